@@ -5,5 +5,6 @@
 #define VITA2HOS_EXE_FILE         VITA2HOS_ROOT_PATH "/executable"
 #define VITA2HOS_DUMP_PATH        VITA2HOS_ROOT_PATH "/dump"
 #define VITA2HOS_DUMP_SHADER_PATH VITA2HOS_DUMP_PATH "/shader"
+#define VITA2HOS_TEXTURE_PATH     VITA2HOS_ROOT_PATH "/texture"
 
 #endif
\ No newline at end of file
@@ -11,6 +11,8 @@
 
 typedef struct {
     uint32_t size;
+    /* Offset of the image inside the memblock */
+    uint32_t offset;
     uint16_t width;
     uint16_t height;
     DkMemBlock memblock;
@@ -18,6 +20,16 @@ typedef struct {
     DkImageView view;
 } dk_surface_t;
 
+#define DK_SURFACES_MAX_COUNT 4
+
+/* One of the surfaces created by dk_surfaces_create */
+typedef struct {
+    dk_surface_t *surface;
+    DkImageFormat format;
+    DkMsMode ms_mode;
+    uint32_t flags;
+} dk_surface_desc_t;
+
 static inline DkMemBlock dk_alloc_memblock(DkDevice device, uint32_t size, uint32_t flags)
 {
     DkMemBlockMaker memblock_maker;
@@ -45,10 +57,16 @@ static inline ptrdiff_t dk_memblock_cpu_addr_offset(const DkMemBlock memblock, c
 void dk_surface_create(DkDevice device, dk_surface_t *surface, uint32_t width, uint32_t height,
                        DkImageFormat format, uint32_t flags);
 void dk_surface_destroy(dk_surface_t *surface);
+DkMemBlock dk_surfaces_create(DkDevice device, uint32_t width, uint32_t height,
+                              const dk_surface_desc_t *descs, uint32_t count);
 
 void dk_cmdbuf_copy_image(DkCmdBuf cmdbuf, DkImage const *src_image, uint32_t src_width,
                           uint32_t src_height, DkImage const *dst_image, uint32_t dst_width,
                           uint32_t dst_height);
+/* Same as dk_cmdbuf_copy_image, with DkBlitFlag flags (e.g. to filter when scaling) */
+void dk_cmdbuf_blit_image(DkCmdBuf cmdbuf, DkImage const *src_image, uint32_t src_width,
+                          uint32_t src_height, DkImage const *dst_image, uint32_t dst_width,
+                          uint32_t dst_height, uint32_t flags);
 
 bool dk_image_for_gxm_color_surface(DkDevice device, DkImage *image,
                                     const SceGxmColorSurfaceInner *surface);
@@ -57,5 +75,8 @@ bool dk_image_for_gxm_ds_surface(DkDevice device, DkImage *image, uint32_t width
 bool dk_image_for_existing_framebuffer(DkDevice device, DkImage *image, const void *addr,
                                        uint32_t width, uint32_t height, uint32_t stride,
                                        SceDisplayPixelFormat pixelfmt);
+bool dk_image_for_gxm_transfer_surface(DkDevice device, DkImage *image, const void *addr,
+                                       uint32_t width, uint32_t height, uint32_t stride,
+                                       DkImageFormat format, uint32_t flags);
 
 #endif
\ No newline at end of file
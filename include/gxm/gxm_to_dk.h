@@ -162,6 +162,216 @@ static inline size_t gxm_texture_format_bytes_per_pixel(SceGxmTextureFormat form
     return gxm_texture_base_format_bytes_per_pixel(format & SCE_GXM_TEXTURE_BASE_FORMAT_MASK) >> 3;
 }
 
+static inline uint32_t
+gxm_texture_base_format_component_count(SceGxmTextureBaseFormat base_format)
+{
+    switch (base_format) {
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U8:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S8:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U16:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S16:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F16:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F32:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F32M:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U32:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S32:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC4:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_SBC4:
+        return 1;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U8U8:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S8S8:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U16U16:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S16S16:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F16F16:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F32F32:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U32U32:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_X8U24:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC5:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_SBC5:
+        return 2;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U5U6U5:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S5S5U6:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_X8S8S8U8:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_SE5M9M9M9:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F11F11F10:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U8U8U8:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S8S8S8:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_YUV420P2:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_YUV420P3:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_YUV422:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+/* Format of the sampled image: DkImageFormat_None when there is no conversion to one yet */
+static inline DkImageFormat
+gxm_texture_base_format_to_dk_image_format(SceGxmTextureBaseFormat base_format)
+{
+    switch (base_format) {
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U8:
+        return DkImageFormat_R8_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S8:
+        return DkImageFormat_R8_Snorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U4U4U4U4:
+        return DkImageFormat_RGBA4_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U1U5U5U5:
+        return DkImageFormat_RGB5A1_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U5U6U5:
+        return DkImageFormat_RGB565_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U8U8:
+        return DkImageFormat_RG8_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S8S8:
+        return DkImageFormat_RG8_Snorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U16:
+        return DkImageFormat_R16_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S16:
+        return DkImageFormat_R16_Snorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F16:
+        return DkImageFormat_R16_Float;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U8U8U8U8:
+        return DkImageFormat_RGBA8_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S8S8S8S8:
+        return DkImageFormat_RGBA8_Snorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U2U10U10U10:
+        return DkImageFormat_RGB10A2_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U16U16:
+        return DkImageFormat_RG16_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S16S16:
+        return DkImageFormat_RG16_Snorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F16F16:
+        return DkImageFormat_RG16_Float;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F32:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F32M:
+        return DkImageFormat_R32_Float;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U32:
+        return DkImageFormat_R32_Uint;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S32:
+        return DkImageFormat_R32_Sint;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_SE5M9M9M9:
+        return DkImageFormat_E5BGR9_Float;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F11F11F10:
+        return DkImageFormat_RG11B10_Float;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F16F16F16F16:
+        return DkImageFormat_RGBA16_Float;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U16U16U16U16:
+        return DkImageFormat_RGBA16_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_S16S16S16S16:
+        return DkImageFormat_RGBA16_Snorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_F32F32:
+        return DkImageFormat_RG32_Float;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_U32U32:
+        return DkImageFormat_RG32_Uint;
+    /* Block compressed formats are copied to block linear images by the texture cache */
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC1:
+        return DkImageFormat_RGBA_BC1;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC2:
+        return DkImageFormat_RGBA_BC2;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC3:
+        return DkImageFormat_RGBA_BC3;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC4:
+        return DkImageFormat_R_BC4_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_SBC4:
+        return DkImageFormat_R_BC4_Snorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC5:
+        return DkImageFormat_RG_BC5_Unorm;
+    case SCE_GXM_TEXTURE_BASE_FORMAT_SBC5:
+        return DkImageFormat_RG_BC5_Snorm;
+    /* Not supported by the GPU: the texture cache decodes them to RGBA8 */
+    case SCE_GXM_TEXTURE_BASE_FORMAT_PVRT2BPP:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_PVRT4BPP:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_PVRTII2BPP:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_PVRTII4BPP:
+        return DkImageFormat_RGBA8_Unorm;
+    /* Expanded through their palette by the texture cache */
+    case SCE_GXM_TEXTURE_BASE_FORMAT_P4:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_P8:
+        return DkImageFormat_RGBA8_Unorm;
+    default:
+        return DkImageFormat_None;
+    }
+}
+
+static inline DkImageFormat gxm_texture_format_to_dk_image_format(SceGxmTextureFormat format)
+{
+    return gxm_texture_base_format_to_dk_image_format(format & SCE_GXM_TEXTURE_BASE_FORMAT_MASK);
+}
+
+/*
+ * GXM swizzles name the components from the most to the least significant bits: the deko3d
+ * formats above store the first component in the least significant bits, so ABGR is the identity.
+ */
+static inline void gxm_texture_format_to_dk_image_swizzle(SceGxmTextureFormat format,
+                                                          DkImageSwizzle swizzle[4])
+{
+#define SWZ(r, g, b, a)                                                                            \
+    { DkImageSwizzle_##r, DkImageSwizzle_##g, DkImageSwizzle_##b, DkImageSwizzle_##a }
+    static const DkImageSwizzle swizzle1[8][4] = {
+        SWZ(Red, Zero, Zero, One),  /* R */
+        SWZ(Red, Zero, Zero, Zero), /* 000R */
+        SWZ(Red, One, One, One),    /* 111R */
+        SWZ(Red, Red, Red, Red),    /* RRRR */
+        SWZ(Red, Red, Red, Zero),   /* 0RRR */
+        SWZ(Red, Red, Red, One),    /* 1RRR */
+        SWZ(Zero, Zero, Zero, Red), /* R000 */
+        SWZ(One, One, One, Red),    /* R111 */
+    };
+    static const DkImageSwizzle swizzle2[8][4] = {
+        SWZ(Red, Green, Zero, One),    /* GR */
+        SWZ(Red, Green, Zero, Zero),   /* 00GR */
+        SWZ(Red, Red, Red, Green),     /* GRRR */
+        SWZ(Green, Green, Green, Red), /* RGGG */
+        SWZ(Red, Green, Red, Green),   /* GRGR */
+        SWZ(Green, Red, Zero, Zero),   /* 00RG */
+        SWZ(Red, Green, Zero, One),    /* Reserved */
+        SWZ(Red, Green, Zero, One),    /* Reserved */
+    };
+    static const DkImageSwizzle swizzle3[2][4] = {
+        SWZ(Red, Green, Blue, One), /* BGR */
+        SWZ(Blue, Green, Red, One), /* RGB */
+    };
+    static const DkImageSwizzle swizzle4[8][4] = {
+        SWZ(Red, Green, Blue, Alpha), /* ABGR */
+        SWZ(Blue, Green, Red, Alpha), /* ARGB */
+        SWZ(Alpha, Blue, Green, Red), /* RGBA */
+        SWZ(Green, Blue, Alpha, Red), /* BGRA */
+        SWZ(Red, Green, Blue, One),   /* 1BGR */
+        SWZ(Blue, Green, Red, One),   /* 1RGB */
+        SWZ(Alpha, Blue, Green, One), /* RGB1 */
+        SWZ(Green, Blue, Alpha, One), /* BGR1 */
+    };
+    static const DkImageSwizzle identity[4] = SWZ(Red, Green, Blue, One);
+#undef SWZ
+    const uint32_t mode = (format & SCE_GXM_TEXTURE_SWIZZLE_MASK) >> 12;
+    const DkImageSwizzle *table;
+
+    /* F11F11F10 only comes as RGB, with RG11B10's layout: red in the least significant bits */
+    if ((format & SCE_GXM_TEXTURE_BASE_FORMAT_MASK) == SCE_GXM_TEXTURE_BASE_FORMAT_F11F11F10) {
+        for (int i = 0; i < 4; i++)
+            swizzle[i] = identity[i];
+        return;
+    }
+
+    switch (gxm_texture_base_format_component_count(format & SCE_GXM_TEXTURE_BASE_FORMAT_MASK)) {
+    case 1:
+        table = swizzle1[mode];
+        break;
+    case 2:
+        table = swizzle2[mode];
+        break;
+    case 3:
+        table = swizzle3[mode & 1];
+        break;
+    default:
+        table = swizzle4[mode];
+        break;
+    }
+
+    for (int i = 0; i < 4; i++)
+        swizzle[i] = table[i];
+}
+
 static inline DkImageFormat gxm_color_format_to_dk_image_format(SceGxmColorFormat format)
 {
     switch (format) {
@@ -188,11 +398,81 @@ static inline DkImageFormat gxm_ds_format_to_dk_image_format(SceGxmDepthStencilF
     }
 }
 
+static inline size_t gxm_transfer_format_bytes_per_pixel(SceGxmTransferFormat format)
+{
+    switch (format) {
+    case SCE_GXM_TRANSFER_FORMAT_U8_R:
+        return 1;
+    case SCE_GXM_TRANSFER_FORMAT_U4U4U4U4_ABGR:
+    case SCE_GXM_TRANSFER_FORMAT_U1U5U5U5_ABGR:
+    case SCE_GXM_TRANSFER_FORMAT_U5U6U5_BGR:
+    case SCE_GXM_TRANSFER_FORMAT_U8U8_GR:
+    case SCE_GXM_TRANSFER_FORMAT_VYUY422:
+    case SCE_GXM_TRANSFER_FORMAT_YVYU422:
+    case SCE_GXM_TRANSFER_FORMAT_UYVY422:
+    case SCE_GXM_TRANSFER_FORMAT_YUYV422:
+    case SCE_GXM_TRANSFER_FORMAT_RAW16:
+        return 2;
+    case SCE_GXM_TRANSFER_FORMAT_U8U8U8_BGR:
+        return 3;
+    case SCE_GXM_TRANSFER_FORMAT_U8U8U8U8_ABGR:
+    case SCE_GXM_TRANSFER_FORMAT_U2U10U10U10_ABGR:
+    case SCE_GXM_TRANSFER_FORMAT_RAW32:
+        return 4;
+    case SCE_GXM_TRANSFER_FORMAT_RAW64:
+        return 8;
+    case SCE_GXM_TRANSFER_FORMAT_RAW128:
+        return 16;
+    default:
+        UNREACHABLE("Invalid SceGxmTransferFormat");
+    }
+}
+
+/* Returns DkImageFormat_None for the formats without an equivalent (24-bit and YUV) */
+static inline DkImageFormat gxm_transfer_format_to_dk_image_format(SceGxmTransferFormat format)
+{
+    switch (format) {
+    case SCE_GXM_TRANSFER_FORMAT_U8_R:
+        return DkImageFormat_R8_Unorm;
+    case SCE_GXM_TRANSFER_FORMAT_U4U4U4U4_ABGR:
+        return DkImageFormat_RGBA4_Unorm;
+    case SCE_GXM_TRANSFER_FORMAT_U1U5U5U5_ABGR:
+        return DkImageFormat_RGB5A1_Unorm;
+    case SCE_GXM_TRANSFER_FORMAT_U5U6U5_BGR:
+        return DkImageFormat_RGB565_Unorm;
+    case SCE_GXM_TRANSFER_FORMAT_U8U8_GR:
+        return DkImageFormat_RG8_Unorm;
+    case SCE_GXM_TRANSFER_FORMAT_U8U8U8U8_ABGR:
+        return DkImageFormat_RGBA8_Unorm;
+    case SCE_GXM_TRANSFER_FORMAT_U2U10U10U10_ABGR:
+        return DkImageFormat_RGB10A2_Unorm;
+    case SCE_GXM_TRANSFER_FORMAT_RAW16:
+        return DkImageFormat_R16_Uint;
+    case SCE_GXM_TRANSFER_FORMAT_RAW32:
+        return DkImageFormat_R32_Uint;
+    case SCE_GXM_TRANSFER_FORMAT_RAW64:
+        return DkImageFormat_RG32_Uint;
+    case SCE_GXM_TRANSFER_FORMAT_RAW128:
+        return DkImageFormat_RGBA32_Uint;
+    default:
+        return DkImageFormat_None;
+    }
+}
+
+/* Whether deko3d can fetch the attribute as is */
+static inline bool gxm_vtx_attrib_is_supported(SceGxmAttributeFormat format, uint8_t componentCount)
+{
+    return format <= SCE_GXM_ATTRIBUTE_FORMAT_UNTYPED && componentCount >= 1 &&
+           componentCount <= 4;
+}
+
 static inline DkVtxAttribType gxm_to_dk_vtx_attrib_type(SceGxmAttributeFormat format)
 {
     switch (format) {
     case SCE_GXM_ATTRIBUTE_FORMAT_U8:
     case SCE_GXM_ATTRIBUTE_FORMAT_U16:
+    /* Raw 32-bit words, which the shader reinterprets */
+    case SCE_GXM_ATTRIBUTE_FORMAT_UNTYPED:
         return DkVtxAttribType_Uint;
     case SCE_GXM_ATTRIBUTE_FORMAT_S8:
     case SCE_GXM_ATTRIBUTE_FORMAT_S16:
@@ -249,6 +529,7 @@ static inline DkVtxAttribSize gxm_to_dk_vtx_attrib_size(SceGxmAttributeFormat fo
             UNREACHABLE("Unsupported SceGxmAttributeFormat component count");
         }
     case SCE_GXM_ATTRIBUTE_FORMAT_F32:
+    case SCE_GXM_ATTRIBUTE_FORMAT_UNTYPED:
         switch (componentCount) {
         case 1:
             return DkVtxAttribSize_1x32;
@@ -274,13 +555,14 @@ static inline DkPrimitive gxm_to_dk_primitive(SceGxmPrimitiveType prim)
     case SCE_GXM_PRIMITIVE_LINES:
         return DkPrimitive_Lines;
     case SCE_GXM_PRIMITIVE_POINTS:
-        return DkPrimitive_Lines;
+        return DkPrimitive_Points;
     case SCE_GXM_PRIMITIVE_TRIANGLE_STRIP:
         return DkPrimitive_TriangleStrip;
     case SCE_GXM_PRIMITIVE_TRIANGLE_FAN:
         return DkPrimitive_TriangleFan;
+    /* Drawn as the line list of their edges, which the indices are converted to */
     case SCE_GXM_PRIMITIVE_TRIANGLE_EDGES:
-        return DkPrimitive_Triangles;
+        return DkPrimitive_Lines;
     default:
         UNREACHABLE("Unsupported SceGxmPrimitiveType");
     }
@@ -370,6 +652,20 @@ static inline DkStencilOp gxm_stencil_op_to_dk_stencil_op(SceGxmStencilOp op)
     }
 }
 
+static inline DkMsMode gxm_multisample_mode_to_dk_ms_mode(SceGxmMultisampleMode mode)
+{
+    switch (mode) {
+    case SCE_GXM_MULTISAMPLE_NONE:
+        return DkMsMode_1x;
+    case SCE_GXM_MULTISAMPLE_2X:
+        return DkMsMode_2x;
+    case SCE_GXM_MULTISAMPLE_4X:
+        return DkMsMode_4x;
+    default:
+        UNREACHABLE("Unsupported SceGxmMultisampleMode");
+    }
+}
+
 static inline DkWrapMode gxm_texture_addr_mode_to_dk_wrap_mode(SceGxmTextureAddrMode mode)
 {
     switch (mode) {
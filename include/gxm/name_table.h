@@ -0,0 +1,29 @@
+#ifndef GXM_NAME_TABLE_H
+#define GXM_NAME_TABLE_H
+
+#include <stdint.h>
+
+/*
+ * Open addressing hash table of (index + 1) into an array of named items, such as the parameters
+ * of a program. The mask is allocated along with the entries, so that publishing a pointer to the
+ * table publishes both.
+ */
+typedef struct {
+    uint32_t mask;
+    uint16_t entries[];
+} GxmNameTable;
+
+typedef const char *(*GxmNameTableGetName)(const void *items, uint32_t index);
+
+/*
+ * Items are inserted in order, so that the first one with a given name is found first. Fails if
+ * there are too many items or if the table can't be allocated. Free the table with free().
+ */
+GxmNameTable *gxm_name_table_create(const void *items, uint32_t count,
+                                    GxmNameTableGetName get_name);
+
+/* Returns the index of the first item with the name, or -1 if there's none */
+int32_t gxm_name_table_find(const GxmNameTable *table, const void *items,
+                            GxmNameTableGetName get_name, const char *name);
+
+#endif
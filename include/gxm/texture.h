@@ -0,0 +1,40 @@
+#ifndef GXM_TEXTURE_H
+#define GXM_TEXTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tiled textures are made of 32x32 texel tiles, each of them in Morton order */
+#define GXM_TEXTURE_TILE_SIZE 32
+
+uint32_t gxm_texture_swizzled_size(uint32_t width, uint32_t height, uint32_t bpp);
+uint32_t gxm_texture_tiled_size(uint32_t width, uint32_t height, uint32_t bpp);
+
+/* Convert to linear rows of dst_stride bytes. bpp is in bytes per texel */
+void gxm_texture_deswizzle(void *dst, size_t dst_stride, const void *src, uint32_t width,
+                           uint32_t height, uint32_t bpp);
+void gxm_texture_detile(void *dst, size_t dst_stride, const void *src, uint32_t width,
+                        uint32_t height, uint32_t bpp);
+
+/* Expand 4-bit texels to bytes, the first texel of each byte being in its low nibble */
+void gxm_texture_unpack_4bpp(uint8_t *dst, const void *src, uint32_t count);
+
+typedef void (*GxmTextureParallelFunc)(void *arg, uint32_t index);
+/* Calls func for every index below count, possibly concurrently, and returns once they're done */
+typedef void (*GxmTextureParallelFor)(GxmTextureParallelFunc func, void *arg, uint32_t count);
+
+/*
+ * Decode PVRTC (or PVRTC2) data to RGBA8 rows. The blocks are always Morton ordered, over a grid of
+ * at least 2x2 blocks. Bands of rows are spread with parallel_for, if not NULL. Fails if the
+ * scratch memory can't be allocated.
+ */
+bool gxm_texture_decode_pvrtc(void *dst, size_t dst_stride, const void *src, uint32_t width,
+                              uint32_t height, bool two_bpp, bool pvrtc2,
+                              GxmTextureParallelFor parallel_for);
+
+uint64_t gxm_texture_hash(const void *data, size_t size);
+/* Only hashes a few lines spread over the data, to cheaply detect most changes */
+uint64_t gxm_texture_hash_sampled(const void *data, size_t size);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef GXM_UNIFORM_H
+#define GXM_UNIFORM_H
+
+#include <stdint.h>
+
+/* Round to nearest even, overflowing to infinity. NaNs become the default NaN, like NEON does */
+uint16_t gxm_float_to_half(float value);
+
+/*
+ * Convert uniform data to the parameter types. Integer types are truncated towards zero and
+ * saturated, NaNs becoming 0, which is what the NEON conversions do: the elements that don't fill
+ * a vector get the same results as the others.
+ */
+void gxm_uniform_convert_f16(uint16_t *dst, const float *src, uint32_t count);
+void gxm_uniform_convert_u32(uint32_t *dst, const float *src, uint32_t count);
+void gxm_uniform_convert_s32(int32_t *dst, const float *src, uint32_t count);
+void gxm_uniform_convert_u16(uint16_t *dst, const float *src, uint32_t count);
+void gxm_uniform_convert_s16(int16_t *dst, const float *src, uint32_t count);
+void gxm_uniform_convert_u8(uint8_t *dst, const float *src, uint32_t count);
+void gxm_uniform_convert_s8(int8_t *dst, const float *src, uint32_t count);
+
+#endif
@@ -10,6 +10,7 @@
 
 #define SCE_GXM_COLOR_BASE_FORMAT_MASK   0xF1800000U
 #define SCE_GXM_TEXTURE_BASE_FORMAT_MASK 0x9f000000U
+#define SCE_GXM_TEXTURE_SWIZZLE_MASK     0x00007000U
 
 #define SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_DISABLE_BIT   1
 #define SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_STRIDE_OFFSET 3
@@ -22,6 +23,14 @@
 #define SCE_GXM_DEPTH_STENCIL_BG_CTRL_STENCIL_MASK 0xFF
 #define SCE_GXM_DEPTH_STENCIL_BG_CTRL_MASK_BIT     0x100
 
+/* SceGxmProgramVaryings.vertex_outputs1 bits */
+#define SCE_GXM_VERTEX_PROGRAM_OUTPUT_POSITION 0x1
+
+/* USSE instructions are 64-bit words with their opcode in the top 5 bits */
+#define USSE_OPCODE_SHIFT 59
+#define USSE_OPCODE_VMOV  0x07
+#define USSE_OPCODE_VPCK  0x08
+
 typedef struct {
     // Control Word 0
     uint32_t unk0 : 3;
@@ -166,6 +175,39 @@ typedef struct SceGxmProgramParameter {
     int32_t resource_index;
 } SceGxmProgramParameter;
 
+typedef struct SceGxmProgramVaryings {
+    uint8_t unk0[10];
+    uint8_t output_param_type;
+    uint8_t output_comp_count;
+    uint16_t varyings_count;
+    uint16_t pad0;
+    uint32_t vertex_outputs1;
+    uint32_t vertex_outputs2;
+} SceGxmProgramVaryings;
+
+static inline const SceGxmProgramParameter *gxm_program_get_parameters(const SceGxmProgram *program)
+{
+    return (const SceGxmProgramParameter *)((const char *)&program->parameters_offset +
+                                            program->parameters_offset);
+}
+
+static inline const SceGxmProgramVaryings *gxm_program_get_varyings(const SceGxmProgram *program)
+{
+    return (const SceGxmProgramVaryings *)((const char *)&program->varyings_offset +
+                                           program->varyings_offset);
+}
+
+static inline const uint64_t *gxm_program_get_primary_program(const SceGxmProgram *program)
+{
+    return (const uint64_t *)((const char *)&program->primary_program_offset +
+                              program->primary_program_offset);
+}
+
+static inline const char *gxm_parameter_get_name(const SceGxmProgramParameter *parameter)
+{
+    return (const char *)parameter + parameter->name_offset;
+}
+
 static inline uint32_t gxm_parameter_type_size(SceGxmParameterType type)
 {
     switch (type) {
@@ -235,6 +277,51 @@ static inline bool gxm_base_format_is_paletted_format(SceGxmTextureBaseFormat ba
            base_format == SCE_GXM_TEXTURE_BASE_FORMAT_P4;
 }
 
+static inline const void *gxm_texture_get_palette(const SceGxmTextureInner *texture)
+{
+    return (const void *)(texture->palette_addr << 6);
+}
+
+static inline bool gxm_base_format_is_pvrt_format(SceGxmTextureBaseFormat base_format)
+{
+    return base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRT2BPP ||
+           base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRT4BPP ||
+           base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRTII2BPP ||
+           base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRTII4BPP;
+}
+
+static inline bool gxm_base_format_is_block_compressed_format(SceGxmTextureBaseFormat base_format)
+{
+    switch (base_format) {
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC1:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC2:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC3:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC4:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_SBC4:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_UBC5:
+    case SCE_GXM_TEXTURE_BASE_FORMAT_SBC5:
+        return true;
+    default:
+        return gxm_base_format_is_pvrt_format(base_format);
+    }
+}
+
+/* Size in texels of the blocks compressed formats are made of, 1x1 for the other formats */
+static inline void gxm_base_format_get_block_size(SceGxmTextureBaseFormat base_format,
+                                                  uint32_t *width, uint32_t *height)
+{
+    if (!gxm_base_format_is_block_compressed_format(base_format)) {
+        *width = *height = 1;
+        return;
+    }
+
+    *width = (base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRT2BPP ||
+              base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRTII2BPP)
+                 ? 8
+                 : 4;
+    *height = 4;
+}
+
 static inline SceGxmDepthStencilFormat
 gxm_ds_surface_get_format(const SceGxmDepthStencilSurface *surface)
 {
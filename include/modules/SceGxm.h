@@ -2,8 +2,10 @@
 #define SCE_GXM_H
 
 #include <deko3d.h>
+#include <psp2/gxm.h>
 
 int SceGxm_init(DkDevice dk_device);
 int SceGxm_finish(void);
+int SceGxm_notification_wait_timeout(const SceGxmNotification *notification, int64_t timeout_ns);
 
 #endif
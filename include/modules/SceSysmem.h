@@ -2,6 +2,7 @@
 #define SCE_SYSMEM_H
 
 #include <deko3d.h>
+#include <stdatomic.h>
 
 typedef struct VitaMemBlockInfo {
     uint32_t index;
@@ -9,11 +10,15 @@ typedef struct VitaMemBlockInfo {
     void *base;
     uint32_t size;
     DkMemBlock dk_memblock;
+    /* Incremented when the GPU writes to the block, for the caches of converted contents */
+    _Atomic uint32_t generation;
 } VitaMemBlockInfo;
 
 int SceSysmem_init(DkDevice dk_device);
 SceUID SceSysmem_get_next_uid(void);
+VitaMemBlockInfo *SceSysmem_get_vita_memblock_info_for_uid(SceUID uid);
 VitaMemBlockInfo *SceSysmem_get_vita_memblock_info_for_addr(const void *addr);
 DkMemBlock SceSysmem_get_dk_memblock_for_addr(const void *addr);
+void SceSysmem_mark_written(const void *addr);
 
 #endif
@@ -8,17 +8,24 @@ extern "C" {
 bool convert_gxp_to_spirv_c(uint32_t **spirv, uint32_t *num_instr, const SceGxmProgram *program,
                             const char *shader_name, bool support_shader_interlock,
                             bool support_texture_barrier, bool direct_fragcolor, bool spirv_shader,
-                            const SceGxmVertexAttribute *hint_attributes,
+                            bool use_ubo, const SceGxmVertexAttribute *hint_attributes,
                             uint32_t num_hint_attributes, bool maskupdate, bool force_shader_debug,
                             bool (*dumper)(const char *ext, const char *dump));
 
 bool convert_gxp_to_glsl_c(char **glsl, const SceGxmProgram *program, const char *shader_name,
                            bool support_shader_interlock, bool support_texture_barrier,
-                           bool direct_fragcolor, bool spirv_shader,
+                           bool direct_fragcolor, bool spirv_shader, bool use_ubo,
                            const SceGxmVertexAttribute *hint_attributes,
                            uint32_t num_hint_attributes, bool maskupdate, bool force_shader_debug,
                            bool (*dumper)(const char *ext, const char *dump));
 
+/*
+ * Byte offsets and sizes of the uniform buffers within the buffer the recompiled shader reads
+ * them from. Index 0 is the default uniform buffer, index i + 1 is uniform buffer i.
+ */
+void get_uniform_buffer_layout_c(const SceGxmProgram *program, uint32_t *offsets, uint32_t *sizes,
+                                 uint32_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,22 +4,32 @@
 #include "gxm/gxm_to_dk.h"
 #include "modules/SceSysmem.h"
 
-void dk_surface_create(DkDevice device, dk_surface_t *surface, uint32_t width, uint32_t height,
-                       DkImageFormat format, uint32_t flags)
+static void dk_surface_layout_init(DkDevice device, DkImageLayout *layout, uint32_t width,
+                                   uint32_t height, DkImageFormat format, DkMsMode ms_mode,
+                                   uint32_t flags)
 {
     DkImageLayoutMaker maker;
-    DkImageLayout layout;
-    uint32_t alignment;
 
     dkImageLayoutMakerDefaults(&maker, device);
     maker.flags = flags;
     maker.format = format;
+    maker.msMode = ms_mode;
     maker.dimensions[0] = width;
     maker.dimensions[1] = height;
-    dkImageLayoutInitialize(&layout, &maker);
+    dkImageLayoutInitialize(layout, &maker);
+}
+
+void dk_surface_create(DkDevice device, dk_surface_t *surface, uint32_t width, uint32_t height,
+                       DkImageFormat format, uint32_t flags)
+{
+    DkImageLayout layout;
+    uint32_t alignment;
+
+    dk_surface_layout_init(device, &layout, width, height, format, DkMsMode_1x, flags);
 
     alignment = dkImageLayoutGetAlignment(&layout);
     surface->size = dkImageLayoutGetSize(&layout);
+    surface->offset = 0;
     surface->width = width;
     surface->height = height;
     surface->memblock = dk_alloc_memblock(device, ALIGN(surface->size, alignment),
@@ -28,6 +38,40 @@ void dk_surface_create(DkDevice device, dk_surface_t *surface, uint32_t width, u
     dkImageViewDefaults(&surface->view, &surface->image);
 }
 
+/* Places the surfaces back to back in a single memblock, owned by the caller */
+DkMemBlock dk_surfaces_create(DkDevice device, uint32_t width, uint32_t height,
+                              const dk_surface_desc_t *descs, uint32_t count)
+{
+    DkImageLayout layouts[DK_SURFACES_MAX_COUNT];
+    DkMemBlock memblock;
+    dk_surface_t *surface;
+    uint32_t size = 0;
+
+    assert(count <= DK_SURFACES_MAX_COUNT);
+
+    for (uint32_t i = 0; i < count; i++) {
+        surface = descs[i].surface;
+        dk_surface_layout_init(device, &layouts[i], width, height, descs[i].format,
+                               descs[i].ms_mode, descs[i].flags);
+        surface->offset = ALIGN(size, dkImageLayoutGetAlignment(&layouts[i]));
+        surface->size = dkImageLayoutGetSize(&layouts[i]);
+        surface->width = width;
+        surface->height = height;
+        size = surface->offset + surface->size;
+    }
+
+    memblock = dk_alloc_memblock(device, size, DkMemBlockFlags_GpuCached | DkMemBlockFlags_Image);
+
+    for (uint32_t i = 0; i < count; i++) {
+        surface = descs[i].surface;
+        surface->memblock = memblock;
+        dkImageInitialize(&surface->image, &layouts[i], memblock, surface->offset);
+        dkImageViewDefaults(&surface->view, &surface->image);
+    }
+
+    return memblock;
+}
+
 void dk_surface_destroy(dk_surface_t *surface)
 {
     dkMemBlockDestroy(surface->memblock);
@@ -36,6 +80,14 @@ void dk_surface_destroy(dk_surface_t *surface)
 void dk_cmdbuf_copy_image(DkCmdBuf cmdbuf, DkImage const *src_image, uint32_t src_width,
                           uint32_t src_height, DkImage const *dst_image, uint32_t dst_width,
                           uint32_t dst_height)
+{
+    dk_cmdbuf_blit_image(cmdbuf, src_image, src_width, src_height, dst_image, dst_width,
+                         dst_height, 0);
+}
+
+void dk_cmdbuf_blit_image(DkCmdBuf cmdbuf, DkImage const *src_image, uint32_t src_width,
+                          uint32_t src_height, DkImage const *dst_image, uint32_t dst_width,
+                          uint32_t dst_height, uint32_t flags)
 {
     DkImageView src_view, dst_view;
     DkImageRect src_rect, dst_rect;
@@ -52,7 +104,7 @@ void dk_cmdbuf_copy_image(DkCmdBuf cmdbuf, DkImage const *src_image, uint32_t sr
 
     dkImageViewDefaults(&src_view, src_image);
     dkImageViewDefaults(&dst_view, dst_image);
-    dkCmdBufBlitImage(cmdbuf, &src_view, &src_rect, &dst_view, &dst_rect, 0, 1);
+    dkCmdBufBlitImage(cmdbuf, &src_view, &src_rect, &dst_view, &dst_rect, flags, 1);
 }
 
 bool dk_image_for_gxm_color_surface(DkDevice device, DkImage *image,
@@ -123,4 +175,27 @@ bool dk_image_for_existing_framebuffer(DkDevice device, DkImage *image, const vo
     dkImageInitialize(image, &layout, block, dk_memblock_cpu_addr_offset(block, addr));
 
     return true;
-}
\ No newline at end of file
+}
+
+bool dk_image_for_gxm_transfer_surface(DkDevice device, DkImage *image, const void *addr,
+                                       uint32_t width, uint32_t height, uint32_t stride,
+                                       DkImageFormat format, uint32_t flags)
+{
+    DkImageLayoutMaker maker;
+    DkImageLayout layout;
+    DkMemBlock block = SceSysmem_get_dk_memblock_for_addr(addr);
+
+    if (!block)
+        return false;
+
+    dkImageLayoutMakerDefaults(&maker, device);
+    maker.flags = DkImageFlags_PitchLinear | flags;
+    maker.format = format;
+    maker.dimensions[0] = width;
+    maker.dimensions[1] = height;
+    maker.pitchStride = stride;
+    dkImageLayoutInitialize(&layout, &maker);
+    dkImageInitialize(image, &layout, block, dk_memblock_cpu_addr_offset(block, addr));
+
+    return true;
+}
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "gxm/name_table.h"
+#include "util.h"
+
+static uint32_t name_hash(const char *name)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+
+    while (*name)
+        hash = (hash ^ (uint8_t)*name++) * 16777619u;
+
+    return hash;
+}
+
+GxmNameTable *gxm_name_table_create(const void *items, uint32_t count,
+                                    GxmNameTableGetName get_name)
+{
+    GxmNameTable *table;
+    uint32_t mask, index;
+
+    if (count >= UINT16_MAX)
+        return NULL;
+
+    /* Keep the load factor at 50% at most */
+    mask = next_pow2(count * 2) - 1;
+    table = calloc(1, sizeof(*table) + (mask + 1) * sizeof(table->entries[0]));
+    if (!table)
+        return NULL;
+    table->mask = mask;
+
+    for (uint32_t i = 0; i < count; i++) {
+        index = name_hash(get_name(items, i)) & mask;
+        while (table->entries[index])
+            index = (index + 1) & mask;
+        table->entries[index] = i + 1;
+    }
+
+    return table;
+}
+
+int32_t gxm_name_table_find(const GxmNameTable *table, const void *items,
+                            GxmNameTableGetName get_name, const char *name)
+{
+    for (uint32_t index = name_hash(name) & table->mask; table->entries[index];
+         index = (index + 1) & table->mask) {
+        if (strcmp(get_name(items, table->entries[index] - 1), name) == 0)
+            return table->entries[index] - 1;
+    }
+
+    return -1;
+}
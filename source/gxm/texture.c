@@ -0,0 +1,632 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "gxm/texture.h"
+#include "util.h"
+
+/* Bits of a Morton offset holding the x coordinate, the y coordinate is in the odd ones */
+#define MORTON_X_MASK 0x55555555u
+
+#define PVRTC_BLOCK_HEIGHT 4
+/* Flags of the modulation values: punch-through texels are transparent, the others interpolated */
+#define PVRTC_MOD_PUNCH_THROUGH 0x10
+#define PVRTC_MOD_INTERPOLATED  0x80
+
+/* Rows decoded by each job, and the size below which a texture is decoded by a single thread */
+#define PVRTC_BAND_ROWS           16
+#define PVRTC_PARALLEL_MIN_TEXELS (64 * 64)
+
+#define HASH_PRIME1 0x9E3779B185EBCA87ull
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4Full
+/* Lines hashed by gxm_texture_hash_sampled */
+#define HASH_SAMPLE_COUNT 64
+#define HASH_SAMPLE_SIZE  64
+
+/* Spreads the low 16 bits of v to the even bits */
+static inline uint32_t morton_dilate(uint32_t v)
+{
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+/*
+ * In Morton order, each 2x2 quad of texels is contiguous: copy a row pair of the quad at a
+ * time. Inlined with a constant bpp, so the memcpy calls become 64/128-bit loads and stores.
+ */
+static inline __attribute__((always_inline)) void
+morton_block_to_linear_quads(uint8_t *dst, size_t dst_stride, const uint8_t *src, uint32_t n,
+                             uint32_t bpp)
+{
+    for (uint32_t y = 0; y < n; y += 2) {
+        const uint32_t ym = morton_dilate(y) << 1;
+        uint8_t *row0 = dst + y * dst_stride;
+        uint8_t *row1 = row0 + dst_stride;
+        uint32_t xm = 0;
+
+        for (uint32_t x = 0; x < n; x += 2) {
+            const uint8_t *quad = src + (size_t)(xm | ym) * bpp;
+
+            memcpy(row0 + x * bpp, quad, 2 * bpp);
+            memcpy(row1 + x * bpp, quad + 2 * bpp, 2 * bpp);
+            /* Add 2 to the dilated x: the carries skip over the y bits */
+            xm = (xm - MORTON_X_MASK + 3) & MORTON_X_MASK;
+        }
+    }
+}
+
+#ifdef __ARM_NEON
+/* Two horizontally adjacent quads are contiguous too: write 4 texels of both rows at a time */
+static void morton_block_to_linear_4bpp_neon(uint8_t *dst, size_t dst_stride, const uint8_t *src,
+                                             uint32_t n)
+{
+    for (uint32_t y = 0; y < n; y += 2) {
+        const uint32_t ym = morton_dilate(y) << 1;
+        uint32_t *row0 = (uint32_t *)(dst + y * dst_stride);
+        uint32_t *row1 = (uint32_t *)(dst + (y + 1) * dst_stride);
+        uint32_t xm = 0;
+
+        for (uint32_t x = 0; x < n; x += 4) {
+            const uint32_t *quads = (const uint32_t *)(src + (size_t)(xm | ym) * 4);
+            const uint32x4_t q0 = vld1q_u32(quads);
+            const uint32x4_t q1 = vld1q_u32(quads + 4);
+
+            vst1q_u32(&row0[x], vcombine_u32(vget_low_u32(q0), vget_low_u32(q1)));
+            vst1q_u32(&row1[x], vcombine_u32(vget_high_u32(q0), vget_high_u32(q1)));
+            /* Add 4 to the dilated x */
+            xm = (xm - MORTON_X_MASK + 15) & MORTON_X_MASK;
+        }
+    }
+}
+#endif
+
+/* Converts an n x n Morton ordered block (n being a power of two), clipped to width x height */
+static void morton_block_to_linear(uint8_t *dst, size_t dst_stride, const uint8_t *src,
+                                   uint32_t n, uint32_t width, uint32_t height, uint32_t bpp)
+{
+    uint32_t xm, ym;
+
+    if (width == n && height == n && n >= 2) {
+        switch (bpp) {
+        case 1:
+            morton_block_to_linear_quads(dst, dst_stride, src, n, 1);
+            return;
+        case 2:
+            morton_block_to_linear_quads(dst, dst_stride, src, n, 2);
+            return;
+        case 4:
+#ifdef __ARM_NEON
+            if (n >= 4) {
+                morton_block_to_linear_4bpp_neon(dst, dst_stride, src, n);
+                return;
+            }
+#endif
+            morton_block_to_linear_quads(dst, dst_stride, src, n, 4);
+            return;
+        case 8:
+            morton_block_to_linear_quads(dst, dst_stride, src, n, 8);
+            return;
+        case 16:
+            morton_block_to_linear_quads(dst, dst_stride, src, n, 16);
+            return;
+        default:
+            break;
+        }
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        ym = morton_dilate(y) << 1;
+        xm = 0;
+        for (uint32_t x = 0; x < width; x++) {
+            memcpy(dst + y * dst_stride + x * bpp, src + (size_t)(xm | ym) * bpp, bpp);
+            xm = (xm - MORTON_X_MASK) & MORTON_X_MASK;
+        }
+    }
+}
+
+uint32_t gxm_texture_swizzled_size(uint32_t width, uint32_t height, uint32_t bpp)
+{
+    return width * height * bpp;
+}
+
+uint32_t gxm_texture_tiled_size(uint32_t width, uint32_t height, uint32_t bpp)
+{
+    return ALIGN(width, GXM_TEXTURE_TILE_SIZE) * ALIGN(height, GXM_TEXTURE_TILE_SIZE) * bpp;
+}
+
+/*
+ * Swizzled textures have power of two dimensions. Non-square ones are a sequence of Morton
+ * ordered squares along the longest dimension.
+ */
+void gxm_texture_deswizzle(void *dst, size_t dst_stride, const void *src, uint32_t width,
+                           uint32_t height, uint32_t bpp)
+{
+    const uint32_t n = MIN2(width, height);
+    const uint32_t count = MAX2(width, height) / n;
+    uint8_t *block_dst;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (width > height)
+            block_dst = (uint8_t *)dst + i * n * bpp;
+        else
+            block_dst = (uint8_t *)dst + i * n * dst_stride;
+        morton_block_to_linear(block_dst, dst_stride, (const uint8_t *)src + i * n * n * bpp, n,
+                               n, n, bpp);
+    }
+}
+
+void gxm_texture_detile(void *dst, size_t dst_stride, const void *src, uint32_t width,
+                        uint32_t height, uint32_t bpp)
+{
+    const uint32_t tile_bytes = GXM_TEXTURE_TILE_SIZE * GXM_TEXTURE_TILE_SIZE * bpp;
+    const uint8_t *tile = src;
+
+    /* The tiles are stored row by row */
+    for (uint32_t y = 0; y < height; y += GXM_TEXTURE_TILE_SIZE) {
+        for (uint32_t x = 0; x < width; x += GXM_TEXTURE_TILE_SIZE) {
+            morton_block_to_linear((uint8_t *)dst + y * dst_stride + x * bpp, dst_stride, tile,
+                                   GXM_TEXTURE_TILE_SIZE, MIN2(GXM_TEXTURE_TILE_SIZE, width - x),
+                                   MIN2(GXM_TEXTURE_TILE_SIZE, height - y), bpp);
+            tile += tile_bytes;
+        }
+    }
+}
+
+void gxm_texture_unpack_4bpp(uint8_t *dst, const void *src, uint32_t count)
+{
+    const uint8_t *p = src;
+
+    for (uint32_t i = 0; i < count / 2; i++) {
+        dst[2 * i] = p[i] & 0xf;
+        dst[2 * i + 1] = p[i] >> 4;
+    }
+}
+
+/* PVRTC colors have 5-bit RGB components and a 4-bit alpha once expanded */
+typedef struct {
+    uint8_t r, g, b, a;
+} PvrtcColor;
+
+typedef struct {
+    PvrtcColor a;
+    PvrtcColor b;
+} PvrtcBlockColors;
+
+/* Weights of color B for the 2-bit modulation values, in the regular and punch-through modes */
+static const uint8_t pvrtc_mod_weights[4] = { 0, 3, 5, 8 };
+static const uint8_t pvrtc_punch_through_mod_weights[4] = { 0, 4, 4 | PVRTC_MOD_PUNCH_THROUGH, 8 };
+
+/* Blocks are Morton ordered, the bits above the smallest dimension are appended */
+static uint32_t pvrtc_block_index(uint32_t x, uint32_t y, uint32_t blocks_x, uint32_t blocks_y)
+{
+    const uint32_t n = MIN2(blocks_x, blocks_y);
+    const uint32_t mask = n - 1;
+
+    return (morton_dilate(x & mask) | (morton_dilate(y & mask) << 1)) + ((x | y) & ~mask) * n;
+}
+
+/*
+ * Color A is in the low half of the color word, color B in the high one. The opaque ones are
+ * RGB554 and RGB555, the others ARGB3443 and ARGB3444.
+ */
+static PvrtcColor pvrtc_color_a(uint32_t data, bool opaque)
+{
+    PvrtcColor color;
+
+    if (opaque) {
+        color.r = (data >> 10) & 0x1f;
+        color.g = (data >> 5) & 0x1f;
+        color.b = (data & 0x1e) | ((data >> 4) & 1);
+        color.a = 0xf;
+    } else {
+        color.r = ((data >> 7) & 0x1e) | ((data >> 11) & 1);
+        color.g = ((data >> 3) & 0x1e) | ((data >> 7) & 1);
+        color.b = ((data << 1) & 0x1c) | ((data >> 2) & 3);
+        color.a = (data >> 11) & 0xe;
+    }
+
+    return color;
+}
+
+static PvrtcColor pvrtc_color_b(uint32_t data, bool opaque)
+{
+    PvrtcColor color;
+
+    if (opaque) {
+        color.r = (data >> 26) & 0x1f;
+        color.g = (data >> 21) & 0x1f;
+        color.b = (data >> 16) & 0x1f;
+        color.a = 0xf;
+    } else {
+        color.r = ((data >> 23) & 0x1e) | ((data >> 27) & 1);
+        color.g = ((data >> 19) & 0x1e) | ((data >> 23) & 1);
+        color.b = ((data >> 15) & 0x1e) | ((data >> 19) & 1);
+        color.a = (data >> 27) & 0xe;
+    }
+
+    return color;
+}
+
+/* Writes the weights of color B for the texels of a block, 8 meaning color B only */
+static void pvrtc_unpack_modulation(uint8_t *mod, uint32_t mod_stride, uint32_t data,
+                                    bool mode, bool two_bpp)
+{
+    uint8_t interpolation;
+
+    if (!two_bpp) {
+        for (uint32_t y = 0; y < PVRTC_BLOCK_HEIGHT; y++) {
+            for (uint32_t x = 0; x < 4; x++, data >>= 2) {
+                mod[y * mod_stride + x] =
+                    mode ? pvrtc_punch_through_mod_weights[data & 3] : pvrtc_mod_weights[data & 3];
+            }
+        }
+        return;
+    }
+
+    if (!mode) {
+        for (uint32_t y = 0; y < PVRTC_BLOCK_HEIGHT; y++) {
+            for (uint32_t x = 0; x < 8; x++, data >>= 1)
+                mod[y * mod_stride + x] = (data & 1) ? 8 : 0;
+        }
+        return;
+    }
+
+    /*
+     * Only the texels of a checkerboard are stored, with 2 bits each. The low bit of the first one
+     * selects the interpolation of the others: both directions, or the one given by the low bit of
+     * the center texel (1 for vertical).
+     */
+    interpolation = 1;
+    if (data & 1) {
+        interpolation = (data & (1u << 20)) ? 3 : 2;
+        data = (data & ~(1u << 20)) | ((data >> 1) & (1u << 20));
+    }
+    data = (data & ~1u) | ((data >> 1) & 1);
+
+    for (uint32_t y = 0; y < PVRTC_BLOCK_HEIGHT; y++) {
+        for (uint32_t x = 0; x < 8; x++) {
+            if ((x ^ y) & 1) {
+                mod[y * mod_stride + x] = PVRTC_MOD_INTERPOLATED | interpolation;
+            } else {
+                mod[y * mod_stride + x] = pvrtc_mod_weights[data & 3];
+                data >>= 2;
+            }
+        }
+    }
+}
+
+/*
+ * Averages the stored neighbours of the interpolated texels of a row of 2bpp blocks. These are
+ * never interpolated themselves, so the rows can be done in any order.
+ */
+static void pvrtc_interpolate_modulation_row(uint8_t *mod, uint32_t width, uint32_t height,
+                                             uint32_t y)
+{
+    const uint8_t *up = mod + ((y + height - 1) % height) * width;
+    const uint8_t *down = mod + ((y + 1) % height) * width;
+    uint8_t *row = mod + y * width;
+
+    for (uint32_t x = 0; x < width; x++) {
+        const uint32_t left = (x + width - 1) % width;
+        const uint32_t right = (x + 1) % width;
+
+        if (!(row[x] & PVRTC_MOD_INTERPOLATED))
+            continue;
+
+        switch (row[x] & ~PVRTC_MOD_INTERPOLATED) {
+        case 1:
+            row[x] = (up[x] + down[x] + row[left] + row[right] + 2) / 4;
+            break;
+        case 2:
+            row[x] = (row[left] + row[right] + 1) / 2;
+            break;
+        default:
+            row[x] = (up[x] + down[x] + 1) / 2;
+            break;
+        }
+    }
+}
+
+/* Decoding state shared by the block rows and row bands, which can be decoded concurrently */
+typedef struct {
+    uint8_t *dst;
+    size_t dst_stride;
+    const uint32_t *words;
+    uint32_t width;
+    uint32_t height;
+    bool two_bpp;
+    bool pvrtc2;
+    uint32_t block_width;
+    uint32_t weight_shift;
+    uint32_t blocks_x;
+    uint32_t blocks_y;
+    uint32_t mod_width;
+    uint32_t mod_height;
+    PvrtcBlockColors *colors;
+    uint8_t *mod;
+} PvrtcDecode;
+
+/*
+ * Texels between two block centers blend the colors of their left and right ends, which are
+ * themselves the colors of the blocks above and below blended vertically. The components of the
+ * ends are weighted by PVRTC_BLOCK_HEIGHT in total, those of the texels by 1 << weight_shift.
+ */
+typedef struct {
+    uint16_t left_a[4];
+    uint16_t right_a[4];
+    uint16_t left_b[4];
+    uint16_t right_b[4];
+} PvrtcSpan;
+
+/*
+ * Blocks are a 32-bit modulation word followed by a color word. PVRTC2 has a single opacity flag
+ * for both colors, and uses the one of color A for hard transitions: these and the modes depending
+ * on them are decoded as the regular ones.
+ */
+static void pvrtc_unpack_block_row(void *arg, uint32_t by)
+{
+    PvrtcDecode *d = arg;
+
+    for (uint32_t bx = 0; bx < d->blocks_x; bx++) {
+        const uint32_t *block =
+            &d->words[2 * pvrtc_block_index(bx, by, d->blocks_x, d->blocks_y)];
+        const uint32_t color_data = block[1];
+        const bool opaque_b = color_data & 0x80000000u;
+        const bool opaque_a = d->pvrtc2 ? opaque_b : (color_data & 0x8000u);
+
+        d->colors[by * d->blocks_x + bx].a = pvrtc_color_a(color_data, opaque_a);
+        d->colors[by * d->blocks_x + bx].b = pvrtc_color_b(color_data, opaque_b);
+        pvrtc_unpack_modulation(
+            &d->mod[by * PVRTC_BLOCK_HEIGHT * d->mod_width + bx * d->block_width], d->mod_width,
+            block[0], color_data & 1, d->two_bpp);
+    }
+}
+
+static inline void pvrtc_blend_vertical(uint16_t *dst, const PvrtcColor *top,
+                                        const PvrtcColor *bottom, uint32_t j)
+{
+    dst[0] = top->r * (PVRTC_BLOCK_HEIGHT - j) + bottom->r * j;
+    dst[1] = top->g * (PVRTC_BLOCK_HEIGHT - j) + bottom->g * j;
+    dst[2] = top->b * (PVRTC_BLOCK_HEIGHT - j) + bottom->b * j;
+    dst[3] = top->a * (PVRTC_BLOCK_HEIGHT - j) + bottom->a * j;
+}
+
+/* Converts a blended component to 8 bits: RGB are 5-bit, alpha is 4-bit */
+static inline uint32_t pvrtc_expand(uint32_t value, uint32_t component, uint32_t weight_shift)
+{
+    if (component < 3)
+        return (value >> (weight_shift - 3)) + (value >> (weight_shift + 2));
+    return (value >> (weight_shift - 4)) + (value >> weight_shift);
+}
+
+/*
+ * Decodes count texels of a span, starting i texels after its left end. Each texel is built in a
+ * local copy, as the stores could otherwise alias the span.
+ */
+static void pvrtc_decode_span(uint8_t *texel, const uint8_t *mod, const PvrtcSpan *span,
+                              uint32_t i, uint32_t count, uint32_t block_width,
+                              uint32_t weight_shift)
+{
+    const PvrtcSpan s = *span;
+    uint8_t out[4];
+
+    for (uint32_t k = 0; k < count; k++, i++, texel += 4) {
+        const uint32_t m = mod[k];
+        const uint32_t weight = m & ~PVRTC_MOD_PUNCH_THROUGH;
+
+        for (uint32_t c = 0; c < 4; c++) {
+            const uint32_t a = pvrtc_expand(s.left_a[c] * (block_width - i) + s.right_a[c] * i,
+                                            c, weight_shift);
+            const uint32_t b = pvrtc_expand(s.left_b[c] * (block_width - i) + s.right_b[c] * i,
+                                            c, weight_shift);
+
+            out[c] = (a * (8 - weight) + b * weight) / 8;
+        }
+        if (m & PVRTC_MOD_PUNCH_THROUGH)
+            out[3] = 0;
+        memcpy(texel, out, sizeof(out));
+    }
+}
+
+#ifdef __ARM_NEON
+/*
+ * Decodes a whole span, two texels at a time: the lanes hold their 4 components. The blended
+ * components fit in 16 bits, so the differences between the ends can wrap around.
+ */
+static void pvrtc_decode_span_neon(uint8_t *texel, const uint8_t *mod, const PvrtcSpan *span,
+                                   uint32_t block_width, uint32_t weight_shift)
+{
+    const int16_t rgb_shift = weight_shift - 3;
+    const int16_t alpha_shift = weight_shift - 4;
+    /* Negative counts shift right */
+    const int16_t high_shifts[8] = {
+        -rgb_shift, -rgb_shift, -rgb_shift, -alpha_shift,
+        -rgb_shift, -rgb_shift, -rgb_shift, -alpha_shift,
+    };
+    const int16_t low_shifts[8] = {
+        -rgb_shift - 5, -rgb_shift - 5, -rgb_shift - 5, -alpha_shift - 4,
+        -rgb_shift - 5, -rgb_shift - 5, -rgb_shift - 5, -alpha_shift - 4,
+    };
+    const int16x8_t high_shift = vld1q_s16(high_shifts);
+    const int16x8_t low_shift = vld1q_s16(low_shifts);
+    const uint16x4_t left_a = vld1_u16(span->left_a);
+    const uint16x4_t left_b = vld1_u16(span->left_b);
+    const uint16x4_t step_a = vsub_u16(vld1_u16(span->right_a), left_a);
+    const uint16x4_t step_b = vsub_u16(vld1_u16(span->right_b), left_b);
+    const uint16x8_t start_a = vmulq_n_u16(vcombine_u16(left_a, left_a), block_width);
+    const uint16x8_t start_b = vmulq_n_u16(vcombine_u16(left_b, left_b), block_width);
+    const uint16x8_t steps_a = vcombine_u16(step_a, step_a);
+    const uint16x8_t steps_b = vcombine_u16(step_b, step_b);
+    uint16x8_t i = vcombine_u16(vdup_n_u16(0), vdup_n_u16(1));
+    uint16x8_t a, b, weight;
+
+    for (uint32_t k = 0; k < block_width; k += 2, texel += 8) {
+        a = vmlaq_u16(start_a, steps_a, i);
+        b = vmlaq_u16(start_b, steps_b, i);
+        a = vaddq_u16(vshlq_u16(a, high_shift), vshlq_u16(a, low_shift));
+        b = vaddq_u16(vshlq_u16(b, high_shift), vshlq_u16(b, low_shift));
+        weight = vcombine_u16(vdup_n_u16(mod[k] & ~PVRTC_MOD_PUNCH_THROUGH),
+                              vdup_n_u16(mod[k + 1] & ~PVRTC_MOD_PUNCH_THROUGH));
+        a = vmlaq_u16(vmulq_u16(a, vsubq_u16(vdupq_n_u16(8), weight)), b, weight);
+        vst1_u8(texel, vmovn_u16(vshrq_n_u16(a, 3)));
+
+        if (mod[k] & PVRTC_MOD_PUNCH_THROUGH)
+            texel[3] = 0;
+        if (mod[k + 1] & PVRTC_MOD_PUNCH_THROUGH)
+            texel[7] = 0;
+        i = vaddq_u16(i, vdupq_n_u16(2));
+    }
+}
+#endif
+
+static void pvrtc_decode_row(const PvrtcDecode *d, uint32_t y)
+{
+    const uint32_t block_width = d->block_width;
+    /* Offset by half a block: the colors are those of the block centers */
+    const uint32_t fy = y + d->mod_height - PVRTC_BLOCK_HEIGHT / 2;
+    const uint32_t j = fy % PVRTC_BLOCK_HEIGHT;
+    const PvrtcBlockColors *row0 =
+        &d->colors[(fy / PVRTC_BLOCK_HEIGHT) % d->blocks_y * d->blocks_x];
+    const PvrtcBlockColors *row1 =
+        &d->colors[(fy / PVRTC_BLOCK_HEIGHT + 1) % d->blocks_y * d->blocks_x];
+    const uint8_t *mod = &d->mod[y * d->mod_width];
+    uint8_t *texels = d->dst + y * d->dst_stride;
+    PvrtcSpan span;
+    uint32_t count;
+    /* The first texels are halfway between the centers of the last block and the first one */
+    uint32_t bx = 0;
+    uint32_t i = block_width / 2;
+
+    pvrtc_blend_vertical(span.right_a, &row0[d->blocks_x - 1].a, &row1[d->blocks_x - 1].a, j);
+    pvrtc_blend_vertical(span.right_b, &row0[d->blocks_x - 1].b, &row1[d->blocks_x - 1].b, j);
+
+    for (uint32_t x = 0; x < d->width; x += count, i = 0) {
+        count = MIN2(block_width - i, d->width - x);
+
+        /* Each span starts where the previous one ended */
+        memcpy(span.left_a, span.right_a, sizeof(span.left_a));
+        memcpy(span.left_b, span.right_b, sizeof(span.left_b));
+        pvrtc_blend_vertical(span.right_a, &row0[bx].a, &row1[bx].a, j);
+        pvrtc_blend_vertical(span.right_b, &row0[bx].b, &row1[bx].b, j);
+
+#ifdef __ARM_NEON
+        if (count == block_width)
+            pvrtc_decode_span_neon(&texels[x * 4], &mod[x], &span, block_width, d->weight_shift);
+        else
+#endif
+            pvrtc_decode_span(&texels[x * 4], &mod[x], &span, i, count, block_width,
+                              d->weight_shift);
+
+        bx = bx + 1 < d->blocks_x ? bx + 1 : 0;
+    }
+}
+
+static void pvrtc_decode_row_band(void *arg, uint32_t band)
+{
+    PvrtcDecode *d = arg;
+    const uint32_t end = MIN2((band + 1) * PVRTC_BAND_ROWS, d->height);
+
+    for (uint32_t y = band * PVRTC_BAND_ROWS; y < end; y++) {
+        if (d->two_bpp)
+            pvrtc_interpolate_modulation_row(d->mod, d->mod_width, d->mod_height, y);
+        pvrtc_decode_row(d, y);
+    }
+}
+
+static void serial_for(GxmTextureParallelFunc func, void *arg, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        func(arg, i);
+}
+
+bool gxm_texture_decode_pvrtc(void *dst, size_t dst_stride, const void *src, uint32_t width,
+                              uint32_t height, bool two_bpp, bool pvrtc2,
+                              GxmTextureParallelFor parallel_for)
+{
+    PvrtcDecode d = {
+        .dst = dst,
+        .dst_stride = dst_stride,
+        .words = src,
+        .width = width,
+        .height = height,
+        .two_bpp = two_bpp,
+        .pvrtc2 = pvrtc2,
+        .block_width = two_bpp ? 8 : 4,
+        .weight_shift = two_bpp ? 5 : 4,
+    };
+
+    d.blocks_x = MAX2(width / d.block_width, 2);
+    d.blocks_y = MAX2(height / PVRTC_BLOCK_HEIGHT, 2);
+    d.mod_width = d.blocks_x * d.block_width;
+    d.mod_height = d.blocks_y * PVRTC_BLOCK_HEIGHT;
+
+    d.colors = malloc(d.blocks_x * d.blocks_y * sizeof(*d.colors) + d.mod_width * d.mod_height);
+    if (!d.colors)
+        return false;
+    d.mod = (uint8_t *)&d.colors[d.blocks_x * d.blocks_y];
+
+    /* Small textures aren't worth waking other threads up for */
+    if (!parallel_for || width * height < PVRTC_PARALLEL_MIN_TEXELS)
+        parallel_for = serial_for;
+
+    /* The rows need the colors and modulation of the blocks around them */
+    parallel_for(pvrtc_unpack_block_row, &d, d.blocks_y);
+    parallel_for(pvrtc_decode_row_band, &d, (height + PVRTC_BAND_ROWS - 1) / PVRTC_BAND_ROWS);
+
+    free(d.colors);
+    return true;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t value)
+{
+    acc += value * HASH_PRIME2;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * HASH_PRIME1;
+}
+
+/* xxHash-like: four independent lanes, so the multiplications can overlap */
+uint64_t gxm_texture_hash(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    const uint8_t *const end = p + size;
+    uint64_t lanes[4] = { HASH_PRIME1 + HASH_PRIME2, HASH_PRIME2, 0, -HASH_PRIME1 };
+    uint64_t value;
+    uint64_t hash = size;
+
+    for (; end - p >= 32; p += 32) {
+        for (int i = 0; i < 4; i++) {
+            memcpy(&value, p + i * sizeof(value), sizeof(value));
+            lanes[i] = hash_round(lanes[i], value);
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+        hash = hash_round(hash, lanes[i]);
+
+    for (; p < end; p++)
+        hash = hash_round(hash, *p);
+
+    return hash;
+}
+
+uint64_t gxm_texture_hash_sampled(const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    const size_t step = size / HASH_SAMPLE_COUNT;
+    uint64_t hash = size;
+
+    if (step < 2 * HASH_SAMPLE_SIZE)
+        return gxm_texture_hash(data, size);
+
+    for (uint32_t i = 0; i < HASH_SAMPLE_COUNT; i++)
+        hash = hash_round(hash, gxm_texture_hash(p + i * step, HASH_SAMPLE_SIZE));
+
+    /* The first sample is at the start: add one at the end */
+    return hash_round(hash, gxm_texture_hash(p + size - HASH_SAMPLE_SIZE, HASH_SAMPLE_SIZE));
+}
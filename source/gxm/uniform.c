@@ -0,0 +1,163 @@
+#include <string.h>
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "gxm/uniform.h"
+#include "util.h"
+
+/* What NEON produces for any NaN input, as it always runs in default NaN mode */
+#define HALF_DEFAULT_NAN 0x7E00
+
+uint16_t gxm_float_to_half(float value)
+{
+    uint32_t bits, sign, mantissa, half, remainder, shift;
+    int32_t exponent;
+
+    memcpy(&bits, &value, sizeof(bits));
+    sign = (bits >> 16) & 0x8000;
+    exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+    mantissa = bits & 0x7FFFFF;
+
+    /* Infinity and NaN */
+    if (exponent == 0xFF - 127 + 15)
+        return mantissa ? HALF_DEFAULT_NAN : sign | 0x7C00;
+    /* Too large: overflows to infinity */
+    if (exponent >= 0x1F)
+        return sign | 0x7C00;
+
+    /* Too small for a normal half: denormalize, rounding to nearest even */
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        half = mantissa >> shift;
+        remainder = mantissa & ((1u << shift) - 1);
+        if (remainder > (1u << (shift - 1)) || (remainder == (1u << (shift - 1)) && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    /* Rounding to nearest even might carry into the exponent, which is still correct */
+    half = sign | (exponent << 10) | (mantissa >> 13);
+    remainder = mantissa & 0x1FFF;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        half++;
+
+    return half;
+}
+
+/* Scalar equivalents of vcvtq_u32_f32 and vcvtq_s32_f32 */
+static inline uint32_t float_to_u32(float value)
+{
+    /* Also catches NaNs */
+    if (!(value > 0.0f))
+        return 0;
+    if (value >= 4294967296.0f)
+        return UINT32_MAX;
+    return (uint32_t)value;
+}
+
+static inline int32_t float_to_s32(float value)
+{
+    if (value != value)
+        return 0;
+    if (value >= 2147483648.0f)
+        return INT32_MAX;
+    if (value <= -2147483648.0f)
+        return INT32_MIN;
+    return (int32_t)value;
+}
+
+void gxm_uniform_convert_f16(uint16_t *dst, const float *src, uint32_t count)
+{
+    uint32_t i = 0;
+
+#if defined(__ARM_NEON) && defined(__ARM_FP16_FORMAT_IEEE)
+    for (; i + 4 <= count; i += 4)
+        vst1_u16(&dst[i], vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(&src[i]))));
+#endif
+    for (; i < count; i++)
+        dst[i] = gxm_float_to_half(src[i]);
+}
+
+void gxm_uniform_convert_u32(uint32_t *dst, const float *src, uint32_t count)
+{
+    uint32_t i = 0;
+
+#ifdef __ARM_NEON
+    for (; i + 4 <= count; i += 4)
+        vst1q_u32(&dst[i], vcvtq_u32_f32(vld1q_f32(&src[i])));
+#endif
+    for (; i < count; i++)
+        dst[i] = float_to_u32(src[i]);
+}
+
+void gxm_uniform_convert_s32(int32_t *dst, const float *src, uint32_t count)
+{
+    uint32_t i = 0;
+
+#ifdef __ARM_NEON
+    for (; i + 4 <= count; i += 4)
+        vst1q_s32(&dst[i], vcvtq_s32_f32(vld1q_f32(&src[i])));
+#endif
+    for (; i < count; i++)
+        dst[i] = float_to_s32(src[i]);
+}
+
+void gxm_uniform_convert_u16(uint16_t *dst, const float *src, uint32_t count)
+{
+    uint32_t i = 0;
+
+#ifdef __ARM_NEON
+    for (; i + 4 <= count; i += 4)
+        vst1_u16(&dst[i], vqmovn_u32(vcvtq_u32_f32(vld1q_f32(&src[i]))));
+#endif
+    for (; i < count; i++)
+        dst[i] = MIN2(float_to_u32(src[i]), UINT16_MAX);
+}
+
+void gxm_uniform_convert_s16(int16_t *dst, const float *src, uint32_t count)
+{
+    uint32_t i = 0;
+
+#ifdef __ARM_NEON
+    for (; i + 4 <= count; i += 4)
+        vst1_s16(&dst[i], vqmovn_s32(vcvtq_s32_f32(vld1q_f32(&src[i]))));
+#endif
+    for (; i < count; i++)
+        dst[i] = MIN2(MAX2(float_to_s32(src[i]), INT16_MIN), INT16_MAX);
+}
+
+void gxm_uniform_convert_u8(uint8_t *dst, const float *src, uint32_t count)
+{
+    uint32_t i = 0;
+
+#ifdef __ARM_NEON
+    for (; i + 8 <= count; i += 8) {
+        const uint16x4_t low = vqmovn_u32(vcvtq_u32_f32(vld1q_f32(&src[i])));
+        const uint16x4_t high = vqmovn_u32(vcvtq_u32_f32(vld1q_f32(&src[i + 4])));
+
+        vst1_u8(&dst[i], vqmovn_u16(vcombine_u16(low, high)));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = MIN2(float_to_u32(src[i]), UINT8_MAX);
+}
+
+void gxm_uniform_convert_s8(int8_t *dst, const float *src, uint32_t count)
+{
+    uint32_t i = 0;
+
+#ifdef __ARM_NEON
+    for (; i + 8 <= count; i += 8) {
+        const int16x4_t low = vqmovn_s32(vcvtq_s32_f32(vld1q_f32(&src[i])));
+        const int16x4_t high = vqmovn_s32(vcvtq_s32_f32(vld1q_f32(&src[i + 4])));
+
+        vst1_s8(&dst[i], vqmovn_s16(vcombine_s16(low, high)));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = MIN2(MAX2(float_to_s32(src[i]), INT8_MIN), INT8_MAX);
+}
@@ -99,6 +99,7 @@ static void create_vita2hos_paths()
     mkdir(VITA2HOS_ROOT_PATH, 0755);
     mkdir(VITA2HOS_DUMP_PATH, 0755);
     mkdir(VITA2HOS_DUMP_SHADER_PATH, 0755);
+    mkdir(VITA2HOS_TEXTURE_PATH, 0755);
 }
 
 int main(int argc, char *argv[])
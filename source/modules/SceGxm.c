@@ -1,6 +1,7 @@
 #include "config.h"
 
 #include <deko3d.h>
+#include <m-dict.h>
 #include <psp2/gxm.h>
 #include <psp2/kernel/error.h>
 #include <psp2/kernel/threadmgr.h>
@@ -17,69 +18,253 @@
 #include "vita3k_shader_recompiler_iface_c.h"
 
 #include "gxm/gxm_to_dk.h"
+#include "gxm/name_table.h"
+#include "gxm/texture.h"
+#include "gxm/uniform.h"
 #include "gxm/util.h"
 #include "modules/SceSysmem.h"
 
 #define DUMP_SHADER_SPIRV     0
 #define DUMP_SHADER_GLSL      0
 #define ENABLE_SHADER_DUMP_CB 0
+#define QUEUE_PER_CONTEXT     0
+#define THREADED_DISPATCH     0
+/* Keep the RGBA8 decodes of PVRTC textures on the SD card, named after their contents' hash */
+#define PERSIST_DECODED_TEXTURES 0
+/* Internal resolution of the shadow surfaces, in percent of the render target size */
+#define RESOLUTION_SCALE_PERCENT 100
+/* Lower the internal resolution while the GPU time per frame exceeds the budget */
+#define DYNAMIC_RESOLUTION 0
+
+#define DYNAMIC_RESOLUTION_BUDGET_US    16666
+#define DYNAMIC_RESOLUTION_MIN_PERCENT  50
+#define DYNAMIC_RESOLUTION_STEP_PERCENT 10
+
+/* Record deko3d commands on a translator thread running on its own core */
+#define DISPATCH_THREAD_CORE      2
+#define DISPATCH_RING_NUM_ENTRIES 256
+/* Largest part of the context state a single command carries to the translator thread */
+#define DISPATCH_STATE_CHUNK_SIZE 64
+
+/* Scenes alternate between these, so recording a scene doesn't stall on the previous one */
+#define SCENE_CMDBUF_COUNT 2
+
+/* Runs of consecutive draws sharing a visibility index, per scene */
+#define VISIBILITY_MAX_RUNS 256
+
+/* Commands gating the old buffer's sync object on the flip, per display queue entry */
+#define DISPLAY_QUEUE_CMDBUF_SIZE 0x100
+
+/* Transfers rotate through these, each one being submitted right away */
+#define TRANSFER_CMDBUF_COUNT 4
+#define TRANSFER_CMDBUF_SIZE  0x1000
+
+/* Textures deko3d can't sample as they are (swizzled, tiled, cube, compressed), kept converted */
+#define TEXTURE_CACHE_SIZE 128
+/* Threads helping the one converting a texture, if it's worth splitting, each on its own core */
+#define TEXTURE_WORKER_COUNT      2
+#define TEXTURE_WORKER_FIRST_CORE 1
+/*
+ * PVRTC textures start decoding when they're initialized, ahead of their first draw, on a thread
+ * below the game's priority. Decodes no draw has taken yet are kept in this many slots.
+ */
+#define TEXTURE_PREFETCH_SLOTS    8
+#define TEXTURE_PREFETCH_CORE     1
+#define TEXTURE_PREFETCH_PRIORITY 160
+/*
+ * Textures are checked for changes once per scene by hashing a sample of their lines, and all of
+ * their contents every this many scenes, or after the GPU wrote to their memory block
+ */
+#define TEXTURE_FULL_HASH_INTERVAL 30
+/* Paletted textures are expanded by a compute shader, each invocation handling 4 indices */
+#define PALETTE_EXPAND_GROUP_INDICES (32 * 4)
+#define PALETTE_MAX_ENTRIES          256
+/* Index buffers of primitives with no Maxwell equivalent, kept converted to ones that have one */
+#define INDEX_CACHE_SIZE 32
+/*
+ * Image and sampler descriptors are deduplicated in a pool shared by all the contexts, their slots
+ * being looked up in sets of DESCRIPTOR_POOL_WAYS picked by hashing what they're built from. Its
+ * size doubles whenever the scenes being recorded use all of its slots, up to the maximum.
+ */
+#define DESCRIPTOR_POOL_IMAGES       4096
+#define DESCRIPTOR_POOL_SAMPLERS     256
+#define DESCRIPTOR_POOL_MAX_IMAGES   32768
+#define DESCRIPTOR_POOL_MAX_SAMPLERS 4096
+#define DESCRIPTOR_POOL_WAYS         8
+#define DESCRIPTOR_POOL_KEY_WORDS    6
+
+/* Longest primary program of a vertex program that only moves its position attribute out */
+#define VERTEX_PASSTHROUGH_MAX_INSTRS 2
+
+#define UNIFORM_BUFFER_CACHE_SIZE 16
+
+/* Below this many parameters, looking names up linearly is faster than hashing them */
+#define PARAMETER_NAME_TABLE_MIN_COUNT 16
+
+/* Depth range of the scene viewport, applied on top of the device's [0, 1] clip space depth */
+#define SCENE_VIEWPORT_MIN_DEPTH 0.0f
+#define SCENE_VIEWPORT_MAX_DEPTH 1.0f
+
+typedef struct {
+    DkCmdBuf cmdbuf;
+    /* Signalled when the last scene recorded into this command buffer finishes */
+    DkFence fence;
+    bool submitted;
+    /* Memory the command buffer records into, given back to it when a scene had to grow it */
+    DkMemBlock memblock;
+    uint32_t mem_offset;
+    uint32_t mem_size;
+    bool grown;
+} SceneCmdBuf;
+
+typedef struct {
+    const void *addr;
+    SceUID uid;
+} UniformBufferCacheEntry;
+
+/* Default uniform buffer last staged along with the uniform buffers of a shader stage */
+typedef struct {
+    bool valid;
+    const void *program;
+    /* Copy the default uniform buffer points to as long as it gets reused */
+    const void *cpu_addr;
+    /* Ring buffer wraps when it was staged: later ones may have overwritten it */
+    uint32_t ring_wraps;
+    const void *buffers[SCE_GXM_MAX_UNIFORM_BUFFERS];
+    uint32_t generations[SCE_GXM_MAX_UNIFORM_BUFFERS];
+} StagedUniformBuffers;
+
+/* Where the recompiled shaders read the uniform buffers from, after the default uniform buffer */
+typedef struct {
+    uint32_t offsets[SCE_GXM_MAX_UNIFORM_BUFFERS];
+    uint32_t sizes[SCE_GXM_MAX_UNIFORM_BUFFERS];
+    /* Bytes the buffers span, zero if the program only reads the default uniform buffer */
+    uint32_t size;
+} UniformBufferLayout;
+
+/* Samples passed by a run of draws, resolved into the visibility buffer at scene end */
+typedef struct {
+    /* Reports written by dkCmdBufReportCounter: 64-bit counter followed by a timestamp */
+    uint64_t begin[2];
+    uint64_t end[2];
+    uint32_t index;
+    uint32_t op;
+    uint32_t reserved[2];
+} VisibilityRun;
+
+typedef struct {
+    DkMemBlock memblock;
+    /* Offset of the ring buffer inside the memblock */
+    uint32_t offset;
+    uint32_t size;
+    /* Times allocations wrapped around to the start of the ring buffer */
+    uint32_t wraps;
+} ContextRingBuffer;
+
+/* Dynamic state */
+typedef struct {
+    struct {
+        uint32_t head;
+    } vertex_rb, fragment_rb;
+    const SceGxmVertexProgram *vertex_program;
+    const SceGxmFragmentProgram *fragment_program;
+    SceGxmRenderTarget *render_target;
+    const SceGxmColorSurfaceInner *color_surface;
+    const SceGxmDepthStencilSurface *ds_surface;
+    SceGxmSyncObject *fragment_sync_object;
+    bool in_scene;
+    bool two_sided_mode;
+    DkRasterizerState rasterizer;
+    DkColorState color;
+    DkColorWriteState color_write;
+    DkDepthStencilState depth_stencil;
+    struct {
+        uint8_t ref;
+        uint8_t compare_mask;
+        uint8_t write_mask;
+    } front_stencil, back_stencil;
+    SceGxmTextureInner fragment_textures[SCE_GXM_MAX_TEXTURE_UNITS];
+    const void *vertex_streams[SCE_GXM_MAX_VERTEX_STREAMS];
+    uint32_t vertex_streams_dirty_mask;
+    uint32_t scene_draw_count;
+    dk_surface_t background_ds;
+    struct {
+        void *cpu_addr;
+        DkGpuAddr gpu_addr;
+        bool allocated;
+    } vertex_default_uniform, fragment_default_uniform;
+    const void *vertex_uniform_buffers[SCE_GXM_MAX_UNIFORM_BUFFERS];
+    const void *fragment_uniform_buffers[SCE_GXM_MAX_UNIFORM_BUFFERS];
+    /* Results of the first core: the others are left untouched, so they add up to 0 */
+    DkGpuAddr visibility_buffer;
+    uint32_t visibility_buffer_size;
+    struct {
+        bool enable;
+        uint16_t index;
+        SceGxmVisibilityTestOp op;
+    } front_visibility, back_visibility;
+    /* Dirty state tracking */
+    union {
+        struct {
+            uint32_t vertex_shader : 1;
+            uint32_t fragment_shader : 1;
+            uint32_t depth_stencil : 1;
+            uint32_t front_stencil : 1;
+            uint32_t back_stencil : 1;
+            uint32_t color_write : 1;
+            uint32_t fragment_textures : 1;
+            uint32_t vertex_default_uniform : 1;
+            uint32_t fragment_default_uniform : 1;
+        } bit;
+        uint32_t raw;
+    } dirty;
+} SceGxmContextState;
 
 typedef struct SceGxmContext {
     SceGxmContextParams params;
+    /* Deferred contexts only record command lists, which get executed by immediate contexts */
+    bool deferred;
+    SceGxmDeferredContextParams deferred_params;
+    DkQueue queue;
     DkMemBlock cmdbuf_memblock;
+    /* Backing storage of the scene command buffers other than the first one */
+    DkMemBlock extra_cmdbuf_memblock;
+    SceneCmdBuf scene_cmdbufs[SCENE_CMDBUF_COUNT];
+    uint32_t scene_cmdbuf_index;
     DkCmdBuf cmdbuf;
-    struct {
-        DkMemBlock memblock;
-        uint32_t size;
-    } vertex_rb, fragment_rb;
+    ContextRingBuffer vertex_rb, fragment_rb;
     DkMemBlock gxm_vert_unif_block_memblock;
     DkMemBlock gxm_frag_unif_block_memblock;
-    DkMemBlock fragment_tex_descriptor_set_memblock;
-    /* Dynamic state */
-    struct {
-        struct {
-            uint32_t head;
-        } vertex_rb, fragment_rb;
-        const SceGxmVertexProgram *vertex_program;
-        const SceGxmFragmentProgram *fragment_program;
-        const SceGxmRenderTarget *render_target;
-        const SceGxmColorSurfaceInner *color_surface;
-        const SceGxmDepthStencilSurface *ds_surface;
-        SceGxmSyncObject *fragment_sync_object;
-        bool in_scene;
-        bool two_sided_mode;
-        DkRasterizerState rasterizer;
-        DkColorState color;
-        DkColorWriteState color_write;
-        DkDepthStencilState depth_stencil;
-        struct {
-            uint8_t ref;
-            uint8_t compare_mask;
-            uint8_t write_mask;
-        } front_stencil, back_stencil;
-        SceGxmTextureInner fragment_textures[SCE_GXM_MAX_TEXTURE_UNITS];
-        dk_surface_t background_ds;
-        struct {
-            void *cpu_addr;
-            DkGpuAddr gpu_addr;
-            bool allocated;
-        } vertex_default_uniform, fragment_default_uniform;
-        /* Dirty state tracking */
-        union {
-            struct {
-                uint32_t vertex_shader : 1;
-                uint32_t fragment_shader : 1;
-                uint32_t depth_stencil : 1;
-                uint32_t front_stencil : 1;
-                uint32_t back_stencil : 1;
-                uint32_t color_write : 1;
-                uint32_t fragment_textures : 1;
-                uint32_t vertex_default_uniform : 1;
-                uint32_t fragment_default_uniform : 1;
-            } bit;
-            uint32_t raw;
-        } dirty;
-    } state;
+    /* Memblocks of the last uniform buffers copied, indexed by address */
+    UniformBufferCacheEntry uniform_buffer_cache[UNIFORM_BUFFER_CACHE_SIZE];
+    /* Reused by the following draws of the scene while the uniform buffers stay the same */
+    StagedUniformBuffers staged_vertex_uniform_buffers, staged_fragment_uniform_buffers;
+    /* VisibilityRun arrays, one per scene command buffer */
+    DkMemBlock visibility_memblock;
+    /* Begin and end timestamp reports, one pair per scene command buffer */
+    DkMemBlock timestamp_memblock;
+    /* Size the scene being recorded renders at, in the shadow surfaces */
+    uint32_t scene_scale_percent;
+    uint32_t scene_width;
+    uint32_t scene_height;
+    uint32_t visibility_run_count;
+    bool visibility_run_active;
+    /* Sequence number of the scene or command list being recorded */
+    uint32_t scene_seq;
+    /* Times the VDM callback failed to provide command memory, since the list began */
+    uint32_t cmdbuf_reserve_failures;
+    /* Command memory allocated in place of what the VDM callback failed to provide */
+    DkMemBlock *fallback_cmdbuf_memblocks;
+    uint32_t fallback_cmdbuf_memblock_count;
+    /* Resources of the command list being recorded, and of the lists ended since */
+    struct CommandListResources *list_resources;
+    struct CommandListResources **ended_lists;
+    uint32_t ended_list_count;
+    /* Translator thread recording this context's commands, if threaded dispatch is enabled */
+    struct DispatchControlBlock *dispatch;
+    /* DispatchStateGroup bits the game thread changed without flagging them dirty */
+    uint32_t dispatch_state_dirty;
+    SceGxmContextState state;
 } SceGxmContext;
 static_assert(sizeof(SceGxmContext) <= SCE_GXM_MINIMUM_CONTEXT_HOST_MEM_SIZE,
               "Oversized SceGxmContext");
@@ -90,6 +275,8 @@ typedef struct SceGxmSyncObject {
 
 typedef struct SceGxmRegisteredProgram {
     const SceGxmProgram *programHeader;
+    /* Lazily built table of the parameters, indexed by name hash */
+    GxmNameTable *parameter_name_table;
 } SceGxmRegisteredProgram;
 
 typedef struct SceGxmShaderPatcher {
@@ -105,6 +292,11 @@ typedef struct SceGxmVertexProgram {
     SceGxmVertexStream *streams;
     unsigned int streamCount;
     DkShader dk_shader;
+    UniformBufferLayout uniform_buffer_layout;
+    /* The default uniform buffer is small enough to be bound as a uniform buffer */
+    bool default_uniform_ubo;
+    /* Passes a single F32 position attribute through: can be used to draw full-screen clears */
+    bool is_clear_candidate;
 } SceGxmVertexProgram;
 
 typedef struct SceGxmFragmentProgram {
@@ -113,25 +305,208 @@ typedef struct SceGxmFragmentProgram {
     SceGxmMultisampleMode multisampleMode;
     SceGxmBlendInfo blendInfo;
     DkShader dk_shader;
+    UniformBufferLayout uniform_buffer_layout;
+    /* The default uniform buffer is small enough to be bound as a uniform buffer */
+    bool default_uniform_ubo;
+    /* Default uniform buffer offset of the constant output color, or -1 if not a clear shader */
+    int32_t clear_color_offset;
 } SceGxmFragmentProgram;
 
 typedef struct SceGxmRenderTarget {
     SceGxmRenderTargetParams params;
+    DkMsMode ms_mode;
+    /* Backs all the shadow surfaces */
+    DkMemBlock shadow_memblock;
+    /* Single-sampled: the multisampled color surface gets resolved to it at the end of the scene */
     dk_surface_t shadow_color_surface;
+    dk_surface_t shadow_msaa_color_surface;
+    /* Multisampled if the render target is */
     dk_surface_t shadow_ds_surface;
+    /* GXM depth/stencil data the shadow depth/stencil surface is in sync with (if any) */
+    const void *shadow_ds_synced_data;
+    uint32_t shadow_ds_synced_seq;
+    uint32_t shadow_ds_synced_scale_percent;
 } SceGxmRenderTarget;
 
+/* Texture converted to a block linear image, keyed by its GXM description and contents */
+typedef struct {
+    const void *data;
+    const void *palette;
+    SceGxmTextureFormat format;
+    uint32_t type;
+    uint16_t width;
+    uint16_t height;
+    uint8_t levels;
+    uint64_t hash;
+    uint64_t sampled_hash;
+    /* Generation of the source memory block when the contents were last hashed */
+    uint32_t generation;
+    /* Sequence numbers of the last scene sampling it, and of the last ones checking its contents */
+    uint32_t last_use_seq;
+    uint32_t last_check_seq;
+    uint32_t last_full_check_seq;
+    /* Sequence number of the last command list pinning the memblock */
+    uint32_t pinned_seq;
+    DkMemBlock memblock;
+    DkImage image;
+} TextureCacheEntry;
+
+/* Converted index buffer, keyed by the source indices and the primitive they're drawn as */
+typedef struct {
+    const void *data;
+    uint32_t count;
+    SceGxmIndexFormat format;
+    SceGxmPrimitiveType prim;
+    uint64_t hash;
+    uint64_t sampled_hash;
+    uint32_t generation;
+    uint32_t last_use_seq;
+    uint32_t last_check_seq;
+    uint32_t last_full_check_seq;
+    uint32_t pinned_seq;
+    DkMemBlock memblock;
+    uint32_t converted_count;
+} IndexCacheEntry;
+
+/* Slot of the descriptor pool, keyed by the texture state and image address it was built from */
+typedef struct {
+    uint32_t key[DESCRIPTOR_POOL_KEY_WORDS];
+    /* Sequence number of the last scene using it: the slot can't be reused before it's done */
+    uint32_t last_use_seq;
+    /* Command lists that can still be executed using it, which also keeps it from being reused */
+    uint32_t pins;
+    uint32_t pinned_seq;
+    bool valid;
+} DescriptorPoolSlot;
+
+typedef struct {
+    DescriptorPoolSlot *slots;
+    uint32_t count;
+} DescriptorPool;
+
+/* Slots don't have a fixed address, as growing the pool reallocates them */
+typedef struct {
+    DescriptorPool *pool;
+    uint32_t index;
+} PinnedDescriptor;
+
+/* Memblock the GPU might still access, destroyed once the scene with sequence number seq is done */
+typedef struct {
+    DkMemBlock memblock;
+    uint32_t seq;
+} RetiredMemBlock;
+
+typedef struct {
+    SceUID thid;
+    UEvent pending_evflag;
+} TextureWorker;
+
+/* Conversion split into independent jobs, which the texture workers take part in */
+typedef struct {
+    GxmTextureParallelFunc func;
+    void *arg;
+    uint32_t count;
+    /* Next job to take, and number of workers that ran out of jobs */
+    uint32_t next;
+    uint32_t idle_workers;
+    UEvent idle_evflag;
+} TextureJobs;
+
+enum {
+    TEXTURE_PREFETCH_FREE,
+    TEXTURE_PREFETCH_QUEUED,
+    TEXTURE_PREFETCH_DECODING,
+    TEXTURE_PREFETCH_DONE,
+};
+
+/* Decode of a PVRTC texture, staged like texture_cache_upload stages it, keyed like cached ones */
+typedef struct {
+    TextureCacheEntry key;
+    SceGxmTextureInner texture;
+    uint32_t state;
+    /* Slots are decoded, and evicted, in the order they were queued */
+    uint32_t queue_seq;
+    DkMemBlock staging;
+} TexturePrefetch;
+
+/* Memblock used by command lists that can still be executed: it's only retired once they're not */
+typedef struct {
+    DkMemBlock memblock;
+    uint32_t pins;
+    /* Sequence number of the last scene executing one of the lists */
+    uint32_t last_use_seq;
+    /* Whether its owner retired it in the meantime */
+    bool retired;
+} PinnedMemBlock;
+
+/*
+ * Resources a command list uses. Lists can be executed again and again, so they stay pinned until
+ * the list's SceGxmCommandList is ended again or its deferred context is destroyed.
+ */
+typedef struct CommandListResources {
+    const SceGxmCommandList *list;
+    /* Held by the deferred context recording the list, and by the executions not recorded yet */
+    uint32_t refs;
+    /* Sequence number of the list, then of the last scene executing it */
+    uint32_t last_use_seq;
+    DkMemBlock *memblocks;
+    uint32_t memblock_count;
+    uint32_t memblock_capacity;
+    PinnedDescriptor *descriptors;
+    uint32_t descriptor_count;
+    uint32_t descriptor_capacity;
+} CommandListResources;
+
+typedef enum {
+    PENDING_SCENE_RECORDING,
+    PENDING_SCENE_SUBMITTED,
+} PendingSceneState;
+
+/* Scene or transfer the GPU might not be done with */
+typedef struct {
+    uint32_t seq;
+    PendingSceneState state;
+    DkFence fence;
+} PendingScene;
+
+/* Memory written by the GPU, reported as written once the scene with sequence number seq is done */
+typedef struct {
+    const void *addr;
+    uint32_t seq;
+} PendingWrite;
+
 typedef struct {
-    DkFence *new_fence;
-    DkFence *old_fence;
+    /* Copied, since the sync object's fence gets replaced when the entry is queued */
+    DkFence new_fence;
+    /* Flip sequence number, the old buffer is released once the flip variable reaches it */
+    uint32_t seq;
+    uint64_t queued_tick;
+    DkCmdBuf cmdbuf;
+    /* Signalled once the GPU is done with the entry's commands */
+    DkFence cmdbuf_fence;
+    bool submitted;
     void *callback_data;
 } DisplayQueueEntry;
 
+/*
+ * Single producer, single consumer (the display queue thread) ring. sceGxmDisplayQueueAddEntry
+ * reserves the entries, and they're submitted in order by the thread recording the scenes.
+ */
 typedef struct {
     uint32_t tail;
     uint32_t head;
+    uint32_t reserved;
     uint32_t num_entries;
     DisplayQueueEntry *entries;
+    DkQueue dk_queue;
+    DkMemBlock cmdbuf_memblock;
+    /* Holds the sequence number of the last completed flip */
+    DkMemBlock flip_memblock;
+    DkVariable flip_variable;
+    uint32_t flip_seq;
+    /* Statistics, accumulated by the display queue thread */
+    uint32_t flips;
+    uint64_t flip_latency_ns;
     uint32_t display_queue_max_pending_count;
     SceGxmDisplayQueueCallback *display_queue_callback;
     uint32_t display_queue_callback_data_size;
@@ -141,6 +516,98 @@ typedef struct {
     UEvent pending_evflag;
 } DisplayQueueControlBlock;
 
+typedef struct {
+    DkFence fence;
+    uint32_t value;
+    /* Bumped on every record, to tell a newer fence from one already waited on */
+    uint32_t serial;
+    bool valid;
+} NotificationFence;
+
+typedef struct {
+    DkCmdList dk_cmd_list;
+    CommandListResources *resources;
+} SceGxmCommandListInner;
+static_assert(sizeof(SceGxmCommandListInner) <= sizeof(SceGxmCommandList), "Incorrect size");
+
+typedef enum {
+    DISPATCH_CMD_SET_STATE,
+    DISPATCH_CMD_BEGIN_SCENE,
+    DISPATCH_CMD_END_SCENE,
+    DISPATCH_CMD_EXECUTE_COMMAND_LIST,
+    DISPATCH_CMD_DRAW,
+    DISPATCH_CMD_DISPLAY_QUEUE_ADD_ENTRY,
+} DispatchCmdType;
+
+/* Parts of the context state the translator thread's copy gets updated with when they change */
+typedef enum {
+    DISPATCH_STATE_PROGRAMS,
+    DISPATCH_STATE_SCENE,
+    DISPATCH_STATE_FIXED_FUNCTION,
+    DISPATCH_STATE_VERTEX_STREAMS,
+    DISPATCH_STATE_DEFAULT_UNIFORMS,
+    DISPATCH_STATE_VISIBILITY,
+    /* One per texture unit */
+    DISPATCH_STATE_FRAGMENT_TEXTURE0,
+} DispatchStateGroup;
+static_assert(DISPATCH_STATE_FRAGMENT_TEXTURE0 + SCE_GXM_MAX_TEXTURE_UNITS <= 32,
+              "Too many dispatch state groups");
+
+typedef struct {
+    DispatchCmdType type;
+    /* Dirty state tracking and scene draw count at the time of the call */
+    uint32_t dirty;
+    uint32_t vertex_streams_dirty_mask;
+    uint32_t scene_draw_count;
+    union {
+        struct {
+            /* Bytes of SceGxmContextState to overwrite */
+            uint16_t offset;
+            uint16_t size;
+            uint8_t data[DISPATCH_STATE_CHUNK_SIZE];
+        } set_state;
+        struct {
+            /* Last transfer the scene has to wait for */
+            DkFence transfer_fence;
+            bool has_transfer_fence;
+        } begin_scene;
+        struct {
+            SceGxmNotification vertex_notification;
+            SceGxmNotification fragment_notification;
+            bool has_vertex_notification;
+            bool has_fragment_notification;
+        } end_scene;
+        struct {
+            DkCmdList cmd_list;
+            CommandListResources *resources;
+        } execute_command_list;
+        struct {
+            SceGxmSyncObject *old_buffer;
+            SceGxmSyncObject *new_buffer;
+        } display_queue_add_entry;
+        struct {
+            SceGxmPrimitiveType prim_type;
+            SceGxmIndexFormat index_type;
+            const void *index_data;
+            uint32_t index_count;
+        } draw;
+    } args;
+} DispatchCmd;
+
+typedef struct DispatchControlBlock {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t exit_thread;
+    SceUID thid;
+    UEvent ready_evflag;
+    UEvent pending_evflag;
+    /* Time spent by the translator thread recording commands, instead of the game thread */
+    uint64_t translate_ns;
+    /* The translator thread's copy of the context, its state is replaced by each command's */
+    SceGxmContext context;
+    DispatchCmd cmds[DISPATCH_RING_NUM_ENTRIES];
+} DispatchControlBlock;
+
 /* Vita3K's shader recompiler */
 struct GXMRenderVertUniformBlock {
     float viewport_flip[4];
@@ -159,18 +626,142 @@ struct GXMRenderFragUniformBlock {
     float res_multiplier;
 };
 
+DICT_DEF2(registered_program_dict, uintptr_t, M_DEFAULT_OPLIST, SceGxmRegisteredProgram *,
+          M_POD_OPLIST)
+
 /* Global state */
 
 static bool g_gxm_initialized;
 
 static DkDevice g_dk_device;
 static DkQueue g_render_queue;
+/* Transfers run on their own queue, in parallel with rendering */
+static DkQueue g_transfer_queue;
+static DkMemBlock g_transfer_cmdbuf_memblock;
+static SceneCmdBuf g_transfer_cmdbufs[TRANSFER_CMDBUF_COUNT];
+static uint32_t g_transfer_cmdbuf_index;
+/* Begin and end timestamp reports, one pair per transfer command buffer */
+static DkMemBlock g_transfer_timestamp_memblock;
+/* Fence of the last submitted scene, for transfers synchronized with rendering */
+static DkFence g_last_scene_fence;
+static bool g_last_scene_fence_valid;
+static Mutex g_transfer_lock;
 static DkMemBlock g_notification_region_memblock;
+/* Fence of the last submitted scene signalling each notification slot, and the value it sets */
+static NotificationFence g_notification_fences[SCE_GXM_NOTIFICATION_COUNT];
+static Mutex g_notification_fences_lock;
 static DisplayQueueControlBlock *g_display_queue;
 static DkMemBlock g_code_memblock;
 static uint32_t g_code_mem_offset;
+/* Accumulates the visibility runs of a scene into the visibility buffer */
+static DkShader g_visibility_resolve_shader;
+static bool g_visibility_resolve_shader_valid;
+/* Looks the indices of paletted textures up in their palette */
+static DkShader g_palette_expand_shader;
+static bool g_palette_expand_shader_valid;
+/* Maps the registered SceGxmProgram pointers to their SceGxmRegisteredProgram */
+static registered_program_dict_t g_registered_programs;
+static RwLock g_registered_programs_lock;
+/* Bumped whenever any scene stores a shadow depth/stencil surface to GXM memory */
+static uint32_t g_ds_store_seq;
+/*
+ * Last sequence number handed out to a scene, transfer or command list, and the one all the scenes
+ * and transfers up to are known to be done with.
+ */
+static uint32_t g_scene_seq;
+static uint32_t g_completed_scene_seq;
+static PendingScene *g_pending_scenes;
+static uint32_t g_pending_scenes_count;
+static uint32_t g_pending_scenes_capacity;
+static Mutex g_pending_scenes_lock;
+static RetiredMemBlock *g_retired_memblocks;
+static uint32_t g_retired_memblocks_count;
+static uint32_t g_retired_memblocks_capacity;
+/* Also protected by g_retired_memblocks_lock */
+static PinnedMemBlock *g_pinned_memblocks;
+static uint32_t g_pinned_memblocks_count;
+static uint32_t g_pinned_memblocks_capacity;
+static Mutex g_retired_memblocks_lock;
+static PendingWrite *g_pending_writes;
+static uint32_t g_pending_writes_count;
+static uint32_t g_pending_writes_capacity;
+static Mutex g_pending_writes_lock;
+static TextureCacheEntry g_texture_cache[TEXTURE_CACHE_SIZE];
+static Mutex g_texture_cache_lock;
+static TextureWorker g_texture_workers[TEXTURE_WORKER_COUNT];
+static uint32_t g_texture_workers_exit;
+/* Only one conversion at a time is split, the others are run by their thread alone */
+static TextureJobs g_texture_jobs;
+static Mutex g_texture_jobs_lock;
+static TexturePrefetch g_texture_prefetches[TEXTURE_PREFETCH_SLOTS];
+static uint32_t g_texture_prefetch_seq;
+static SceUID g_texture_prefetch_thid;
+static uint32_t g_texture_prefetch_exit;
+static UEvent g_texture_prefetch_pending_evflag;
+/* Signalled whenever a decode ends, for a draw waiting on it */
+static UEvent g_texture_prefetch_done_evflag;
+static Mutex g_texture_prefetch_lock;
+static IndexCacheEntry g_index_cache[INDEX_CACHE_SIZE];
+static Mutex g_index_cache_lock;
+/* The image descriptors of the pool followed by the sampler ones */
+static DkMemBlock g_descriptor_pool_memblock;
+static uint32_t g_descriptor_pool_pinned_seq;
+static DescriptorPool g_descriptor_pool_images;
+static DescriptorPool g_descriptor_pool_samplers;
+static Mutex g_descriptor_pool_lock;
+/* Internal resolution scenes begin with, and GPU time of the scenes completed this frame */
+static uint32_t g_resolution_scale_percent;
+static uint64_t g_gpu_frame_ns;
+
+/*
+ * Per-frame statistics, reported and reset on every display queue flip. The game thread and the
+ * translator thread both update them.
+ */
+static struct {
+    uint32_t ds_loads;
+    uint32_t ds_loads_skipped;
+    uint32_t clears_replaced;
+    uint32_t notification_waits;
+    uint32_t notification_waits_signalled;
+    uint64_t notification_wait_ns;
+    uint32_t dispatch_cmds;
+    uint64_t dispatch_wait_ns;
+    uint32_t transfers;
+    uint64_t transfer_bytes;
+    uint64_t transfer_gpu_ns;
+    uint32_t visibility_runs;
+    uint32_t texture_uploads;
+    uint64_t texture_upload_bytes;
+    uint32_t texture_decodes;
+    uint64_t texture_decode_ns;
+    uint32_t texture_prefetch_hits;
+    uint32_t texture_cache_hits;
+    uint32_t texture_cache_misses;
+    uint32_t texture_cache_invalidations;
+    uint32_t descriptors_built;
+    uint32_t descriptor_set_overflows;
+    uint32_t index_conversions;
+    uint32_t draws;
+    uint64_t draw_ns;
+    uint32_t command_lists;
+    uint32_t command_list_draws;
+    uint64_t command_list_draw_ns;
+    uint32_t display_queue_max_depth;
+    uint64_t gpu_ns;
+} g_frame_stats;
+#define FRAME_STATS_ADD(counter, n) __atomic_fetch_add(&g_frame_stats.counter, n, __ATOMIC_RELAXED)
+#define FRAME_STATS_TAKE(counter)   __atomic_exchange_n(&g_frame_stats.counter, 0, __ATOMIC_RELAXED)
+
+/* The immediate context (GXM only allows one), if its commands go through a translator thread */
+static SceGxmContext *g_dispatch_context;
 
 static int SceGxmDisplayQueue_thread(SceSize args, void *argp);
+static int SceGxmTextureWorker_thread(SceSize args, void *argp);
+static int SceGxmTexturePrefetch_thread(SceSize args, void *argp);
+static void texture_prefetch_queue(const SceGxmTextureInner *texture);
+#if THREADED_DISPATCH
+static int SceGxmDispatch_thread(SceSize args, void *argp);
+#endif
 
 #if DUMP_SHADER_SPIRV
 static void dump_shader_spirv(const char *prefix, const uint32_t *spirv, uint32_t num_instr)
@@ -203,10 +794,57 @@ static bool shader_dump_cb(const char *ext, const char *dump)
 #define SHADER_DUMP_CB NULL
 #endif
 
+static const char visibility_resolve_glsl[] =
+    "#version 460\n"
+    "layout(local_size_x = 1) in;\n"
+    "struct Run { uvec4 begin; uvec4 end; uint index; uint op; uvec2 reserved; };\n"
+    "layout(std430, binding = 0) readonly buffer Runs { Run runs[]; };\n"
+    "layout(std430, binding = 1) buffer Visibility { uint visibility[]; };\n"
+    "void main() {\n"
+    "    Run run = runs[gl_WorkGroupID.x];\n"
+    "    uint samples = run.end.x - run.begin.x;\n"
+    "    if (run.op == 0u)\n"
+    "        atomicAdd(visibility[run.index], samples);\n"
+    "    else if (samples != 0u)\n"
+    "        visibility[run.index] = 1u;\n"
+    "}\n";
+
+static const char palette_expand_glsl[] =
+    "#version 460\n"
+    "layout(local_size_x = 32) in;\n"
+    "layout(std430, binding = 0) readonly buffer Indices { uint indices[]; };\n"
+    "layout(std430, binding = 1) readonly buffer Palette { uint palette[256]; };\n"
+    "layout(std430, binding = 2) writeonly buffer Texels { uvec4 texels[]; };\n"
+    "void main() {\n"
+    "    uint i = gl_GlobalInvocationID.x;\n"
+    "    uint word = indices[i];\n"
+    "    texels[i] = uvec4(palette[word & 0xffu], palette[(word >> 8) & 0xffu],\n"
+    "                      palette[(word >> 16) & 0xffu], palette[word >> 24]);\n"
+    "}\n";
+
+static bool compute_shader_init(DkShader *shader, const char *glsl)
+{
+    DkShaderMaker shader_maker;
+    uint32_t shader_size;
+
+    if (!uam_compiler_compile_glsl(pipeline_stage_compute, glsl,
+                                   dkMemBlockGetCpuAddr(g_code_memblock) + g_code_mem_offset,
+                                   &shader_size))
+        return false;
+
+    dkShaderMakerDefaults(&shader_maker, g_code_memblock, g_code_mem_offset);
+    dkShaderInitialize(shader, &shader_maker);
+    g_code_mem_offset += ALIGN(shader_size, DK_SHADER_CODE_ALIGNMENT);
+
+    return true;
+}
+
 EXPORT(SceGxm, 0xB0F1E4EC, int, sceGxmInitialize, const SceGxmInitializeParams *params)
 {
     DkQueueMaker queue_maker;
+    DkCmdBufMaker cmdbuf_maker;
     uint32_t display_queue_num_entries;
+    DisplayQueueEntry *entry;
 
     if (g_gxm_initialized)
         return SCE_GXM_ERROR_ALREADY_INITIALIZED;
@@ -216,10 +854,95 @@ EXPORT(SceGxm, 0xB0F1E4EC, int, sceGxmInitialize, const SceGxmInitializeParams *
     queue_maker.flags = DkQueueFlags_Graphics;
     g_render_queue = dkQueueCreate(&queue_maker);
 
+    /*
+     * Create the transfer queue. It needs the graphics flag: fills and format converting blits
+     * use the 3D and 2D engines, and DkQueueFlags_Transfer queues only have the copy engine.
+     */
+    dkQueueMakerDefaults(&queue_maker, g_dk_device);
+    queue_maker.flags = DkQueueFlags_Graphics;
+    g_transfer_queue = dkQueueCreate(&queue_maker);
+
+    g_transfer_cmdbuf_memblock =
+        dk_alloc_memblock(g_dk_device, TRANSFER_CMDBUF_COUNT * TRANSFER_CMDBUF_SIZE,
+                          DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+    for (uint32_t i = 0; i < TRANSFER_CMDBUF_COUNT; i++) {
+        dkCmdBufMakerDefaults(&cmdbuf_maker, g_dk_device);
+        g_transfer_cmdbufs[i].cmdbuf = dkCmdBufCreate(&cmdbuf_maker);
+        dkCmdBufAddMemory(g_transfer_cmdbufs[i].cmdbuf, g_transfer_cmdbuf_memblock,
+                          i * TRANSFER_CMDBUF_SIZE, TRANSFER_CMDBUF_SIZE);
+        g_transfer_cmdbufs[i].submitted = false;
+    }
+    g_transfer_timestamp_memblock = dk_alloc_memblock(
+        g_dk_device, TRANSFER_CMDBUF_COUNT * 2 * 2 * sizeof(uint64_t), DkMemBlockFlags_CpuUncached);
+    g_transfer_cmdbuf_index = 0;
+    g_last_scene_fence_valid = false;
+    mutexInit(&g_transfer_lock);
+
     /* Create memory block for the "notification region" */
     g_notification_region_memblock =
         dk_alloc_memblock(g_dk_device, SCE_GXM_NOTIFICATION_COUNT * sizeof(uint32_t),
                           DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuUncached);
+    memset(g_notification_fences, 0, sizeof(g_notification_fences));
+    mutexInit(&g_notification_fences_lock);
+
+    g_scene_seq = 0;
+    g_completed_scene_seq = 0;
+    g_pending_scenes = NULL;
+    g_pending_scenes_count = g_pending_scenes_capacity = 0;
+    mutexInit(&g_pending_scenes_lock);
+    g_resolution_scale_percent = RESOLUTION_SCALE_PERCENT;
+    g_gpu_frame_ns = 0;
+    g_retired_memblocks = NULL;
+    g_retired_memblocks_count = g_retired_memblocks_capacity = 0;
+    g_pinned_memblocks = NULL;
+    g_pinned_memblocks_count = g_pinned_memblocks_capacity = 0;
+    mutexInit(&g_retired_memblocks_lock);
+    g_pending_writes = NULL;
+    g_pending_writes_count = g_pending_writes_capacity = 0;
+    mutexInit(&g_pending_writes_lock);
+    memset(g_texture_cache, 0, sizeof(g_texture_cache));
+    mutexInit(&g_texture_cache_lock);
+    memset(&g_texture_jobs, 0, sizeof(g_texture_jobs));
+    ueventCreate(&g_texture_jobs.idle_evflag, true);
+    mutexInit(&g_texture_jobs_lock);
+    g_texture_workers_exit = 0;
+    for (uint32_t i = 0; i < TEXTURE_WORKER_COUNT; i++) {
+        TextureWorker *worker = &g_texture_workers[i];
+
+        ueventCreate(&worker->pending_evflag, true);
+        worker->thid = sceKernelCreateThread("SceGxmTextureWorker", SceGxmTextureWorker_thread,
+                                             64, 0x4000, 0, 0, NULL);
+        assert(worker->thid > 0);
+        sceKernelStartThread(worker->thid, sizeof(worker), &worker);
+    }
+    memset(g_texture_prefetches, 0, sizeof(g_texture_prefetches));
+    g_texture_prefetch_seq = 0;
+    g_texture_prefetch_exit = 0;
+    ueventCreate(&g_texture_prefetch_pending_evflag, true);
+    ueventCreate(&g_texture_prefetch_done_evflag, true);
+    mutexInit(&g_texture_prefetch_lock);
+    g_texture_prefetch_thid =
+        sceKernelCreateThread("SceGxmTexturePrefetch", SceGxmTexturePrefetch_thread,
+                              TEXTURE_PREFETCH_PRIORITY, 0x4000, 0, 0, NULL);
+    assert(g_texture_prefetch_thid > 0);
+    sceKernelStartThread(g_texture_prefetch_thid, 0, NULL);
+    memset(g_index_cache, 0, sizeof(g_index_cache));
+    mutexInit(&g_index_cache_lock);
+
+    g_descriptor_pool_memblock =
+        dk_alloc_memblock(g_dk_device,
+                          DESCRIPTOR_POOL_IMAGES * sizeof(DkImageDescriptor) +
+                              DESCRIPTOR_POOL_SAMPLERS * sizeof(DkSamplerDescriptor),
+                          DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+    g_descriptor_pool_pinned_seq = 0;
+    g_descriptor_pool_images.slots = calloc(DESCRIPTOR_POOL_IMAGES, sizeof(DescriptorPoolSlot));
+    g_descriptor_pool_images.count = DESCRIPTOR_POOL_IMAGES;
+    g_descriptor_pool_samplers.slots = calloc(DESCRIPTOR_POOL_SAMPLERS, sizeof(DescriptorPoolSlot));
+    g_descriptor_pool_samplers.count = DESCRIPTOR_POOL_SAMPLERS;
+    mutexInit(&g_descriptor_pool_lock);
+
+    registered_program_dict_init(g_registered_programs);
+    rwlockInit(&g_registered_programs_lock);
 
     /* Allocate and initialize the display queue, and its worker thread */
     display_queue_num_entries = next_pow2(params->displayQueueMaxPendingCount + 1);
@@ -229,6 +952,7 @@ EXPORT(SceGxm, 0xB0F1E4EC, int, sceGxmInitialize, const SceGxmInitializeParams *
     assert(g_display_queue);
     g_display_queue->head = 0;
     g_display_queue->tail = 0;
+    g_display_queue->reserved = 0;
     g_display_queue->num_entries = display_queue_num_entries;
     g_display_queue->entries =
         (DisplayQueueEntry *)((char *)g_display_queue + sizeof(DisplayQueueControlBlock));
@@ -240,11 +964,33 @@ EXPORT(SceGxm, 0xB0F1E4EC, int, sceGxmInitialize, const SceGxmInitializeParams *
                                                   64, 0x1000, 0, 0, NULL);
     assert(g_display_queue->thid > 0);
 
+    g_display_queue->flips = 0;
+    g_display_queue->flip_latency_ns = 0;
+
+    /* The old buffers' sync objects are released from this queue once they're swapped out */
+    dkQueueMakerDefaults(&queue_maker, g_dk_device);
+    queue_maker.flags = DkQueueFlags_Transfer;
+    g_display_queue->dk_queue = dkQueueCreate(&queue_maker);
+    g_display_queue->cmdbuf_memblock =
+        dk_alloc_memblock(g_dk_device, display_queue_num_entries * DISPLAY_QUEUE_CMDBUF_SIZE,
+                          DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+    g_display_queue->flip_memblock =
+        dk_alloc_memblock(g_dk_device, sizeof(uint32_t),
+                          DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuUncached);
+    dkVariableInitialize(&g_display_queue->flip_variable, g_display_queue->flip_memblock, 0);
+    dkVariableSignal(&g_display_queue->flip_variable, DkVarOp_Set, 0);
+    g_display_queue->flip_seq = 0;
+
     for (uint32_t i = 0; i < display_queue_num_entries; i++) {
-        g_display_queue->entries[i].callback_data =
-            (char *)g_display_queue->entries +
-            (sizeof(DisplayQueueEntry) * display_queue_num_entries) +
-            i * params->displayQueueCallbackDataSize;
+        entry = &g_display_queue->entries[i];
+        entry->callback_data = (char *)g_display_queue->entries +
+                               (sizeof(DisplayQueueEntry) * display_queue_num_entries) +
+                               i * params->displayQueueCallbackDataSize;
+        dkCmdBufMakerDefaults(&cmdbuf_maker, g_dk_device);
+        entry->cmdbuf = dkCmdBufCreate(&cmdbuf_maker);
+        dkCmdBufAddMemory(entry->cmdbuf, g_display_queue->cmdbuf_memblock,
+                          i * DISPLAY_QUEUE_CMDBUF_SIZE, DISPLAY_QUEUE_CMDBUF_SIZE);
+        entry->submitted = false;
     }
 
     ueventCreate(&g_display_queue->ready_evflag, true);
@@ -259,6 +1005,16 @@ EXPORT(SceGxm, 0xB0F1E4EC, int, sceGxmInitialize, const SceGxmInitializeParams *
 
     g_code_mem_offset = 0;
 
+    g_visibility_resolve_shader_valid =
+        compute_shader_init(&g_visibility_resolve_shader, visibility_resolve_glsl);
+    if (!g_visibility_resolve_shader_valid)
+        LOG("Failed to compile the visibility resolve shader, visibility tests are disabled");
+
+    g_palette_expand_shader_valid =
+        compute_shader_init(&g_palette_expand_shader, palette_expand_glsl);
+    if (!g_palette_expand_shader_valid)
+        LOG("Failed to compile the palette expansion shader, paletted textures are disabled");
+
     g_gxm_initialized = true;
 
     return 0;
@@ -266,1311 +1022,4550 @@ EXPORT(SceGxm, 0xB0F1E4EC, int, sceGxmInitialize, const SceGxmInitializeParams *
 
 EXPORT(SceGxm, 0xB627DE66, int, sceGxmTerminate)
 {
-    g_display_queue->exit_thread = 1;
+    __atomic_store_n(&g_display_queue->exit_thread, 1, __ATOMIC_RELAXED);
     ueventSignal(&g_display_queue->pending_evflag);
     sceKernelWaitThreadEnd(g_display_queue->thid, NULL, NULL);
 
+    __atomic_store_n(&g_texture_workers_exit, 1, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < TEXTURE_WORKER_COUNT; i++) {
+        ueventSignal(&g_texture_workers[i].pending_evflag);
+        sceKernelWaitThreadEnd(g_texture_workers[i].thid, NULL, NULL);
+    }
+
+    __atomic_store_n(&g_texture_prefetch_exit, 1, __ATOMIC_RELAXED);
+    ueventSignal(&g_texture_prefetch_pending_evflag);
+    sceKernelWaitThreadEnd(g_texture_prefetch_thid, NULL, NULL);
+    for (uint32_t i = 0; i < TEXTURE_PREFETCH_SLOTS; i++) {
+        if (g_texture_prefetches[i].state == TEXTURE_PREFETCH_DONE)
+            dkMemBlockDestroy(g_texture_prefetches[i].staging);
+    }
+
+    /* Release the sync objects of the flips that will never happen */
+    dkVariableSignal(&g_display_queue->flip_variable, DkVarOp_Set, g_display_queue->flip_seq);
+    dkQueueWaitIdle(g_display_queue->dk_queue);
+    for (uint32_t i = 0; i < g_display_queue->num_entries; i++)
+        dkCmdBufDestroy(g_display_queue->entries[i].cmdbuf);
+    dkMemBlockDestroy(g_display_queue->cmdbuf_memblock);
+    dkMemBlockDestroy(g_display_queue->flip_memblock);
+    dkQueueDestroy(g_display_queue->dk_queue);
     free(g_display_queue);
+    registered_program_dict_clear(g_registered_programs);
     dkMemBlockDestroy(g_code_memblock);
     dkMemBlockDestroy(g_notification_region_memblock);
+    dkQueueWaitIdle(g_transfer_queue);
+    for (uint32_t i = 0; i < TRANSFER_CMDBUF_COUNT; i++)
+        dkCmdBufDestroy(g_transfer_cmdbufs[i].cmdbuf);
+    dkMemBlockDestroy(g_transfer_cmdbuf_memblock);
+    dkMemBlockDestroy(g_transfer_timestamp_memblock);
+    dkQueueDestroy(g_transfer_queue);
+    dkQueueWaitIdle(g_render_queue);
+    for (uint32_t i = 0; i < TEXTURE_CACHE_SIZE; i++) {
+        if (g_texture_cache[i].memblock)
+            dkMemBlockDestroy(g_texture_cache[i].memblock);
+    }
+    for (uint32_t i = 0; i < INDEX_CACHE_SIZE; i++) {
+        if (g_index_cache[i].memblock)
+            dkMemBlockDestroy(g_index_cache[i].memblock);
+    }
+    dkMemBlockDestroy(g_descriptor_pool_memblock);
+    free(g_descriptor_pool_images.slots);
+    free(g_descriptor_pool_samplers.slots);
+    for (uint32_t i = 0; i < g_retired_memblocks_count; i++)
+        dkMemBlockDestroy(g_retired_memblocks[i].memblock);
+    free(g_retired_memblocks);
+    for (uint32_t i = 0; i < g_pinned_memblocks_count; i++) {
+        if (g_pinned_memblocks[i].retired)
+            dkMemBlockDestroy(g_pinned_memblocks[i].memblock);
+    }
+    free(g_pinned_memblocks);
+    free(g_pending_writes);
+    free(g_pending_scenes);
     dkQueueDestroy(g_render_queue);
 
     g_gxm_initialized = false;
     return 0;
 }
 
-EXPORT(SceGxm, 0xE84CE5B4, int, sceGxmCreateContext, const SceGxmContextParams *params,
-       SceGxmContext **context)
+/*
+ * Every scene, transfer and command list gets its own sequence number, which the resources it uses
+ * are tagged with. Scenes and transfers are tracked until the GPU is done with them: the lowest one
+ * still pending tells which sequence numbers are complete, whichever context or queue they were
+ * submitted from. Command lists aren't tracked, the scenes executing them are.
+ */
+static uint32_t scene_seq_next(void)
 {
-    DkCmdBufMaker cmdbuf_maker;
-    SceGxmContext *ctx = params->hostMem;
+    return __atomic_add_fetch(&g_scene_seq, 1, __ATOMIC_RELAXED);
+}
 
-    if (params->hostMemSize < sizeof(SceGxmContext))
-        return SCE_GXM_ERROR_INVALID_VALUE;
+static uint32_t scene_seq_begin(void)
+{
+    PendingScene *pending;
+    uint32_t seq;
+
+    mutexLock(&g_pending_scenes_lock);
+    if (g_pending_scenes_count == g_pending_scenes_capacity) {
+        g_pending_scenes_capacity = MAX2(16, g_pending_scenes_capacity * 2);
+        pending =
+            realloc(g_pending_scenes, g_pending_scenes_capacity * sizeof(*g_pending_scenes));
+        assert(pending);
+        g_pending_scenes = pending;
+    }
+    seq = scene_seq_next();
+    g_pending_scenes[g_pending_scenes_count++] =
+        (PendingScene){ .seq = seq, .state = PENDING_SCENE_RECORDING };
+    mutexUnlock(&g_pending_scenes_lock);
 
-    memset(ctx, 0, sizeof(*ctx));
-    ctx->params = *params;
+    return seq;
+}
 
-    /* Get the passed backing storage buffer for the main command buffer */
-    ctx->cmdbuf_memblock = SceSysmem_get_dk_memblock_for_addr(params->vdmRingBufferMem);
-    assert(ctx->cmdbuf_memblock);
+/* Must be called with g_pending_scenes_lock held */
+static PendingScene *scene_seq_find(uint32_t seq)
+{
+    for (uint32_t i = 0; i < g_pending_scenes_count; i++) {
+        if (g_pending_scenes[i].seq == seq)
+            return &g_pending_scenes[i];
+    }
 
-    /* Create the command buffer */
-    dkCmdBufMakerDefaults(&cmdbuf_maker, g_dk_device);
-    ctx->cmdbuf = dkCmdBufCreate(&cmdbuf_maker);
-    assert(ctx->cmdbuf);
+    return NULL;
+}
 
-    /* Assing the backing storage buffer to the main command buffer */
-    dkCmdBufAddMemory(ctx->cmdbuf, ctx->cmdbuf_memblock, 0, ctx->params.vdmRingBufferMemSize);
+/* The scene is done once the fence gets signalled */
+static void scene_seq_submit(uint32_t seq, const DkFence *fence)
+{
+    PendingScene *pending;
 
-    /* Get the passed vertex ringbuffer for vertex default uniform buffer reservations */
-    ctx->vertex_rb.memblock = SceSysmem_get_dk_memblock_for_addr(params->vertexRingBufferMem);
-    assert(ctx->vertex_rb.memblock);
-    assert(params->vertexRingBufferMem == dkMemBlockGetCpuAddr(ctx->vertex_rb.memblock));
-    ctx->vertex_rb.size = params->vertexRingBufferMemSize;
+    mutexLock(&g_pending_scenes_lock);
+    pending = scene_seq_find(seq);
+    if (pending) {
+        pending->state = PENDING_SCENE_SUBMITTED;
+        pending->fence = *fence;
+    }
+    mutexUnlock(&g_pending_scenes_lock);
+}
 
-    /* Get the passed fragment ringbuffer for fragment default uniform buffer reservations */
-    ctx->fragment_rb.memblock = SceSysmem_get_dk_memblock_for_addr(params->fragmentRingBufferMem);
-    assert(ctx->fragment_rb.memblock);
-    assert(params->fragmentRingBufferMem == dkMemBlockGetCpuAddr(ctx->fragment_rb.memblock));
-    ctx->fragment_rb.size = params->fragmentRingBufferMemSize;
+/* Drops the scenes and transfers the GPU is done with, and returns the completed seq */
+static uint32_t scene_seq_poll(void)
+{
+    uint32_t completed, i;
 
-    ctx->gxm_vert_unif_block_memblock = dk_alloc_memblock(
-        g_dk_device, ALIGN(sizeof(struct GXMRenderVertUniformBlock), DK_UNIFORM_BUF_ALIGNMENT),
-        DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+    mutexLock(&g_pending_scenes_lock);
 
-    ctx->gxm_frag_unif_block_memblock = dk_alloc_memblock(
-        g_dk_device, ALIGN(sizeof(struct GXMRenderFragUniformBlock), DK_UNIFORM_BUF_ALIGNMENT),
-        DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+    for (i = 0; i < g_pending_scenes_count;) {
+        if (g_pending_scenes[i].state == PENDING_SCENE_SUBMITTED &&
+            dkFenceWait(&g_pending_scenes[i].fence, 0) == DkResult_Success)
+            g_pending_scenes[i] = g_pending_scenes[--g_pending_scenes_count];
+        else
+            i++;
+    }
 
-    ctx->fragment_tex_descriptor_set_memblock =
-        dk_alloc_memblock(g_dk_device,
-                          (sizeof(struct DkImageDescriptor) + sizeof(DkSamplerDescriptor)) *
-                              SCE_GXM_MAX_TEXTURE_UNITS,
-                          DkMemBlockFlags_GpuCached);
+    completed = __atomic_load_n(&g_scene_seq, __ATOMIC_RELAXED);
+    for (i = 0; i < g_pending_scenes_count; i++) {
+        if ((int32_t)(g_pending_scenes[i].seq - 1 - completed) < 0)
+            completed = g_pending_scenes[i].seq - 1;
+    }
+    __atomic_store_n(&g_completed_scene_seq, completed, __ATOMIC_RELEASE);
 
-    /* Init default state */
-    memset(&ctx->state, 0, sizeof(ctx->state));
+    mutexUnlock(&g_pending_scenes_lock);
 
-    dkRasterizerStateDefaults(&ctx->state.rasterizer);
-    ctx->state.rasterizer.cullMode = DkFace_None;
-    ctx->state.rasterizer.frontFace = DkFrontFace_CW;
+    return completed;
+}
 
-    dkColorStateDefaults(&ctx->state.color);
-    dkColorWriteStateDefaults(&ctx->state.color_write);
+/* Waits for the GPU to be done with the oldest submitted scene or transfer, if there is one */
+static bool scene_seq_wait_oldest(void)
+{
+    PendingScene *oldest = NULL;
+    DkFence fence;
 
-    ctx->state.depth_stencil.depthTestEnable = true;
-    ctx->state.depth_stencil.depthWriteEnable = true;
-    ctx->state.depth_stencil.stencilTestEnable = true;
-    ctx->state.depth_stencil.depthCompareOp = DkCompareOp_Lequal;
+    mutexLock(&g_pending_scenes_lock);
+    for (uint32_t i = 0; i < g_pending_scenes_count; i++) {
+        if (g_pending_scenes[i].state == PENDING_SCENE_SUBMITTED &&
+            (!oldest || (int32_t)(g_pending_scenes[i].seq - oldest->seq) < 0))
+            oldest = &g_pending_scenes[i];
+    }
+    if (oldest)
+        fence = oldest->fence;
+    mutexUnlock(&g_pending_scenes_lock);
 
-    ctx->state.depth_stencil.stencilFrontFailOp = DkStencilOp_Keep;
-    ctx->state.depth_stencil.stencilFrontPassOp = DkStencilOp_Keep;
-    ctx->state.depth_stencil.stencilFrontDepthFailOp = DkStencilOp_Keep;
-    ctx->state.depth_stencil.stencilFrontCompareOp = DkCompareOp_Always;
+    if (!oldest)
+        return false;
 
-    ctx->state.depth_stencil.stencilBackFailOp = DkStencilOp_Keep;
-    ctx->state.depth_stencil.stencilBackPassOp = DkStencilOp_Keep;
-    ctx->state.depth_stencil.stencilBackDepthFailOp = DkStencilOp_Keep;
-    ctx->state.depth_stencil.stencilBackCompareOp = DkCompareOp_Always;
+    dkFenceWait(&fence, -1);
+    return true;
+}
 
-    ctx->state.front_stencil.ref = 0;
-    ctx->state.front_stencil.compare_mask = 0;
-    ctx->state.front_stencil.write_mask = 0;
+/* Whichever of two sequence numbers was handed out last */
+static inline uint32_t scene_seq_latest(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) > 0 ? a : b;
+}
 
-    ctx->state.back_stencil.ref = 0;
-    ctx->state.back_stencil.compare_mask = 0;
-    ctx->state.back_stencil.write_mask = 0;
+/* Grows a dynamic array if needed, so that it can hold one more element */
+static void *array_grow(void *array, uint32_t count, uint32_t *capacity, size_t element_size)
+{
+    if (count < *capacity)
+        return array;
 
-    *context = ctx;
+    *capacity = MAX2(16, *capacity * 2);
+    array = realloc(array, *capacity * element_size);
+    assert(array);
 
-    return 0;
+    return array;
 }
 
-EXPORT(SceGxm, 0xEDDC5FB2, int, sceGxmDestroyContext, SceGxmContext *context)
+/* Must be called with g_retired_memblocks_lock held */
+static PinnedMemBlock *gpu_memblock_find_pinned(DkMemBlock memblock)
 {
-    dkQueueWaitIdle(g_render_queue);
-    dkMemBlockDestroy(context->gxm_vert_unif_block_memblock);
-    dkMemBlockDestroy(context->gxm_frag_unif_block_memblock);
-    dkMemBlockDestroy(context->fragment_tex_descriptor_set_memblock);
-    dkCmdBufDestroy(context->cmdbuf);
+    for (uint32_t i = 0; i < g_pinned_memblocks_count; i++) {
+        if (g_pinned_memblocks[i].memblock == memblock)
+            return &g_pinned_memblocks[i];
+    }
 
-    if (context->state.background_ds.memblock)
-        dkMemBlockDestroy(context->state.background_ds.memblock);
+    return NULL;
+}
 
-    return 0;
+/* Must be called with g_retired_memblocks_lock held */
+static void gpu_memblock_retire_locked(DkMemBlock memblock, uint32_t seq)
+{
+    g_retired_memblocks = array_grow(g_retired_memblocks, g_retired_memblocks_count,
+                                     &g_retired_memblocks_capacity, sizeof(*g_retired_memblocks));
+    g_retired_memblocks[g_retired_memblocks_count++] = (RetiredMemBlock){ memblock, seq };
 }
 
-EXPORT(SceGxm, 0x0733D8AE, void, sceGxmFinish, SceGxmContext *context)
+static void gpu_memblock_retire(DkMemBlock memblock, uint32_t seq)
 {
-    dkQueueWaitIdle(g_render_queue);
+    PinnedMemBlock *pinned;
+
+    mutexLock(&g_retired_memblocks_lock);
+    pinned = gpu_memblock_find_pinned(memblock);
+    if (pinned) {
+        pinned->retired = true;
+        pinned->last_use_seq = scene_seq_latest(pinned->last_use_seq, seq);
+    } else {
+        gpu_memblock_retire_locked(memblock, seq);
+    }
+    mutexUnlock(&g_retired_memblocks_lock);
 }
 
-EXPORT(SceGxm, 0x8BDE825A, volatile unsigned int *, sceGxmGetNotificationRegion, void)
+/* Keeps the memblock from being destroyed when it's retired, until it's unpinned */
+static void gpu_memblock_pin(DkMemBlock memblock, uint32_t seq)
 {
-    return dkMemBlockGetCpuAddr(g_notification_region_memblock);
+    PinnedMemBlock *pinned;
+
+    mutexLock(&g_retired_memblocks_lock);
+    pinned = gpu_memblock_find_pinned(memblock);
+    if (!pinned) {
+        g_pinned_memblocks =
+            array_grow(g_pinned_memblocks, g_pinned_memblocks_count,
+                       &g_pinned_memblocks_capacity, sizeof(*g_pinned_memblocks));
+        pinned = &g_pinned_memblocks[g_pinned_memblocks_count++];
+        *pinned = (PinnedMemBlock){ .memblock = memblock, .last_use_seq = seq };
+    }
+    pinned->pins++;
+    mutexUnlock(&g_retired_memblocks_lock);
 }
 
-EXPORT(SceGxm, 0x6A6013E1, int, sceGxmSyncObjectCreate, SceGxmSyncObject **syncObject)
+/* The memblock is destroyed once the scene with sequence number seq is done, if it was retired */
+static void gpu_memblock_unpin(DkMemBlock memblock, uint32_t seq)
 {
-    SceGxmSyncObject *sync_object;
+    PinnedMemBlock *pinned;
+
+    mutexLock(&g_retired_memblocks_lock);
+    pinned = gpu_memblock_find_pinned(memblock);
+    assert(pinned);
+    pinned->last_use_seq = scene_seq_latest(pinned->last_use_seq, seq);
+    if (--pinned->pins == 0) {
+        if (pinned->retired)
+            gpu_memblock_retire_locked(memblock, pinned->last_use_seq);
+        *pinned = g_pinned_memblocks[--g_pinned_memblocks_count];
+    }
+    mutexUnlock(&g_retired_memblocks_lock);
+}
 
-    sync_object = malloc(sizeof(*sync_object));
-    if (!sync_object)
-        return SCE_KERNEL_ERROR_NO_MEMORY;
+static CommandListResources *command_list_resources_create(uint32_t seq)
+{
+    CommandListResources *resources = calloc(1, sizeof(*resources));
 
-    memset(sync_object, 0, sizeof(*sync_object));
-    *syncObject = sync_object;
+    assert(resources);
+    resources->refs = 1;
+    resources->last_use_seq = seq;
 
-    return 0;
+    return resources;
 }
 
-EXPORT(SceGxm, 0x889AE88C, int, sceGxmSyncObjectDestroy, SceGxmSyncObject *syncObject)
+static void command_list_resources_pin_memblock(CommandListResources *resources,
+                                                DkMemBlock memblock)
 {
-    free(syncObject);
-    return 0;
+    resources->memblocks = array_grow(resources->memblocks, resources->memblock_count,
+                                      &resources->memblock_capacity, sizeof(DkMemBlock));
+    resources->memblocks[resources->memblock_count++] = memblock;
+    gpu_memblock_pin(memblock, __atomic_load_n(&resources->last_use_seq, __ATOMIC_RELAXED));
 }
 
-EXPORT(SceGxm, 0x9F448E79, int, sceGxmNotificationWait, const SceGxmNotification *notification)
+/* Must be called with g_descriptor_pool_lock held */
+static void command_list_resources_pin_descriptor(CommandListResources *resources,
+                                                  DescriptorPool *pool, uint32_t index)
 {
-    DkVariable variable;
-    uint32_t offset =
-        dk_memblock_cpu_addr_offset(g_notification_region_memblock, (void *)notification->address);
-    assert(offset < SCE_GXM_NOTIFICATION_COUNT * sizeof(uint32_t));
-
-    dkVariableInitialize(&variable, g_notification_region_memblock, offset);
-
-    while (dkVariableRead(&variable) != notification->value)
-        dkQueueWaitIdle(g_render_queue);
-
-    return 0;
+    DescriptorPoolSlot *slot = &pool->slots[index];
+
+    if (slot->pins && slot->pinned_seq == resources->last_use_seq)
+        return;
+
+    resources->descriptors =
+        array_grow(resources->descriptors, resources->descriptor_count,
+                   &resources->descriptor_capacity, sizeof(PinnedDescriptor));
+    resources->descriptors[resources->descriptor_count++] =
+        (PinnedDescriptor){ .pool = pool, .index = index };
+    slot->pins++;
+    slot->pinned_seq = resources->last_use_seq;
 }
 
-EXPORT(SceGxm, 0x05032658, int, sceGxmShaderPatcherCreate, const SceGxmShaderPatcherParams *params,
-       SceGxmShaderPatcher **shaderPatcher)
+/* Drops a reference: the last one unpins the resources, once the last scene using them is done */
+static void command_list_resources_release(CommandListResources *resources)
 {
-    SceGxmShaderPatcher *shader_patcher;
+    uint32_t seq;
 
-    shader_patcher = malloc(sizeof(*shader_patcher));
-    if (!shader_patcher)
-        return SCE_KERNEL_ERROR_NO_MEMORY;
+    if (__atomic_sub_fetch(&resources->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
 
-    memset(shader_patcher, 0, sizeof(*shader_patcher));
-    shader_patcher->params = *params;
-    *shaderPatcher = shader_patcher;
+    seq = __atomic_load_n(&resources->last_use_seq, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < resources->memblock_count; i++)
+        gpu_memblock_unpin(resources->memblocks[i], seq);
 
-    return 0;
+    mutexLock(&g_descriptor_pool_lock);
+    for (uint32_t i = 0; i < resources->descriptor_count; i++) {
+        const PinnedDescriptor *pinned = &resources->descriptors[i];
+        DescriptorPoolSlot *slot = &pinned->pool->slots[pinned->index];
+
+        slot->pins--;
+        slot->last_use_seq = scene_seq_latest(slot->last_use_seq, seq);
+    }
+    mutexUnlock(&g_descriptor_pool_lock);
+
+    free(resources->memblocks);
+    free(resources->descriptors);
+    free(resources);
 }
 
-EXPORT(SceGxm, 0xEAA5B100, int, sceGxmShaderPatcherDestroy, SceGxmShaderPatcher *shaderPatcher)
+/*
+ * Keeps a memblock the command list being recorded uses from being destroyed while the list can be
+ * executed. pinned_seq avoids pinning cached ones for every draw.
+ */
+static void context_pin_memblock(SceGxmContext *context, DkMemBlock memblock,
+                                 uint32_t *pinned_seq)
 {
-    free(shaderPatcher->registered_programs);
-    free(shaderPatcher);
-    return 0;
+    if (!context->deferred || (pinned_seq && *pinned_seq == context->scene_seq))
+        return;
+
+    command_list_resources_pin_memblock(context->list_resources, memblock);
+    if (pinned_seq)
+        *pinned_seq = context->scene_seq;
 }
 
-EXPORT(SceGxm, 0x2B528462, int, sceGxmShaderPatcherRegisterProgram,
-       SceGxmShaderPatcher *shaderPatcher, const SceGxmProgram *programHeader,
-       SceGxmShaderPatcherId *programId)
+/*
+ * Bumping the memblock generation as soon as the write is recorded would let the texture caches
+ * check the memory before the GPU writes it, and keep their stale copy afterwards.
+ */
+static void gpu_write_record(const void *addr, uint32_t seq)
 {
-    SceGxmRegisteredProgram *shader_patcher_id;
+    PendingWrite *pending;
+
+    mutexLock(&g_pending_writes_lock);
+    if (g_pending_writes_count == g_pending_writes_capacity) {
+        g_pending_writes_capacity = MAX2(16, g_pending_writes_capacity * 2);
+        pending =
+            realloc(g_pending_writes, g_pending_writes_capacity * sizeof(*g_pending_writes));
+        assert(pending);
+        g_pending_writes = pending;
+    }
+    g_pending_writes[g_pending_writes_count++] = (PendingWrite){ addr, seq };
+    mutexUnlock(&g_pending_writes_lock);
+}
+
+static void gpu_memblocks_collect(void)
+{
+    const uint32_t completed = scene_seq_poll();
+    uint32_t i = 0;
+
+    mutexLock(&g_retired_memblocks_lock);
+    while (i < g_retired_memblocks_count) {
+        if ((int32_t)(g_retired_memblocks[i].seq - completed) <= 0) {
+            dkMemBlockDestroy(g_retired_memblocks[i].memblock);
+            g_retired_memblocks[i] = g_retired_memblocks[--g_retired_memblocks_count];
+        } else {
+            i++;
+        }
+    }
+    mutexUnlock(&g_retired_memblocks_lock);
+
+    mutexLock(&g_pending_writes_lock);
+    i = 0;
+    while (i < g_pending_writes_count) {
+        if ((int32_t)(g_pending_writes[i].seq - completed) <= 0) {
+            SceSysmem_mark_written(g_pending_writes[i].addr);
+            g_pending_writes[i] = g_pending_writes[--g_pending_writes_count];
+        } else {
+            i++;
+        }
+    }
+    mutexUnlock(&g_pending_writes_lock);
+}
+
+#define CONTEXT_STATE_RANGE(first, last)                                                          \
+    {                                                                                              \
+        offsetof(SceGxmContextState, first),                                                       \
+            offsetof(SceGxmContextState, last) + MEMBER_SIZE(SceGxmContextState, last) -           \
+                offsetof(SceGxmContextState, first)                                                \
+    }
+
+/* What the translator thread reads of each group, the game thread keeps the rest to itself */
+static const struct {
+    uint16_t offset;
+    uint16_t size;
+} g_dispatch_state_ranges[DISPATCH_STATE_FRAGMENT_TEXTURE0] = {
+    [DISPATCH_STATE_PROGRAMS] = CONTEXT_STATE_RANGE(vertex_program, fragment_program),
+    [DISPATCH_STATE_SCENE] = CONTEXT_STATE_RANGE(render_target, fragment_sync_object),
+    [DISPATCH_STATE_FIXED_FUNCTION] = CONTEXT_STATE_RANGE(rasterizer, back_stencil),
+    [DISPATCH_STATE_VERTEX_STREAMS] = CONTEXT_STATE_RANGE(vertex_streams, vertex_streams),
+    [DISPATCH_STATE_DEFAULT_UNIFORMS] =
+        CONTEXT_STATE_RANGE(vertex_default_uniform, fragment_default_uniform),
+    [DISPATCH_STATE_VISIBILITY] = CONTEXT_STATE_RANGE(visibility_buffer, back_visibility),
+};
+
+static DispatchCmd *dispatch_cmd_reserve(SceGxmContext *context)
+{
+    DispatchControlBlock *dispatch = context->dispatch;
+    uint64_t start;
+
+    /* Throttle down if the translator thread is too far behind */
+    if (CIRC_SPACE(dispatch->head, __atomic_load_n(&dispatch->tail, __ATOMIC_ACQUIRE),
+                   DISPATCH_RING_NUM_ENTRIES) == 0) {
+        start = armTicksToNs(armGetSystemTick());
+        while (CIRC_SPACE(dispatch->head, __atomic_load_n(&dispatch->tail, __ATOMIC_ACQUIRE),
+                          DISPATCH_RING_NUM_ENTRIES) == 0) {
+            waitSingle(waiterForUEvent(&dispatch->ready_evflag), -1);
+        }
+        FRAME_STATS_ADD(dispatch_wait_ns, armTicksToNs(armGetSystemTick()) - start);
+    }
+
+    return &dispatch->cmds[dispatch->head];
+}
+
+static void dispatch_cmd_submit(SceGxmContext *context);
+
+/*
+ * Sends the parts of the state changed since the last command ahead of it, in chunks: most draws
+ * only change a few of them, so this is much less to copy than the whole state.
+ */
+static void dispatch_send_state(SceGxmContext *context, DispatchCmdType type)
+{
+    uint32_t groups = context->dispatch_state_dirty;
+    uint32_t group, offset, size, chunk_size;
+    DispatchCmd *cmd;
+
+    if (context->state.dirty.bit.vertex_shader || context->state.dirty.bit.fragment_shader)
+        groups |= 1u << DISPATCH_STATE_PROGRAMS;
+    if (type == DISPATCH_CMD_BEGIN_SCENE)
+        groups |= 1u << DISPATCH_STATE_SCENE;
+    if (context->state.dirty.bit.depth_stencil || context->state.dirty.bit.front_stencil ||
+        context->state.dirty.bit.back_stencil || context->state.dirty.bit.color_write)
+        groups |= 1u << DISPATCH_STATE_FIXED_FUNCTION;
+    if (context->state.vertex_streams_dirty_mask)
+        groups |= 1u << DISPATCH_STATE_VERTEX_STREAMS;
+    if (context->state.dirty.bit.vertex_default_uniform ||
+        context->state.dirty.bit.fragment_default_uniform)
+        groups |= 1u << DISPATCH_STATE_DEFAULT_UNIFORMS;
+
+    while (groups) {
+        group = __builtin_ctz(groups);
+        groups &= groups - 1;
+
+        if (group >= DISPATCH_STATE_FRAGMENT_TEXTURE0) {
+            offset = offsetof(SceGxmContextState, fragment_textures) +
+                     (group - DISPATCH_STATE_FRAGMENT_TEXTURE0) * sizeof(SceGxmTextureInner);
+            size = sizeof(SceGxmTextureInner);
+        } else {
+            offset = g_dispatch_state_ranges[group].offset;
+            size = g_dispatch_state_ranges[group].size;
+        }
+
+        for (; size > 0; offset += chunk_size, size -= chunk_size) {
+            chunk_size = MIN2(size, DISPATCH_STATE_CHUNK_SIZE);
+            cmd = dispatch_cmd_reserve(context);
+            cmd->type = DISPATCH_CMD_SET_STATE;
+            cmd->args.set_state.offset = offset;
+            cmd->args.set_state.size = chunk_size;
+            memcpy(cmd->args.set_state.data, (const char *)&context->state + offset, chunk_size);
+            dispatch_cmd_submit(context);
+        }
+    }
+
+    context->dispatch_state_dirty = 0;
+}
+
+static DispatchCmd *dispatch_cmd_alloc(SceGxmContext *context, DispatchCmdType type)
+{
+    DispatchCmd *cmd;
+
+    dispatch_send_state(context, type);
+
+    cmd = dispatch_cmd_reserve(context);
+    cmd->type = type;
+    cmd->dirty = context->state.dirty.raw;
+    cmd->vertex_streams_dirty_mask = context->state.vertex_streams_dirty_mask;
+    cmd->scene_draw_count = context->state.scene_draw_count;
+
+    return cmd;
+}
+
+static void dispatch_cmd_submit(SceGxmContext *context)
+{
+    DispatchControlBlock *dispatch = context->dispatch;
+
+    __atomic_store_n(&dispatch->head, (dispatch->head + 1) & (DISPATCH_RING_NUM_ENTRIES - 1),
+                     __ATOMIC_RELEASE);
+    ueventSignal(&dispatch->pending_evflag);
+    FRAME_STATS_ADD(dispatch_cmds, 1);
+}
+
+/* Waits until the translator thread has recorded and submitted all the pending commands */
+static void dispatch_sync(SceGxmContext *context)
+{
+    DispatchControlBlock *dispatch = context->dispatch;
+    uint64_t start = armTicksToNs(armGetSystemTick());
+
+    while (CIRC_CNT(__atomic_load_n(&dispatch->head, __ATOMIC_RELAXED),
+                    __atomic_load_n(&dispatch->tail, __ATOMIC_ACQUIRE),
+                    DISPATCH_RING_NUM_ENTRIES) > 0) {
+        waitSingle(waiterForUEvent(&dispatch->ready_evflag), -1);
+    }
+
+    FRAME_STATS_ADD(dispatch_wait_ns, armTicksToNs(armGetSystemTick()) - start);
+}
+
+#if THREADED_DISPATCH
+static void dispatch_create(SceGxmContext *context)
+{
+    DispatchControlBlock *dispatch;
+
+    dispatch = malloc(sizeof(*dispatch));
+    assert(dispatch);
+    memset(dispatch, 0, sizeof(*dispatch));
+
+    dispatch->thid = sceKernelCreateThread("SceGxmDispatch", SceGxmDispatch_thread, 64, 0x4000, 0,
+                                           0, NULL);
+    assert(dispatch->thid > 0);
+
+    ueventCreate(&dispatch->ready_evflag, true);
+    ueventCreate(&dispatch->pending_evflag, true);
+
+    /* From now on, the command buffers are only touched by the translator thread */
+    context->dispatch = dispatch;
+    dispatch->context = *context;
+    g_dispatch_context = context;
+
+    sceKernelStartThread(dispatch->thid, sizeof(dispatch), &dispatch);
+}
+
+static void dispatch_destroy(SceGxmContext *context)
+{
+    DispatchControlBlock *dispatch = context->dispatch;
+
+    __atomic_store_n(&dispatch->exit_thread, 1, __ATOMIC_RELAXED);
+    ueventSignal(&dispatch->pending_evflag);
+    sceKernelWaitThreadEnd(dispatch->thid, NULL, NULL);
+
+    g_dispatch_context = NULL;
+    context->dispatch = NULL;
+    free(dispatch);
+}
+#endif
+
+static void context_init(SceGxmContext *ctx)
+{
+    /* Init default state */
+    memset(&ctx->state, 0, sizeof(ctx->state));
+
+    dkRasterizerStateDefaults(&ctx->state.rasterizer);
+    ctx->state.rasterizer.cullMode = DkFace_None;
+    ctx->state.rasterizer.frontFace = DkFrontFace_CW;
+
+    dkColorStateDefaults(&ctx->state.color);
+    dkColorWriteStateDefaults(&ctx->state.color_write);
+
+    ctx->state.depth_stencil.depthTestEnable = true;
+    ctx->state.depth_stencil.depthWriteEnable = true;
+    ctx->state.depth_stencil.stencilTestEnable = true;
+    ctx->state.depth_stencil.depthCompareOp = DkCompareOp_Lequal;
+
+    ctx->state.depth_stencil.stencilFrontFailOp = DkStencilOp_Keep;
+    ctx->state.depth_stencil.stencilFrontPassOp = DkStencilOp_Keep;
+    ctx->state.depth_stencil.stencilFrontDepthFailOp = DkStencilOp_Keep;
+    ctx->state.depth_stencil.stencilFrontCompareOp = DkCompareOp_Always;
+
+    ctx->state.depth_stencil.stencilBackFailOp = DkStencilOp_Keep;
+    ctx->state.depth_stencil.stencilBackPassOp = DkStencilOp_Keep;
+    ctx->state.depth_stencil.stencilBackDepthFailOp = DkStencilOp_Keep;
+    ctx->state.depth_stencil.stencilBackCompareOp = DkCompareOp_Always;
+
+    ctx->state.front_stencil.ref = 0;
+    ctx->state.front_stencil.compare_mask = 0;
+    ctx->state.front_stencil.write_mask = 0;
+
+    ctx->state.back_stencil.ref = 0;
+    ctx->state.back_stencil.compare_mask = 0;
+    ctx->state.back_stencil.write_mask = 0;
+}
+
+static void scene_cmdbuf_add_mem(void *user_data, DkCmdBuf cmdbuf, size_t min_req_size)
+{
+    SceGxmContext *context = user_data;
+    SceGxmContext *recording_context = context->dispatch ? &context->dispatch->context : context;
+    SceneCmdBuf *scene_cmdbuf =
+        &recording_context->scene_cmdbufs[recording_context->scene_cmdbuf_index];
+    const uint32_t size =
+        ALIGN(MAX2(min_req_size, scene_cmdbuf->mem_size), DK_MEMBLOCK_ALIGNMENT);
+    DkMemBlock memblock;
+
+    /*
+     * The scene doesn't fit in the VDM ring buffer: keep recording into a temporary memblock, freed
+     * once the scene completes. The next BeginScene goes back to the command buffer's own memory.
+     */
+    memblock = dk_alloc_memblock(g_dk_device, size,
+                                 DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+    assert(memblock);
+    dkCmdBufAddMemory(cmdbuf, memblock, 0, size);
+    gpu_memblock_retire(memblock, recording_context->scene_seq);
+    scene_cmdbuf->grown = true;
+}
+
+EXPORT(SceGxm, 0xE84CE5B4, int, sceGxmCreateContext, const SceGxmContextParams *params,
+       SceGxmContext **context)
+{
+    DkCmdBufMaker cmdbuf_maker;
+#if QUEUE_PER_CONTEXT
+    DkQueueMaker queue_maker;
+#endif
+    uint32_t cmdbuf_mem_size;
+    SceGxmContext *ctx = params->hostMem;
+
+    if (params->hostMemSize < sizeof(SceGxmContext))
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->params = *params;
+
+#if QUEUE_PER_CONTEXT
+    /* Give each context its own queue, so rendering threads don't serialize on each other */
+    dkQueueMakerDefaults(&queue_maker, g_dk_device);
+    queue_maker.flags = DkQueueFlags_Graphics;
+    ctx->queue = dkQueueCreate(&queue_maker);
+#else
+    ctx->queue = g_render_queue;
+#endif
+
+    /* Get the passed backing storage buffer for the scene command buffers */
+    ctx->cmdbuf_memblock = SceSysmem_get_dk_memblock_for_addr(params->vdmRingBufferMem);
+    assert(ctx->cmdbuf_memblock);
+
+    /*
+     * The first scene command buffer records into the whole ring buffer, the others into memory of
+     * the same size allocated here, so that a scene can be recorded while the previous one runs
+     */
+    cmdbuf_mem_size = ctx->params.vdmRingBufferMemSize & ~(DK_CMDMEM_ALIGNMENT - 1);
+    ctx->extra_cmdbuf_memblock =
+        dk_alloc_memblock(g_dk_device, (SCENE_CMDBUF_COUNT - 1) * cmdbuf_mem_size,
+                          DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+    assert(ctx->extra_cmdbuf_memblock);
+
+    dkCmdBufMakerDefaults(&cmdbuf_maker, g_dk_device);
+    cmdbuf_maker.userData = ctx;
+    cmdbuf_maker.cbAddMem = scene_cmdbuf_add_mem;
+    for (uint32_t i = 0; i < SCENE_CMDBUF_COUNT; i++) {
+        SceneCmdBuf *scene_cmdbuf = &ctx->scene_cmdbufs[i];
+
+        scene_cmdbuf->cmdbuf = dkCmdBufCreate(&cmdbuf_maker);
+        assert(scene_cmdbuf->cmdbuf);
+        scene_cmdbuf->memblock = i == 0 ? ctx->cmdbuf_memblock : ctx->extra_cmdbuf_memblock;
+        scene_cmdbuf->mem_offset = i == 0 ? 0 : (i - 1) * cmdbuf_mem_size;
+        scene_cmdbuf->mem_size = cmdbuf_mem_size;
+        dkCmdBufAddMemory(scene_cmdbuf->cmdbuf, scene_cmdbuf->memblock, scene_cmdbuf->mem_offset,
+                          scene_cmdbuf->mem_size);
+    }
+    ctx->cmdbuf = ctx->scene_cmdbufs[0].cmdbuf;
+
+    /* Get the passed vertex ringbuffer for vertex default uniform buffer reservations */
+    ctx->vertex_rb.memblock = SceSysmem_get_dk_memblock_for_addr(params->vertexRingBufferMem);
+    assert(ctx->vertex_rb.memblock);
+    assert(params->vertexRingBufferMem == dkMemBlockGetCpuAddr(ctx->vertex_rb.memblock));
+    ctx->vertex_rb.size = params->vertexRingBufferMemSize;
+
+    /* Get the passed fragment ringbuffer for fragment default uniform buffer reservations */
+    ctx->fragment_rb.memblock = SceSysmem_get_dk_memblock_for_addr(params->fragmentRingBufferMem);
+    assert(ctx->fragment_rb.memblock);
+    assert(params->fragmentRingBufferMem == dkMemBlockGetCpuAddr(ctx->fragment_rb.memblock));
+    ctx->fragment_rb.size = params->fragmentRingBufferMemSize;
+
+    /* Only written by the GPU, through dkCmdBufPushConstants */
+    ctx->gxm_vert_unif_block_memblock = dk_alloc_memblock(
+        g_dk_device, ALIGN(sizeof(struct GXMRenderVertUniformBlock), DK_UNIFORM_BUF_ALIGNMENT),
+        DkMemBlockFlags_GpuCached);
+
+    ctx->gxm_frag_unif_block_memblock = dk_alloc_memblock(
+        g_dk_device, ALIGN(sizeof(struct GXMRenderFragUniformBlock), DK_UNIFORM_BUF_ALIGNMENT),
+        DkMemBlockFlags_GpuCached);
+
+    /* Read back by the resolve shader only, so it can live in uncached memory */
+    ctx->visibility_memblock = dk_alloc_memblock(
+        g_dk_device, SCENE_CMDBUF_COUNT * VISIBILITY_MAX_RUNS * sizeof(VisibilityRun),
+        DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+
+    /* 64-bit counter followed by a timestamp, for the beginning and the end of each scene */
+    ctx->timestamp_memblock = dk_alloc_memblock(
+        g_dk_device, SCENE_CMDBUF_COUNT * 2 * 2 * sizeof(uint64_t), DkMemBlockFlags_CpuUncached);
+
+    context_init(ctx);
+#if THREADED_DISPATCH
+    dispatch_create(ctx);
+#endif
+    *context = ctx;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xEDDC5FB2, int, sceGxmDestroyContext, SceGxmContext *context)
+{
+    sceGxmFinish(context);
+#if THREADED_DISPATCH
+    dispatch_destroy(context);
+#endif
+    dkMemBlockDestroy(context->gxm_vert_unif_block_memblock);
+    dkMemBlockDestroy(context->gxm_frag_unif_block_memblock);
+    dkMemBlockDestroy(context->visibility_memblock);
+    dkMemBlockDestroy(context->timestamp_memblock);
+    for (uint32_t i = 0; i < SCENE_CMDBUF_COUNT; i++)
+        dkCmdBufDestroy(context->scene_cmdbufs[i].cmdbuf);
+    dkMemBlockDestroy(context->extra_cmdbuf_memblock);
+#if QUEUE_PER_CONTEXT
+    dkQueueDestroy(context->queue);
+#endif
+
+    if (context->state.background_ds.memblock)
+        dkMemBlockDestroy(context->state.background_ds.memblock);
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x0733D8AE, void, sceGxmFinish, SceGxmContext *context)
+{
+    SceGxmContext *recording_context = context;
+    SceneCmdBuf *scene_cmdbuf;
+
+    /* Make sure all the scenes have been submitted: the translator thread owns the cmdbufs */
+    if (context->dispatch) {
+        dispatch_sync(context);
+        recording_context = &context->dispatch->context;
+    }
+
+    /* Scenes of a context complete in order: waiting for the last one is enough */
+    scene_cmdbuf = &recording_context->scene_cmdbufs[recording_context->scene_cmdbuf_index];
+    if (scene_cmdbuf->submitted)
+        dkFenceWait(&scene_cmdbuf->fence, -1);
+}
+
+static void deferred_context_cmdbuf_add_mem(void *user_data, DkCmdBuf cmdbuf, size_t min_req_size)
+{
+    SceGxmContext *context = user_data;
+    const uint32_t aligned_req_size = ALIGN(min_req_size, DK_CMDMEM_ALIGNMENT);
+    uint32_t offset, padding, size = 0;
+    DkMemBlock memblock, *fallbacks;
+    void *mem;
+
+    /*
+     * Command list memory is owned by the application, and it's handed out by the VDM callback.
+     * Ask for enough to be able to align the start of what it returns.
+     */
+    mem = context->deferred_params.vdmCallback(context->deferred_params.userData,
+                                               aligned_req_size + DK_CMDMEM_ALIGNMENT, &size);
+    memblock = mem ? SceSysmem_get_dk_memblock_for_addr(mem) : NULL;
+    if (memblock) {
+        offset = dk_memblock_cpu_addr_offset(memblock, mem);
+        padding = ALIGN(offset, DK_CMDMEM_ALIGNMENT) - offset;
+        if (size >= padding + aligned_req_size) {
+            dkCmdBufAddMemory(cmdbuf, memblock, offset + padding,
+                              (size - padding) & ~(DK_CMDMEM_ALIGNMENT - 1));
+            return;
+        }
+    }
+
+    LOG("Deferred context VDM callback failed to provide %zu bytes", min_req_size);
+
+    /*
+     * deko3d can't go on without memory: record into our own, and have the call that needed it
+     * return SCE_GXM_ERROR_RESERVE_FAILED. It's freed along with the context.
+     */
+    size = ALIGN(aligned_req_size, DK_MEMBLOCK_ALIGNMENT);
+    memblock = dk_alloc_memblock(g_dk_device, size,
+                                 DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+    assert(memblock);
+    fallbacks = realloc(context->fallback_cmdbuf_memblocks,
+                        (context->fallback_cmdbuf_memblock_count + 1) * sizeof(*fallbacks));
+    assert(fallbacks);
+    fallbacks[context->fallback_cmdbuf_memblock_count++] = memblock;
+    context->fallback_cmdbuf_memblocks = fallbacks;
+    context->cmdbuf_reserve_failures++;
+
+    dkCmdBufAddMemory(cmdbuf, memblock, 0, size);
+}
+
+EXPORT(SceGxm, 0x64AEED1E, int, sceGxmCreateDeferredContext,
+       const SceGxmDeferredContextParams *params, SceGxmContext **deferredContext)
+{
+    DkCmdBufMaker cmdbuf_maker;
+    SceGxmContext *ctx;
+
+    if (!params || !deferredContext)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+    else if (!params->vdmCallback || !params->vertexCallback || !params->fragmentCallback)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+    else if (params->hostMemSize < SCE_GXM_MINIMUM_DEFERRED_CONTEXT_HOST_MEM_SIZE)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    /* The passed host memory is too small for our context: the handle is opaque anyway */
+    ctx = malloc(sizeof(*ctx));
+    if (!ctx)
+        return SCE_GXM_ERROR_OUT_OF_MEMORY;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->deferred = true;
+    ctx->deferred_params = *params;
+    ctx->queue = g_render_queue;
+
+    /* Command lists are never cleared: memory keeps being requested from the VDM callback */
+    dkCmdBufMakerDefaults(&cmdbuf_maker, g_dk_device);
+    cmdbuf_maker.userData = ctx;
+    cmdbuf_maker.cbAddMem = deferred_context_cmdbuf_add_mem;
+    ctx->cmdbuf = dkCmdBufCreate(&cmdbuf_maker);
+    assert(ctx->cmdbuf);
+
+    context_init(ctx);
+    *deferredContext = ctx;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xD6A2FF2F, int, sceGxmDestroyDeferredContext, SceGxmContext *deferredContext)
+{
+    if (!deferredContext)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+    else if (!deferredContext->deferred)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    /* A list left unfinished never gets executed */
+    if (deferredContext->state.in_scene)
+        command_list_resources_release(deferredContext->list_resources);
+
+    /* Any of the lists recorded since they were allocated may use them */
+    for (uint32_t i = 0; i < deferredContext->fallback_cmdbuf_memblock_count; i++) {
+        for (uint32_t j = 0; j < deferredContext->ended_list_count; j++)
+            command_list_resources_pin_memblock(deferredContext->ended_lists[j],
+                                                deferredContext->fallback_cmdbuf_memblocks[i]);
+        gpu_memblock_retire(deferredContext->fallback_cmdbuf_memblocks[i],
+                            __atomic_load_n(&g_scene_seq, __ATOMIC_RELAXED));
+    }
+    free(deferredContext->fallback_cmdbuf_memblocks);
+
+    /* Lists can't be executed anymore once their deferred context is gone */
+    for (uint32_t i = 0; i < deferredContext->ended_list_count; i++)
+        command_list_resources_release(deferredContext->ended_lists[i]);
+    free(deferredContext->ended_lists);
+
+    dkCmdBufDestroy(deferredContext->cmdbuf);
+    free(deferredContext);
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x8BDE825A, volatile unsigned int *, sceGxmGetNotificationRegion, void)
+{
+    return dkMemBlockGetCpuAddr(g_notification_region_memblock);
+}
+
+EXPORT(SceGxm, 0x6A6013E1, int, sceGxmSyncObjectCreate, SceGxmSyncObject **syncObject)
+{
+    SceGxmSyncObject *sync_object;
+
+    sync_object = malloc(sizeof(*sync_object));
+    if (!sync_object)
+        return SCE_KERNEL_ERROR_NO_MEMORY;
+
+    memset(sync_object, 0, sizeof(*sync_object));
+    *syncObject = sync_object;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x889AE88C, int, sceGxmSyncObjectDestroy, SceGxmSyncObject *syncObject)
+{
+    free(syncObject);
+    return 0;
+}
+
+static uint32_t notification_get_index(const SceGxmNotification *notification)
+{
+    uint32_t offset =
+        dk_memblock_cpu_addr_offset(g_notification_region_memblock, (void *)notification->address);
+    assert(offset < SCE_GXM_NOTIFICATION_COUNT * sizeof(uint32_t));
+
+    return offset / sizeof(uint32_t);
+}
+
+static void notification_record_fence(DkQueue queue, const SceGxmNotification *notification)
+{
+    NotificationFence *entry = &g_notification_fences[notification_get_index(notification)];
+
+    mutexLock(&g_notification_fences_lock);
+    dkQueueSignalFence(queue, &entry->fence, false);
+    entry->value = notification->value;
+    entry->serial++;
+    entry->valid = true;
+    mutexUnlock(&g_notification_fences_lock);
+}
+
+int SceGxm_notification_wait_timeout(const SceGxmNotification *notification, int64_t timeout_ns)
+{
+    NotificationFence *entry;
+    DkVariable variable;
+    DkFence fence;
+    bool has_fence;
+    bool waited = false;
+    uint32_t waited_serial = 0;
+    uint64_t elapsed_ns;
+    int ret = 0;
+    const uint64_t start = armGetSystemTick();
+    const uint32_t index = notification_get_index(notification);
+
+    dkVariableInitialize(&variable, g_notification_region_memblock, index * sizeof(uint32_t));
+
+    FRAME_STATS_ADD(notification_waits, 1);
+
+    /* Fast path: the GPU already wrote the value */
+    if (dkVariableRead(&variable) == notification->value) {
+        FRAME_STATS_ADD(notification_waits_signalled, 1);
+        return 0;
+    }
+
+    entry = &g_notification_fences[index];
+
+    while (dkVariableRead(&variable) != notification->value) {
+        elapsed_ns = armTicksToNs(armGetSystemTick() - start);
+        if (timeout_ns >= 0 && elapsed_ns >= (uint64_t)timeout_ns) {
+            ret = SCE_KERNEL_ERROR_WAIT_TIMEOUT;
+            break;
+        }
+
+        /*
+         * The fence might be the one of an earlier scene setting the same value, which has been
+         * overwritten since: only wait on each fence once, and check the value again.
+         */
+        mutexLock(&g_notification_fences_lock);
+        has_fence = entry->valid && entry->value == notification->value &&
+                    (!waited || entry->serial != waited_serial);
+        if (has_fence) {
+            fence = entry->fence;
+            waited_serial = entry->serial;
+            waited = true;
+        }
+        mutexUnlock(&g_notification_fences_lock);
+
+        /* Block only on the fence of the scene producing the value */
+        if (has_fence) {
+            dkFenceWait(&fence, timeout_ns >= 0 ? timeout_ns - (int64_t)elapsed_ns : -1);
+            continue;
+        }
+
+        /* The scene producing the value hasn't been submitted yet */
+        svcSleepThread(100000ull);
+    }
+
+    FRAME_STATS_ADD(notification_wait_ns, armTicksToNs(armGetSystemTick() - start));
+
+    return ret;
+}
+
+EXPORT(SceGxm, 0x9F448E79, int, sceGxmNotificationWait, const SceGxmNotification *notification)
+{
+    return SceGxm_notification_wait_timeout(notification, -1);
+}
+
+/* The timestamps are in GPU ticks, which run at 614.4 MHz */
+static inline uint64_t gpu_ticks_to_ns(uint64_t ticks)
+{
+    return ticks * 625 / 384;
+}
+
+static bool transfer_get_last_fence(DkFence *fence)
+{
+    const SceneCmdBuf *transfer_cmdbuf;
+    bool valid;
+
+    mutexLock(&g_transfer_lock);
+    transfer_cmdbuf = &g_transfer_cmdbufs[g_transfer_cmdbuf_index];
+    valid = transfer_cmdbuf->submitted;
+    if (valid)
+        *fence = transfer_cmdbuf->fence;
+    mutexUnlock(&g_transfer_lock);
+
+    return valid;
+}
+
+/* Reports the GPU timestamp at the beginning (0) or the end (1) of the current transfer */
+static void transfer_report_timestamp(DkCmdBuf cmdbuf, uint32_t index)
+{
+    const uint32_t offset = (g_transfer_cmdbuf_index * 2 + index) * 2 * sizeof(uint64_t);
+
+    dkCmdBufReportCounter(cmdbuf, DkCounter_Timestamp,
+                          dkMemBlockGetGpuAddr(g_transfer_timestamp_memblock) + offset);
+}
+
+/* Accounts the GPU time of the last transfer of the current command buffer, once it's done */
+static void transfer_account_gpu_time(void)
+{
+    const uint64_t *reports =
+        (const uint64_t *)dkMemBlockGetCpuAddr(g_transfer_timestamp_memblock) +
+        g_transfer_cmdbuf_index * 4;
+
+    FRAME_STATS_ADD(transfer_gpu_ns, gpu_ticks_to_ns(reports[3] - reports[1]));
+}
+
+/* Returns the command buffer to record the transfer into, with g_transfer_lock held */
+static DkCmdBuf transfer_begin(SceGxmSyncObject *sync_object, uint32_t sync_flags)
+{
+    SceneCmdBuf *transfer_cmdbuf;
+
+    /* The translator thread might not have submitted the scenes to wait for yet */
+    if ((sync_flags & (SCE_GXM_TRANSFER_FRAGMENT_SYNC | SCE_GXM_TRANSFER_VERTEX_SYNC)) &&
+        g_dispatch_context)
+        dispatch_sync(g_dispatch_context);
+
+    mutexLock(&g_transfer_lock);
+
+    /* Switch to the next transfer command buffer, waiting for the GPU to be done with it */
+    g_transfer_cmdbuf_index = (g_transfer_cmdbuf_index + 1) % TRANSFER_CMDBUF_COUNT;
+    transfer_cmdbuf = &g_transfer_cmdbufs[g_transfer_cmdbuf_index];
+    if (transfer_cmdbuf->submitted) {
+        dkFenceWait(&transfer_cmdbuf->fence, -1);
+        transfer_account_gpu_time();
+    }
+    dkCmdBufClear(transfer_cmdbuf->cmdbuf);
+
+    if (sync_object)
+        dkCmdBufWaitFence(transfer_cmdbuf->cmdbuf, &sync_object->fence);
+
+    if ((sync_flags & (SCE_GXM_TRANSFER_FRAGMENT_SYNC | SCE_GXM_TRANSFER_VERTEX_SYNC)) &&
+        g_last_scene_fence_valid)
+        dkCmdBufWaitFence(transfer_cmdbuf->cmdbuf, &g_last_scene_fence);
+
+    /* Only time the transfer itself, not the waits */
+    transfer_report_timestamp(transfer_cmdbuf->cmdbuf, 0);
+
+    return transfer_cmdbuf->cmdbuf;
+}
+
+static void transfer_end(SceGxmSyncObject *sync_object, const SceGxmNotification *notification,
+                         const void *dest_address, uint32_t size)
+{
+    SceneCmdBuf *transfer_cmdbuf = &g_transfer_cmdbufs[g_transfer_cmdbuf_index];
+    const uint32_t seq = scene_seq_begin();
+    DkVariable variable;
+
+    transfer_report_timestamp(transfer_cmdbuf->cmdbuf, 1);
+
+    if (notification) {
+        dkVariableInitialize(&variable, g_notification_region_memblock,
+                             notification_get_index(notification) * sizeof(uint32_t));
+        dkCmdBufSignalVariable(transfer_cmdbuf->cmdbuf, &variable, DkVarOp_Set,
+                               notification->value, DkPipelinePos_Bottom);
+    }
+
+    dkQueueSubmitCommands(g_transfer_queue, dkCmdBufFinishList(transfer_cmdbuf->cmdbuf));
+
+    dkQueueSignalFence(g_transfer_queue, &transfer_cmdbuf->fence, false);
+    transfer_cmdbuf->submitted = true;
+    scene_seq_submit(seq, &transfer_cmdbuf->fence);
+    if (sync_object)
+        dkQueueSignalFence(g_transfer_queue, &sync_object->fence, true);
+    if (notification)
+        notification_record_fence(g_transfer_queue, notification);
+
+    dkQueueFlush(g_transfer_queue);
+
+    FRAME_STATS_ADD(transfers, 1);
+    FRAME_STATS_ADD(transfer_bytes, size);
+
+    mutexUnlock(&g_transfer_lock);
+
+    gpu_write_record(dest_address, seq);
+}
+
+static int transfer_image_init(DkImage *image, DkImageView *view, const void *addr,
+                               SceGxmTransferType type, uint32_t width, uint32_t height,
+                               int32_t stride, DkImageFormat format, uint32_t flags)
+{
+    /* Only linear surfaces map to deko3d images as is */
+    if (type != SCE_GXM_TRANSFER_LINEAR || stride <= 0 || format == DkImageFormat_None) {
+        LOG("Unsupported transfer surface: type: 0x%x, stride: %" PRId32 ", format: %d", type,
+            stride, format);
+        return SCE_GXM_ERROR_INVALID_VALUE;
+    }
+
+    if (!dk_image_for_gxm_transfer_surface(g_dk_device, image, addr, width, height, stride, format,
+                                           flags))
+        return SCE_GXM_ERROR_INVALID_POINTER;
+
+    dkImageViewDefaults(view, image);
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x62312BF8, int, sceGxmTransferCopy, uint32_t width, uint32_t height,
+       uint32_t colorKeyValue, uint32_t colorKeyMask, SceGxmTransferColorKeyMode colorKeyMode,
+       SceGxmTransferFormat srcFormat, SceGxmTransferType srcType, const void *srcAddress,
+       uint32_t srcX, uint32_t srcY, int32_t srcStride, SceGxmTransferFormat destFormat,
+       SceGxmTransferType destType, void *destAddress, uint32_t destX, uint32_t destY,
+       int32_t destStride, SceGxmSyncObject *syncObject, uint32_t syncFlags,
+       const SceGxmNotification *notification)
+{
+    const DkImageRect src_rect = { srcX, srcY, 0, width, height, 1 };
+    const DkImageRect dst_rect = { destX, destY, 0, width, height, 1 };
+    DkImage src_image, dst_image;
+    DkImageView src_view, dst_view;
+    DkCmdBuf cmdbuf;
+    int ret;
+
+    if (!srcAddress || !destAddress)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+
+    if (colorKeyMode != SCE_GXM_TRANSFER_COLORKEY_NONE)
+        LOG("sceGxmTransferCopy: color keying is not supported, copying all the texels");
+
+    ret = transfer_image_init(&src_image, &src_view, srcAddress, srcType, srcX + width,
+                              srcY + height, srcStride,
+                              gxm_transfer_format_to_dk_image_format(srcFormat),
+                              DkImageFlags_Usage2DEngine);
+    if (ret != 0)
+        return ret;
+
+    ret = transfer_image_init(&dst_image, &dst_view, destAddress, destType, destX + width,
+                              destY + height, destStride,
+                              gxm_transfer_format_to_dk_image_format(destFormat),
+                              DkImageFlags_Usage2DEngine);
+    if (ret != 0)
+        return ret;
+
+    cmdbuf = transfer_begin(syncObject, syncFlags);
+    /* Only format conversions need the 2D engine */
+    if (srcFormat == destFormat)
+        dkCmdBufCopyImage(cmdbuf, &src_view, &src_rect, &dst_view, &dst_rect, 0);
+    else
+        dkCmdBufBlitImage(cmdbuf, &src_view, &src_rect, &dst_view, &dst_rect, 0, 0);
+    transfer_end(syncObject, notification, destAddress,
+                 width * height * gxm_transfer_format_bytes_per_pixel(destFormat));
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xD10F7EAD, int, sceGxmTransferDownscale, SceGxmTransferFormat srcFormat,
+       const void *srcAddress, unsigned int srcX, unsigned int srcY, unsigned int srcWidth,
+       unsigned int srcHeight, int srcStride, SceGxmTransferFormat destFormat, void *destAddress,
+       unsigned int destX, unsigned int destY, int destStride, SceGxmSyncObject *syncObject,
+       unsigned int syncFlags, const SceGxmNotification *notification)
+{
+    const DkImageRect src_rect = { srcX, srcY, 0, srcWidth, srcHeight, 1 };
+    const DkImageRect dst_rect = { destX, destY, 0, srcWidth / 2, srcHeight / 2, 1 };
+    DkImage src_image, dst_image;
+    DkImageView src_view, dst_view;
+    DkCmdBuf cmdbuf;
+    int ret;
+
+    if (!srcAddress || !destAddress)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+
+    ret = transfer_image_init(&src_image, &src_view, srcAddress, SCE_GXM_TRANSFER_LINEAR,
+                              srcX + srcWidth, srcY + srcHeight, srcStride,
+                              gxm_transfer_format_to_dk_image_format(srcFormat),
+                              DkImageFlags_Usage2DEngine);
+    if (ret != 0)
+        return ret;
+
+    ret = transfer_image_init(&dst_image, &dst_view, destAddress, SCE_GXM_TRANSFER_LINEAR,
+                              destX + dst_rect.width, destY + dst_rect.height, destStride,
+                              gxm_transfer_format_to_dk_image_format(destFormat),
+                              DkImageFlags_Usage2DEngine);
+    if (ret != 0)
+        return ret;
+
+    /* Sampling halfway between texels averages each 2x2 block */
+    cmdbuf = transfer_begin(syncObject, syncFlags);
+    dkCmdBufBlitImage(cmdbuf, &src_view, &src_rect, &dst_view, &dst_rect, DkBlitFlag_FilterLinear,
+                      0);
+    transfer_end(syncObject, notification, destAddress,
+                 srcWidth * srcHeight * gxm_transfer_format_bytes_per_pixel(srcFormat));
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x2A8F7C2C, int, sceGxmTransferFill, uint32_t color,
+       SceGxmTransferFormat destFormat, void *destAddress, uint32_t destX, uint32_t destY,
+       uint32_t width, uint32_t height, int32_t destStride, SceGxmSyncObject *syncObject,
+       uint32_t syncFlags, const SceGxmNotification *notification)
+{
+    const size_t bpp = gxm_transfer_format_bytes_per_pixel(destFormat);
+    const DkScissor scissor = { destX, destY, width, height };
+    uint32_t clear_color[4] = { 0 };
+    DkImageFormat format;
+    DkImage dst_image;
+    DkImageView dst_view;
+    DkCmdBuf cmdbuf;
+    int ret;
+
+    if (!destAddress)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+
+    /* The color is already packed in the destination format: clear through a raw view */
+    switch (bpp) {
+    case 1:
+        format = DkImageFormat_R8_Uint;
+        clear_color[0] = color & 0xFF;
+        break;
+    case 2:
+        format = DkImageFormat_R16_Uint;
+        clear_color[0] = color & 0xFFFF;
+        break;
+    case 4:
+        format = DkImageFormat_R32_Uint;
+        clear_color[0] = color;
+        break;
+    default:
+        format = DkImageFormat_None;
+        break;
+    }
+
+    ret = transfer_image_init(&dst_image, &dst_view, destAddress, SCE_GXM_TRANSFER_LINEAR,
+                              destX + width, destY + height, destStride, format,
+                              DkImageFlags_UsageRender);
+    if (ret != 0)
+        return ret;
+
+    cmdbuf = transfer_begin(syncObject, syncFlags);
+    dkCmdBufBindRenderTarget(cmdbuf, &dst_view, NULL);
+    dkCmdBufSetScissors(cmdbuf, 0, &scissor, 1);
+    dkCmdBufClearColor(cmdbuf, 0, DkColorMask_RGBA, clear_color);
+    transfer_end(syncObject, notification, destAddress, width * height * bpp);
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x05032658, int, sceGxmShaderPatcherCreate, const SceGxmShaderPatcherParams *params,
+       SceGxmShaderPatcher **shaderPatcher)
+{
+    SceGxmShaderPatcher *shader_patcher;
+
+    shader_patcher = malloc(sizeof(*shader_patcher));
+    if (!shader_patcher)
+        return SCE_KERNEL_ERROR_NO_MEMORY;
+
+    memset(shader_patcher, 0, sizeof(*shader_patcher));
+    shader_patcher->params = *params;
+    *shaderPatcher = shader_patcher;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xEAA5B100, int, sceGxmShaderPatcherDestroy, SceGxmShaderPatcher *shaderPatcher)
+{
+    free(shaderPatcher->registered_programs);
+    free(shaderPatcher);
+    return 0;
+}
+
+EXPORT(SceGxm, 0x2B528462, int, sceGxmShaderPatcherRegisterProgram,
+       SceGxmShaderPatcher *shaderPatcher, const SceGxmProgram *programHeader,
+       SceGxmShaderPatcherId *programId)
+{
+    SceGxmRegisteredProgram *shader_patcher_id;
+
+    shader_patcher_id = malloc(sizeof(*shader_patcher_id));
+    if (!shader_patcher_id)
+        return SCE_KERNEL_ERROR_NO_MEMORY;
+
+    memset(shader_patcher_id, 0, sizeof(*shader_patcher_id));
+    shader_patcher_id->programHeader = programHeader;
+
+    shaderPatcher->registered_programs =
+        reallocarray(shaderPatcher->registered_programs, shaderPatcher->registered_count + 1,
+                     sizeof(SceGxmShaderPatcherId));
+    shaderPatcher->registered_programs[shaderPatcher->registered_count] = shader_patcher_id;
+    shaderPatcher->registered_count++;
+
+    rwlockWriteLock(&g_registered_programs_lock);
+    registered_program_dict_set_at(g_registered_programs, (uintptr_t)programHeader,
+                                   shader_patcher_id);
+    rwlockWriteUnlock(&g_registered_programs_lock);
+
+    *programId = shader_patcher_id;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xF103AF8A, int, sceGxmShaderPatcherUnregisterProgram,
+       SceGxmShaderPatcher *shaderPatcher, SceGxmShaderPatcherId programId)
+{
+    SceGxmRegisteredProgram **entry;
+
+    /* The same program might have been registered again since */
+    rwlockWriteLock(&g_registered_programs_lock);
+    entry = registered_program_dict_get(g_registered_programs,
+                                        (uintptr_t)programId->programHeader);
+    if (entry && *entry == programId)
+        registered_program_dict_erase(g_registered_programs, (uintptr_t)programId->programHeader);
+    rwlockWriteUnlock(&g_registered_programs_lock);
+
+    free(programId->parameter_name_table);
+    free(programId);
+    return 0;
+}
+
+static int translate_shader(DkShader *shader, const SceGxmProgram *program, pipeline_stage stage,
+                            const char *prefix, DkMemBlock code_memblock, uint32_t *code_offset,
+                            bool use_ubo, const SceGxmVertexAttribute *attributes,
+                            unsigned int attributeCount)
+{
+    bool ret;
+    char *glsl;
+    uint32_t shader_size;
+    DkShaderMaker shader_maker;
+    void *shader_load_addr = dkMemBlockGetCpuAddr(code_memblock) + *code_offset;
+
+#if DUMP_SHADER_SPIRV
+    uint32_t *spirv;
+    uint32_t num_instr;
+
+    ret = convert_gxp_to_spirv_c(&spirv, &num_instr, program, prefix, false, false, false, false,
+                                 use_ubo, attributes, attributeCount, false, false, SHADER_DUMP_CB);
+    if (ret) {
+        dump_shader_spirv(prefix, spirv, num_instr);
+        free(spirv);
+    }
+#endif
+
+    LOG("Converting shader (%s) to GLSL...", prefix);
+    ret = convert_gxp_to_glsl_c(&glsl, program, prefix, false, false, false, false, use_ubo,
+                                attributes, attributeCount, false, false, SHADER_DUMP_CB);
+    LOG("  ret: %d", ret);
+#if DUMP_SHADER_GLSL
+    if (ret)
+        dump_shader_glsl(prefix, glsl);
+#endif
+    if (!ret)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    LOG("UAM compiling shader (%s)...", prefix);
+    ret = uam_compiler_compile_glsl(stage, glsl, shader_load_addr, &shader_size);
+    LOG("  compile ret: %d, size: 0x%x", ret, shader_size);
+    free(glsl);
+
+    dkShaderMakerDefaults(&shader_maker, code_memblock, *code_offset);
+    dkShaderInitialize(shader, &shader_maker);
+    *code_offset += ALIGN(shader_size, DK_SHADER_CODE_ALIGNMENT);
+
+    return 0;
+}
+
+static void program_get_uniform_buffer_layout(const SceGxmProgram *program,
+                                              UniformBufferLayout *layout)
+{
+    uint32_t offsets[SCE_GXM_MAX_UNIFORM_BUFFERS + 1], sizes[SCE_GXM_MAX_UNIFORM_BUFFERS + 1];
+
+    get_uniform_buffer_layout_c(program, offsets, sizes, ARRAY_SIZE(sizes));
+
+    layout->size = 0;
+    for (uint32_t i = 0; i < SCE_GXM_MAX_UNIFORM_BUFFERS; i++) {
+        layout->offsets[i] = offsets[i + 1];
+        layout->sizes[i] = sizes[i + 1];
+        if (sizes[i + 1])
+            layout->size = offsets[i + 1] + sizes[i + 1];
+    }
+}
+
+/* Bytes to bind at the default uniform buffer binding */
+static uint32_t program_default_uniform_binding_size(const SceGxmProgram *program,
+                                                     const UniformBufferLayout *layout)
+{
+    return MAX2(program->default_uniform_buffer_count * sizeof(float), layout->size);
+}
+
+static bool program_default_uniform_fits_ubo(const SceGxmProgram *program,
+                                             const UniformBufferLayout *layout)
+{
+    return program_default_uniform_binding_size(program, layout) <= DK_UNIFORM_BUF_MAX_SIZE;
+}
+
+/*
+ * Only programs with nothing to compute the position from but the attribute qualify: no uniforms,
+ * literals nor secondary program, and a primary program short enough to only be moving it to the
+ * position output.
+ */
+static bool vertex_program_is_clear_candidate(const SceGxmProgram *program,
+                                              const SceGxmVertexAttribute *attributes,
+                                              unsigned int attributeCount,
+                                              const SceGxmVertexStream *streams,
+                                              unsigned int streamCount)
+{
+    const SceGxmProgramVaryings *varyings = gxm_program_get_varyings(program);
+
+    return program->default_uniform_buffer_count == 0 && program->uniform_buffer_count == 0 &&
+           program->literals_count == 0 && program->secondary_program_instr_count == 0 &&
+           program->primary_program_instr_count <= VERTEX_PASSTHROUGH_MAX_INSTRS &&
+           varyings->vertex_outputs1 == SCE_GXM_VERTEX_PROGRAM_OUTPUT_POSITION &&
+           varyings->vertex_outputs2 == 0 && attributeCount == 1 && streamCount == 1 &&
+           attributes[0].format == SCE_GXM_ATTRIBUTE_FORMAT_F32 &&
+           attributes[0].componentCount >= 2 && attributes[0].streamIndex == 0;
+}
+
+static int32_t fragment_program_get_clear_color_offset(const SceGxmProgram *program)
+{
+    const SceGxmProgramParameter *const parameters = gxm_program_get_parameters(program);
+    const SceGxmProgramParameter *color = NULL;
+    uint32_t opcode;
+
+    /*
+     * A clear shader reads neither varyings nor textures, and its whole primary program is a single
+     * move (or pack to the output format) of a float4 uniform: that rules out discards, literals
+     * and any computation on the color
+     */
+    if (gxm_program_get_varyings(program)->varyings_count != 0 || program->literals_count != 0 ||
+        program->secondary_program_instr_count != 0 || program->primary_program_instr_count != 1)
+        return -1;
+
+    opcode = gxm_program_get_primary_program(program)[0] >> USSE_OPCODE_SHIFT;
+    if (opcode != USSE_OPCODE_VMOV && opcode != USSE_OPCODE_VPCK)
+        return -1;
+
+    for (uint32_t i = 0; i < program->parameter_count; i++) {
+        switch (parameters[i].category) {
+        case SCE_GXM_PARAMETER_CATEGORY_UNIFORM:
+            if (color)
+                return -1;
+            color = &parameters[i];
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (!color || color->type != SCE_GXM_PARAMETER_TYPE_F32 || color->component_count != 4 ||
+        color->array_size != 1)
+        return -1;
+
+    return color->resource_index * sizeof(uint32_t);
+}
+
+EXPORT(SceGxm, 0xB7BBA6D5, int, sceGxmShaderPatcherCreateVertexProgram,
+       SceGxmShaderPatcher *shaderPatcher, SceGxmShaderPatcherId programId,
+       const SceGxmVertexAttribute *attributes, unsigned int attributeCount,
+       const SceGxmVertexStream *streams, unsigned int streamCount,
+       SceGxmVertexProgram **vertexProgram)
+{
+    int ret;
+    SceGxmVertexProgram *vertex_program;
+
+    /* Reject what the vertex fetch can't handle now rather than when drawing */
+    for (unsigned int i = 0; i < attributeCount; i++) {
+        if (!gxm_vtx_attrib_is_supported(attributes[i].format, attributes[i].componentCount)) {
+            LOG("Unsupported vertex attribute format %u with %u components",
+                attributes[i].format, attributes[i].componentCount);
+            return SCE_GXM_ERROR_INVALID_VALUE;
+        }
+    }
+
+    vertex_program = malloc(sizeof(*vertex_program));
+    if (!vertex_program)
+        return SCE_KERNEL_ERROR_NO_MEMORY;
+
+    memset(vertex_program, 0, sizeof(*vertex_program));
+    vertex_program->programId = programId;
+    vertex_program->attributes = calloc(attributeCount, sizeof(SceGxmVertexAttribute));
+    memcpy(vertex_program->attributes, attributes, attributeCount * sizeof(SceGxmVertexAttribute));
+    vertex_program->attributeCount = attributeCount;
+    vertex_program->streams = calloc(streamCount, sizeof(SceGxmVertexStream));
+    memcpy(vertex_program->streams, streams, streamCount * sizeof(SceGxmVertexStream));
+    vertex_program->streamCount = streamCount;
+    vertex_program->is_clear_candidate = vertex_program_is_clear_candidate(
+        programId->programHeader, attributes, attributeCount, streams, streamCount);
+    program_get_uniform_buffer_layout(programId->programHeader,
+                                      &vertex_program->uniform_buffer_layout);
+    vertex_program->default_uniform_ubo = program_default_uniform_fits_ubo(
+        programId->programHeader, &vertex_program->uniform_buffer_layout);
+
+    ret = translate_shader(&vertex_program->dk_shader, programId->programHeader,
+                           pipeline_stage_vertex, "vert", g_code_memblock, &g_code_mem_offset,
+                           vertex_program->default_uniform_ubo, attributes, attributeCount);
+    if (ret != 0) {
+        free(vertex_program);
+        return ret;
+    }
+
+    *vertexProgram = vertex_program;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xAC1FF2DA, int, sceGxmShaderPatcherReleaseVertexProgram,
+       SceGxmShaderPatcher *shaderPatcher, SceGxmVertexProgram *vertexProgram)
+{
+    free(vertexProgram->attributes);
+    free(vertexProgram->streams);
+    free(vertexProgram);
+    return 0;
+}
+
+EXPORT(SceGxm, 0x4ED2E49D, int, sceGxmShaderPatcherCreateFragmentProgram,
+       SceGxmShaderPatcher *shaderPatcher, SceGxmShaderPatcherId programId,
+       SceGxmOutputRegisterFormat outputFormat, SceGxmMultisampleMode multisampleMode,
+       const SceGxmBlendInfo *blendInfo, const SceGxmProgram *vertexProgram,
+       SceGxmFragmentProgram **fragmentProgram)
+{
+    int ret;
+    SceGxmFragmentProgram *fragment_program;
+
+    fragment_program = malloc(sizeof(*fragment_program));
+    if (!fragment_program)
+        return SCE_KERNEL_ERROR_NO_MEMORY;
+
+    memset(fragment_program, 0, sizeof(*fragment_program));
+    fragment_program->programId = programId;
+    fragment_program->outputFormat = outputFormat;
+    fragment_program->multisampleMode = multisampleMode;
+    if (blendInfo) {
+        fragment_program->blendInfo = *blendInfo;
+    } else {
+        fragment_program->blendInfo = (SceGxmBlendInfo){
+            SCE_GXM_COLOR_MASK_ALL,    SCE_GXM_BLEND_FUNC_NONE,   SCE_GXM_BLEND_FUNC_NONE,
+            SCE_GXM_BLEND_FACTOR_ONE,  SCE_GXM_BLEND_FACTOR_ZERO, SCE_GXM_BLEND_FACTOR_ONE,
+            SCE_GXM_BLEND_FACTOR_ZERO,
+        };
+    }
+    fragment_program->clear_color_offset =
+        fragment_program_get_clear_color_offset(programId->programHeader);
+    program_get_uniform_buffer_layout(programId->programHeader,
+                                      &fragment_program->uniform_buffer_layout);
+    fragment_program->default_uniform_ubo = program_default_uniform_fits_ubo(
+        programId->programHeader, &fragment_program->uniform_buffer_layout);
+
+    ret = translate_shader(&fragment_program->dk_shader, programId->programHeader,
+                           pipeline_stage_fragment, "frag", g_code_memblock, &g_code_mem_offset,
+                           fragment_program->default_uniform_ubo, NULL, 0);
+    if (ret != 0) {
+        free(fragment_program);
+        return ret;
+    }
+
+    *fragmentProgram = fragment_program;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xBE2743D1, int, sceGxmShaderPatcherReleaseFragmentProgram,
+       SceGxmShaderPatcher *shaderPatcher, SceGxmFragmentProgram *fragmentProgram)
+{
+    free(fragmentProgram);
+    return 0;
+}
+
+EXPORT(SceGxm, 0xA949A803, const SceGxmProgram *, sceGxmShaderPatcherGetProgramFromId,
+       SceGxmShaderPatcherId programId)
+{
+    if (programId)
+        return programId->programHeader;
+
+    return NULL;
+}
+
+/* Size of a render target dimension at the given internal resolution */
+static inline uint32_t resolution_scale(uint32_t size, uint32_t percent)
+{
+    return (size * percent + 99) / 100;
+}
+
+EXPORT(SceGxm, 0xB291C959, int, sceGxmGetRenderTargetMemSize,
+       const SceGxmRenderTargetParams *params, unsigned int *driverMemSize)
+{
+    *driverMemSize = sizeof(SceGxmRenderTarget);
+    return 0;
+}
+
+EXPORT(SceGxm, 0x207AF96B, int, sceGxmCreateRenderTarget, const SceGxmRenderTargetParams *params,
+       SceGxmRenderTarget **renderTarget)
+{
+    SceGxmRenderTarget *render_target;
+    dk_surface_desc_t descs[3];
+    uint32_t count = 0;
+
+    if (!g_gxm_initialized)
+        return SCE_GXM_ERROR_UNINITIALIZED;
+    else if (!params)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+    else if (params->scenesPerFrame > SCE_GXM_MAX_SCENES_PER_RENDERTARGET)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    render_target = malloc(sizeof(*render_target));
+    if (!render_target)
+        return SCE_KERNEL_ERROR_NO_MEMORY;
+
+    memset(render_target, 0, sizeof(*render_target));
+    render_target->params = *params;
+    render_target->ms_mode = gxm_multisample_mode_to_dk_ms_mode(params->multisampleMode);
+
+    /* Create shadow color and depth/stencil surfaces */
+    descs[count++] = (dk_surface_desc_t){
+        .surface = &render_target->shadow_color_surface,
+        .format = DkImageFormat_RGBA8_Unorm,
+        .ms_mode = DkMsMode_1x,
+        .flags = DkImageFlags_UsageRender | DkImageFlags_Usage2DEngine |
+                 DkImageFlags_HwCompression,
+    };
+    if (render_target->ms_mode != DkMsMode_1x) {
+        descs[count++] = (dk_surface_desc_t){
+            .surface = &render_target->shadow_msaa_color_surface,
+            .format = DkImageFormat_RGBA8_Unorm,
+            .ms_mode = render_target->ms_mode,
+            .flags = DkImageFlags_UsageRender | DkImageFlags_Usage2DEngine |
+                     DkImageFlags_HwCompression,
+        };
+    }
+    descs[count++] = (dk_surface_desc_t){
+        .surface = &render_target->shadow_ds_surface,
+        .format = DkImageFormat_ZF32_X24S8,
+        .ms_mode = render_target->ms_mode,
+        .flags = DkImageFlags_UsageRender | DkImageFlags_Usage2DEngine |
+                 DkImageFlags_HwCompression,
+    };
+    /* Sized for the highest internal resolution, lower ones only render to a part of them */
+    render_target->shadow_memblock =
+        dk_surfaces_create(g_dk_device, resolution_scale(params->width, RESOLUTION_SCALE_PERCENT),
+                           resolution_scale(params->height, RESOLUTION_SCALE_PERCENT), descs,
+                           count);
+
+    *renderTarget = render_target;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x0B94C50A, int, sceGxmDestroyRenderTarget, SceGxmRenderTarget *renderTarget)
+{
+    dkMemBlockDestroy(renderTarget->shadow_memblock);
+    free(renderTarget);
+    return 0;
+}
+
+EXPORT(SceGxm, 0xED0F6E25, int, sceGxmColorSurfaceInit, SceGxmColorSurface *surface,
+       SceGxmColorFormat colorFormat, SceGxmColorSurfaceType surfaceType,
+       SceGxmColorSurfaceScaleMode scaleMode, SceGxmOutputRegisterSize outputRegisterSize,
+       unsigned int width, unsigned int height, unsigned int strideInPixels, void *data)
+{
+    SceGxmColorSurfaceInner *inner = (SceGxmColorSurfaceInner *)surface;
+
+    memset(inner, 0, sizeof(*inner));
+    inner->disabled = 0;
+    inner->downscale = scaleMode == SCE_GXM_COLOR_SURFACE_SCALE_MSAA_DOWNSCALE;
+    inner->width = width;
+    inner->height = height;
+    inner->strideInPixels = strideInPixels;
+    inner->data = data;
+    inner->colorFormat = colorFormat;
+    inner->surfaceType = surfaceType;
+    inner->outputRegisterSize = outputRegisterSize;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xCA9D41D1, int, sceGxmDepthStencilSurfaceInit, SceGxmDepthStencilSurface *surface,
+       SceGxmDepthStencilFormat depthStencilFormat, SceGxmDepthStencilSurfaceType surfaceType,
+       unsigned int strideInSamples, void *depthData, void *stencilData)
+
+{
+    if (!surface)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+    else if ((uint32_t)depthData % SCE_GXM_DEPTHSTENCIL_SURFACE_ALIGNMENT != 0)
+        return SCE_GXM_ERROR_INVALID_ALIGNMENT;
+    else if ((strideInSamples == 0) || ((strideInSamples % SCE_GXM_TILE_SIZEX) != 0))
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    memset(surface, 0, sizeof(*surface));
+    surface->zlsControl =
+        SCE_GXM_DEPTH_STENCIL_FORCE_LOAD_DISABLED | SCE_GXM_DEPTH_STENCIL_FORCE_STORE_DISABLED |
+        ((strideInSamples >> 5) - 1) << SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_STRIDE_OFFSET |
+        (surfaceType &
+         (SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_TYPE_MASK << SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_TYPE_OFFSET)) |
+        (depthStencilFormat & (SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_FORMAT_MASK
+                               << SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_FORMAT_OFFSET));
+    surface->depthData = depthData;
+    surface->stencilData = stencilData;
+    surface->backgroundDepth = 1.0f;
+    surface->backgroundControl = SCE_GXM_DEPTH_STENCIL_BG_CTRL_MASK_BIT;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x14BD831F, void, sceGxmSetFrontDepthFunc, SceGxmContext *context,
+       SceGxmDepthFunc depthFunc)
+{
+    context->state.depth_stencil.depthCompareOp = gxm_depth_func_to_dk_compare_op(depthFunc);
+    context->state.dirty.bit.depth_stencil = true;
+
+    if (!context->state.two_sided_mode)
+        sceGxmSetBackDepthFunc(context, depthFunc);
+}
+
+EXPORT(SceGxm, 0xF32CBF34, void, sceGxmSetFrontDepthWriteEnable, SceGxmContext *context,
+       SceGxmDepthWriteMode enable)
+{
+    context->state.depth_stencil.depthWriteEnable = (enable == SCE_GXM_DEPTH_WRITE_ENABLED) ? 1 : 0;
+    context->state.dirty.bit.depth_stencil = true;
+
+    if (!context->state.two_sided_mode)
+        sceGxmSetBackDepthWriteEnable(context, enable);
+}
+
+EXPORT(SceGxm, 0x8FA6FE44, void, sceGxmSetFrontStencilRef, SceGxmContext *context,
+       unsigned int sref)
+{
+    context->state.front_stencil.ref = sref;
+    context->state.dirty.bit.front_stencil = true;
+
+    if (!context->state.two_sided_mode)
+        sceGxmSetBackStencilRef(context, sref);
+}
+
+EXPORT(SceGxm, 0xB042A4D2, void, sceGxmSetBackDepthFunc, SceGxmContext *context,
+       SceGxmDepthFunc depthFunc)
+{
+    /* Unsupported */
+}
+
+EXPORT(SceGxm, 0xC18B706B, void, sceGxmSetBackDepthWriteEnable, SceGxmContext *context,
+       SceGxmDepthWriteMode enable)
+{
+    /* Unsupported */
+}
+
+EXPORT(SceGxm, 0x866A0517, void, sceGxmSetBackStencilRef, SceGxmContext *context, unsigned int sref)
+{
+    context->state.back_stencil.ref = sref;
+    context->state.dirty.bit.back_stencil = true;
+}
+
+EXPORT(SceGxm, 0xB8645A9A, void, sceGxmSetFrontStencilFunc, SceGxmContext *context,
+       SceGxmStencilFunc func, SceGxmStencilOp stencilFail, SceGxmStencilOp depthFail,
+       SceGxmStencilOp depthPass, unsigned char compareMask, unsigned char writeMask)
+{
+
+    context->state.depth_stencil.stencilFrontFailOp = gxm_stencil_op_to_dk_stencil_op(stencilFail);
+    context->state.depth_stencil.stencilFrontDepthFailOp =
+        gxm_stencil_op_to_dk_stencil_op(depthFail);
+    context->state.depth_stencil.stencilFrontPassOp = gxm_stencil_op_to_dk_stencil_op(depthPass);
+    context->state.depth_stencil.stencilFrontCompareOp = gxm_stencil_func_to_dk_compare_op(func);
+    context->state.front_stencil.compare_mask = compareMask;
+    context->state.front_stencil.write_mask = writeMask;
+    context->state.dirty.bit.depth_stencil = true;
+    context->state.dirty.bit.front_stencil = true;
+
+    if (!context->state.two_sided_mode) {
+        sceGxmSetBackStencilFunc(context, func, stencilFail, depthFail, depthPass, compareMask,
+                                 writeMask);
+    }
+}
+
+EXPORT(SceGxm, 0x1A68C8D2, void, sceGxmSetBackStencilFunc, SceGxmContext *context,
+       SceGxmStencilFunc func, SceGxmStencilOp stencilFail, SceGxmStencilOp depthFail,
+       SceGxmStencilOp depthPass, unsigned char compareMask, unsigned char writeMask)
+{
+    context->state.depth_stencil.stencilBackFailOp = gxm_stencil_op_to_dk_stencil_op(stencilFail);
+    context->state.depth_stencil.stencilBackDepthFailOp =
+        gxm_stencil_op_to_dk_stencil_op(depthFail);
+    context->state.depth_stencil.stencilBackPassOp = gxm_stencil_op_to_dk_stencil_op(depthPass);
+    context->state.depth_stencil.stencilBackCompareOp = gxm_stencil_func_to_dk_compare_op(func);
+    context->state.back_stencil.compare_mask = compareMask;
+    context->state.back_stencil.write_mask = writeMask;
+    context->state.dirty.bit.depth_stencil = true;
+    context->state.dirty.bit.back_stencil = true;
+}
+
+EXPORT(SceGxm, 0x7767EC49, int, sceGxmSetVisibilityBuffer, SceGxmContext *context,
+       void *bufferBase, unsigned int stridePerCore)
+{
+    VitaMemBlockInfo *block;
+
+    if (!bufferBase) {
+        context->state.visibility_buffer = DK_GPU_ADDR_INVALID;
+        context->state.visibility_buffer_size = 0;
+        context->dispatch_state_dirty |= 1u << DISPATCH_STATE_VISIBILITY;
+        return 0;
+    }
+
+    if (((uintptr_t)bufferBase & (SCE_GXM_VISIBILITY_ALIGNMENT - 1)) ||
+        (stridePerCore & (SCE_GXM_VISIBILITY_ALIGNMENT - 1)))
+        return SCE_GXM_ERROR_INVALID_ALIGNMENT;
+
+    block = SceSysmem_get_vita_memblock_info_for_addr(bufferBase);
+    if (!block)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    context->state.visibility_buffer = dkMemBlockGetGpuAddr(block->dk_memblock) +
+                                       ((uintptr_t)bufferBase - (uintptr_t)block->base);
+    context->state.visibility_buffer_size =
+        MIN2(stridePerCore, (SCE_GXM_MAX_VISIBILITY_INDEX + 1) * sizeof(uint32_t));
+    context->dispatch_state_dirty |= 1u << DISPATCH_STATE_VISIBILITY;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x12625C34, void, sceGxmSetFrontVisibilityTestEnable, SceGxmContext *context,
+       SceGxmVisibilityTestMode enable)
+{
+    context->state.front_visibility.enable = enable == SCE_GXM_VISIBILITY_TEST_ENABLED;
+    context->dispatch_state_dirty |= 1u << DISPATCH_STATE_VISIBILITY;
+
+    if (!context->state.two_sided_mode)
+        sceGxmSetBackVisibilityTestEnable(context, enable);
+}
+
+EXPORT(SceGxm, 0x17B3BF86, void, sceGxmSetBackVisibilityTestEnable, SceGxmContext *context,
+       SceGxmVisibilityTestMode enable)
+{
+    context->state.back_visibility.enable = enable == SCE_GXM_VISIBILITY_TEST_ENABLED;
+    context->dispatch_state_dirty |= 1u << DISPATCH_STATE_VISIBILITY;
+}
+
+EXPORT(SceGxm, 0xAE7886FE, void, sceGxmSetFrontVisibilityTestIndex, SceGxmContext *context,
+       unsigned int index)
+{
+    context->state.front_visibility.index = index & SCE_GXM_MAX_VISIBILITY_INDEX;
+    context->dispatch_state_dirty |= 1u << DISPATCH_STATE_VISIBILITY;
+
+    if (!context->state.two_sided_mode)
+        sceGxmSetBackVisibilityTestIndex(context, index);
+}
+
+EXPORT(SceGxm, 0x52E6B3C0, void, sceGxmSetBackVisibilityTestIndex, SceGxmContext *context,
+       unsigned int index)
+{
+    context->state.back_visibility.index = index & SCE_GXM_MAX_VISIBILITY_INDEX;
+    context->dispatch_state_dirty |= 1u << DISPATCH_STATE_VISIBILITY;
+}
+
+EXPORT(SceGxm, 0xD0E3CD9A, void, sceGxmSetFrontVisibilityTestOp, SceGxmContext *context,
+       SceGxmVisibilityTestOp op)
+{
+    context->state.front_visibility.op = op;
+    context->dispatch_state_dirty |= 1u << DISPATCH_STATE_VISIBILITY;
+
+    if (!context->state.two_sided_mode)
+        sceGxmSetBackVisibilityTestOp(context, op);
+}
+
+EXPORT(SceGxm, 0xC83F0AB3, void, sceGxmSetBackVisibilityTestOp, SceGxmContext *context,
+       SceGxmVisibilityTestOp op)
+{
+    context->state.back_visibility.op = op;
+    context->dispatch_state_dirty |= 1u << DISPATCH_STATE_VISIBILITY;
+}
+
+static void set_vita3k_gxm_uniform_blocks(SceGxmContext *context)
+{
+    const SceGxmRenderTargetParams *const rt_params = &context->state.render_target->params;
+
+    /* The shaders work in render target coordinates, the multiplier maps them to the shadow's */
+    const struct GXMRenderVertUniformBlock vert_unif = {
+        .viewport_flip = { 1.0f, 1.0f, 1.0f, 1.0f },
+        .viewport_flag = (0) ? 0.0f : 1.0f,
+        .z_offset = 0.0f,
+        .z_scale = 1.0f,
+        .screen_width = rt_params->width,
+        .screen_height = rt_params->height
+    };
+
+    const struct GXMRenderFragUniformBlock frag_unif = {
+        .back_disabled = 0.0f,
+        .front_disabled = 0.0f,
+        .writing_mask = 0.0f,
+        .use_raw_image = 0.0f,
+        .res_multiplier = context->scene_scale_percent / 100.0f,
+    };
+
+    const DkGpuAddr vert_unif_addr = dkMemBlockGetGpuAddr(context->gxm_vert_unif_block_memblock);
+    const DkGpuAddr frag_unif_addr = dkMemBlockGetGpuAddr(context->gxm_frag_unif_block_memblock);
+    const uint32_t vert_unif_size = ALIGN(sizeof(vert_unif), DK_UNIFORM_BUF_ALIGNMENT);
+    const uint32_t frag_unif_size = ALIGN(sizeof(frag_unif), DK_UNIFORM_BUF_ALIGNMENT);
+
+    /*
+     * The blocks are updated inline in the command stream instead of being written by the CPU,
+     * so the previous scenes still in flight keep reading their own values.
+     */
+    dkCmdBufPushConstants(context->cmdbuf, vert_unif_addr, vert_unif_size, 0, sizeof(vert_unif),
+                          &vert_unif);
+    dkCmdBufBindUniformBuffer(context->cmdbuf, DkStage_Vertex, 2 /* hardcoded */, vert_unif_addr,
+                              vert_unif_size);
+
+    dkCmdBufPushConstants(context->cmdbuf, frag_unif_addr, frag_unif_size, 0, sizeof(frag_unif),
+                          &frag_unif);
+    dkCmdBufBindUniformBuffer(context->cmdbuf, DkStage_Fragment, 3 /* hardcoded */,
+                              frag_unif_addr, frag_unif_size);
+}
+
+static void load_gxm_ds_surface_to_shadow(SceGxmContext *context, SceGxmRenderTarget *render_target,
+                                          const SceGxmDepthStencilSurface *ds_surface)
+{
+    DkImage ds_surface_image;
+    const dk_surface_t *const shadow_ds_surface = &render_target->shadow_ds_surface;
+    const uint32_t rt_width = render_target->params.width;
+    const uint32_t rt_height = render_target->params.height;
+
+    /* The shadow already holds what the last scene stored to this surface, at the same internal
+     * resolution, and no other scene has stored depth/stencil data since: nothing to load */
+    if (render_target->shadow_ds_synced_data == ds_surface->depthData &&
+        render_target->shadow_ds_synced_seq == g_ds_store_seq &&
+        render_target->shadow_ds_synced_scale_percent == context->scene_scale_percent) {
+        FRAME_STATS_ADD(ds_loads_skipped, 1);
+        return;
+    }
+
+    if (!dk_image_for_gxm_ds_surface(g_dk_device, &ds_surface_image, rt_width, rt_height,
+                                     ds_surface))
+        return;
+
+    LOG("Loading depth/stencil surface: GXM -> shadow");
+    dk_cmdbuf_copy_image(context->cmdbuf, &ds_surface_image, rt_width, rt_height,
+                         &shadow_ds_surface->image, context->scene_width, context->scene_height);
+
+    /* Make sure the copy has landed before the first draw call depth tests against it */
+    dkCmdBufBarrier(context->cmdbuf, DkBarrier_Full, DkInvalidateFlags_Image);
+
+    render_target->shadow_ds_synced_data = ds_surface->depthData;
+    render_target->shadow_ds_synced_seq = g_ds_store_seq;
+    render_target->shadow_ds_synced_scale_percent = context->scene_scale_percent;
+    FRAME_STATS_ADD(ds_loads, 1);
+}
+
+static VisibilityRun *context_visibility_runs(SceGxmContext *context, DkGpuAddr *gpu_addr)
+{
+    const uint32_t offset =
+        context->scene_cmdbuf_index * VISIBILITY_MAX_RUNS * sizeof(VisibilityRun);
+
+    *gpu_addr = dkMemBlockGetGpuAddr(context->visibility_memblock) + offset;
+    return (VisibilityRun *)((char *)dkMemBlockGetCpuAddr(context->visibility_memblock) + offset);
+}
+
+static bool context_visibility_enabled(const SceGxmContext *context)
+{
+    return context->visibility_memblock && g_visibility_resolve_shader_valid &&
+           context->state.visibility_buffer_size &&
+           (context->state.front_visibility.enable || context->state.back_visibility.enable);
+}
+
+static void context_end_visibility_run(SceGxmContext *context)
+{
+    DkGpuAddr runs_addr;
+
+    if (!context->visibility_run_active)
+        return;
+
+    context_visibility_runs(context, &runs_addr);
+    dkCmdBufReportCounter(context->cmdbuf, DkCounter_SamplesPassed,
+                          runs_addr + (context->visibility_run_count - 1) * sizeof(VisibilityRun) +
+                              offsetof(VisibilityRun, end));
+    context->visibility_run_active = false;
+}
+
+/*
+ * Consecutive draws sharing a visibility index and op are counted by a single pair of
+ * samples passed reports. The counter doesn't tell faces apart, so the front settings
+ * take precedence over the back ones.
+ */
+static void context_update_visibility_run(SceGxmContext *context)
+{
+    VisibilityRun *runs;
+    VisibilityRun *run;
+    DkGpuAddr runs_addr;
+    uint32_t index;
+    SceGxmVisibilityTestOp op;
+
+    if (!context_visibility_enabled(context)) {
+        context_end_visibility_run(context);
+        return;
+    }
+
+    if (context->state.front_visibility.enable) {
+        index = context->state.front_visibility.index;
+        op = context->state.front_visibility.op;
+    } else {
+        index = context->state.back_visibility.index;
+        op = context->state.back_visibility.op;
+    }
+
+    if ((index + 1) * sizeof(uint32_t) > context->state.visibility_buffer_size) {
+        context_end_visibility_run(context);
+        return;
+    }
+
+    runs = context_visibility_runs(context, &runs_addr);
+    if (context->visibility_run_active) {
+        run = &runs[context->visibility_run_count - 1];
+        if (run->index == index && run->op == op)
+            return;
+        context_end_visibility_run(context);
+    }
+
+    if (context->visibility_run_count == VISIBILITY_MAX_RUNS) {
+        LOG("Too many visibility runs in the scene, dropping index %" PRIu32, index);
+        return;
+    }
+
+    run = &runs[context->visibility_run_count];
+    run->index = index;
+    run->op = op;
+    dkCmdBufReportCounter(context->cmdbuf, DkCounter_SamplesPassed,
+                          runs_addr + context->visibility_run_count * sizeof(VisibilityRun) +
+                              offsetof(VisibilityRun, begin));
+    context->visibility_run_count++;
+    context->visibility_run_active = true;
+}
+
+/* Accumulates the samples passed by each run into the visibility buffer, on the GPU */
+static void context_resolve_visibility(SceGxmContext *context)
+{
+    const DkShader *shader = &g_visibility_resolve_shader;
+    DkGpuAddr runs_addr;
+
+    context_end_visibility_run(context);
+
+    if (context->visibility_run_count == 0)
+        return;
+
+    context_visibility_runs(context, &runs_addr);
+    dkCmdBufBarrier(context->cmdbuf, DkBarrier_Full, DkInvalidateFlags_L2Cache);
+    dkCmdBufBindShaders(context->cmdbuf, DkStageFlag_Compute, &shader, 1);
+    dkCmdBufBindStorageBuffer(context->cmdbuf, DkStage_Compute, 0, runs_addr,
+                              context->visibility_run_count * sizeof(VisibilityRun));
+    dkCmdBufBindStorageBuffer(context->cmdbuf, DkStage_Compute, 1,
+                              context->state.visibility_buffer,
+                              context->state.visibility_buffer_size);
+    dkCmdBufDispatchCompute(context->cmdbuf, context->visibility_run_count, 1, 1);
+    FRAME_STATS_ADD(visibility_runs, context->visibility_run_count);
+    context->visibility_run_count = 0;
+}
+
+/* Reports the GPU timestamp at the beginning (0) or the end (1) of the scene */
+static void context_report_scene_timestamp(SceGxmContext *context, uint32_t index)
+{
+    const uint32_t offset = (context->scene_cmdbuf_index * 2 + index) * 2 * sizeof(uint64_t);
+
+    dkCmdBufReportCounter(context->cmdbuf, DkCounter_Timestamp,
+                          dkMemBlockGetGpuAddr(context->timestamp_memblock) + offset);
+}
+
+/* Accounts the GPU time of the last scene of the current command buffer, once it's done */
+static void context_account_scene_gpu_time(const SceGxmContext *context)
+{
+    const uint64_t *reports = (const uint64_t *)dkMemBlockGetCpuAddr(context->timestamp_memblock) +
+                              context->scene_cmdbuf_index * 4;
+
+    __atomic_fetch_add(&g_gpu_frame_ns, gpu_ticks_to_ns(reports[3] - reports[1]),
+                       __ATOMIC_RELAXED);
+}
+
+static void context_record_begin_scene(SceGxmContext *context, DkFence *transfer_fence)
+{
+    SceGxmRenderTarget *render_target = context->state.render_target;
+    const SceGxmDepthStencilSurface *depth_stencil = context->state.ds_surface;
+    const uint32_t scale_percent = __atomic_load_n(&g_resolution_scale_percent, __ATOMIC_RELAXED);
+    const uint32_t width = resolution_scale(render_target->params.width, scale_percent);
+    const uint32_t height = resolution_scale(render_target->params.height, scale_percent);
+    DkViewport viewport = {
+        0.0f, 0.0f, (float)width, (float)height, SCENE_VIEWPORT_MIN_DEPTH, SCENE_VIEWPORT_MAX_DEPTH
+    };
+    DkScissor scissor = { 0, 0, width, height };
+    const bool multisampled = render_target->ms_mode != DkMsMode_1x;
+    DkMultisampleState multisample_state;
+    SceneCmdBuf *scene_cmdbuf;
+
+    /* Switch to the next scene command buffer, waiting for the GPU to be done with it */
+    context->scene_cmdbuf_index = (context->scene_cmdbuf_index + 1) % SCENE_CMDBUF_COUNT;
+    scene_cmdbuf = &context->scene_cmdbufs[context->scene_cmdbuf_index];
+    if (scene_cmdbuf->submitted) {
+        dkFenceWait(&scene_cmdbuf->fence, -1);
+        context_account_scene_gpu_time(context);
+    }
+    context->cmdbuf = scene_cmdbuf->cmdbuf;
+    context->scene_scale_percent = scale_percent;
+    context->scene_width = width;
+    context->scene_height = height;
+    context->scene_seq = scene_seq_begin();
+    gpu_memblocks_collect();
+
+    dkCmdBufClear(context->cmdbuf);
+    if (scene_cmdbuf->grown) {
+        dkCmdBufAddMemory(context->cmdbuf, scene_cmdbuf->memblock, scene_cmdbuf->mem_offset,
+                          scene_cmdbuf->mem_size);
+        scene_cmdbuf->grown = false;
+    }
+    context_report_scene_timestamp(context, 0);
+    dkCmdBufBindRenderTarget(context->cmdbuf,
+                             multisampled ? &render_target->shadow_msaa_color_surface.view
+                                          : &render_target->shadow_color_surface.view,
+                             &render_target->shadow_ds_surface.view);
+    dkMultisampleStateDefaults(&multisample_state);
+    multisample_state.mode = render_target->ms_mode;
+    multisample_state.rasterizerMode = render_target->ms_mode;
+    dkCmdBufBindMultisampleState(context->cmdbuf, &multisample_state);
+    dkCmdBufSetViewports(context->cmdbuf, 0, &viewport, 1);
+    dkCmdBufSetScissors(context->cmdbuf, 0, &scissor, 1);
+    dkCmdBufBindRasterizerState(context->cmdbuf, &context->state.rasterizer);
+    dkCmdBufBindColorState(context->cmdbuf, &context->state.color);
+    set_vita3k_gxm_uniform_blocks(context);
+    context->visibility_run_count = 0;
+    context->visibility_run_active = false;
+
+    /* Wait until the framebuffer is swapped out before writing to it */
+    if (context->state.fragment_sync_object)
+        dkCmdBufWaitFence(context->cmdbuf, &context->state.fragment_sync_object->fence);
+
+    if (transfer_fence)
+        dkCmdBufWaitFence(context->cmdbuf, transfer_fence);
+
+    if (!depth_stencil) {
+        dkCmdBufClearDepthStencil(context->cmdbuf, true, 1.0f, 0xFF, 0);
+        render_target->shadow_ds_synced_data = NULL;
+    } else {
+        if (!(depth_stencil->zlsControl & SCE_GXM_DEPTH_STENCIL_FORCE_LOAD_ENABLED)) {
+            dkCmdBufClearDepthStencil(context->cmdbuf, true, depth_stencil->backgroundDepth, 0xFF,
+                                      depth_stencil->zlsControl &
+                                          SCE_GXM_DEPTH_STENCIL_BG_CTRL_STENCIL_MASK);
+            render_target->shadow_ds_synced_data = NULL;
+        } else if (multisampled) {
+            /* The 2D engine can't write multisampled surfaces */
+            LOG("Unsupported depth/stencil load to a multisampled render target");
+            dkCmdBufClearDepthStencil(context->cmdbuf, true, depth_stencil->backgroundDepth, 0xFF,
+                                      depth_stencil->zlsControl &
+                                          SCE_GXM_DEPTH_STENCIL_BG_CTRL_STENCIL_MASK);
+            render_target->shadow_ds_synced_data = NULL;
+        } else {
+            load_gxm_ds_surface_to_shadow(context, render_target, depth_stencil);
+        }
+    }
+}
+
+EXPORT(SceGxm, 0x8734FF4E, int, sceGxmBeginScene, SceGxmContext *context, unsigned int flags,
+       const SceGxmRenderTarget *renderTarget, const SceGxmValidRegion *validRegion,
+       SceGxmSyncObject *vertexSyncObject, SceGxmSyncObject *fragmentSyncObject,
+       const SceGxmColorSurface *colorSurface, const SceGxmDepthStencilSurface *depthStencil)
+{
+    SceGxmColorSurfaceInner *color_surface_inner = (SceGxmColorSurfaceInner *)colorSurface;
+    DispatchCmd *cmd;
+    DkFence transfer_fence;
+    bool has_transfer_fence = false;
+
+    if (context->deferred)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+    else if (context->state.in_scene)
+        return SCE_GXM_ERROR_WITHIN_SCENE;
+
+    LOG("sceGxmBeginScene to renderTarget %p, fragmentSyncObject: %p, "
+        "w: %" PRId32 ", h: %" PRId32 ", stride: %" PRId32 ", CPU addr: %p",
+        renderTarget, fragmentSyncObject, color_surface_inner->width, color_surface_inner->height,
+        color_surface_inner->strideInPixels, color_surface_inner->data);
+
+    context->state.vertex_rb.head = 0;
+    context->state.fragment_rb.head = 0;
+    context->state.scene_draw_count = 0;
+    context->staged_vertex_uniform_buffers.valid = false;
+    context->staged_fragment_uniform_buffers.valid = false;
+
+    /* Mark all state as dirty to make sure we bind everything before the first draw call */
+    context->state.dirty.raw = ~(uint32_t)0;
+    context->state.vertex_streams_dirty_mask = ~(uint32_t)0;
+    context->state.render_target = (SceGxmRenderTarget *)renderTarget;
+    context->state.color_surface = color_surface_inner;
+    context->state.ds_surface = depthStencil;
+    context->state.fragment_sync_object = fragmentSyncObject;
+    context->state.in_scene = true;
+
+    if (flags & (SCE_GXM_SCENE_FRAGMENT_TRANSFER_SYNC | SCE_GXM_SCENE_VERTEX_TRANSFER_SYNC))
+        has_transfer_fence = transfer_get_last_fence(&transfer_fence);
+
+    if (context->dispatch) {
+        cmd = dispatch_cmd_alloc(context, DISPATCH_CMD_BEGIN_SCENE);
+        cmd->args.begin_scene.transfer_fence = transfer_fence;
+        cmd->args.begin_scene.has_transfer_fence = has_transfer_fence;
+        dispatch_cmd_submit(context);
+    } else {
+        context_record_begin_scene(context, has_transfer_fence ? &transfer_fence : NULL);
+    }
+
+    return 0;
+}
+
+static void context_record_end_scene(SceGxmContext *context,
+                                     const SceGxmNotification *vertex_notification,
+                                     const SceGxmNotification *fragment_notification)
+{
+    DkCmdList cmd_list;
+    DkVariable variable;
+    DkImage color_surface_image;
+    DkImage ds_surface_image;
+    SceGxmRenderTarget *const render_target = context->state.render_target;
+    SceneCmdBuf *const scene_cmdbuf = &context->scene_cmdbufs[context->scene_cmdbuf_index];
+    const dk_surface_t *const shadow_color_surface = &render_target->shadow_color_surface;
+    const dk_surface_t *const shadow_ds_surface = &render_target->shadow_ds_surface;
+    const bool multisampled = render_target->ms_mode != DkMsMode_1x;
+    const SceGxmColorSurfaceInner *const gxm_color_surface = context->state.color_surface;
+    const SceGxmDepthStencilSurface *const gxm_ds_surface = context->state.ds_surface;
+    const uint32_t rt_width = render_target->params.width;
+    const uint32_t rt_height = render_target->params.height;
+    bool discard_color;
+    bool discard_stencil;
+
+    /* The notifications tell the app the visibility results are ready */
+    context_resolve_visibility(context);
+
+    if (vertex_notification) {
+        dkVariableInitialize(&variable, g_notification_region_memblock,
+                             notification_get_index(vertex_notification) * sizeof(uint32_t));
+        dkCmdBufSignalVariable(context->cmdbuf, &variable, DkVarOp_Set, vertex_notification->value,
+                               DkPipelinePos_Rasterizer);
+    }
+
+    if (fragment_notification) {
+        dkVariableInitialize(&variable, g_notification_region_memblock,
+                             notification_get_index(fragment_notification) * sizeof(uint32_t));
+        dkCmdBufSignalVariable(context->cmdbuf, &variable, DkVarOp_Set,
+                               fragment_notification->value, DkPipelinePos_Bottom);
+    }
+
+    /* Wait for fragments to be completed before the copy/discard */
+    dkCmdBufBarrier(context->cmdbuf, DkBarrier_Fragments, 0);
+
+    /* Check whether we need to discard the color and/or depth/stencil surfaces */
+    discard_color = gxm_color_surface == NULL;
+    discard_stencil = !gxm_ds_surface ||
+                      !(gxm_ds_surface->zlsControl & SCE_GXM_DEPTH_STENCIL_FORCE_STORE_ENABLED);
+    if (!discard_stencil && multisampled) {
+        /* Depth/stencil samples can't be resolved */
+        LOG("Unsupported depth/stencil store from a multisampled render target");
+        discard_stencil = true;
+    }
+
+    /* Copy from the shadow color surface to the GXM color surface */
+    if (discard_color) {
+        dkCmdBufDiscardColor(context->cmdbuf, 0);
+    } else {
+        if (multisampled) {
+            dkCmdBufResolveImage(context->cmdbuf, &render_target->shadow_msaa_color_surface.view,
+                                 &shadow_color_surface->view);
+        }
+        if (dk_image_for_gxm_color_surface(g_dk_device, &color_surface_image, gxm_color_surface)) {
+            LOG("Copying color surface: shadow -> GXM");
+            /* Filter when downscaling from a higher internal resolution */
+            dk_cmdbuf_blit_image(context->cmdbuf, &shadow_color_surface->image,
+                                 context->scene_width, context->scene_height,
+                                 &color_surface_image, gxm_color_surface->width,
+                                 gxm_color_surface->height,
+                                 context->scene_scale_percent != 100 ? DkBlitFlag_FilterLinear
+                                                                     : 0);
+            gpu_write_record(gxm_color_surface->data, context->scene_seq);
+        }
+    }
 
-    shader_patcher_id = malloc(sizeof(*shader_patcher_id));
-    if (!shader_patcher_id)
-        return SCE_KERNEL_ERROR_NO_MEMORY;
+    /* Copy from the shadow depth/stencil surface to the GXM depth/stencil surface */
+    if (discard_stencil) {
+        dkCmdBufDiscardDepthStencil(context->cmdbuf);
+        render_target->shadow_ds_synced_data = NULL;
+    } else {
+        if (dk_image_for_gxm_ds_surface(g_dk_device, &ds_surface_image, rt_width, rt_height,
+                                        gxm_ds_surface)) {
+            LOG("Copying depth/stencil surface: shadow -> GXM");
+            dk_cmdbuf_copy_image(context->cmdbuf, &shadow_ds_surface->image,
+                                 context->scene_width, context->scene_height, &ds_surface_image,
+                                 rt_width, rt_height);
+            render_target->shadow_ds_synced_data = gxm_ds_surface->depthData;
+            render_target->shadow_ds_synced_seq = ++g_ds_store_seq;
+            render_target->shadow_ds_synced_scale_percent = context->scene_scale_percent;
+        } else {
+            render_target->shadow_ds_synced_data = NULL;
+        }
+    }
 
-    memset(shader_patcher_id, 0, sizeof(*shader_patcher_id));
-    shader_patcher_id->programHeader = programHeader;
+    context_report_scene_timestamp(context, 1);
+    cmd_list = dkCmdBufFinishList(context->cmdbuf);
+    dkQueueSubmitCommands(context->queue, cmd_list);
+
+    /* Signal fences when rendering and copying finishes */
+    dkQueueSignalFence(context->queue, &scene_cmdbuf->fence, false);
+    scene_cmdbuf->submitted = true;
+    scene_seq_submit(context->scene_seq, &scene_cmdbuf->fence);
+    if (context->state.fragment_sync_object)
+        dkQueueSignalFence(context->queue, &context->state.fragment_sync_object->fence, true);
+
+    /* Transfers synchronized with rendering wait for this one */
+    mutexLock(&g_transfer_lock);
+    g_last_scene_fence = scene_cmdbuf->fence;
+    g_last_scene_fence_valid = true;
+    mutexUnlock(&g_transfer_lock);
+
+    /* Remember which fence produces each notification value, so waits don't drain the queue */
+    if (vertex_notification)
+        notification_record_fence(context->queue, vertex_notification);
+    if (fragment_notification)
+        notification_record_fence(context->queue, fragment_notification);
+
+    dkQueueFlush(context->queue);
+}
 
-    shaderPatcher->registered_programs =
-        reallocarray(shaderPatcher->registered_programs, shaderPatcher->registered_count + 1,
-                     sizeof(SceGxmShaderPatcherId));
-    shaderPatcher->registered_programs[shaderPatcher->registered_count] = shader_patcher_id;
-    shaderPatcher->registered_count++;
+EXPORT(SceGxm, 0xFE300E2F, int, sceGxmEndScene, SceGxmContext *context,
+       const SceGxmNotification *vertexNotification, const SceGxmNotification *fragmentNotification)
+{
+    DispatchCmd *cmd;
 
-    *programId = shader_patcher_id;
+    LOG("sceGxmEndScene");
+
+    if (context->deferred)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+    else if (!context->state.in_scene)
+        return SCE_GXM_ERROR_NOT_WITHIN_SCENE;
+
+    if (context->dispatch) {
+        /* The notifications might live on the stack: pass them by value */
+        cmd = dispatch_cmd_alloc(context, DISPATCH_CMD_END_SCENE);
+        cmd->args.end_scene.has_vertex_notification = vertexNotification != NULL;
+        if (vertexNotification)
+            cmd->args.end_scene.vertex_notification = *vertexNotification;
+        cmd->args.end_scene.has_fragment_notification = fragmentNotification != NULL;
+        if (fragmentNotification)
+            cmd->args.end_scene.fragment_notification = *fragmentNotification;
+        dispatch_cmd_submit(context);
+    } else {
+        context_record_end_scene(context, vertexNotification, fragmentNotification);
+    }
+
+    context->state.in_scene = false;
 
     return 0;
 }
 
-EXPORT(SceGxm, 0xF103AF8A, int, sceGxmShaderPatcherUnregisterProgram,
-       SceGxmShaderPatcher *shaderPatcher, SceGxmShaderPatcherId programId)
+EXPORT(SceGxm, 0x944D3F83, int, sceGxmBeginCommandList, SceGxmContext *deferredContext)
 {
-    free(programId);
+    if (!deferredContext)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+    else if (!deferredContext->deferred)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+    else if (deferredContext->state.in_scene)
+        return SCE_GXM_ERROR_WITHIN_SCENE;
+
+    /* The list can't rely on any state: the immediate context might have changed it */
+    dkCmdBufBindRasterizerState(deferredContext->cmdbuf, &deferredContext->state.rasterizer);
+    dkCmdBufBindColorState(deferredContext->cmdbuf, &deferredContext->state.color);
+    deferredContext->state.dirty.raw = ~(uint32_t)0;
+    deferredContext->state.vertex_streams_dirty_mask = ~(uint32_t)0;
+    deferredContext->state.scene_draw_count = 0;
+    deferredContext->state.in_scene = true;
+    /* The memory of the previous lists' copies may get reused once they have run */
+    deferredContext->staged_vertex_uniform_buffers.valid = false;
+    deferredContext->staged_fragment_uniform_buffers.valid = false;
+    deferredContext->scene_seq = scene_seq_next();
+    deferredContext->list_resources = command_list_resources_create(deferredContext->scene_seq);
+    deferredContext->cmdbuf_reserve_failures = 0;
+
     return 0;
 }
 
-static int translate_shader(DkShader *shader, const SceGxmProgram *program, pipeline_stage stage,
-                            const char *prefix, DkMemBlock code_memblock, uint32_t *code_offset,
-                            const SceGxmVertexAttribute *attributes, unsigned int attributeCount)
+EXPORT(SceGxm, 0x36D85916, int, sceGxmEndCommandList, SceGxmContext *deferredContext,
+       SceGxmCommandList *commandList)
 {
-    bool ret;
-    char *glsl;
-    uint32_t shader_size;
-    DkShaderMaker shader_maker;
-    void *shader_load_addr = dkMemBlockGetCpuAddr(code_memblock) + *code_offset;
+    SceGxmCommandListInner *command_list_inner = (SceGxmCommandListInner *)commandList;
+    CommandListResources *resources;
+    DkCmdList dk_cmd_list;
+    uint32_t i;
 
-#if DUMP_SHADER_SPIRV
-    uint32_t *spirv;
-    uint32_t num_instr;
+    if (!deferredContext || !commandList)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+    else if (!deferredContext->deferred)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+    else if (!deferredContext->state.in_scene)
+        return SCE_GXM_ERROR_NOT_WITHIN_SCENE;
 
-    ret = convert_gxp_to_spirv_c(&spirv, &num_instr, program, prefix, false, false, false, false,
-                                 attributes, attributeCount, false, false, SHADER_DUMP_CB);
-    if (ret) {
-        dump_shader_spirv(prefix, spirv, num_instr);
-        free(spirv);
+    dk_cmd_list = dkCmdBufFinishList(deferredContext->cmdbuf);
+    deferredContext->state.in_scene = false;
+    resources = deferredContext->list_resources;
+    deferredContext->list_resources = NULL;
+
+    /* Part of the list went to memory the application didn't provide: it's not usable */
+    if (deferredContext->cmdbuf_reserve_failures) {
+        command_list_resources_release(resources);
+        return SCE_GXM_ERROR_RESERVE_FAILED;
     }
-#endif
 
-    LOG("Converting shader (%s) to GLSL...", prefix);
-    ret = convert_gxp_to_glsl_c(&glsl, program, prefix, false, false, false, false, attributes,
-                                attributeCount, false, false, SHADER_DUMP_CB);
-    LOG("  ret: %d", ret);
-#if DUMP_SHADER_GLSL
-    if (ret)
-        dump_shader_glsl(prefix, glsl);
+    /* Ending a list into the same memory means the previous one won't be executed again */
+    resources->list = commandList;
+    for (i = 0; i < deferredContext->ended_list_count; i++) {
+        if (deferredContext->ended_lists[i]->list == commandList)
+            break;
+    }
+    if (i < deferredContext->ended_list_count) {
+        command_list_resources_release(deferredContext->ended_lists[i]);
+    } else {
+        deferredContext->ended_lists =
+            realloc(deferredContext->ended_lists, (i + 1) * sizeof(CommandListResources *));
+        assert(deferredContext->ended_lists);
+        deferredContext->ended_list_count++;
+    }
+    deferredContext->ended_lists[i] = resources;
+
+    command_list_inner->dk_cmd_list = dk_cmd_list;
+    command_list_inner->resources = resources;
+    FRAME_STATS_ADD(command_lists, 1);
+
+    return 0;
+}
+
+static void context_record_execute_command_list(SceGxmContext *context, DkCmdList cmd_list,
+                                                CommandListResources *resources)
+{
+    /* Its resources must outlive this scene */
+    __atomic_store_n(&resources->last_use_seq, context->scene_seq, __ATOMIC_RELAXED);
+    command_list_resources_release(resources);
+
+    /* The command list draws aren't visibility tested */
+    context_end_visibility_run(context);
+
+    /* Splice the command list in between what has been recorded so far and the rest of the scene */
+    dkQueueSubmitCommands(context->queue, dkCmdBufFinishList(context->cmdbuf));
+    dkQueueSubmitCommands(context->queue, cmd_list);
+
+    /* Restore the state the command list might have changed */
+    dkCmdBufBindRasterizerState(context->cmdbuf, &context->state.rasterizer);
+    dkCmdBufBindColorState(context->cmdbuf, &context->state.color);
+    context->state.dirty.raw = ~(uint32_t)0;
+    context->state.vertex_streams_dirty_mask = ~(uint32_t)0;
+}
+
+EXPORT(SceGxm, 0xE9E81073, int, sceGxmExecuteCommandList, SceGxmContext *context,
+       SceGxmCommandList *commandList)
+{
+    const SceGxmCommandListInner *command_list_inner = (SceGxmCommandListInner *)commandList;
+    DispatchCmd *cmd;
+
+    if (!context || !commandList)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+    else if (context->deferred)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+    else if (!context->state.in_scene)
+        return SCE_GXM_ERROR_NOT_WITHIN_SCENE;
+
+    /* The list may be ended again or destroyed before the translator thread gets to it */
+    __atomic_add_fetch(&command_list_inner->resources->refs, 1, __ATOMIC_RELAXED);
+
+    if (context->dispatch) {
+        cmd = dispatch_cmd_alloc(context, DISPATCH_CMD_EXECUTE_COMMAND_LIST);
+        cmd->args.execute_command_list.cmd_list = command_list_inner->dk_cmd_list;
+        cmd->args.execute_command_list.resources = command_list_inner->resources;
+        dispatch_cmd_submit(context);
+    } else {
+        context_record_execute_command_list(context, command_list_inner->dk_cmd_list,
+                                            command_list_inner->resources);
+    }
+
+    return 0;
+}
+
+static void frame_stats_report_display_queue(void)
+{
+    const uint32_t flips = __atomic_exchange_n(&g_display_queue->flips, 0, __ATOMIC_RELAXED);
+    const uint64_t latency_ns =
+        __atomic_exchange_n(&g_display_queue->flip_latency_ns, 0, __ATOMIC_RELAXED);
+
+    LOG_DEBUG("Frame stats: display queue max depth: %" PRIu32 ", flips: %" PRIu32
+              ", average flip latency: %" PRIu64 " us",
+              FRAME_STATS_TAKE(display_queue_max_depth), flips,
+              flips ? latency_ns / flips / 1000 : 0);
+}
+
+/* Picks the internal resolution of the next scenes from the GPU time of the last frame */
+static void resolution_scale_update(void)
+{
+    const uint64_t gpu_ns = __atomic_exchange_n(&g_gpu_frame_ns, 0, __ATOMIC_RELAXED);
+#if DYNAMIC_RESOLUTION
+    const uint64_t budget_ns = DYNAMIC_RESOLUTION_BUDGET_US * 1000ull;
+    uint32_t percent = g_resolution_scale_percent;
+
+    /* Only scale back up with some headroom, so the resolution doesn't oscillate */
+    if (gpu_ns > budget_ns)
+        percent = MAX2(percent - DYNAMIC_RESOLUTION_STEP_PERCENT, DYNAMIC_RESOLUTION_MIN_PERCENT);
+    else if (gpu_ns < budget_ns * 3 / 4)
+        percent = MIN2(percent + DYNAMIC_RESOLUTION_STEP_PERCENT, RESOLUTION_SCALE_PERCENT);
+    __atomic_store_n(&g_resolution_scale_percent, percent, __ATOMIC_RELAXED);
 #endif
-    if (!ret)
+
+    FRAME_STATS_ADD(gpu_ns, gpu_ns);
+}
+
+static void frame_stats_report_and_reset(void)
+{
+    LOG_DEBUG("Frame stats: DS loads: %" PRIu32 " (skipped: %" PRIu32 ")",
+              FRAME_STATS_TAKE(ds_loads), FRAME_STATS_TAKE(ds_loads_skipped));
+    LOG_DEBUG("Frame stats: clears replaced: %" PRIu32, FRAME_STATS_TAKE(clears_replaced));
+    LOG_DEBUG("Frame stats: notification waits: %" PRIu32 " (already signalled: %" PRIu32
+              "), wait time: %" PRIu64 " us",
+              FRAME_STATS_TAKE(notification_waits), FRAME_STATS_TAKE(notification_waits_signalled),
+              FRAME_STATS_TAKE(notification_wait_ns) / 1000);
+    LOG_DEBUG("Frame stats: transfers: %" PRIu32 ", transferred: %" PRIu64
+              " KiB, GPU transfer time: %" PRIu64 " us",
+              FRAME_STATS_TAKE(transfers), FRAME_STATS_TAKE(transfer_bytes) / 1024,
+              FRAME_STATS_TAKE(transfer_gpu_ns) / 1000);
+    LOG_DEBUG("Frame stats: visibility runs: %" PRIu32, FRAME_STATS_TAKE(visibility_runs));
+    LOG_DEBUG("Frame stats: texture uploads: %" PRIu32 ", uploaded: %" PRIu64
+              " KiB, PVRTC decodes: %" PRIu32 " (%" PRIu64 " us), prefetched: %" PRIu32,
+              FRAME_STATS_TAKE(texture_uploads), FRAME_STATS_TAKE(texture_upload_bytes) / 1024,
+              FRAME_STATS_TAKE(texture_decodes), FRAME_STATS_TAKE(texture_decode_ns) / 1000,
+              FRAME_STATS_TAKE(texture_prefetch_hits));
+    LOG_DEBUG("Frame stats: texture cache hits: %" PRIu32 ", misses: %" PRIu32
+              ", invalidations: %" PRIu32,
+              FRAME_STATS_TAKE(texture_cache_hits), FRAME_STATS_TAKE(texture_cache_misses),
+              FRAME_STATS_TAKE(texture_cache_invalidations));
+    LOG_DEBUG("Frame stats: descriptors built: %" PRIu32 ", set overflows: %" PRIu32,
+              FRAME_STATS_TAKE(descriptors_built), FRAME_STATS_TAKE(descriptor_set_overflows));
+    LOG_DEBUG("Frame stats: index buffer conversions: %" PRIu32,
+              FRAME_STATS_TAKE(index_conversions));
+    LOG_DEBUG("Frame stats: immediate draws: %" PRIu32 " (%" PRIu64 " us), command lists: %" PRIu32
+              ", command list draws: %" PRIu32 " (%" PRIu64 " us, summed over all threads)",
+              FRAME_STATS_TAKE(draws), FRAME_STATS_TAKE(draw_ns) / 1000,
+              FRAME_STATS_TAKE(command_lists), FRAME_STATS_TAKE(command_list_draws),
+              FRAME_STATS_TAKE(command_list_draw_ns) / 1000);
+    LOG_DEBUG("Frame stats: GPU scene time: %" PRIu64 " us, resolution scale: %" PRIu32 "%%",
+              FRAME_STATS_TAKE(gpu_ns) / 1000, g_resolution_scale_percent);
+    frame_stats_report_display_queue();
+
+    if (g_dispatch_context) {
+        LOG_DEBUG("Frame stats: dispatched commands: %" PRIu32 ", translation: %" PRIu64
+                  " us, game thread waits: %" PRIu64 " us",
+                  FRAME_STATS_TAKE(dispatch_cmds),
+                  __atomic_exchange_n(&g_dispatch_context->dispatch->translate_ns, 0,
+                                      __ATOMIC_RELAXED) /
+                      1000,
+                  FRAME_STATS_TAKE(dispatch_wait_ns) / 1000);
+    }
+}
+
+static int SceGxmDisplayQueue_thread(SceSize args, void *argp)
+{
+    DisplayQueueControlBlock *queue = *(DisplayQueueControlBlock **)argp;
+    DisplayQueueEntry *entry;
+
+    ueventSignal(&queue->ready_evflag);
+
+    while (!__atomic_load_n(&queue->exit_thread, __ATOMIC_RELAXED)) {
+        while (CIRC_CNT(__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE), queue->tail,
+                        queue->num_entries) > 0) {
+            if (__atomic_load_n(&queue->exit_thread, __ATOMIC_RELAXED))
+                break;
+
+            /* Get the first pending framebuffer swap */
+            entry = &queue->entries[queue->tail];
+
+            /* Wait until rendering finishes */
+            dkFenceWait(&entry->new_fence, -1);
+
+            /* Call the user-specified callback: this sets the new framebuffer */
+            queue->display_queue_callback(entry->callback_data);
+
+            /* Signal that the old buffer has swapped out, so it can be rendered to again */
+            dkVariableSignal(&queue->flip_variable, DkVarOp_Set, entry->seq);
+
+            __atomic_fetch_add(&queue->flips, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&queue->flip_latency_ns,
+                               armTicksToNs(armGetSystemTick() - entry->queued_tick),
+                               __ATOMIC_RELAXED);
+
+            __atomic_store_n(&queue->tail, (queue->tail + 1) & (queue->num_entries - 1),
+                             __ATOMIC_RELEASE);
+            ueventSignal(&queue->ready_evflag);
+        }
+
+        if (__atomic_load_n(&queue->exit_thread, __ATOMIC_RELAXED))
+            break;
+
+        waitSingle(waiterForUEvent(&queue->pending_evflag), -1);
+    }
+
+    return 0;
+}
+
+/* Submits the oldest reserved entry, once the scenes rendering to the new buffer are submitted */
+static void display_queue_submit_entry(SceGxmSyncObject *old_buffer, SceGxmSyncObject *new_buffer)
+{
+    DisplayQueueControlBlock *queue = g_display_queue;
+    DisplayQueueEntry *entry = &queue->entries[queue->head];
+
+    entry->new_fence = new_buffer->fence;
+
+    /*
+     * Scenes rendering to the old buffer wait on its sync object: replace its fence with one
+     * that only gets signalled once the flip has happened.
+     */
+    if (old_buffer) {
+        if (entry->submitted)
+            dkFenceWait(&entry->cmdbuf_fence, -1);
+        dkCmdBufClear(entry->cmdbuf);
+        dkCmdBufWaitVariable(entry->cmdbuf, &queue->flip_variable, DkVarCompareOp_Sequential,
+                             entry->seq);
+        dkQueueSubmitCommands(queue->dk_queue, dkCmdBufFinishList(entry->cmdbuf));
+        dkQueueSignalFence(queue->dk_queue, &entry->cmdbuf_fence, false);
+        dkQueueSignalFence(queue->dk_queue, &old_buffer->fence, true);
+        dkQueueFlush(queue->dk_queue);
+        entry->submitted = true;
+    }
+
+    __atomic_store_n(&queue->head, (queue->head + 1) & (queue->num_entries - 1),
+                     __ATOMIC_RELEASE);
+    ueventSignal(&queue->pending_evflag);
+}
+
+EXPORT(SceGxm, 0xEC5C26B5, int, sceGxmDisplayQueueAddEntry, SceGxmSyncObject *oldBuffer,
+       SceGxmSyncObject *newBuffer, const void *callbackData)
+{
+    DisplayQueueControlBlock *queue = g_display_queue;
+    DisplayQueueEntry *entry;
+    DispatchCmd *cmd;
+    uint32_t depth;
+
+    LOG("sceGxmDisplayQueueAddEntry: old: %p, new: %p", oldBuffer, newBuffer);
+
+    resolution_scale_update();
+    frame_stats_report_and_reset();
+
+    /* Throttle down if we already have enough pending display queue entries */
+    while ((depth = CIRC_CNT(queue->reserved, __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE),
+                             queue->num_entries)) == queue->display_queue_max_pending_count) {
+        waitSingle(waiterForUEvent(&queue->ready_evflag), -1);
+    }
+    /* Only the game thread updates it */
+    g_frame_stats.display_queue_max_depth = MAX2(g_frame_stats.display_queue_max_depth, depth + 1);
+
+    entry = &queue->entries[queue->reserved];
+    entry->seq = ++queue->flip_seq;
+    entry->queued_tick = armGetSystemTick();
+    memcpy(entry->callback_data, callbackData, queue->display_queue_callback_data_size);
+    queue->reserved = (queue->reserved + 1) & (queue->num_entries - 1);
+
+    /*
+     * The fence of the new buffer gets signalled by the translator thread's submission of the
+     * scene: queue the flip behind it rather than waiting for the translator thread to catch up
+     */
+    if (g_dispatch_context) {
+        cmd = dispatch_cmd_alloc(g_dispatch_context, DISPATCH_CMD_DISPLAY_QUEUE_ADD_ENTRY);
+        cmd->args.display_queue_add_entry.old_buffer = oldBuffer;
+        cmd->args.display_queue_add_entry.new_buffer = newBuffer;
+        dispatch_cmd_submit(g_dispatch_context);
+    } else {
+        display_queue_submit_entry(oldBuffer, newBuffer);
+    }
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xB98C5B0D, int, sceGxmDisplayQueueFinish, void)
+{
+    DisplayQueueControlBlock *queue = g_display_queue;
+
+    while (CIRC_CNT(queue->reserved, __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE),
+                    queue->num_entries) > 0)
+        waitSingle(waiterForUEvent(&queue->ready_evflag), -1);
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x31FF8ABD, void, sceGxmSetVertexProgram, SceGxmContext *context,
+       const SceGxmVertexProgram *vertexProgram)
+{
+    context->state.vertex_program = vertexProgram;
+    context->state.dirty.bit.vertex_shader = true;
+}
+
+EXPORT(SceGxm, 0xAD2F48D9, void, sceGxmSetFragmentProgram, SceGxmContext *context,
+       const SceGxmFragmentProgram *fragmentProgram)
+{
+    const uint32_t mask =
+        ((fragmentProgram->blendInfo.colorMask & SCE_GXM_COLOR_MASK_R) ? DkColorMask_R : 0) |
+        ((fragmentProgram->blendInfo.colorMask & SCE_GXM_COLOR_MASK_G) ? DkColorMask_G : 0) |
+        ((fragmentProgram->blendInfo.colorMask & SCE_GXM_COLOR_MASK_B) ? DkColorMask_B : 0) |
+        ((fragmentProgram->blendInfo.colorMask & SCE_GXM_COLOR_MASK_A) ? DkColorMask_A : 0);
+
+    dkColorWriteStateSetMask(&context->state.color_write, 0, mask);
+    context->state.dirty.bit.color_write = true;
+
+    context->state.fragment_program = fragmentProgram;
+    context->state.dirty.bit.fragment_shader = true;
+}
+
+EXPORT(SceGxm, 0x29C34DF5, int, sceGxmSetFragmentTexture, SceGxmContext *context,
+       unsigned int textureIndex, const SceGxmTexture *texture)
+{
+    context->state.fragment_textures[textureIndex] = *(SceGxmTextureInner *)texture;
+    context->state.dirty.bit.fragment_textures = true;
+    context->dispatch_state_dirty |= 1u << (DISPATCH_STATE_FRAGMENT_TEXTURE0 + textureIndex);
+    return 0;
+}
+
+EXPORT(SceGxm, 0x895DF2E9, int, sceGxmSetVertexStream, SceGxmContext *context,
+       unsigned int streamIndex, const void *streamData)
+{
+    if (streamIndex >= SCE_GXM_MAX_VERTEX_STREAMS)
         return SCE_GXM_ERROR_INVALID_VALUE;
 
-    LOG("UAM compiling shader (%s)...", prefix);
-    ret = uam_compiler_compile_glsl(stage, glsl, shader_load_addr, &shader_size);
-    LOG("  compile ret: %d, size: 0x%x", ret, shader_size);
-    free(glsl);
+    /* Bound on the next draw call */
+    context->state.vertex_streams[streamIndex] = streamData;
+    context->state.vertex_streams_dirty_mask |= 1u << streamIndex;
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0x8FA3F9C3, unsigned int, sceGxmProgramGetDefaultUniformBufferSize,
+       const SceGxmProgram *program)
+{
+    return program->default_uniform_buffer_count * sizeof(float);
+}
+
+EXPORT(SceGxm, 0xC697CAE5, int, sceGxmSetVertexDefaultUniformBuffer, SceGxmContext *context,
+       const void *uniformBuffer)
+{
+    VitaMemBlockInfo *block;
+    uint32_t offset;
+
+    block = SceSysmem_get_vita_memblock_info_for_addr(uniformBuffer);
+    if (!block)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    offset = (uintptr_t)uniformBuffer - (uintptr_t)block->base;
+
+    context->state.vertex_default_uniform.cpu_addr =
+        dkMemBlockGetCpuAddr(block->dk_memblock) + offset;
+    context->state.vertex_default_uniform.gpu_addr =
+        dkMemBlockGetGpuAddr(block->dk_memblock) + offset;
+    context->state.dirty.bit.vertex_default_uniform = true;
+
+    return 0;
+}
+
+static uint32_t context_ring_buffer_align(const ContextRingBuffer *rb, uint32_t head,
+                                          uint32_t alignment)
+{
+    const uint32_t addr = dkMemBlockGetGpuAddr(rb->memblock) + rb->offset + head;
+
+    /* Only the low bits of the GPU address matter for the alignment */
+    return head + (-addr & (alignment - 1));
+}
+
+static int context_ring_buffer_alloc(SceGxmContext *context, ContextRingBuffer *rb, uint32_t *head,
+                                     SceGxmDeferredContextCallback *callback, uint32_t size,
+                                     uint32_t alignment, void **cpu_addr, DkGpuAddr *gpu_addr)
+{
+    uint32_t start = context_ring_buffer_align(rb, *head, alignment);
+    uint32_t granted_size;
+    void *mem;
+
+    if (start + size > rb->size) {
+        if (!context->deferred) {
+            start = context_ring_buffer_align(rb, 0, alignment);
+            if (start + size > rb->size)
+                return SCE_GXM_ERROR_RESERVE_FAILED;
+            rb->wraps++;
+        } else {
+            /* Deferred contexts can't wrap around: their command lists may not have run yet */
+            mem = callback(context->deferred_params.userData, size + alignment - 1,
+                           &granted_size);
+            if (!mem || granted_size < size + alignment - 1)
+                return SCE_GXM_ERROR_RESERVE_FAILED;
+
+            rb->memblock = SceSysmem_get_dk_memblock_for_addr(mem);
+            if (!rb->memblock)
+                return SCE_GXM_ERROR_INVALID_VALUE;
+
+            rb->offset = dk_memblock_cpu_addr_offset(rb->memblock, mem);
+            rb->size = granted_size;
+            start = context_ring_buffer_align(rb, 0, alignment);
+        }
+    }
 
-    dkShaderMakerDefaults(&shader_maker, code_memblock, *code_offset);
-    dkShaderInitialize(shader, &shader_maker);
-    *code_offset += ALIGN(shader_size, DK_SHADER_CODE_ALIGNMENT);
+    *cpu_addr = dkMemBlockGetCpuAddr(rb->memblock) + rb->offset + start;
+    *gpu_addr = dkMemBlockGetGpuAddr(rb->memblock) + rb->offset + start;
+    *head = start + size;
 
     return 0;
 }
 
-EXPORT(SceGxm, 0xB7BBA6D5, int, sceGxmShaderPatcherCreateVertexProgram,
-       SceGxmShaderPatcher *shaderPatcher, SceGxmShaderPatcherId programId,
-       const SceGxmVertexAttribute *attributes, unsigned int attributeCount,
-       const SceGxmVertexStream *streams, unsigned int streamCount,
-       SceGxmVertexProgram **vertexProgram)
+static uint32_t default_uniform_buffer_alignment(bool ubo)
+{
+    return ubo ? DK_UNIFORM_BUF_ALIGNMENT : sizeof(float);
+}
+
+EXPORT(SceGxm, 0x97118913, int, sceGxmReserveVertexDefaultUniformBuffer, SceGxmContext *context,
+       void **uniformBuffer)
 {
+    const SceGxmProgram *program;
+    uint32_t size;
     int ret;
-    SceGxmVertexProgram *vertex_program;
 
-    vertex_program = malloc(sizeof(*vertex_program));
-    if (!vertex_program)
-        return SCE_KERNEL_ERROR_NO_MEMORY;
+    if (!context->state.in_scene)
+        return SCE_GXM_ERROR_NOT_WITHIN_SCENE;
+    else if (!context->state.vertex_program)
+        return SCE_GXM_ERROR_NULL_PROGRAM;
 
-    memset(vertex_program, 0, sizeof(*vertex_program));
-    vertex_program->programId = programId;
-    vertex_program->attributes = calloc(attributeCount, sizeof(SceGxmVertexAttribute));
-    memcpy(vertex_program->attributes, attributes, attributeCount * sizeof(SceGxmVertexAttribute));
-    vertex_program->attributeCount = attributeCount;
-    vertex_program->streams = calloc(streamCount, sizeof(SceGxmVertexStream));
-    memcpy(vertex_program->streams, streams, streamCount * sizeof(SceGxmVertexStream));
-    vertex_program->streamCount = streamCount;
+    program = context->state.vertex_program->programId->programHeader;
+    size = program->default_uniform_buffer_count * sizeof(float);
+    if (size == 0) {
+        *uniformBuffer = NULL;
+        return 0;
+    }
 
-    ret = translate_shader(&vertex_program->dk_shader, programId->programHeader,
-                           pipeline_stage_vertex, "vert", g_code_memblock, &g_code_mem_offset,
-                           attributes, attributeCount);
-    if (ret != 0) {
-        free(vertex_program);
-        return ret;
+    /* Uniform buffer bindings cover whole DK_UNIFORM_BUF_ALIGNMENT blocks */
+    if (context->state.vertex_program->default_uniform_ubo)
+        size = ALIGN(size, DK_UNIFORM_BUF_ALIGNMENT);
+
+    if (context->state.vertex_default_uniform.allocated) {
+        *uniformBuffer = context->state.vertex_default_uniform.cpu_addr;
+        return 0;
     }
 
-    *vertexProgram = vertex_program;
+    ret = context_ring_buffer_alloc(
+        context, &context->vertex_rb, &context->state.vertex_rb.head,
+        context->deferred_params.vertexCallback, size,
+        default_uniform_buffer_alignment(context->state.vertex_program->default_uniform_ubo),
+        &context->state.vertex_default_uniform.cpu_addr,
+        &context->state.vertex_default_uniform.gpu_addr);
+    if (ret != 0)
+        return ret;
+
+    *uniformBuffer = context->state.vertex_default_uniform.cpu_addr;
+    context->state.vertex_default_uniform.allocated = true;
+    context->state.dirty.bit.vertex_default_uniform = true;
 
     return 0;
 }
 
-EXPORT(SceGxm, 0xAC1FF2DA, int, sceGxmShaderPatcherReleaseVertexProgram,
-       SceGxmShaderPatcher *shaderPatcher, SceGxmVertexProgram *vertexProgram)
+EXPORT(SceGxm, 0xA824EB24, int, sceGxmSetFragmentDefaultUniformBuffer, SceGxmContext *context,
+       const void *uniformBuffer)
 {
-    free(vertexProgram->attributes);
-    free(vertexProgram->streams);
-    free(vertexProgram);
+    VitaMemBlockInfo *block;
+    uint32_t offset;
+
+    block = SceSysmem_get_vita_memblock_info_for_addr(uniformBuffer);
+    if (!block)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    offset = (uintptr_t)uniformBuffer - (uintptr_t)block->base;
+
+    context->state.fragment_default_uniform.cpu_addr =
+        dkMemBlockGetCpuAddr(block->dk_memblock) + offset;
+    context->state.fragment_default_uniform.gpu_addr =
+        dkMemBlockGetGpuAddr(block->dk_memblock) + offset;
+    context->state.dirty.bit.fragment_default_uniform = true;
+
     return 0;
 }
 
-EXPORT(SceGxm, 0x4ED2E49D, int, sceGxmShaderPatcherCreateFragmentProgram,
-       SceGxmShaderPatcher *shaderPatcher, SceGxmShaderPatcherId programId,
-       SceGxmOutputRegisterFormat outputFormat, SceGxmMultisampleMode multisampleMode,
-       const SceGxmBlendInfo *blendInfo, const SceGxmProgram *vertexProgram,
-       SceGxmFragmentProgram **fragmentProgram)
+EXPORT(SceGxm, 0x7B1FABB6, int, sceGxmReserveFragmentDefaultUniformBuffer, SceGxmContext *context,
+       void **uniformBuffer)
 {
+    const SceGxmProgram *program;
+    uint32_t size;
     int ret;
-    SceGxmFragmentProgram *fragment_program;
 
-    fragment_program = malloc(sizeof(*fragment_program));
-    if (!fragment_program)
-        return SCE_KERNEL_ERROR_NO_MEMORY;
+    if (!context->state.in_scene)
+        return SCE_GXM_ERROR_NOT_WITHIN_SCENE;
+    else if (!context->state.fragment_program)
+        return SCE_GXM_ERROR_NULL_PROGRAM;
 
-    memset(fragment_program, 0, sizeof(*fragment_program));
-    fragment_program->programId = programId;
-    fragment_program->outputFormat = outputFormat;
-    fragment_program->multisampleMode = multisampleMode;
-    if (blendInfo) {
-        fragment_program->blendInfo = *blendInfo;
-    } else {
-        fragment_program->blendInfo = (SceGxmBlendInfo){
-            SCE_GXM_COLOR_MASK_ALL,    SCE_GXM_BLEND_FUNC_NONE,   SCE_GXM_BLEND_FUNC_NONE,
-            SCE_GXM_BLEND_FACTOR_ONE,  SCE_GXM_BLEND_FACTOR_ZERO, SCE_GXM_BLEND_FACTOR_ONE,
-            SCE_GXM_BLEND_FACTOR_ZERO,
-        };
+    program = context->state.fragment_program->programId->programHeader;
+    size = program->default_uniform_buffer_count * sizeof(float);
+    if (size == 0) {
+        *uniformBuffer = NULL;
+        return 0;
     }
 
-    ret = translate_shader(&fragment_program->dk_shader, programId->programHeader,
-                           pipeline_stage_fragment, "frag", g_code_memblock, &g_code_mem_offset,
-                           NULL, 0);
-    if (ret != 0) {
-        free(fragment_program);
-        return ret;
+    /* Uniform buffer bindings cover whole DK_UNIFORM_BUF_ALIGNMENT blocks */
+    if (context->state.fragment_program->default_uniform_ubo)
+        size = ALIGN(size, DK_UNIFORM_BUF_ALIGNMENT);
+
+    if (context->state.fragment_default_uniform.allocated) {
+        *uniformBuffer = context->state.fragment_default_uniform.cpu_addr;
+        return 0;
     }
 
-    *fragmentProgram = fragment_program;
+    ret = context_ring_buffer_alloc(
+        context, &context->fragment_rb, &context->state.fragment_rb.head,
+        context->deferred_params.fragmentCallback, size,
+        default_uniform_buffer_alignment(context->state.fragment_program->default_uniform_ubo),
+        &context->state.fragment_default_uniform.cpu_addr,
+        &context->state.fragment_default_uniform.gpu_addr);
+    if (ret != 0)
+        return ret;
+
+    *uniformBuffer = context->state.fragment_default_uniform.cpu_addr;
+    context->state.fragment_default_uniform.allocated = true;
+    context->state.dirty.bit.fragment_default_uniform = true;
 
     return 0;
 }
 
-EXPORT(SceGxm, 0xBE2743D1, int, sceGxmShaderPatcherReleaseFragmentProgram,
-       SceGxmShaderPatcher *shaderPatcher, SceGxmFragmentProgram *fragmentProgram)
+EXPORT(SceGxm, 0xC68015E4, int, sceGxmSetVertexUniformBuffer, SceGxmContext *context,
+       unsigned int bufferIndex, const void *bufferData)
 {
-    free(fragmentProgram);
+    if (bufferIndex >= SCE_GXM_MAX_UNIFORM_BUFFERS)
+        return SCE_GXM_ERROR_INVALID_VALUE;
+
+    /* Read on the next draw call */
+    context->state.vertex_uniform_buffers[bufferIndex] = bufferData;
+
     return 0;
 }
 
-EXPORT(SceGxm, 0xA949A803, const SceGxmProgram *, sceGxmShaderPatcherGetProgramFromId,
-       SceGxmShaderPatcherId programId)
+EXPORT(SceGxm, 0xEA0FC310, int, sceGxmSetFragmentUniformBuffer, SceGxmContext *context,
+       unsigned int bufferIndex, const void *bufferData)
 {
-    if (programId)
-        return programId->programHeader;
+    if (bufferIndex >= SCE_GXM_MAX_UNIFORM_BUFFERS)
+        return SCE_GXM_ERROR_INVALID_VALUE;
 
-    return NULL;
+    /* Read on the next draw call */
+    context->state.fragment_uniform_buffers[bufferIndex] = bufferData;
+
+    return 0;
 }
 
-EXPORT(SceGxm, 0xB291C959, int, sceGxmGetRenderTargetMemSize,
-       const SceGxmRenderTargetParams *params, unsigned int *driverMemSize)
+static void uniform_data_convert(void *dst, const float *src, uint32_t count,
+                                 SceGxmParameterType type)
 {
-    *driverMemSize = sizeof(SceGxmRenderTarget);
-    return 0;
+    switch (type) {
+    case SCE_GXM_PARAMETER_TYPE_F32:
+        memcpy(dst, src, count * sizeof(float));
+        break;
+    case SCE_GXM_PARAMETER_TYPE_F16:
+        gxm_uniform_convert_f16(dst, src, count);
+        break;
+    case SCE_GXM_PARAMETER_TYPE_U32:
+        gxm_uniform_convert_u32(dst, src, count);
+        break;
+    case SCE_GXM_PARAMETER_TYPE_S32:
+        gxm_uniform_convert_s32(dst, src, count);
+        break;
+    case SCE_GXM_PARAMETER_TYPE_U16:
+        gxm_uniform_convert_u16(dst, src, count);
+        break;
+    case SCE_GXM_PARAMETER_TYPE_S16:
+        gxm_uniform_convert_s16(dst, src, count);
+        break;
+    case SCE_GXM_PARAMETER_TYPE_U8:
+        gxm_uniform_convert_u8(dst, src, count);
+        break;
+    case SCE_GXM_PARAMETER_TYPE_S8:
+        gxm_uniform_convert_s8(dst, src, count);
+        break;
+    default:
+        UNREACHABLE("Unsupported uniform parameter type");
+    }
 }
 
-EXPORT(SceGxm, 0x207AF96B, int, sceGxmCreateRenderTarget, const SceGxmRenderTargetParams *params,
-       SceGxmRenderTarget **renderTarget)
+EXPORT(SceGxm, 0x65DD0C84, int, sceGxmSetUniformDataF, void *uniformBuffer,
+       const SceGxmProgramParameter *parameter, unsigned int componentOffset,
+       unsigned int componentCount, const float *sourceData)
 {
-    SceGxmRenderTarget *render_target;
+    const bool is_float = (parameter->type == SCE_GXM_PARAMETER_TYPE_F16) ||
+                          (parameter->type == SCE_GXM_PARAMETER_TYPE_F32);
 
-    if (!g_gxm_initialized)
-        return SCE_GXM_ERROR_UNINITIALIZED;
-    else if (!params)
+    if (!uniformBuffer || !sourceData)
         return SCE_GXM_ERROR_INVALID_POINTER;
-    else if (params->scenesPerFrame > SCE_GXM_MAX_SCENES_PER_RENDERTARGET)
+    else if (parameter->type == SCE_GXM_PARAMETER_TYPE_C10 ||
+             parameter->type == SCE_GXM_PARAMETER_TYPE_AGGREGATE)
         return SCE_GXM_ERROR_INVALID_VALUE;
 
-    render_target = malloc(sizeof(*render_target));
-    if (!render_target)
-        return SCE_KERNEL_ERROR_NO_MEMORY;
+    uint32_t alignment;
+    if (is_float && (parameter->array_size > 1) && (parameter->component_count > 1))
+        alignment = 8;
+    else
+        alignment = 4;
 
-    render_target->params = *params;
-    /* Create shadow color and depth/stencil surfaces */
-    dk_surface_create(g_dk_device, &render_target->shadow_color_surface, params->width,
-                      params->height, DkImageFormat_RGBA8_Unorm,
-                      DkImageFlags_UsageRender | DkImageFlags_Usage2DEngine |
-                          DkImageFlags_HwCompression);
-    dk_surface_create(g_dk_device, &render_target->shadow_ds_surface, params->width, params->height,
-                      DkImageFormat_ZF32_X24S8,
-                      DkImageFlags_UsageRender | DkImageFlags_Usage2DEngine |
-                          DkImageFlags_HwCompression);
+    uint32_t scalar_size = gxm_parameter_type_size(parameter->type);
+    uint32_t vector_size = scalar_size * parameter->component_count;
+    uint32_t vector_index = componentOffset / parameter->component_count;
+    uint32_t scalar_index = componentOffset % parameter->component_count;
+    uint32_t vector_mod_align = vector_size % alignment;
+    uint32_t vector_padding_bytes = vector_mod_align ? alignment - vector_mod_align : 0;
 
-    *renderTarget = render_target;
+    uint32_t offset = parameter->resource_index * sizeof(uint32_t) +
+                      vector_index * (vector_size + vector_padding_bytes) +
+                      scalar_index * scalar_size;
 
-    return 0;
-}
+    /* Without padding between the vectors, the whole range is contiguous */
+    if (vector_padding_bytes == 0) {
+        uniform_data_convert((char *)uniformBuffer + offset, sourceData, componentCount,
+                             parameter->type);
+        return 0;
+    }
 
-EXPORT(SceGxm, 0x0B94C50A, int, sceGxmDestroyRenderTarget, SceGxmRenderTarget *renderTarget)
-{
-    dk_surface_destroy(&renderTarget->shadow_color_surface);
-    dk_surface_destroy(&renderTarget->shadow_ds_surface);
-    free(renderTarget);
-    return 0;
-}
+    uint32_t scalars_to_copy = MIN2(parameter->component_count - scalar_index, componentCount);
 
-EXPORT(SceGxm, 0xED0F6E25, int, sceGxmColorSurfaceInit, SceGxmColorSurface *surface,
-       SceGxmColorFormat colorFormat, SceGxmColorSurfaceType surfaceType,
-       SceGxmColorSurfaceScaleMode scaleMode, SceGxmOutputRegisterSize outputRegisterSize,
-       unsigned int width, unsigned int height, unsigned int strideInPixels, void *data)
-{
-    SceGxmColorSurfaceInner *inner = (SceGxmColorSurfaceInner *)surface;
+    while (componentCount > 0) {
+        uniform_data_convert((char *)uniformBuffer + offset, sourceData, scalars_to_copy,
+                             parameter->type);
 
-    memset(inner, 0, sizeof(*inner));
-    inner->disabled = 0;
-    inner->downscale = scaleMode == SCE_GXM_COLOR_SURFACE_SCALE_MSAA_DOWNSCALE;
-    inner->width = width;
-    inner->height = height;
-    inner->strideInPixels = strideInPixels;
-    inner->data = data;
-    inner->colorFormat = colorFormat;
-    inner->surfaceType = surfaceType;
-    inner->outputRegisterSize = outputRegisterSize;
+        offset += scalars_to_copy * scalar_size + vector_padding_bytes;
+        sourceData += scalars_to_copy;
+
+        componentCount -= scalars_to_copy;
+        scalars_to_copy = MIN2(parameter->component_count, componentCount);
+    }
 
     return 0;
 }
 
-EXPORT(SceGxm, 0xCA9D41D1, int, sceGxmDepthStencilSurfaceInit, SceGxmDepthStencilSurface *surface,
-       SceGxmDepthStencilFormat depthStencilFormat, SceGxmDepthStencilSurfaceType surfaceType,
-       unsigned int strideInSamples, void *depthData, void *stencilData)
-
+static int init_texture_base(SceGxmTextureInner *texture, const void *data,
+                             SceGxmTextureFormat tex_format, uint32_t width, uint32_t height,
+                             uint32_t mipCount, SceGxmTextureType texture_type)
 {
-    if (!surface)
-        return SCE_GXM_ERROR_INVALID_POINTER;
-    else if ((uint32_t)depthData % SCE_GXM_DEPTHSTENCIL_SURFACE_ALIGNMENT != 0)
-        return SCE_GXM_ERROR_INVALID_ALIGNMENT;
-    else if ((strideInSamples == 0) || ((strideInSamples % SCE_GXM_TILE_SIZEX) != 0))
+    if (width > 4096 || height > 4096 || mipCount > 13)
         return SCE_GXM_ERROR_INVALID_VALUE;
 
-    memset(surface, 0, sizeof(*surface));
-    surface->zlsControl =
-        SCE_GXM_DEPTH_STENCIL_FORCE_LOAD_DISABLED | SCE_GXM_DEPTH_STENCIL_FORCE_STORE_DISABLED |
-        ((strideInSamples >> 5) - 1) << SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_STRIDE_OFFSET |
-        (surfaceType &
-         (SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_TYPE_MASK << SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_TYPE_OFFSET)) |
-        (depthStencilFormat & (SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_FORMAT_MASK
-                               << SCE_GXM_DEPTH_STENCIL_ZLS_CTRL_FORMAT_OFFSET));
-    surface->depthData = depthData;
-    surface->stencilData = stencilData;
-    surface->backgroundDepth = 1.0f;
-    surface->backgroundControl = SCE_GXM_DEPTH_STENCIL_BG_CTRL_MASK_BIT;
+    texture->mip_count = MIN2(15, mipCount - 1);
+    texture->format0 = (tex_format & 0x80000000) >> 31;
+    texture->lod_bias = 31;
+
+    if ((texture_type == SCE_GXM_TEXTURE_SWIZZLED) || (texture_type == SCE_GXM_TEXTURE_CUBE)) {
+        texture->uaddr_mode = texture->vaddr_mode = SCE_GXM_TEXTURE_ADDR_MIRROR;
+        texture->height_base2 = highest_set_bit(height);
+        texture->width_base2 = highest_set_bit(width);
+    } else {
+        texture->uaddr_mode = texture->vaddr_mode = SCE_GXM_TEXTURE_ADDR_CLAMP;
+        texture->height = height - 1;
+        texture->width = width - 1;
+    }
+
+    texture->base_format = (tex_format & 0x1F000000) >> 24;
+    texture->type = texture_type >> 29;
+    texture->data_addr = (uint32_t)data >> 2;
+    texture->swizzle_format = (tex_format & 0x7000) >> 12;
+    texture->normalize_mode = 1;
+    texture->min_filter = SCE_GXM_TEXTURE_FILTER_POINT;
+    texture->mag_filter = SCE_GXM_TEXTURE_FILTER_POINT;
+
+    texture_prefetch_queue(texture);
 
     return 0;
 }
 
-EXPORT(SceGxm, 0x14BD831F, void, sceGxmSetFrontDepthFunc, SceGxmContext *context,
-       SceGxmDepthFunc depthFunc)
+EXPORT(SceGxm, 0x4811AECB, int, sceGxmTextureInitLinear, SceGxmTexture *texture, const void *data,
+       SceGxmTextureFormat texFormat, unsigned int width, unsigned int height,
+       unsigned int mipCount)
 {
-    context->state.depth_stencil.depthCompareOp = gxm_depth_func_to_dk_compare_op(depthFunc);
-    context->state.dirty.bit.depth_stencil = true;
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    if (!context->state.two_sided_mode)
-        sceGxmSetBackDepthFunc(context, depthFunc);
+    return init_texture_base((SceGxmTextureInner *)texture, data, texFormat, width, height,
+                             mipCount, SCE_GXM_TEXTURE_LINEAR);
 }
 
-EXPORT(SceGxm, 0xF32CBF34, void, sceGxmSetFrontDepthWriteEnable, SceGxmContext *context,
-       SceGxmDepthWriteMode enable)
+EXPORT(SceGxm, 0xD572D547, int, sceGxmTextureInitSwizzled, SceGxmTexture *texture,
+       const void *data, SceGxmTextureFormat texFormat, unsigned int width, unsigned int height,
+       unsigned int mipCount)
 {
-    context->state.depth_stencil.depthWriteEnable = (enable == SCE_GXM_DEPTH_WRITE_ENABLED) ? 1 : 0;
-    context->state.dirty.bit.depth_stencil = true;
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    if (!context->state.two_sided_mode)
-        sceGxmSetBackDepthWriteEnable(context, enable);
+    return init_texture_base((SceGxmTextureInner *)texture, data, texFormat, width, height,
+                             mipCount, SCE_GXM_TEXTURE_SWIZZLED);
 }
 
-EXPORT(SceGxm, 0x8FA6FE44, void, sceGxmSetFrontStencilRef, SceGxmContext *context,
-       unsigned int sref)
+EXPORT(SceGxm, 0xE6F0DB27, int, sceGxmTextureInitTiled, SceGxmTexture *texture, const void *data,
+       SceGxmTextureFormat texFormat, unsigned int width, unsigned int height,
+       unsigned int mipCount)
 {
-    context->state.front_stencil.ref = sref;
-    context->state.dirty.bit.front_stencil = true;
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    if (!context->state.two_sided_mode)
-        sceGxmSetBackStencilRef(context, sref);
+    return init_texture_base((SceGxmTextureInner *)texture, data, texFormat, width, height,
+                             mipCount, SCE_GXM_TEXTURE_TILED);
 }
 
-EXPORT(SceGxm, 0xB042A4D2, void, sceGxmSetBackDepthFunc, SceGxmContext *context,
-       SceGxmDepthFunc depthFunc)
+EXPORT(SceGxm, 0x11DC8DC9, int, sceGxmTextureInitCube, SceGxmTexture *texture, const void *data,
+       SceGxmTextureFormat texFormat, unsigned int width, unsigned int height,
+       unsigned int mipCount)
 {
-    /* Unsupported */
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+
+    return init_texture_base((SceGxmTextureInner *)texture, data, texFormat, width, height,
+                             mipCount, SCE_GXM_TEXTURE_CUBE);
 }
 
-EXPORT(SceGxm, 0xC18B706B, void, sceGxmSetBackDepthWriteEnable, SceGxmContext *context,
-       SceGxmDepthWriteMode enable)
+EXPORT(SceGxm, 0x5341BD46, void *, sceGxmTextureGetData, const SceGxmTexture *texture)
 {
-    /* Unsupported */
+    return gxm_texture_get_data((SceGxmTextureInner *)texture);
 }
 
-EXPORT(SceGxm, 0x866A0517, void, sceGxmSetBackStencilRef, SceGxmContext *context, unsigned int sref)
+EXPORT(SceGxm, 0xE868D2B3, SceGxmTextureFormat, sceGxmTextureGetFormat,
+       const SceGxmTexture *texture)
 {
-    context->state.back_stencil.ref = sref;
-    context->state.dirty.bit.back_stencil = true;
+    return gxm_texture_get_format((SceGxmTextureInner *)texture);
 }
 
-EXPORT(SceGxm, 0xB8645A9A, void, sceGxmSetFrontStencilFunc, SceGxmContext *context,
-       SceGxmStencilFunc func, SceGxmStencilOp stencilFail, SceGxmStencilOp depthFail,
-       SceGxmStencilOp depthPass, unsigned char compareMask, unsigned char writeMask)
+EXPORT(SceGxm, 0xF23FCE81, SceGxmTextureGammaMode, sceGxmTextureGetGammaMode,
+       const SceGxmTexture *texture)
 {
-
-    context->state.depth_stencil.stencilFrontFailOp = gxm_stencil_op_to_dk_stencil_op(stencilFail);
-    context->state.depth_stencil.stencilFrontDepthFailOp =
-        gxm_stencil_op_to_dk_stencil_op(depthFail);
-    context->state.depth_stencil.stencilFrontCompareOp = gxm_stencil_func_to_dk_compare_op(func);
-    context->state.front_stencil.compare_mask = compareMask;
-    context->state.front_stencil.write_mask = writeMask;
-    context->state.dirty.bit.depth_stencil = true;
-    context->state.dirty.bit.front_stencil = true;
-
-    if (!context->state.two_sided_mode) {
-        sceGxmSetBackStencilFunc(context, func, stencilFail, depthFail, depthPass, compareMask,
-                                 writeMask);
-    }
+    return ((SceGxmTextureInner *)texture)->gamma_mode << 27;
 }
 
-EXPORT(SceGxm, 0x1A68C8D2, void, sceGxmSetBackStencilFunc, SceGxmContext *context,
-       SceGxmStencilFunc func, SceGxmStencilOp stencilFail, SceGxmStencilOp depthFail,
-       SceGxmStencilOp depthPass, unsigned char compareMask, unsigned char writeMask)
+EXPORT(SceGxm, 0x5420A086, uint32_t, sceGxmTextureGetHeight, const SceGxmTexture *texture)
 {
-    context->state.depth_stencil.stencilBackFailOp = gxm_stencil_op_to_dk_stencil_op(stencilFail);
-    context->state.depth_stencil.stencilBackDepthFailOp =
-        gxm_stencil_op_to_dk_stencil_op(depthFail);
-    context->state.depth_stencil.stencilBackCompareOp = gxm_stencil_func_to_dk_compare_op(func);
-    context->state.back_stencil.compare_mask = compareMask;
-    context->state.back_stencil.write_mask = writeMask;
-    context->state.dirty.bit.depth_stencil = true;
-    context->state.dirty.bit.back_stencil = true;
+    return gxm_texture_get_height((SceGxmTextureInner *)texture);
 }
 
-static void set_vita3k_gxm_uniform_blocks(SceGxmContext *context, const DkViewport *viewport)
+EXPORT(SceGxm, 0x2DE55DA5, uint32_t, sceGxmTextureGetLodBias, const SceGxmTexture *texture)
 {
-    const struct GXMRenderVertUniformBlock vert_unif = {
-        .viewport_flip = { 1.0f, 1.0f, 1.0f, 1.0f },
-        .viewport_flag = (0) ? 0.0f : 1.0f,
-        .z_offset = 0.0f,
-        .z_scale = 1.0f,
-        .screen_width = viewport->width,
-        .screen_height = viewport->height
-    };
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    const struct GXMRenderFragUniformBlock frag_unif = {
-        .back_disabled = 0.0f,
-        .front_disabled = 0.0f,
-        .writing_mask = 0.0f,
-        .use_raw_image = 0.0f,
-        .res_multiplier = 0,
-    };
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    memcpy(dkMemBlockGetCpuAddr(context->gxm_vert_unif_block_memblock), &vert_unif,
-           sizeof(vert_unif));
-    dkCmdBufBindUniformBuffer(context->cmdbuf, DkStage_Vertex, 2 /* hardcoded */,
-                              dkMemBlockGetGpuAddr(context->gxm_vert_unif_block_memblock),
-                              ALIGN(sizeof(vert_unif), DK_UNIFORM_BUF_ALIGNMENT));
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return 0;
 
-    memcpy(dkMemBlockGetCpuAddr(context->gxm_frag_unif_block_memblock), &frag_unif,
-           sizeof(frag_unif));
-    dkCmdBufBindUniformBuffer(context->cmdbuf, DkStage_Fragment, 3 /* hardcoded */,
-                              dkMemBlockGetGpuAddr(context->gxm_frag_unif_block_memblock),
-                              ALIGN(sizeof(frag_unif), DK_UNIFORM_BUF_ALIGNMENT));
+    return inner->lod_bias;
 }
 
-EXPORT(SceGxm, 0x8734FF4E, int, sceGxmBeginScene, SceGxmContext *context, unsigned int flags,
-       const SceGxmRenderTarget *renderTarget, const SceGxmValidRegion *validRegion,
-       SceGxmSyncObject *vertexSyncObject, SceGxmSyncObject *fragmentSyncObject,
-       const SceGxmColorSurface *colorSurface, const SceGxmDepthStencilSurface *depthStencil)
+EXPORT(SceGxm, 0xB65EE6F7, int, sceGxmTextureSetLodBias, SceGxmTexture *texture, unsigned int bias)
 {
-    uint16_t rt_width = renderTarget->params.width;
-    uint16_t rt_height = renderTarget->params.height;
-    DkViewport viewport = { 0.0f, 0.0f, (float)rt_width, (float)rt_height, 0.0f, 1.0f };
-    DkScissor scissor = { 0, 0, rt_width, rt_height };
-    SceGxmColorSurfaceInner *color_surface_inner = (SceGxmColorSurfaceInner *)colorSurface;
-
-    if (context->state.in_scene)
-        return SCE_GXM_ERROR_WITHIN_SCENE;
-
-    LOG("sceGxmBeginScene to renderTarget %p, fragmentSyncObject: %p, "
-        "w: %" PRId32 ", h: %" PRId32 ", stride: %" PRId32 ", CPU addr: %p",
-        renderTarget, fragmentSyncObject, color_surface_inner->width, color_surface_inner->height,
-        color_surface_inner->strideInPixels, color_surface_inner->data);
-
-    dkCmdBufClear(context->cmdbuf);
-    dkCmdBufBindRenderTarget(context->cmdbuf, &renderTarget->shadow_color_surface.view,
-                             &renderTarget->shadow_ds_surface.view);
-    dkCmdBufSetViewports(context->cmdbuf, 0, &viewport, 1);
-    dkCmdBufSetScissors(context->cmdbuf, 0, &scissor, 1);
-    dkCmdBufBindRasterizerState(context->cmdbuf, &context->state.rasterizer);
-    dkCmdBufBindColorState(context->cmdbuf, &context->state.color);
-    set_vita3k_gxm_uniform_blocks(context, &viewport);
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    context->state.vertex_rb.head = 0;
-    context->state.fragment_rb.head = 0;
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    /* Wait until the framebuffer is swapped out before writing to it */
-    if (fragmentSyncObject)
-        dkCmdBufWaitFence(context->cmdbuf, &fragmentSyncObject->fence);
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return SCE_GXM_ERROR_UNSUPPORTED;
 
-    if (!depthStencil) {
-        dkCmdBufClearDepthStencil(context->cmdbuf, true, 1.0f, 0xFF, 0);
-    } else {
-        if (!(depthStencil->zlsControl & SCE_GXM_DEPTH_STENCIL_FORCE_LOAD_ENABLED)) {
-            dkCmdBufClearDepthStencil(context->cmdbuf, true, depthStencil->backgroundDepth, 0xFF,
-                                      depthStencil->zlsControl &
-                                          SCE_GXM_DEPTH_STENCIL_BG_CTRL_STENCIL_MASK);
-        } else {
-            /* TODO: Copy GXM DS to shadow? */
-        }
-    }
+    if (bias > 63)
+        return SCE_GXM_ERROR_INVALID_VALUE;
 
-    /* Mark all state as dirty to make sure we bind everything before the first draw call */
-    context->state.dirty.raw = ~(uint32_t)0;
-    context->state.render_target = renderTarget;
-    context->state.color_surface = color_surface_inner;
-    context->state.ds_surface = depthStencil;
-    context->state.fragment_sync_object = fragmentSyncObject;
-    context->state.in_scene = true;
+    inner->lod_bias = bias;
 
     return 0;
 }
 
-EXPORT(SceGxm, 0xFE300E2F, int, sceGxmEndScene, SceGxmContext *context,
-       const SceGxmNotification *vertexNotification, const SceGxmNotification *fragmentNotification)
+EXPORT(SceGxm, 0xBE524A2C, uint32_t, sceGxmTextureGetLodMin, const SceGxmTexture *texture)
 {
-    DkCmdList cmd_list;
-    DkVariable variable;
-    uint32_t offset;
-    DkImage color_surface_image;
-    DkImage ds_surface_image;
-    const SceGxmRenderTarget *const render_target = context->state.render_target;
-    const dk_surface_t *const shadow_color_surface = &render_target->shadow_color_surface;
-    const dk_surface_t *const shadow_ds_surface = &render_target->shadow_ds_surface;
-    const SceGxmColorSurfaceInner *const gxm_color_surface = context->state.color_surface;
-    const SceGxmDepthStencilSurface *const gxm_ds_surface = context->state.ds_surface;
-    const uint32_t rt_width = render_target->params.width;
-    const uint32_t rt_height = render_target->params.height;
-    bool discard_color;
-    bool discard_stencil;
-
-    LOG("sceGxmEndScene");
-
-    if (!context->state.in_scene)
-        return SCE_GXM_ERROR_NOT_WITHIN_SCENE;
-
-    if (vertexNotification) {
-        offset = dk_memblock_cpu_addr_offset(g_notification_region_memblock,
-                                             (void *)vertexNotification->address);
-        assert(offset < SCE_GXM_NOTIFICATION_COUNT * sizeof(uint32_t));
-
-        dkVariableInitialize(&variable, g_notification_region_memblock, offset);
-        dkCmdBufSignalVariable(context->cmdbuf, &variable, DkVarOp_Set, vertexNotification->value,
-                               DkPipelinePos_Rasterizer);
-    }
-
-    if (fragmentNotification) {
-        offset = dk_memblock_cpu_addr_offset(g_notification_region_memblock,
-                                             (void *)fragmentNotification->address);
-        assert(offset < SCE_GXM_NOTIFICATION_COUNT * sizeof(uint32_t));
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-        dkVariableInitialize(&variable, g_notification_region_memblock, offset);
-        dkCmdBufSignalVariable(context->cmdbuf, &variable, DkVarOp_Set, fragmentNotification->value,
-                               DkPipelinePos_Bottom);
-    }
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    /* Wait for fragments to be completed before the copy/discard */
-    dkCmdBufBarrier(context->cmdbuf, DkBarrier_Fragments, 0);
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return 0;
 
-    /* Check whether we need to discard the color and/or depth/stencil surfaces */
-    discard_color = gxm_color_surface == NULL;
-    discard_stencil = !gxm_ds_surface ||
-                      !(gxm_ds_surface->zlsControl & SCE_GXM_DEPTH_STENCIL_FORCE_STORE_ENABLED);
+    return inner->lod_min0 | (inner->lod_min1 << 2);
+}
 
-    /* Copy from the shadow color surface to the GXM color surface */
-    if (discard_color) {
-        dkCmdBufDiscardColor(context->cmdbuf, 0);
-    } else {
-        if (dk_image_for_gxm_color_surface(g_dk_device, &color_surface_image, gxm_color_surface)) {
-            LOG("Copying color surface: shadow -> GXM");
-            dk_cmdbuf_copy_image(context->cmdbuf, &shadow_color_surface->image,
-                                 shadow_color_surface->width, shadow_color_surface->height,
-                                 &color_surface_image, gxm_color_surface->width,
-                                 gxm_color_surface->height);
-        }
-    }
+EXPORT(SceGxm, 0xB79E17FC, int, sceGxmTextureSetLodMin, SceGxmTexture *texture, unsigned int lodMin)
+{
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    /* Copy from the shadow depth/stencil surface to the GXM depth/stencil surface */
-    if (discard_stencil) {
-        dkCmdBufDiscardDepthStencil(context->cmdbuf);
-    } else {
-        if (dk_image_for_gxm_ds_surface(g_dk_device, &ds_surface_image, rt_width, rt_height,
-                                        gxm_ds_surface)) {
-            LOG("Copying depth/stencil surface: shadow -> GXM");
-            dk_cmdbuf_copy_image(context->cmdbuf, &shadow_ds_surface->image,
-                                 shadow_ds_surface->width, shadow_ds_surface->height,
-                                 &ds_surface_image, rt_width, rt_height);
-        }
-    }
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    /* Signal fence when rendering and copying finishes */
-    dkQueueSignalFence(g_render_queue, &context->state.fragment_sync_object->fence, true);
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return SCE_GXM_ERROR_UNSUPPORTED;
 
-    cmd_list = dkCmdBufFinishList(context->cmdbuf);
-    dkQueueSubmitCommands(g_render_queue, cmd_list);
-    dkQueueFlush(g_render_queue);
+    if (lodMin > 15)
+        return SCE_GXM_ERROR_INVALID_VALUE;
 
-    context->state.in_scene = false;
+    inner->lod_min0 = lodMin & 3;
+    inner->lod_min1 = lodMin >> 2;
 
     return 0;
 }
 
-static int SceGxmDisplayQueue_thread(SceSize args, void *argp)
+EXPORT(SceGxm, 0xAE7FBB51, SceGxmTextureFilter, sceGxmTextureGetMagFilter,
+       const SceGxmTexture *texture)
 {
-    DisplayQueueControlBlock *queue = *(DisplayQueueControlBlock **)argp;
-    DisplayQueueEntry *entry;
-
-    ueventSignal(&queue->ready_evflag);
-
-    while (!queue->exit_thread) {
-        while (CIRC_CNT(queue->head, queue->tail, queue->num_entries) > 0) {
-            if (queue->exit_thread)
-                break;
-
-            /* Get the first pending framebuffer swap */
-            entry = &queue->entries[queue->tail];
-
-            /* Wait until rendering finishes */
-            dkFenceWait(entry->new_fence, -1);
-
-            /* Call the user-specified callback: this sets the new framebuffer */
-            queue->display_queue_callback(entry->callback_data);
-
-            /* Signal that the old buffer has swapped out, so it can be rendered to again */
-            // dkFenceSignal(entry->old_fence);
-
-            queue->tail = (queue->tail + 1) & (queue->num_entries - 1);
-            ueventSignal(&queue->ready_evflag);
-        }
+    return ((SceGxmTextureInner *)texture)->mag_filter;
+}
 
-        if (queue->exit_thread)
-            break;
+EXPORT(SceGxm, 0xFA695FD7, int, sceGxmTextureSetMagFilter, SceGxmTexture *texture,
+       SceGxmTextureFilter magFilter)
+{
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-        waitSingle(waiterForUEvent(&queue->pending_evflag), -1);
-    }
+    ((SceGxmTextureInner *)texture)->mag_filter = magFilter;
 
     return 0;
 }
 
-EXPORT(SceGxm, 0xEC5C26B5, int, sceGxmDisplayQueueAddEntry, SceGxmSyncObject *oldBuffer,
-       SceGxmSyncObject *newBuffer, const void *callbackData)
+EXPORT(SceGxm, 0x920666C6, SceGxmTextureFilter, sceGxmTextureGetMinFilter,
+       const SceGxmTexture *texture)
 {
-    DisplayQueueControlBlock *queue = g_display_queue;
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    LOG("sceGxmDisplayQueueAddEntry: old: %p, new: %p", oldBuffer, newBuffer);
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return inner->mag_filter;
+    return inner->min_filter;
+}
 
-    /* Throttle down if we already have enough pending display queue entries */
-    while (CIRC_CNT(queue->head, queue->tail, queue->num_entries) ==
-           queue->display_queue_max_pending_count) {
-        waitSingle(waiterForUEvent(&queue->ready_evflag), -1);
-    }
+EXPORT(SceGxm, 0x416764E3, int, sceGxmTextureSetMinFilter, SceGxmTexture *texture,
+       SceGxmTextureFilter minFilter)
+{
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    /* Push the fences and the callback data to the display queue */
-    queue->entries[queue->head].new_fence = &newBuffer->fence;
-    queue->entries[queue->head].old_fence = &oldBuffer->fence;
-    memcpy(queue->entries[queue->head].callback_data, callbackData,
-           queue->display_queue_callback_data_size);
-    queue->head = (queue->head + 1) & (queue->num_entries - 1);
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    ueventSignal(&queue->pending_evflag);
+    /* Strided textures share the mag filter */
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return inner->mag_filter == minFilter ? 0 : SCE_GXM_ERROR_UNSUPPORTED;
+
+    inner->min_filter = minFilter;
 
     return 0;
 }
 
-EXPORT(SceGxm, 0xB98C5B0D, int, sceGxmDisplayQueueFinish, void)
+EXPORT(SceGxm, 0xCE94CA15, SceGxmTextureMipFilter, sceGxmTextureGetMipFilter,
+       const SceGxmTexture *texture)
 {
-    DisplayQueueControlBlock *queue = g_display_queue;
-
-    while (CIRC_CNT(queue->head, queue->tail, queue->num_entries) > 0)
-        waitSingle(waiterForUEvent(&queue->ready_evflag), -1);
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    return 0;
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return SCE_GXM_TEXTURE_MIP_FILTER_DISABLED;
+    return inner->mip_filter ? SCE_GXM_TEXTURE_MIP_FILTER_ENABLED
+                             : SCE_GXM_TEXTURE_MIP_FILTER_DISABLED;
 }
 
-EXPORT(SceGxm, 0x31FF8ABD, void, sceGxmSetVertexProgram, SceGxmContext *context,
-       const SceGxmVertexProgram *vertexProgram)
+EXPORT(SceGxm, 0x1CA9FE0B, int, sceGxmTextureSetMipFilter, SceGxmTexture *texture,
+       SceGxmTextureMipFilter mipFilter)
 {
-    context->state.vertex_program = vertexProgram;
-    context->state.dirty.bit.vertex_shader = true;
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
+
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
+
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return mipFilter == SCE_GXM_TEXTURE_MIP_FILTER_DISABLED ? 0 : SCE_GXM_ERROR_UNSUPPORTED;
+
+    inner->mip_filter = mipFilter == SCE_GXM_TEXTURE_MIP_FILTER_ENABLED;
+
+    return 0;
 }
 
-EXPORT(SceGxm, 0xAD2F48D9, void, sceGxmSetFragmentProgram, SceGxmContext *context,
-       const SceGxmFragmentProgram *fragmentProgram)
+EXPORT(SceGxm, 0xF7B7B1E4, uint32_t, sceGxmTextureGetMipmapCount, const SceGxmTexture *texture)
 {
-    const uint32_t mask =
-        ((fragmentProgram->blendInfo.colorMask & SCE_GXM_COLOR_MASK_R) ? DkColorMask_R : 0) |
-        ((fragmentProgram->blendInfo.colorMask & SCE_GXM_COLOR_MASK_G) ? DkColorMask_G : 0) |
-        ((fragmentProgram->blendInfo.colorMask & SCE_GXM_COLOR_MASK_B) ? DkColorMask_B : 0) |
-        ((fragmentProgram->blendInfo.colorMask & SCE_GXM_COLOR_MASK_A) ? DkColorMask_A : 0);
-
-    dkColorWriteStateSetMask(&context->state.color_write, 0, mask);
-    context->state.dirty.bit.color_write = true;
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    context->state.fragment_program = fragmentProgram;
-    context->state.dirty.bit.fragment_shader = true;
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return 0;
+    return (inner->mip_count + 1) & 0xf;
 }
 
-EXPORT(SceGxm, 0x29C34DF5, int, sceGxmSetFragmentTexture, SceGxmContext *context,
-       unsigned int textureIndex, const SceGxmTexture *texture)
+EXPORT(SceGxm, 0x4CC42929, uint32_t, sceGxmTextureGetMipmapCountUnsafe,
+       const SceGxmTexture *texture)
 {
-    context->state.fragment_textures[textureIndex] = *(SceGxmTextureInner *)texture;
-    context->state.dirty.bit.fragment_textures = true;
-    return 0;
+    return (((SceGxmTextureInner *)texture)->mip_count + 1) & 0xf;
 }
 
-EXPORT(SceGxm, 0x895DF2E9, int, sceGxmSetVertexStream, SceGxmContext *context,
-       unsigned int streamIndex, const void *streamData)
+EXPORT(SceGxm, 0xF8F2D4D1, int, sceGxmTextureSetMipmapCount, SceGxmTexture *texture,
+       unsigned int mipCount)
 {
-    VitaMemBlockInfo *stream_block;
-    uint32_t stream_offset;
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
+
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    stream_block = SceSysmem_get_vita_memblock_info_for_addr(streamData);
-    if (!stream_block)
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return SCE_GXM_ERROR_UNSUPPORTED;
+
+    if (mipCount > 13)
         return SCE_GXM_ERROR_INVALID_VALUE;
 
-    stream_offset = (uintptr_t)streamData - (uintptr_t)stream_block->base;
-    dkCmdBufBindVtxBuffer(context->cmdbuf, streamIndex,
-                          dkMemBlockGetGpuAddr(stream_block->dk_memblock) + stream_offset,
-                          stream_block->size - stream_offset);
+    inner->mip_count = MIN2(15, mipCount - 1);
 
     return 0;
 }
 
-EXPORT(SceGxm, 0x8FA3F9C3, unsigned int, sceGxmProgramGetDefaultUniformBufferSize,
-       const SceGxmProgram *program)
+EXPORT(SceGxm, 0x512BB86C, int, sceGxmTextureGetNormalizeMode, const SceGxmTexture *texture)
 {
-    return program->default_uniform_buffer_count * sizeof(float);
+    return ((SceGxmTextureInner *)texture)->normalize_mode << 31;
 }
 
-EXPORT(SceGxm, 0xC697CAE5, int, sceGxmSetVertexDefaultUniformBuffer, SceGxmContext *context,
-       const void *uniformBuffer)
+EXPORT(SceGxm, 0x0D189C30, void *, sceGxmTextureGetPalette, const SceGxmTexture *texture)
 {
-    VitaMemBlockInfo *block;
-    uint32_t offset;
+    SceGxmTextureBaseFormat base_format =
+        gxm_texture_get_base_format(sceGxmTextureGetFormat(texture));
 
-    block = SceSysmem_get_vita_memblock_info_for_addr(uniformBuffer);
-    if (!block)
-        return SCE_GXM_ERROR_INVALID_VALUE;
+    return gxm_base_format_is_paletted_format(base_format) ? (void *)(texture->palette_addr << 6)
+                                                           : NULL;
+}
 
-    offset = (uintptr_t)uniformBuffer - (uintptr_t)block->base;
+EXPORT(SceGxm, 0xDD6AABFA, int, sceGxmTextureSetPalette, SceGxmTexture *texture,
+       const void *paletteData)
+{
+    if (!texture)
+        return SCE_GXM_ERROR_INVALID_POINTER;
 
-    context->state.vertex_default_uniform.cpu_addr =
-        dkMemBlockGetCpuAddr(block->dk_memblock) + offset;
-    context->state.vertex_default_uniform.gpu_addr =
-        dkMemBlockGetGpuAddr(block->dk_memblock) + offset;
-    context->state.dirty.bit.vertex_default_uniform = true;
+    if ((uintptr_t)paletteData & (SCE_GXM_PALETTE_ALIGNMENT - 1))
+        return SCE_GXM_ERROR_INVALID_ALIGNMENT;
+
+    ((SceGxmTextureInner *)texture)->palette_addr = (uintptr_t)paletteData >> 6;
 
     return 0;
 }
 
-EXPORT(SceGxm, 0x97118913, int, sceGxmReserveVertexDefaultUniformBuffer, SceGxmContext *context,
-       void **uniformBuffer)
+EXPORT(SceGxm, 0xB0BD52F3, uint32_t, sceGxmTextureGetStride, const SceGxmTexture *texture)
 {
-    const SceGxmProgram *program;
-    uint32_t size;
-
-    if (!context->state.in_scene)
-        return SCE_GXM_ERROR_NOT_WITHIN_SCENE;
-    else if (!context->state.vertex_program)
-        return SCE_GXM_ERROR_NULL_PROGRAM;
-
-    program = context->state.vertex_program->programId->programHeader;
-    size = program->default_uniform_buffer_count * sizeof(float);
-    if (size == 0) {
-        *uniformBuffer = NULL;
-        return 0;
-    }
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    if (context->state.vertex_default_uniform.allocated) {
-        *uniformBuffer = context->state.vertex_default_uniform.cpu_addr;
+    if (gxm_texture_get_type(inner) != SCE_GXM_TEXTURE_LINEAR_STRIDED)
         return 0;
-    }
+    return gxm_texture_get_stride_in_bytes(inner);
+}
 
-    if (context->state.vertex_rb.head + size > context->vertex_rb.size)
-        context->state.vertex_rb.head = 0;
+EXPORT(SceGxm, 0xF65D4917, SceGxmTextureType, sceGxmTextureGetType, const SceGxmTexture *texture)
+{
+    return gxm_texture_get_type((SceGxmTextureInner *)texture);
+}
 
-    *uniformBuffer = context->state.vertex_default_uniform.cpu_addr =
-        dkMemBlockGetCpuAddr(context->vertex_rb.memblock) + context->state.vertex_rb.head;
-    context->state.vertex_default_uniform.gpu_addr =
-        dkMemBlockGetGpuAddr(context->vertex_rb.memblock) + context->state.vertex_rb.head;
+EXPORT(SceGxm, 0x2AE22788, SceGxmTextureAddrMode, sceGxmTextureGetUAddrMode,
+       const SceGxmTexture *texture)
+{
+    return ((SceGxmTextureInner *)texture)->uaddr_mode;
+}
 
-    context->state.vertex_rb.head += size;
-    context->state.vertex_default_uniform.allocated = true;
-    context->state.dirty.bit.vertex_default_uniform = true;
+EXPORT(SceGxm, 0xC037DA83, int, sceGxmTextureGetUAddrModeSafe, const SceGxmTexture *texture)
+{
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    return 0;
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return SCE_GXM_TEXTURE_ADDR_CLAMP;
+    return inner->uaddr_mode;
 }
 
-EXPORT(SceGxm, 0xA824EB24, int, sceGxmSetFragmentDefaultUniformBuffer, SceGxmContext *context,
-       const void *uniformBuffer)
+EXPORT(SceGxm, 0x46136CA9, SceGxmTextureAddrMode, sceGxmTextureGetVAddrMode,
+       const SceGxmTexture *texture)
 {
-    VitaMemBlockInfo *block;
-    uint32_t offset;
+    return ((SceGxmTextureInner *)texture)->vaddr_mode;
+}
 
-    block = SceSysmem_get_vita_memblock_info_for_addr(uniformBuffer);
-    if (!block)
-        return SCE_GXM_ERROR_INVALID_VALUE;
+EXPORT(SceGxm, 0xD2F0D9C1, int, sceGxmTextureGetVAddrModeSafe, const SceGxmTexture *texture)
+{
+    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
 
-    offset = (uintptr_t)uniformBuffer - (uintptr_t)block->base;
+    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return SCE_GXM_TEXTURE_ADDR_CLAMP;
+    return inner->vaddr_mode;
+}
 
-    context->state.fragment_default_uniform.cpu_addr =
-        dkMemBlockGetCpuAddr(block->dk_memblock) + offset;
-    context->state.fragment_default_uniform.gpu_addr =
-        dkMemBlockGetGpuAddr(block->dk_memblock) + offset;
-    context->state.dirty.bit.fragment_default_uniform = true;
+EXPORT(SceGxm, 0x126A3EB3, uint32_t, sceGxmTextureGetWidth, const SceGxmTexture *texture)
+{
+    return gxm_texture_get_width((SceGxmTextureInner *)texture);
+}
 
-    return 0;
+static const char *program_parameter_get_name(const void *parameters, uint32_t index)
+{
+    return gxm_parameter_get_name(&((const SceGxmProgramParameter *)parameters)[index]);
 }
 
-EXPORT(SceGxm, 0x7B1FABB6, int, sceGxmReserveFragmentDefaultUniformBuffer, SceGxmContext *context,
-       void **uniformBuffer)
+static const GxmNameTable *registered_program_get_parameter_name_table(
+    SceGxmRegisteredProgram *program)
 {
-    const SceGxmProgram *program;
-    uint32_t size;
+    const SceGxmProgram *header = program->programHeader;
+    GxmNameTable *table, *expected = NULL;
 
-    if (!context->state.in_scene)
-        return SCE_GXM_ERROR_NOT_WITHIN_SCENE;
-    else if (!context->state.fragment_program)
-        return SCE_GXM_ERROR_NULL_PROGRAM;
+    table = __atomic_load_n(&program->parameter_name_table, __ATOMIC_ACQUIRE);
+    if (table)
+        return table;
 
-    program = context->state.fragment_program->programId->programHeader;
-    size = program->default_uniform_buffer_count * sizeof(float);
-    if (size == 0) {
-        *uniformBuffer = NULL;
-        return 0;
+    table = gxm_name_table_create(gxm_program_get_parameters(header), header->parameter_count,
+                                  program_parameter_get_name);
+    if (!table)
+        return NULL;
+
+    /* Another thread might have built the table concurrently: keep the first one */
+    if (!__atomic_compare_exchange_n(&program->parameter_name_table, &expected, table, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(table);
+        return expected;
     }
 
-    if (context->state.fragment_default_uniform.allocated) {
-        *uniformBuffer = context->state.fragment_default_uniform.cpu_addr;
-        return 0;
+    return table;
+}
+
+EXPORT(SceGxm, 0x277794C4, const SceGxmProgramParameter *, sceGxmProgramFindParameterByName,
+       const SceGxmProgram *program, const char *name)
+{
+    const SceGxmProgramParameter *const parameters = gxm_program_get_parameters(program);
+    const GxmNameTable *table = NULL;
+    SceGxmRegisteredProgram **entry;
+    int32_t index;
+
+    if (program->parameter_count < PARAMETER_NAME_TABLE_MIN_COUNT)
+        goto linear_search;
+
+    /* Held until the lookup is done, so the program can't be unregistered and freed meanwhile */
+    rwlockReadLock(&g_registered_programs_lock);
+    entry = registered_program_dict_get(g_registered_programs, (uintptr_t)program);
+    if (entry)
+        table = registered_program_get_parameter_name_table(*entry);
+    if (table) {
+        index = gxm_name_table_find(table, parameters, program_parameter_get_name, name);
+        rwlockReadUnlock(&g_registered_programs_lock);
+        return index >= 0 ? &parameters[index] : NULL;
+    }
+    rwlockReadUnlock(&g_registered_programs_lock);
+
+linear_search:
+    /* Programs can be queried before being registered: fall back to a linear search */
+    for (uint32_t i = 0; i < program->parameter_count; i++) {
+        if (strcmp(gxm_parameter_get_name(&parameters[i]), name) == 0)
+            return &parameters[i];
     }
 
-    if (context->state.fragment_rb.head + size > context->fragment_rb.size)
-        context->state.fragment_rb.head = 0;
+    return NULL;
+}
 
-    *uniformBuffer = context->state.fragment_default_uniform.cpu_addr =
-        dkMemBlockGetCpuAddr(context->fragment_rb.memblock) + context->state.fragment_rb.head;
-    context->state.fragment_default_uniform.gpu_addr =
-        dkMemBlockGetGpuAddr(context->fragment_rb.memblock) + context->state.fragment_rb.head;
+EXPORT(SceGxm, 0xDBA8D061, uint32_t, sceGxmProgramParameterGetArraySize,
+       const SceGxmProgramParameter *parameter)
+{
+    return parameter->array_size;
+}
 
-    context->state.fragment_rb.head += size;
-    context->state.fragment_default_uniform.allocated = true;
-    context->state.dirty.bit.fragment_default_uniform = true;
+EXPORT(SceGxm, 0x1997DC17, SceGxmParameterCategory, sceGxmProgramParameterGetCategory,
+       const SceGxmProgramParameter *parameter)
+{
+    return parameter->category;
+}
 
-    return 0;
+EXPORT(SceGxm, 0xBD2998D1, uint32_t, sceGxmProgramParameterGetComponentCount,
+       const SceGxmProgramParameter *parameter)
+{
+    return parameter->component_count;
 }
 
-EXPORT(SceGxm, 0x65DD0C84, int, sceGxmSetUniformDataF, void *uniformBuffer,
-       const SceGxmProgramParameter *parameter, unsigned int componentOffset,
-       unsigned int componentCount, const float *sourceData)
+EXPORT(SceGxm, 0xBB58267D, uint32_t, sceGxmProgramParameterGetContainerIndex,
+       const SceGxmProgramParameter *parameter)
 {
-    const bool is_float = (parameter->type == SCE_GXM_PARAMETER_TYPE_F16) ||
-                          (parameter->type == SCE_GXM_PARAMETER_TYPE_F32);
+    return parameter->container_index;
+}
 
-    if (!uniformBuffer || !sourceData)
-        return SCE_GXM_ERROR_INVALID_POINTER;
+EXPORT(SceGxm, 0x6E61DDF5, uint32_t, sceGxmProgramParameterGetIndex, const SceGxmProgram *program,
+       const SceGxmProgramParameter *parameter)
+{
+    uint32_t parameter_offset = program->parameters_offset;
 
-    uint32_t alignment;
-    if (is_float && (parameter->array_size > 1) && (parameter->component_count > 1))
-        alignment = 8;
-    else
-        alignment = 4;
+    if (parameter_offset > 0)
+        parameter_offset += (uintptr_t)&program->parameters_offset;
+    return (uint32_t)((uintptr_t)parameter - parameter_offset) >> 4;
+}
 
-    uint32_t scalar_size = gxm_parameter_type_size(parameter->type);
-    uint32_t vector_size = scalar_size * parameter->component_count;
-    uint32_t vector_index = componentOffset / parameter->component_count;
-    uint32_t scalar_index = componentOffset % parameter->component_count;
-    uint32_t vector_mod_align = vector_size % alignment;
-    uint32_t vector_padding_bytes = vector_mod_align ? alignment - vector_mod_align : 0;
+EXPORT(SceGxm, 0x6AF88A5D, const char *, sceGxmProgramParameterGetName,
+       const SceGxmProgramParameter *parameter)
+{
+    if (!parameter)
+        return NULL;
+    return gxm_parameter_get_name(parameter);
+}
+
+EXPORT(SceGxm, 0x5C79D59A, uint32_t, sceGxmProgramParameterGetResourceIndex,
+       const SceGxmProgramParameter *parameter)
+{
+    return parameter->resource_index;
+}
 
-    uint32_t offset = parameter->resource_index * sizeof(uint32_t) +
-                      vector_index * (vector_size + vector_padding_bytes) +
-                      scalar_index * scalar_size;
+EXPORT(SceGxm, 0xE6D9C4CE, SceGxmParameterSemantic, sceGxmProgramParameterGetSemantic,
+       const SceGxmProgramParameter *parameter)
+{
+    if (parameter->category != SCE_GXM_PARAMETER_CATEGORY_ATTRIBUTE)
+        return SCE_GXM_PARAMETER_SEMANTIC_NONE;
 
-    /* Only floats are supported for now */
-    assert(parameter->type == SCE_GXM_PARAMETER_TYPE_F32);
+    return parameter->semantic;
+}
 
-    uint32_t scalars_to_copy = MIN2(parameter->component_count - scalar_index, componentCount);
+EXPORT(SceGxm, 0xB85CC13E, uint32_t, sceGxmProgramParameterGetSemanticIndex,
+       const SceGxmProgramParameter *parameter)
+{
+    return parameter->semantic_index & 0xf;
+}
 
-    while (componentCount > 0) {
-        memcpy((char *)uniformBuffer + offset, sourceData, scalars_to_copy * scalar_size);
+EXPORT(SceGxm, 0x7B9023C3, SceGxmParameterType, sceGxmProgramParameterGetType,
+       const SceGxmProgramParameter *parameter)
+{
+    return parameter->type;
+}
 
-        offset += scalars_to_copy * scalar_size + vector_padding_bytes;
-        sourceData += scalars_to_copy;
+/*
+ * Dimensions of a texture level in the blocks of texels compressed formats are made of (texels for
+ * the others), returning the size of a block in bits
+ */
+static uint32_t texture_level_blocks(SceGxmTextureFormat format, uint32_t width, uint32_t height,
+                                     uint32_t *blocks_x, uint32_t *blocks_y)
+{
+    const SceGxmTextureBaseFormat base_format = gxm_texture_get_base_format(format);
+    uint32_t block_width, block_height;
 
-        componentCount -= scalars_to_copy;
-        scalars_to_copy = MIN2(parameter->component_count, componentCount);
+    gxm_base_format_get_block_size(base_format, &block_width, &block_height);
+    *blocks_x = ALIGN(width, block_width) / block_width;
+    *blocks_y = ALIGN(height, block_height) / block_height;
+
+    /* PVRTC levels are padded to 2x2 blocks */
+    if (gxm_base_format_is_pvrt_format(base_format)) {
+        *blocks_x = MAX2(*blocks_x, 2);
+        *blocks_y = MAX2(*blocks_y, 2);
     }
 
-    return 0;
+    return gxm_texture_base_format_bytes_per_pixel(base_format) * block_width * block_height;
 }
 
-static int init_texture_base(SceGxmTextureInner *texture, const void *data,
-                             SceGxmTextureFormat tex_format, uint32_t width, uint32_t height,
-                             uint32_t mipCount, SceGxmTextureType texture_type)
+static uint32_t texture_palette_size(SceGxmTextureBaseFormat base_format)
 {
-    if (width > 4096 || height > 4096 || mipCount > 13)
-        return SCE_GXM_ERROR_INVALID_VALUE;
-
-    texture->mip_count = MIN2(15, mipCount - 1);
-    texture->format0 = (tex_format & 0x80000000) >> 31;
-    texture->lod_bias = 31;
+    return (base_format == SCE_GXM_TEXTURE_BASE_FORMAT_P4 ? 16 : PALETTE_MAX_ENTRIES) *
+           sizeof(uint32_t);
+}
 
-    if ((texture_type == SCE_GXM_TEXTURE_SWIZZLED) || (texture_type == SCE_GXM_TEXTURE_CUBE)) {
-        texture->uaddr_mode = texture->vaddr_mode = SCE_GXM_TEXTURE_ADDR_MIRROR;
-        texture->height_base2 = highest_set_bit(height);
-        texture->width_base2 = highest_set_bit(width);
-    } else {
-        texture->uaddr_mode = texture->vaddr_mode = SCE_GXM_TEXTURE_ADDR_CLAMP;
-        texture->height = height - 1;
-        texture->width = width - 1;
-    }
+/* Number of levels of the mip chain sampled from */
+static uint32_t texture_mip_levels(const SceGxmTextureInner *texture)
+{
+    const uint32_t max_size =
+        MAX2(gxm_texture_get_width(texture), gxm_texture_get_height(texture));
 
-    texture->base_format = (tex_format & 0x1F000000) >> 24;
-    texture->type = texture_type >> 29;
-    texture->data_addr = (uint32_t)data >> 2;
-    texture->swizzle_format = (tex_format & 0x7000) >> 12;
-    texture->normalize_mode = 1;
-    texture->min_filter = SCE_GXM_TEXTURE_FILTER_POINT;
-    texture->mag_filter = SCE_GXM_TEXTURE_FILTER_POINT;
+    /* The mip count bits of strided textures hold their stride instead */
+    if (gxm_texture_get_type(texture) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return 1;
 
-    return 0;
+    return MIN2((uint32_t)texture->mip_count + 1, highest_set_bit(max_size) + 1);
 }
 
-EXPORT(SceGxm, 0x4811AECB, int, sceGxmTextureInitLinear, SceGxmTexture *texture, const void *data,
-       SceGxmTextureFormat texFormat, unsigned int width, unsigned int height,
-       unsigned int mipCount)
+/* Size of the rows of a level of a linear texture, which are padded to 8 texels */
+static uint32_t texture_linear_stride(const SceGxmTextureInner *texture, uint32_t width)
 {
-    if (!texture)
-        return SCE_GXM_ERROR_INVALID_POINTER;
+    uint32_t blocks_x, blocks_y, block_bits;
 
-    return init_texture_base((SceGxmTextureInner *)texture, data, texFormat, width, height,
-                             mipCount, SCE_GXM_TEXTURE_LINEAR);
+    if (gxm_texture_get_type(texture) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
+        return gxm_texture_get_stride_in_bytes(texture);
+
+    block_bits = texture_level_blocks(gxm_texture_get_format(texture), ALIGN(width, 8), 1,
+                                      &blocks_x, &blocks_y);
+    return blocks_x * block_bits / 8;
 }
 
-EXPORT(SceGxm, 0x5341BD46, void *, sceGxmTextureGetData, const SceGxmTexture *texture)
+/* Size of a level as laid out in memory, levels following each other from the largest one */
+static uint32_t texture_level_size(const SceGxmTextureInner *texture, uint32_t level)
 {
-    return gxm_texture_get_data((SceGxmTextureInner *)texture);
+    const SceGxmTextureFormat format = gxm_texture_get_format(texture);
+    const uint32_t type = gxm_texture_get_type(texture);
+    const uint32_t width = MAX2(gxm_texture_get_width(texture) >> level, 1);
+    const uint32_t height = MAX2(gxm_texture_get_height(texture) >> level, 1);
+    uint32_t blocks_x, blocks_y;
+    const uint32_t block_bits = texture_level_blocks(format, width, height, &blocks_x, &blocks_y);
+
+    if (type == SCE_GXM_TEXTURE_TILED)
+        return gxm_texture_tiled_size(blocks_x, blocks_y, block_bits) / 8;
+
+    /* PVRTC blocks are always Morton ordered */
+    if ((type == SCE_GXM_TEXTURE_LINEAR || type == SCE_GXM_TEXTURE_LINEAR_STRIDED) &&
+        !gxm_base_format_is_pvrt_format(gxm_texture_get_base_format(format)))
+        return texture_linear_stride(texture, width) * blocks_y;
+
+    return gxm_texture_swizzled_size(blocks_x, blocks_y, block_bits) / 8;
 }
 
-EXPORT(SceGxm, 0xE868D2B3, SceGxmTextureFormat, sceGxmTextureGetFormat,
-       const SceGxmTexture *texture)
+/* Size of a mip chain: the whole texture, or a face of a cube texture */
+static uint32_t texture_chain_size(const SceGxmTextureInner *texture)
 {
-    return gxm_texture_get_format((SceGxmTextureInner *)texture);
+    uint32_t size = 0;
+
+    for (uint32_t level = 0; level < texture_mip_levels(texture); level++)
+        size += texture_level_size(texture, level);
+
+    return size;
 }
 
-EXPORT(SceGxm, 0xF23FCE81, SceGxmTextureGammaMode, sceGxmTextureGetGammaMode,
-       const SceGxmTexture *texture)
+static uint32_t texture_source_size(const SceGxmTextureInner *texture)
 {
-    return ((SceGxmTextureInner *)texture)->gamma_mode << 27;
+    return (gxm_texture_get_type(texture) == SCE_GXM_TEXTURE_CUBE ? 6 : 1) *
+           texture_chain_size(texture);
 }
 
-EXPORT(SceGxm, 0x5420A086, uint32_t, sceGxmTextureGetHeight, const SceGxmTexture *texture)
+#if PERSIST_DECODED_TEXTURES
+static void texture_persisted_path(char *path, size_t size, const TextureCacheEntry *entry,
+                                   uint32_t face, uint32_t level)
 {
-    return gxm_texture_get_height((SceGxmTextureInner *)texture);
+    snprintf(path, size,
+             VITA2HOS_TEXTURE_PATH "/%016" PRIx64 "_%08" PRIx32 "_%" PRIu32 "x%" PRIu32 "_%" PRIu32
+                                   "_%" PRIu32 ".rgba",
+             entry->hash, (uint32_t)entry->format, (uint32_t)entry->width,
+             (uint32_t)entry->height, face, level);
 }
 
-EXPORT(SceGxm, 0x2DE55DA5, uint32_t, sceGxmTextureGetLodBias, const SceGxmTexture *texture)
+static bool texture_persisted_load(void *dst, uint32_t size, const TextureCacheEntry *entry,
+                                   uint32_t face, uint32_t level)
 {
-    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
+    char path[128];
+    void *data;
+    uint32_t data_size;
 
-    if (!texture)
-        return SCE_GXM_ERROR_INVALID_POINTER;
+    texture_persisted_path(path, sizeof(path), entry, face, level);
+    if (util_load_file(path, &data, &data_size) != 0)
+        return false;
 
-    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
-        return 0;
+    if (data_size == size)
+        memcpy(dst, data, size);
+    free(data);
 
-    return inner->lod_bias;
+    return data_size == size;
 }
 
-EXPORT(SceGxm, 0xBE524A2C, uint32_t, sceGxmTextureGetLodMin, const SceGxmTexture *texture)
+static void texture_persisted_store(const void *src, uint32_t size, const TextureCacheEntry *entry,
+                                    uint32_t face, uint32_t level)
 {
-    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
+    char path[128];
 
-    if (!texture)
-        return SCE_GXM_ERROR_INVALID_POINTER;
+    texture_persisted_path(path, sizeof(path), entry, face, level);
+    util_write_binary_file(path, src, size);
+}
+#endif
 
-    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
-        return 0;
+static void texture_jobs_run(TextureJobs *jobs)
+{
+    uint32_t index;
 
-    return inner->lod_min0 | (inner->lod_min1 << 2);
+    while ((index = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_ACQUIRE)) < jobs->count)
+        jobs->func(jobs->arg, index);
 }
 
-EXPORT(SceGxm, 0xAE7FBB51, SceGxmTextureFilter, sceGxmTextureGetMagFilter,
-       const SceGxmTexture *texture)
+static int SceGxmTextureWorker_thread(SceSize args, void *argp)
 {
-    return ((SceGxmTextureInner *)texture)->mag_filter;
+    TextureWorker *worker = *(TextureWorker **)argp;
+    const uint32_t core = TEXTURE_WORKER_FIRST_CORE + (worker - g_texture_workers);
+
+    svcSetThreadCoreMask(CUR_THREAD_HANDLE, core, BIT(core));
+
+    for (;;) {
+        waitSingle(waiterForUEvent(&worker->pending_evflag), -1);
+        if (__atomic_load_n(&g_texture_workers_exit, __ATOMIC_RELAXED))
+            break;
+
+        texture_jobs_run(&g_texture_jobs);
+        if (__atomic_add_fetch(&g_texture_jobs.idle_workers, 1, __ATOMIC_ACQ_REL) ==
+            TEXTURE_WORKER_COUNT)
+            ueventSignal(&g_texture_jobs.idle_evflag);
+    }
+
+    return 0;
 }
 
-EXPORT(SceGxm, 0x920666C6, SceGxmTextureFilter, sceGxmTextureGetMinFilter,
-       const SceGxmTexture *texture)
+/*
+ * Runs the jobs of a conversion on the calling thread and the texture workers. All the workers are
+ * waited for, as they read the jobs' state until they're out of jobs. If another conversion is
+ * using them, the calling thread runs the jobs alone.
+ */
+static void texture_parallel_for(GxmTextureParallelFunc func, void *arg, uint32_t count)
 {
-    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
+    if (!mutexTryLock(&g_texture_jobs_lock)) {
+        for (uint32_t i = 0; i < count; i++)
+            func(arg, i);
+        return;
+    }
 
-    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
-        return inner->mag_filter;
-    return inner->min_filter;
+    g_texture_jobs.func = func;
+    g_texture_jobs.arg = arg;
+    g_texture_jobs.count = count;
+    g_texture_jobs.idle_workers = 0;
+    __atomic_store_n(&g_texture_jobs.next, 0, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < TEXTURE_WORKER_COUNT; i++)
+        ueventSignal(&g_texture_workers[i].pending_evflag);
+
+    texture_jobs_run(&g_texture_jobs);
+    while (__atomic_load_n(&g_texture_jobs.idle_workers, __ATOMIC_ACQUIRE) < TEXTURE_WORKER_COUNT)
+        waitSingle(waiterForUEvent(&g_texture_jobs.idle_evflag), -1);
+
+    mutexUnlock(&g_texture_jobs_lock);
 }
 
-EXPORT(SceGxm, 0xCE94CA15, SceGxmTextureMipFilter, sceGxmTextureGetMipFilter,
-       const SceGxmTexture *texture)
+/* PVRTC has no GPU support: decode it to RGBA8, or load a previous decode */
+static void texture_decode_pvrtc(void *dst, const void *src, const TextureCacheEntry *entry,
+                                 uint32_t face, uint32_t level, GxmTextureParallelFor parallel_for)
 {
-    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
+    const SceGxmTextureBaseFormat base_format = gxm_texture_get_base_format(entry->format);
+    const uint32_t width = MAX2(entry->width >> level, 1);
+    const uint32_t height = MAX2(entry->height >> level, 1);
+    const uint32_t size = width * height * 4;
+    uint64_t start;
+
+#if PERSIST_DECODED_TEXTURES
+    if (texture_persisted_load(dst, size, entry, face, level))
+        return;
+#endif
 
-    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
-        return SCE_GXM_TEXTURE_MIP_FILTER_DISABLED;
-    return inner->mip_filter ? SCE_GXM_TEXTURE_MIP_FILTER_ENABLED
-                             : SCE_GXM_TEXTURE_MIP_FILTER_DISABLED;
+    start = armGetSystemTick();
+    if (!gxm_texture_decode_pvrtc(dst, width * 4, src, width, height,
+                                  base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRT2BPP ||
+                                      base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRTII2BPP,
+                                  base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRTII2BPP ||
+                                      base_format == SCE_GXM_TEXTURE_BASE_FORMAT_PVRTII4BPP,
+                                  parallel_for)) {
+        LOG("Could not decode PVRTC texture %p", src);
+        memset(dst, 0, size);
+        return;
+    }
+    FRAME_STATS_ADD(texture_decodes, 1);
+    FRAME_STATS_ADD(texture_decode_ns, armTicksToNs(armGetSystemTick() - start));
+
+#if PERSIST_DECODED_TEXTURES
+    texture_persisted_store(dst, size, entry, face, level);
+#endif
 }
 
-EXPORT(SceGxm, 0xF7B7B1E4, uint32_t, sceGxmTextureGetMipmapCount, const SceGxmTexture *texture)
+/*
+ * Dimensions of a level once staged: in blocks for compressed formats other than PVRTC, which is
+ * decoded to RGBA8, and in unpacked indices for paletted formats. Returns the size of a block.
+ */
+static uint32_t texture_staged_level_blocks(const TextureCacheEntry *entry, uint32_t level,
+                                            uint32_t *blocks_x, uint32_t *blocks_y)
 {
-    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
+    const SceGxmTextureBaseFormat base_format = gxm_texture_get_base_format(entry->format);
+    const uint32_t width = MAX2(entry->width >> level, 1);
+    const uint32_t height = MAX2(entry->height >> level, 1);
+
+    if (gxm_base_format_is_pvrt_format(base_format) ||
+        gxm_base_format_is_paletted_format(base_format)) {
+        *blocks_x = width;
+        *blocks_y = height;
+        return gxm_base_format_is_pvrt_format(base_format) ? 4 : 1;
+    }
 
-    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
-        return 0;
-    return (inner->mip_count + 1) & 0xf;
+    return texture_level_blocks(entry->format, width, height, blocks_x, blocks_y) / 8;
 }
 
-EXPORT(SceGxm, 0x4CC42929, uint32_t, sceGxmTextureGetMipmapCountUnsafe,
-       const SceGxmTexture *texture)
+/* Size of all the faces and levels once staged, each face followed by its whole mip chain */
+static uint32_t texture_staged_size(const TextureCacheEntry *entry)
 {
-    return (((SceGxmTextureInner *)texture)->mip_count + 1) & 0xf;
+    uint32_t blocks_x, blocks_y, block_size;
+    uint32_t face_size = 0;
+
+    for (uint32_t level = 0; level < entry->levels; level++) {
+        block_size = texture_staged_level_blocks(entry, level, &blocks_x, &blocks_y);
+        face_size += blocks_x * blocks_y * block_size;
+    }
+
+    return (entry->type == SCE_GXM_TEXTURE_CUBE ? 6 : 1) * face_size;
 }
 
-EXPORT(SceGxm, 0x512BB86C, int, sceGxmTextureGetNormalizeMode, const SceGxmTexture *texture)
+/* Decodes all the faces and levels of a PVRTC texture, one after the other */
+static void texture_stage_pvrtc(uint8_t *dst, const TextureCacheEntry *entry,
+                                const SceGxmTextureInner *texture,
+                                GxmTextureParallelFor parallel_for)
 {
-    return ((SceGxmTextureInner *)texture)->normalize_mode << 31;
+    const uint32_t faces = entry->type == SCE_GXM_TEXTURE_CUBE ? 6 : 1;
+    const uint8_t *src = entry->data;
+    uint32_t blocks_x, blocks_y, block_size;
+
+    for (uint32_t face = 0; face < faces; face++) {
+        for (uint32_t level = 0; level < entry->levels; level++) {
+            block_size = texture_staged_level_blocks(entry, level, &blocks_x, &blocks_y);
+            texture_decode_pvrtc(dst, src, entry, face, level, parallel_for);
+            dst += blocks_x * blocks_y * block_size;
+            src += texture_level_size(texture, level);
+        }
+    }
 }
 
-EXPORT(SceGxm, 0x0D189C30, void *, sceGxmTextureGetPalette, const SceGxmTexture *texture)
+static bool texture_cache_entry_matches(const TextureCacheEntry *entry,
+                                        const TextureCacheEntry *key)
 {
-    SceGxmTextureBaseFormat base_format =
-        gxm_texture_get_base_format(sceGxmTextureGetFormat(texture));
-
-    return gxm_base_format_is_paletted_format(base_format) ? (void *)(texture->palette_addr << 6)
-                                                           : NULL;
+    return entry->data == key->data && entry->palette == key->palette &&
+           entry->format == key->format && entry->type == key->type &&
+           entry->width == key->width && entry->height == key->height &&
+           entry->levels == key->levels;
 }
 
-EXPORT(SceGxm, 0xB0BD52F3, uint32_t, sceGxmTextureGetStride, const SceGxmTexture *texture)
+static void texture_cache_entry_key(TextureCacheEntry *key, const SceGxmTextureInner *texture,
+                                    SceGxmTextureFormat format)
 {
-    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
-
-    if (gxm_texture_get_type(inner) != SCE_GXM_TEXTURE_LINEAR_STRIDED)
-        return 0;
-    return gxm_texture_get_stride_in_bytes(inner);
+    memset(key, 0, sizeof(*key));
+    key->data = gxm_texture_get_data(texture);
+    key->palette = gxm_texture_get_palette(texture);
+    key->format = format;
+    key->type = gxm_texture_get_type(texture);
+    key->width = gxm_texture_get_width(texture);
+    key->height = gxm_texture_get_height(texture);
+    key->levels = texture_mip_levels(texture);
 }
 
-EXPORT(SceGxm, 0xF65D4917, SceGxmTextureType, sceGxmTextureGetType, const SceGxmTexture *texture)
+/*
+ * Queues the decode of a PVRTC texture the cache doesn't hold yet. If the cache is busy, it's left
+ * for its first draw to decode, rather than blocking the game.
+ */
+static void texture_prefetch_queue(const SceGxmTextureInner *texture)
 {
-    return gxm_texture_get_type((SceGxmTextureInner *)texture);
+    const SceGxmTextureFormat format = gxm_texture_get_format(texture);
+    TexturePrefetch *slot = NULL;
+    TextureCacheEntry key;
+    bool cached = false;
+
+    if (!gxm_base_format_is_pvrt_format(gxm_texture_get_base_format(format)) ||
+        !SceSysmem_get_vita_memblock_info_for_addr(gxm_texture_get_data(texture)))
+        return;
+
+    texture_cache_entry_key(&key, texture, format);
+
+    if (!mutexTryLock(&g_texture_cache_lock))
+        return;
+    for (uint32_t i = 0; i < TEXTURE_CACHE_SIZE && !cached; i++) {
+        cached = g_texture_cache[i].memblock &&
+                 texture_cache_entry_matches(&g_texture_cache[i], &key);
+    }
+    mutexUnlock(&g_texture_cache_lock);
+    if (cached)
+        return;
+
+    mutexLock(&g_texture_prefetch_lock);
+
+    for (uint32_t i = 0; i < TEXTURE_PREFETCH_SLOTS; i++) {
+        TexturePrefetch *cur = &g_texture_prefetches[i];
+
+        if (cur->state != TEXTURE_PREFETCH_FREE && texture_cache_entry_matches(&cur->key, &key))
+            goto out;
+        /* Take free slots first, then the oldest one not being decoded */
+        if (cur->state == TEXTURE_PREFETCH_DECODING)
+            continue;
+        if (!slot || (slot->state != TEXTURE_PREFETCH_FREE &&
+                      (cur->state == TEXTURE_PREFETCH_FREE ||
+                       (int32_t)(cur->queue_seq - slot->queue_seq) < 0)))
+            slot = cur;
+    }
+
+    if (slot) {
+        if (slot->state == TEXTURE_PREFETCH_DONE)
+            dkMemBlockDestroy(slot->staging);
+        slot->key = key;
+        slot->texture = *texture;
+        slot->state = TEXTURE_PREFETCH_QUEUED;
+        slot->queue_seq = ++g_texture_prefetch_seq;
+        ueventSignal(&g_texture_prefetch_pending_evflag);
+    }
+
+out:
+    mutexUnlock(&g_texture_prefetch_lock);
 }
 
-EXPORT(SceGxm, 0x2AE22788, SceGxmTextureAddrMode, sceGxmTextureGetUAddrMode,
-       const SceGxmTexture *texture)
+/* Marks the oldest queued slot as being decoded, copying what the decode needs out of it */
+static TexturePrefetch *texture_prefetch_next(TextureCacheEntry *key,
+                                              SceGxmTextureInner *texture)
 {
-    return ((SceGxmTextureInner *)texture)->uaddr_mode;
+    TexturePrefetch *slot = NULL;
+
+    mutexLock(&g_texture_prefetch_lock);
+    for (uint32_t i = 0; i < TEXTURE_PREFETCH_SLOTS; i++) {
+        TexturePrefetch *cur = &g_texture_prefetches[i];
+
+        if (cur->state == TEXTURE_PREFETCH_QUEUED &&
+            (!slot || (int32_t)(cur->queue_seq - slot->queue_seq) < 0))
+            slot = cur;
+    }
+    if (slot) {
+        slot->state = TEXTURE_PREFETCH_DECODING;
+        *key = slot->key;
+        *texture = slot->texture;
+    }
+    mutexUnlock(&g_texture_prefetch_lock);
+
+    return slot;
 }
 
-EXPORT(SceGxm, 0xC037DA83, int, sceGxmTextureGetUAddrModeSafe, const SceGxmTexture *texture)
+/*
+ * Decodes the texture on the calling thread alone, leaving the texture workers to the draws. The
+ * decode is dropped if the game was still writing the texture.
+ */
+static DkMemBlock texture_prefetch_decode(TextureCacheEntry *key,
+                                          const SceGxmTextureInner *texture)
 {
-    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
+    const uint32_t source_size = texture_source_size(texture);
+    const uint32_t staged_size = texture_staged_size(key);
+    DkMemBlock staging;
+
+    key->hash = gxm_texture_hash(key->data, source_size);
+    staging = dk_alloc_memblock(g_dk_device, staged_size,
+                                DkMemBlockFlags_CpuCached | DkMemBlockFlags_GpuCached);
+    if (!staging)
+        return NULL;
 
-    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
-        return SCE_GXM_TEXTURE_ADDR_CLAMP;
-    return inner->uaddr_mode;
+    texture_stage_pvrtc(dkMemBlockGetCpuAddr(staging), key, texture, NULL);
+    if (gxm_texture_hash(key->data, source_size) != key->hash) {
+        dkMemBlockDestroy(staging);
+        return NULL;
+    }
+    dkMemBlockFlushCpuCache(staging, 0, staged_size);
+
+    return staging;
 }
 
-EXPORT(SceGxm, 0x46136CA9, SceGxmTextureAddrMode, sceGxmTextureGetVAddrMode,
-       const SceGxmTexture *texture)
+static int SceGxmTexturePrefetch_thread(SceSize args, void *argp)
 {
-    return ((SceGxmTextureInner *)texture)->vaddr_mode;
+    TexturePrefetch *slot;
+    TextureCacheEntry key;
+    SceGxmTextureInner texture;
+    DkMemBlock staging;
+
+    svcSetThreadCoreMask(CUR_THREAD_HANDLE, TEXTURE_PREFETCH_CORE, BIT(TEXTURE_PREFETCH_CORE));
+
+    for (;;) {
+        waitSingle(waiterForUEvent(&g_texture_prefetch_pending_evflag), -1);
+
+        while (!__atomic_load_n(&g_texture_prefetch_exit, __ATOMIC_RELAXED) &&
+               (slot = texture_prefetch_next(&key, &texture))) {
+            staging = texture_prefetch_decode(&key, &texture);
+
+            mutexLock(&g_texture_prefetch_lock);
+            slot->key.hash = key.hash;
+            slot->staging = staging;
+            slot->state = staging ? TEXTURE_PREFETCH_DONE : TEXTURE_PREFETCH_FREE;
+            mutexUnlock(&g_texture_prefetch_lock);
+            ueventSignal(&g_texture_prefetch_done_evflag);
+        }
+
+        if (__atomic_load_n(&g_texture_prefetch_exit, __ATOMIC_RELAXED))
+            break;
+    }
+
+    return 0;
 }
 
-EXPORT(SceGxm, 0xD2F0D9C1, int, sceGxmTextureGetVAddrModeSafe, const SceGxmTexture *texture)
+/*
+ * Takes the staged decode of a texture if it was prefetched and its contents haven't changed since,
+ * waiting for the decode if it's in progress. A decode that didn't start yet is cancelled, as the
+ * draw would otherwise wait behind the other queued ones.
+ */
+static DkMemBlock texture_prefetch_take(const TextureCacheEntry *entry)
 {
-    SceGxmTextureInner *inner = (SceGxmTextureInner *)texture;
+    DkMemBlock staging = NULL;
 
-    if (gxm_texture_get_type(inner) == SCE_GXM_TEXTURE_LINEAR_STRIDED)
-        return SCE_GXM_TEXTURE_ADDR_CLAMP;
-    return inner->vaddr_mode;
+    mutexLock(&g_texture_prefetch_lock);
+
+    for (uint32_t i = 0; i < TEXTURE_PREFETCH_SLOTS; i++) {
+        TexturePrefetch *cur = &g_texture_prefetches[i];
+
+        if (cur->state == TEXTURE_PREFETCH_FREE || !texture_cache_entry_matches(&cur->key, entry))
+            continue;
+
+        while (cur->state == TEXTURE_PREFETCH_DECODING) {
+            mutexUnlock(&g_texture_prefetch_lock);
+            waitSingle(waiterForUEvent(&g_texture_prefetch_done_evflag), -1);
+            mutexLock(&g_texture_prefetch_lock);
+        }
+
+        /* The slot might have been given to another texture once the decode was done */
+        if (cur->state == TEXTURE_PREFETCH_FREE || !texture_cache_entry_matches(&cur->key, entry))
+            break;
+        if (cur->state == TEXTURE_PREFETCH_DONE) {
+            if (cur->key.hash == entry->hash)
+                staging = cur->staging;
+            else
+                dkMemBlockDestroy(cur->staging);
+        }
+        cur->state = TEXTURE_PREFETCH_FREE;
+        break;
+    }
+
+    mutexUnlock(&g_texture_prefetch_lock);
+
+    if (staging)
+        FRAME_STATS_ADD(texture_prefetch_hits, 1);
+
+    return staging;
 }
 
-EXPORT(SceGxm, 0x126A3EB3, uint32_t, sceGxmTextureGetWidth, const SceGxmTexture *texture)
+/* Looks the staged indices up in the staged palette, writing RGBA8 texels after the palette */
+static void texture_expand_palette(DkCmdBuf cmdbuf, DkMemBlock staging, uint32_t index_count)
 {
-    return gxm_texture_get_width((SceGxmTextureInner *)texture);
+    const DkShader *shader = &g_palette_expand_shader;
+    const DkGpuAddr indices_addr = dkMemBlockGetGpuAddr(staging);
+    const DkGpuAddr palette_addr = indices_addr + index_count;
+    const DkGpuAddr texels_addr = palette_addr + PALETTE_MAX_ENTRIES * sizeof(uint32_t);
+
+    dkCmdBufBindShaders(cmdbuf, DkStageFlag_Compute, &shader, 1);
+    dkCmdBufBindStorageBuffer(cmdbuf, DkStage_Compute, 0, indices_addr, index_count);
+    dkCmdBufBindStorageBuffer(cmdbuf, DkStage_Compute, 1, palette_addr,
+                              PALETTE_MAX_ENTRIES * sizeof(uint32_t));
+    dkCmdBufBindStorageBuffer(cmdbuf, DkStage_Compute, 2, texels_addr,
+                              index_count * sizeof(uint32_t));
+    dkCmdBufDispatchCompute(cmdbuf, index_count / PALETTE_EXPAND_GROUP_INDICES, 1, 1);
+    dkCmdBufBarrier(cmdbuf, DkBarrier_Full, 0);
 }
 
-EXPORT(SceGxm, 0x277794C4, const SceGxmProgramParameter *, sceGxmProgramFindParameterByName,
-       const SceGxmProgram *program, const char *name)
+/*
+ * Converts the texture to linear rows (of blocks, for compressed formats, or of indices, for
+ * paletted ones) in a staging buffer, and copies it to the cached image. Like in the source, each
+ * face is staged with its whole mip chain.
+ */
+static void texture_cache_upload(SceGxmContext *context, TextureCacheEntry *entry,
+                                 const SceGxmTextureInner *texture, uint32_t seq)
 {
-    const uint8_t *parameter_bytes;
-    const char *parameter_name;
-    const SceGxmProgramParameter *const parameters =
-        (const SceGxmProgramParameter *)((char *)&program->parameters_offset +
-                                         program->parameters_offset);
+    const SceGxmTextureBaseFormat base_format = gxm_texture_get_base_format(entry->format);
+    const uint32_t faces = entry->type == SCE_GXM_TEXTURE_CUBE ? 6 : 1;
+    const bool pvrt = gxm_base_format_is_pvrt_format(base_format);
+    const bool paletted = gxm_base_format_is_paletted_format(base_format);
+    /* 4-bit indices are unpacked to bytes first, doubling the source offsets */
+    const uint32_t src_scale = base_format == SCE_GXM_TEXTURE_BASE_FORMAT_P4 ? 2 : 1;
+    uint32_t blocks_x, blocks_y, block_size, stride, src_stride, index_size;
+    uint32_t staged_size = texture_staged_size(entry);
+    uint32_t copy_offset = 0;
+    const uint8_t *src = entry->data;
+    uint8_t *unpacked = NULL;
+    DkMemBlock staging = NULL;
+    bool prefetched;
+    DkImageView view;
+    DkImageRect rect;
+    DkCopyBuf copy_buf = { 0 };
+    uint8_t *staged;
+    uint8_t *dst;
+
+    /* The indices are followed by the palette and the texels the expansion writes */
+    index_size = ALIGN(staged_size, PALETTE_EXPAND_GROUP_INDICES);
+    if (paletted)
+        copy_offset = index_size + PALETTE_MAX_ENTRIES * sizeof(uint32_t);
+
+    if (base_format == SCE_GXM_TEXTURE_BASE_FORMAT_P4) {
+        unpacked = malloc(2 * texture_source_size(texture));
+        if (!unpacked) {
+            LOG("Could not allocate memory to unpack texture %p", src);
+            return;
+        }
+        gxm_texture_unpack_4bpp(unpacked, src, 2 * texture_source_size(texture));
+        src = unpacked;
+    }
 
-    for (uint32_t i = 0; i < program->parameter_count; i++) {
-        parameter_bytes = (const uint8_t *)&parameters[i];
-        parameter_name = (const char *)(parameter_bytes + parameters[i].name_offset);
-        if (strcmp(parameter_name, name) == 0)
-            return (const SceGxmProgramParameter *)parameter_bytes;
+    /* PVRTC textures were usually decoded in the background when they were initialized */
+    if (pvrt)
+        staging = texture_prefetch_take(entry);
+    prefetched = staging != NULL;
+    if (!prefetched) {
+        staging = dk_alloc_memblock(g_dk_device,
+                                    paletted ? copy_offset + staged_size * sizeof(uint32_t)
+                                             : staged_size,
+                                    DkMemBlockFlags_CpuCached | DkMemBlockFlags_GpuCached);
+    }
+    staged = dkMemBlockGetCpuAddr(staging);
+    dst = staged;
+
+    if (pvrt && !prefetched)
+        texture_stage_pvrtc(staged, entry, texture, texture_parallel_for);
+
+    for (uint32_t face = 0; face < faces && !pvrt; face++) {
+        for (uint32_t level = 0; level < entry->levels; level++) {
+            block_size = texture_staged_level_blocks(entry, level, &blocks_x, &blocks_y);
+            stride = blocks_x * block_size;
+
+            switch (entry->type) {
+            case SCE_GXM_TEXTURE_LINEAR:
+            case SCE_GXM_TEXTURE_LINEAR_STRIDED:
+                src_stride =
+                    src_scale * texture_linear_stride(texture, MAX2(entry->width >> level, 1));
+                for (uint32_t y = 0; y < blocks_y; y++)
+                    memcpy(dst + y * stride, src + y * src_stride, stride);
+                break;
+            case SCE_GXM_TEXTURE_TILED:
+                gxm_texture_detile(dst, stride, src, blocks_x, blocks_y, block_size);
+                break;
+            default:
+                gxm_texture_deswizzle(dst, stride, src, blocks_x, blocks_y, block_size);
+                break;
+            }
+
+            dst += stride * blocks_y;
+            src += src_scale * texture_level_size(texture, level);
+        }
     }
+    free(unpacked);
 
-    return NULL;
+    if (paletted) {
+        memset(staged + staged_size, 0, index_size - staged_size);
+        memcpy(staged + index_size, gxm_texture_get_palette(texture),
+               texture_palette_size(base_format));
+        staged_size = copy_offset;
+    }
+    dkMemBlockFlushCpuCache(staging, 0, staged_size);
+
+    /* Draws recorded before might still be sampling the previous contents */
+    if (entry->last_use_seq)
+        dkCmdBufBarrier(context->cmdbuf, DkBarrier_Full, 0);
+
+    if (paletted)
+        texture_expand_palette(context->cmdbuf, staging, index_size);
+
+    dkImageViewDefaults(&view, &entry->image);
+    if (entry->type == SCE_GXM_TEXTURE_CUBE)
+        view.type = DkImageType_2DArray;
+    copy_buf.addr = dkMemBlockGetGpuAddr(staging) + copy_offset;
+    for (uint32_t face = 0; face < faces; face++) {
+        for (uint32_t level = 0; level < entry->levels; level++) {
+            block_size = texture_staged_level_blocks(entry, level, &blocks_x, &blocks_y);
+            rect = (DkImageRect){ 0, 0, face, MAX2(entry->width >> level, 1),
+                                  MAX2(entry->height >> level, 1), 1 };
+            view.mipLevelOffset = level;
+            dkCmdBufCopyBufferToImage(context->cmdbuf, &copy_buf, &view, &rect, 0);
+            copy_buf.addr += blocks_x * blocks_y * (paletted ? sizeof(uint32_t) : block_size);
+        }
+    }
+    dkCmdBufBarrier(context->cmdbuf, DkBarrier_Full, DkInvalidateFlags_Image);
+
+    /* Command lists copy from it again every time they are executed */
+    context_pin_memblock(context, staging, NULL);
+    gpu_memblock_retire(staging, seq);
+    FRAME_STATS_ADD(texture_uploads, 1);
+    FRAME_STATS_ADD(texture_upload_bytes, staged_size);
 }
 
-EXPORT(SceGxm, 0xDBA8D061, uint32_t, sceGxmProgramParameterGetArraySize,
-       const SceGxmProgramParameter *parameter)
+static bool texture_cache_entry_init(TextureCacheEntry *entry, const SceGxmTextureInner *texture,
+                                     SceGxmTextureFormat format, DkImageFormat dk_format)
 {
-    return parameter->array_size;
+    DkImageLayoutMaker image_layout_maker;
+    DkImageLayout image_layout;
+
+    entry->data = gxm_texture_get_data(texture);
+    entry->palette = gxm_texture_get_palette(texture);
+    entry->format = format;
+    entry->type = gxm_texture_get_type(texture);
+    entry->width = gxm_texture_get_width(texture);
+    entry->height = gxm_texture_get_height(texture);
+    entry->levels = texture_mip_levels(texture);
+    entry->last_use_seq = 0;
+    entry->last_check_seq = 0;
+    entry->pinned_seq = 0;
+
+    dkImageLayoutMakerDefaults(&image_layout_maker, g_dk_device);
+    image_layout_maker.type =
+        entry->type == SCE_GXM_TEXTURE_CUBE ? DkImageType_Cubemap : DkImageType_2D;
+    image_layout_maker.format = dk_format;
+    image_layout_maker.dimensions[0] = entry->width;
+    image_layout_maker.dimensions[1] = entry->height;
+    image_layout_maker.dimensions[2] = entry->type == SCE_GXM_TEXTURE_CUBE ? 6 : 1;
+    image_layout_maker.mipLevels = entry->levels;
+    dkImageLayoutInitialize(&image_layout, &image_layout_maker);
+
+    entry->memblock = dk_alloc_memblock(
+        g_dk_device,
+        ALIGN(dkImageLayoutGetSize(&image_layout), dkImageLayoutGetAlignment(&image_layout)),
+        DkMemBlockFlags_GpuCached | DkMemBlockFlags_Image);
+    if (!entry->memblock)
+        return false;
+
+    dkImageInitialize(&entry->image, &image_layout, entry->memblock, 0);
+
+    return true;
 }
 
-EXPORT(SceGxm, 0x1997DC17, SceGxmParameterCategory, sceGxmProgramParameterGetCategory,
-       const SceGxmProgramParameter *parameter)
+/* Whether the contents of a cached texture might have changed since they were last hashed */
+static bool texture_cache_entry_maybe_changed(const TextureCacheEntry *entry,
+                                              uint64_t sampled_hash, uint32_t generation,
+                                              uint32_t seq)
 {
-    return parameter->category;
+    return entry->sampled_hash != sampled_hash || entry->generation != generation ||
+           seq - entry->last_full_check_seq >= TEXTURE_FULL_HASH_INTERVAL;
 }
 
-EXPORT(SceGxm, 0xBD2998D1, uint32_t, sceGxmProgramParameterGetComponentCount,
-       const SceGxmProgramParameter *parameter)
-{
-    return parameter->component_count;
+/*
+ * Returns the converted image of a texture deko3d can't sample as is, and its GPU address.
+ * Conversions happen the first time a texture is seen, and again when its contents change: these
+ * are checked once per scene.
+ */
+static const DkImage *texture_cache_get_image(SceGxmContext *context,
+                                              const SceGxmTextureInner *texture,
+                                              VitaMemBlockInfo *block, SceGxmTextureFormat format,
+                                              DkImageFormat dk_format, DkGpuAddr *image_addr)
+{
+    const SceGxmTextureBaseFormat base_format = gxm_texture_get_base_format(format);
+    const void *data = gxm_texture_get_data(texture);
+    const void *palette = gxm_texture_get_palette(texture);
+    const uint32_t seq = context->scene_seq;
+    TextureCacheEntry key;
+    TextureCacheEntry *entry = NULL;
+    TextureCacheEntry *victim = &g_texture_cache[0];
+    const DkImage *image = NULL;
+    const uint32_t generation = atomic_load(&block->generation);
+    uint64_t palette_hash = 0;
+    uint64_t sampled_hash;
+    uint64_t hash;
+
+    /* Sub-byte formats are not handled by the converters, unless they are block compressed */
+    if (gxm_texture_format_bytes_per_pixel(format) == 0 &&
+        !gxm_base_format_is_block_compressed_format(base_format) &&
+        base_format != SCE_GXM_TEXTURE_BASE_FORMAT_P4)
+        return NULL;
+
+    if (gxm_base_format_is_paletted_format(base_format) &&
+        (!palette || !g_palette_expand_shader_valid))
+        return NULL;
+
+    texture_cache_entry_key(&key, texture, format);
+
+    mutexLock(&g_texture_cache_lock);
+
+    for (uint32_t i = 0; i < TEXTURE_CACHE_SIZE; i++) {
+        TextureCacheEntry *cur = &g_texture_cache[i];
+
+        if (cur->memblock && texture_cache_entry_matches(cur, &key)) {
+            entry = cur;
+            break;
+        }
+        /* Evict empty entries first, then the least recently used one */
+        if (victim->memblock &&
+            (!cur->memblock || (int32_t)(cur->last_use_seq - victim->last_use_seq) < 0))
+            victim = cur;
+    }
+
+    if (entry && entry->last_check_seq == seq) {
+        FRAME_STATS_ADD(texture_cache_hits, 1);
+        entry->last_use_seq = seq;
+        context_pin_memblock(context, entry->memblock, &entry->pinned_seq);
+        image = &entry->image;
+        *image_addr = dkMemBlockGetGpuAddr(entry->memblock);
+        goto out;
+    }
+
+    /* Palettes are small enough to always be hashed fully */
+    if (gxm_base_format_is_paletted_format(base_format))
+        palette_hash = gxm_texture_hash(palette, texture_palette_size(base_format));
+    sampled_hash = gxm_texture_hash_sampled(data, texture_source_size(texture)) ^ palette_hash;
+
+    if (entry && !texture_cache_entry_maybe_changed(entry, sampled_hash, generation, seq)) {
+        FRAME_STATS_ADD(texture_cache_hits, 1);
+        goto checked;
+    }
+
+    hash = gxm_texture_hash(data, texture_source_size(texture)) ^ palette_hash;
+
+    if (!entry) {
+        FRAME_STATS_ADD(texture_cache_misses, 1);
+        if (victim->memblock)
+            gpu_memblock_retire(victim->memblock, victim->last_use_seq);
+        victim->memblock = NULL;
+        if (!texture_cache_entry_init(victim, texture, format, dk_format))
+            goto out;
+        entry = victim;
+        entry->hash = hash;
+        texture_cache_upload(context, entry, texture, seq);
+    } else if (entry->hash != hash) {
+        FRAME_STATS_ADD(texture_cache_invalidations, 1);
+        entry->hash = hash;
+        texture_cache_upload(context, entry, texture, seq);
+    } else {
+        FRAME_STATS_ADD(texture_cache_hits, 1);
+    }
+
+    entry->sampled_hash = sampled_hash;
+    entry->generation = generation;
+    entry->last_full_check_seq = seq;
+
+checked:
+    entry->last_check_seq = seq;
+    entry->last_use_seq = seq;
+    context_pin_memblock(context, entry->memblock, &entry->pinned_seq);
+    image = &entry->image;
+    *image_addr = dkMemBlockGetGpuAddr(entry->memblock);
+
+out:
+    mutexUnlock(&g_texture_cache_lock);
+    return image;
 }
 
-EXPORT(SceGxm, 0xBB58267D, uint32_t, sceGxmProgramParameterGetContainerIndex,
-       const SceGxmProgramParameter *parameter)
+/*
+ * Picks an empty slot, or else the least recently used one the GPU is done with, which no command
+ * list that can still be executed uses.
+ */
+static DescriptorPoolSlot *descriptor_pool_find_victim(DescriptorPoolSlot *slots, uint32_t count,
+                                                       uint32_t completed)
 {
-    return parameter->container_index;
+    DescriptorPoolSlot *victim = NULL;
+
+    for (uint32_t i = 0; i < count; i++) {
+        DescriptorPoolSlot *cur = &slots[i];
+
+        if (!cur->valid)
+            return cur;
+        if (cur->pins || (int32_t)(cur->last_use_seq - completed) > 0)
+            continue;
+        if (!victim || (int32_t)(cur->last_use_seq - victim->last_use_seq) < 0)
+            victim = cur;
+    }
+
+    return victim;
 }
 
-EXPORT(SceGxm, 0x6E61DDF5, uint32_t, sceGxmProgramParameterGetIndex, const SceGxmProgram *program,
-       const SceGxmProgramParameter *parameter)
+/*
+ * Doubles the number of slots of one of the pool's descriptor sets. The descriptors move to a new
+ * memblock at the same indices, the old one staying alive for the scenes and command lists that
+ * bound it. Must be called with g_descriptor_pool_lock held.
+ */
+static bool descriptor_pool_grow(DescriptorPool *pool, uint32_t max_count)
 {
-    uint32_t parameter_offset = program->parameters_offset;
+    const uint32_t image_count = g_descriptor_pool_images.count;
+    const uint32_t new_count = pool->count * 2;
+    uint32_t new_image_count, new_sampler_count;
+    DescriptorPoolSlot *slots;
+    DkMemBlock memblock;
+    char *old_descriptors, *new_descriptors;
+
+    if (new_count > max_count)
+        return false;
+
+    new_image_count = pool == &g_descriptor_pool_images ? new_count : image_count;
+    new_sampler_count =
+        pool == &g_descriptor_pool_samplers ? new_count : g_descriptor_pool_samplers.count;
+    memblock = dk_alloc_memblock(g_dk_device,
+                                 new_image_count * sizeof(DkImageDescriptor) +
+                                     new_sampler_count * sizeof(DkSamplerDescriptor),
+                                 DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+    if (!memblock)
+        return false;
+
+    slots = realloc(pool->slots, new_count * sizeof(*slots));
+    if (!slots) {
+        dkMemBlockDestroy(memblock);
+        return false;
+    }
+    memset(&slots[pool->count], 0, (new_count - pool->count) * sizeof(*slots));
+    pool->slots = slots;
+    pool->count = new_count;
+
+    old_descriptors = dkMemBlockGetCpuAddr(g_descriptor_pool_memblock);
+    new_descriptors = dkMemBlockGetCpuAddr(memblock);
+    memcpy(new_descriptors, old_descriptors, image_count * sizeof(DkImageDescriptor));
+    memcpy(new_descriptors + new_image_count * sizeof(DkImageDescriptor),
+           old_descriptors + image_count * sizeof(DkImageDescriptor),
+           g_descriptor_pool_samplers.count * sizeof(DkSamplerDescriptor));
+
+    /* Every scene that could have bound the old memblock has a sequence number up to this one */
+    gpu_memblock_retire(g_descriptor_pool_memblock,
+                        __atomic_load_n(&g_scene_seq, __ATOMIC_ACQUIRE));
+    g_descriptor_pool_memblock = memblock;
+    g_descriptor_pool_pinned_seq = 0;
+
+    LOG("Descriptor pool grown to %" PRIu32 " image and %" PRIu32 " sampler descriptors",
+        new_image_count, new_sampler_count);
 
-    if (parameter_offset > 0)
-        parameter_offset += (uintptr_t)&program->parameters_offset;
-    return (uint32_t)((uintptr_t)parameter - parameter_offset) >> 4;
+    return true;
 }
 
-EXPORT(SceGxm, 0x6AF88A5D, const char *, sceGxmProgramParameterGetName,
-       const SceGxmProgramParameter *parameter)
+/*
+ * Finds the slot of a descriptor in the pool, or takes one of its set the GPU is done with to build
+ * it into. If the scenes in flight use the whole set, any slot of the pool they don't use is taken
+ * instead, waiting for them to complete if needed. If the scenes being recorded use them all by
+ * themselves, the pool grows. Returns -1 if it can't. Command lists being recorded pin the slots
+ * they use. Must be called with g_descriptor_pool_lock held.
+ */
+static int32_t descriptor_pool_lookup(DescriptorPool *pool, uint32_t max_count, const uint32_t *key,
+                                      uint32_t seq, CommandListResources *list, bool *built)
 {
-    if (!parameter)
-        return NULL;
-    return (const char *)((uintptr_t)parameter + parameter->name_offset);
+    uint32_t completed = __atomic_load_n(&g_completed_scene_seq, __ATOMIC_ACQUIRE);
+    DescriptorPoolSlot *slots = pool->slots;
+    const uint32_t count = pool->count;
+    DescriptorPoolSlot *victim;
+    DescriptorPoolSlot *set;
+    uint32_t hash = 0;
+
+    for (uint32_t i = 0; i < DESCRIPTOR_POOL_KEY_WORDS; i++)
+        hash = (hash ^ key[i]) * 0x9E3779B1;
+    set = &slots[(hash >> 16) % (count / DESCRIPTOR_POOL_WAYS) * DESCRIPTOR_POOL_WAYS];
+
+    for (uint32_t i = 0; i < DESCRIPTOR_POOL_WAYS; i++) {
+        if (set[i].valid && !memcmp(set[i].key, key, sizeof(set[i].key))) {
+            set[i].last_use_seq = seq;
+            if (list)
+                command_list_resources_pin_descriptor(list, pool, &set[i] - slots);
+            *built = false;
+            return &set[i] - slots;
+        }
+    }
+
+    victim = descriptor_pool_find_victim(set, DESCRIPTOR_POOL_WAYS, completed);
+    if (!victim) {
+        completed = scene_seq_poll();
+        victim = descriptor_pool_find_victim(set, DESCRIPTOR_POOL_WAYS, completed);
+    }
+    if (!victim) {
+        FRAME_STATS_ADD(descriptor_set_overflows, 1);
+        victim = descriptor_pool_find_victim(slots, count, completed);
+    }
+    while (!victim && scene_seq_wait_oldest()) {
+        completed = scene_seq_poll();
+        victim = descriptor_pool_find_victim(slots, count, completed);
+    }
+
+    /* The new slots are all empty, so looking up again can't grow it another time */
+    if (!victim) {
+        if (!descriptor_pool_grow(pool, max_count))
+            return -1;
+        return descriptor_pool_lookup(pool, max_count, key, seq, list, built);
+    }
+
+    memcpy(victim->key, key, sizeof(victim->key));
+    victim->last_use_seq = seq;
+    victim->valid = true;
+    if (list)
+        command_list_resources_pin_descriptor(list, pool, victim - slots);
+    *built = true;
+
+    return victim - slots;
 }
 
-EXPORT(SceGxm, 0x5C79D59A, uint32_t, sceGxmProgramParameterGetResourceIndex,
-       const SceGxmProgramParameter *parameter)
+static void texture_sampler_init(DkSampler *sampler, const SceGxmTextureInner *texture)
 {
-    return parameter->resource_index;
+    dkSamplerDefaults(sampler);
+    sampler->wrapMode[0] = gxm_texture_addr_mode_to_dk_wrap_mode(texture->uaddr_mode);
+    sampler->wrapMode[1] = gxm_texture_addr_mode_to_dk_wrap_mode(texture->vaddr_mode);
+    sampler->magFilter = gxm_texture_filter_to_dk_filter(texture->mag_filter);
+    /* The min filter, mip filter and LOD bias bits of strided textures hold their stride */
+    if (gxm_texture_get_type(texture) == SCE_GXM_TEXTURE_LINEAR_STRIDED) {
+        sampler->minFilter = sampler->magFilter;
+    } else {
+        sampler->minFilter = gxm_texture_filter_to_dk_filter(texture->min_filter);
+        sampler->mipFilter = texture->mip_filter ? DkMipFilter_Linear : DkMipFilter_Nearest;
+        /* In eighths of a level, biased by 31 */
+        sampler->lodBias = ((int32_t)texture->lod_bias - 31) / 8.0f;
+        sampler->lodClampMin = texture->lod_min0 | (texture->lod_min1 << 2);
+    }
 }
 
-EXPORT(SceGxm, 0xE6D9C4CE, SceGxmParameterSemantic, sceGxmProgramParameterGetSemantic,
-       const SceGxmProgramParameter *parameter)
+/* Returns the pool index of the sampler descriptor of a texture, building it if needed */
+static int32_t descriptor_pool_get_sampler(const SceGxmTextureInner *texture, uint32_t seq,
+                                           CommandListResources *list, bool *built)
 {
-    if (parameter->category != SCE_GXM_PARAMETER_CATEGORY_ATTRIBUTE)
-        return SCE_GXM_PARAMETER_SEMANTIC_NONE;
+    DkImageDescriptor *image_descriptors;
+    DkSamplerDescriptor *descriptors;
+    SceGxmTextureInner state = { 0 };
+    uint32_t key[DESCRIPTOR_POOL_KEY_WORDS] = { 0 };
+    DkSampler sampler;
+    int32_t index;
+
+    /* Only keep the fields the sampler is built from */
+    state.type = texture->type;
+    state.uaddr_mode = texture->uaddr_mode;
+    state.vaddr_mode = texture->vaddr_mode;
+    state.mag_filter = texture->mag_filter;
+    if (gxm_texture_get_type(texture) != SCE_GXM_TEXTURE_LINEAR_STRIDED) {
+        state.min_filter = texture->min_filter;
+        state.mip_filter = texture->mip_filter;
+        state.lod_bias = texture->lod_bias;
+        state.lod_min0 = texture->lod_min0;
+        state.lod_min1 = texture->lod_min1;
+    }
+    memcpy(key, &state, sizeof(state));
+
+    mutexLock(&g_descriptor_pool_lock);
+    index = descriptor_pool_lookup(&g_descriptor_pool_samplers, DESCRIPTOR_POOL_MAX_SAMPLERS, key,
+                                   seq, list, built);
+    if (index >= 0 && *built) {
+        /* The sampler descriptors follow the image ones */
+        image_descriptors = dkMemBlockGetCpuAddr(g_descriptor_pool_memblock);
+        descriptors = (DkSamplerDescriptor *)&image_descriptors[g_descriptor_pool_images.count];
+        texture_sampler_init(&sampler, &state);
+        dkSamplerDescriptorInitialize(&descriptors[index], &sampler);
+        FRAME_STATS_ADD(descriptors_built, 1);
+    }
+    mutexUnlock(&g_descriptor_pool_lock);
 
-    return parameter->semantic;
+    return index;
 }
 
-EXPORT(SceGxm, 0xB85CC13E, uint32_t, sceGxmProgramParameterGetSemanticIndex,
-       const SceGxmProgramParameter *parameter)
+/*
+ * Returns the pool index of the image descriptor of a texture, building it if needed. Textures
+ * sampled in place have no image yet: it's only made to build their descriptor.
+ */
+static int32_t descriptor_pool_get_image(const SceGxmTextureInner *texture, const DkImage *image,
+                                         DkGpuAddr image_addr, VitaMemBlockInfo *block,
+                                         uint32_t seq, CommandListResources *list, bool *built)
 {
-    return parameter->semantic_index & 0xf;
-}
+    const SceGxmTextureFormat format = gxm_texture_get_format(texture);
+    DkImageDescriptor *descriptors;
+    SceGxmTextureInner state = *texture;
+    uint32_t key[DESCRIPTOR_POOL_KEY_WORDS];
+    DkImageLayoutMaker image_layout_maker;
+    DkImageLayout image_layout;
+    DkImage linear_image;
+    DkImageView image_view;
+    int32_t index;
 
-EXPORT(SceGxm, 0x7B9023C3, SceGxmParameterType, sceGxmProgramParameterGetType,
-       const SceGxmProgramParameter *parameter)
-{
-    return parameter->type;
+    /* Clear the sampler fields, unless they hold the stride */
+    state.uaddr_mode = state.vaddr_mode = state.mag_filter = 0;
+    if (gxm_texture_get_type(texture) != SCE_GXM_TEXTURE_LINEAR_STRIDED) {
+        state.min_filter = state.mip_filter = state.lod_bias = 0;
+        state.lod_min0 = state.lod_min1 = 0;
+    }
+    memcpy(key, &state, sizeof(state));
+    key[4] = (uint32_t)image_addr;
+    key[5] = (uint32_t)(image_addr >> 32);
+
+    mutexLock(&g_descriptor_pool_lock);
+    index = descriptor_pool_lookup(&g_descriptor_pool_images, DESCRIPTOR_POOL_MAX_IMAGES, key, seq,
+                                   list, built);
+    if (index >= 0 && *built) {
+        descriptors = dkMemBlockGetCpuAddr(g_descriptor_pool_memblock);
+        if (!image) {
+            dkImageLayoutMakerDefaults(&image_layout_maker, g_dk_device);
+            image_layout_maker.flags = DkImageFlags_PitchLinear;
+            image_layout_maker.type = DkImageType_2D;
+            image_layout_maker.format = gxm_texture_format_to_dk_image_format(format);
+            image_layout_maker.dimensions[0] = gxm_texture_get_width(texture);
+            image_layout_maker.dimensions[1] = gxm_texture_get_height(texture);
+            image_layout_maker.pitchStride =
+                texture_linear_stride(texture, gxm_texture_get_width(texture));
+            dkImageLayoutInitialize(&image_layout, &image_layout_maker);
+
+            dkImageInitialize(&linear_image, &image_layout, block->dk_memblock,
+                              image_addr - dkMemBlockGetGpuAddr(block->dk_memblock));
+            image = &linear_image;
+        }
+
+        dkImageViewDefaults(&image_view, image);
+        gxm_texture_format_to_dk_image_swizzle(format, image_view.swizzle);
+        dkImageDescriptorInitialize(&descriptors[index], &image_view, false, false);
+        FRAME_STATS_ADD(descriptors_built, 1);
+    }
+    mutexUnlock(&g_descriptor_pool_lock);
+
+    return index;
 }
 
-static void upload_fragment_texture_descriptors(SceGxmContext *context)
+/* Returns false if the descriptors of a texture couldn't be bound */
+static bool upload_fragment_texture_descriptors(SceGxmContext *context)
 {
+    const uint32_t seq = context->scene_seq;
+    CommandListResources *list = context->deferred ? context->list_resources : NULL;
     const SceGxmTextureInner *texture;
     VitaMemBlockInfo *tex_block;
     void *tex_data;
-    DkSampler sampler;
-    DkImageLayoutMaker image_layout_maker;
-    DkImageLayout image_layout;
-    DkImage image;
-    DkImageView image_view;
-    DkGpuAddr desc_addr;
-    struct {
-        DkImageDescriptor images[SCE_GXM_MAX_TEXTURE_UNITS];
-        DkSamplerDescriptor samplers[SCE_GXM_MAX_TEXTURE_UNITS];
-    } descriptors;
+    SceGxmTextureFormat format;
+    SceGxmTextureBaseFormat base_format;
+    uint32_t type, stride;
+    DkImageFormat dk_format;
+    const DkImage *image;
+    DkGpuAddr image_addr;
+    int32_t image_index, sampler_index;
+    uint32_t image_count, sampler_count;
+    DkGpuAddr pool_addr;
+    bool in_place, image_built, sampler_built;
+    bool built = false, bound = true;
 
     for (int i = 0; i < SCE_GXM_MAX_TEXTURE_UNITS; i++) {
         texture = &context->state.fragment_textures[i];
@@ -1582,40 +5577,149 @@ static void upload_fragment_texture_descriptors(SceGxmContext *context)
         if (!tex_block)
             continue;
 
-        dkSamplerDefaults(&sampler);
-        sampler.wrapMode[0] = gxm_texture_addr_mode_to_dk_wrap_mode(texture->uaddr_mode);
-        sampler.wrapMode[1] = gxm_texture_addr_mode_to_dk_wrap_mode(texture->vaddr_mode);
-        sampler.minFilter = gxm_texture_filter_to_dk_filter(texture->min_filter);
-        sampler.magFilter = gxm_texture_filter_to_dk_filter(texture->mag_filter);
-        dkSamplerDescriptorInitialize(&descriptors.samplers[i], &sampler);
-
-        dkImageLayoutMakerDefaults(&image_layout_maker, g_dk_device);
-        image_layout_maker.flags = DkImageFlags_PitchLinear;
-        image_layout_maker.type = DkImageType_2D;
-        image_layout_maker.format = DkImageFormat_RGBA8_Unorm;
-        image_layout_maker.dimensions[0] = gxm_texture_get_width(texture);
-        image_layout_maker.dimensions[1] = gxm_texture_get_height(texture);
-        image_layout_maker.pitchStride =
-            gxm_texture_get_width(texture) *
-            gxm_texture_format_bytes_per_pixel(gxm_texture_get_format(texture));
-        dkImageLayoutInitialize(&image_layout, &image_layout_maker);
-
-        dkImageInitialize(&image, &image_layout, tex_block->dk_memblock,
-                          dk_memblock_cpu_addr_offset(tex_block->dk_memblock, tex_data));
-        dkImageViewDefaults(&image_view, &image);
-        dkImageDescriptorInitialize(&descriptors.images[i], &image_view, false, false);
-        dkCmdBufBindTexture(context->cmdbuf, DkStage_Fragment, i, dkMakeTextureHandle(i, i));
-    }
-
-    desc_addr = dkMemBlockGetGpuAddr(context->fragment_tex_descriptor_set_memblock);
-    dkCmdBufPushData(context->cmdbuf, desc_addr, &descriptors, sizeof(descriptors));
-    dkCmdBufBindImageDescriptorSet(context->cmdbuf, desc_addr, SCE_GXM_MAX_TEXTURE_UNITS);
+        format = gxm_texture_get_format(texture);
+        dk_format = gxm_texture_format_to_dk_image_format(format);
+        if (dk_format == DkImageFormat_None) {
+            LOG("Unsupported texture format 0x%08x", format);
+            continue;
+        }
+
+        base_format = gxm_texture_get_base_format(format);
+        type = gxm_texture_get_type(texture);
+        in_place = false;
+
+        switch (type) {
+        case SCE_GXM_TEXTURE_LINEAR:
+        case SCE_GXM_TEXTURE_LINEAR_STRIDED:
+            /*
+             * The GPU can't sample block compressed images nor mip chains in pitch linear layout,
+             * and needs aligned rows. Paletted images need to be expanded.
+             */
+            stride = texture_linear_stride(texture, gxm_texture_get_width(texture));
+            if (gxm_base_format_is_block_compressed_format(base_format) ||
+                gxm_base_format_is_paletted_format(base_format) ||
+                texture_mip_levels(texture) > 1 || stride % DK_IMAGE_LINEAR_STRIDE_ALIGNMENT) {
+                image = texture_cache_get_image(context, texture, tex_block, format, dk_format,
+                                                &image_addr);
+                break;
+            }
+
+            /* Sampled in place, the image only being made if its descriptor needs building */
+            in_place = true;
+            image = NULL;
+            image_addr = dkMemBlockGetGpuAddr(tex_block->dk_memblock) +
+                         dk_memblock_cpu_addr_offset(tex_block->dk_memblock, tex_data);
+            break;
+        case SCE_GXM_TEXTURE_SWIZZLED:
+        case SCE_GXM_TEXTURE_TILED:
+        case SCE_GXM_TEXTURE_CUBE:
+            image = texture_cache_get_image(context, texture, tex_block, format, dk_format,
+                                            &image_addr);
+            break;
+        default:
+            image = NULL;
+            break;
+        }
+
+        if (!image && !in_place) {
+            LOG("Unsupported texture type 0x%08" PRIx32 ", format 0x%08x", type, format);
+            continue;
+        }
+
+        image_index = descriptor_pool_get_image(texture, image, image_addr, tex_block, seq, list,
+                                                &image_built);
+        sampler_index = descriptor_pool_get_sampler(texture, seq, list, &sampler_built);
+        if (image_index < 0 || sampler_index < 0) {
+            LOG("Descriptor pool exhausted, texture unit %d can't be bound", i);
+            bound = false;
+            continue;
+        }
+        built |= image_built || sampler_built;
+
+        dkCmdBufBindTexture(context->cmdbuf, DkStage_Fragment, i,
+                            dkMakeTextureHandle(image_index, sampler_index));
+    }
+
+    /* Slots might have held other descriptors, which the GPU could have cached */
+    if (built)
+        dkCmdBufBarrier(context->cmdbuf, DkBarrier_None, DkInvalidateFlags_Pool);
+
+    /* The pool might have grown since the lookups, the latest memblock holding all their results */
+    mutexLock(&g_descriptor_pool_lock);
+    pool_addr = dkMemBlockGetGpuAddr(g_descriptor_pool_memblock);
+    image_count = g_descriptor_pool_images.count;
+    sampler_count = g_descriptor_pool_samplers.count;
+    context_pin_memblock(context, g_descriptor_pool_memblock, &g_descriptor_pool_pinned_seq);
+    mutexUnlock(&g_descriptor_pool_lock);
+
+    dkCmdBufBindImageDescriptorSet(context->cmdbuf, pool_addr, image_count);
     dkCmdBufBindSamplerDescriptorSet(
-        context->cmdbuf, desc_addr + SCE_GXM_MAX_TEXTURE_UNITS * sizeof(DkImageDescriptor),
-        SCE_GXM_MAX_TEXTURE_UNITS);
+        context->cmdbuf, pool_addr + image_count * sizeof(DkImageDescriptor), sampler_count);
+
+    return bound;
+}
+
+static void bind_default_uniform_buffer(DkCmdBuf cmdbuf, DkStage stage, uint32_t id, bool ubo,
+                                        DkGpuAddr gpu_addr, const SceGxmProgram *program,
+                                        const UniformBufferLayout *layout)
+{
+    const uint32_t size = program_default_uniform_binding_size(program, layout);
+
+    if (ubo) {
+        dkCmdBufBindUniformBuffer(cmdbuf, stage, id, gpu_addr,
+                                  ALIGN(size, DK_UNIFORM_BUF_ALIGNMENT));
+    } else {
+        /* Too big for a uniform buffer */
+        dkCmdBufBindStorageBuffer(cmdbuf, stage, id, gpu_addr, size);
+    }
+}
+
+static VitaMemBlockInfo *context_get_uniform_buffer_memblock(SceGxmContext *context,
+                                                              const void *addr)
+{
+    UniformBufferCacheEntry *entry =
+        &context->uniform_buffer_cache[((uintptr_t)addr >> 4) & (UNIFORM_BUFFER_CACHE_SIZE - 1)];
+    VitaMemBlockInfo *block = NULL;
+
+    /* UIDs aren't reused, so this also catches the memblock having been freed since */
+    if (entry->addr == addr)
+        block = SceSysmem_get_vita_memblock_info_for_uid(entry->uid);
+
+    if (!block) {
+        block = SceSysmem_get_vita_memblock_info_for_addr(addr);
+        if (!block)
+            return NULL;
+
+        entry->addr = addr;
+        entry->uid = block->uid;
+    }
+
+    return block;
+}
+
+static void context_read_uniform_buffer(SceGxmContext *context, void *dst, const void *src,
+                                        uint32_t size)
+{
+    VitaMemBlockInfo *block = NULL;
+    uint32_t offset, read_size = 0;
+
+    if (src) {
+        block = context_get_uniform_buffer_memblock(context, src);
+        if (!block)
+            LOG("Uniform buffer data %p is not mapped", src);
+    }
+
+    if (block) {
+        offset = (uintptr_t)src - (uintptr_t)block->base;
+        read_size = MIN2(size, block->size - offset);
+        memcpy(dst, dkMemBlockGetCpuAddr(block->dk_memblock) + offset, read_size);
+    }
+
+    memset((char *)dst + read_size, 0, size - read_size);
 }
 
-static void context_flush_dirty_state(SceGxmContext *context)
+/* Returns false if the draw can't be recorded, the state it needs not being bindable */
+static bool context_flush_dirty_state(SceGxmContext *context)
 {
     const DkShader *shaders[2];
     const SceGxmVertexProgram *vertex_program = context->state.vertex_program;
@@ -1624,7 +5728,11 @@ static void context_flush_dirty_state(SceGxmContext *context)
     const SceGxmVertexStream *streams = vertex_program->streams;
     DkVtxAttribState vertex_attrib_state[SCE_GXM_MAX_VERTEX_ATTRIBUTES];
     DkVtxBufferState vertex_buffer_state[SCE_GXM_MAX_VERTEX_STREAMS];
+    VitaMemBlockInfo *stream_block;
+    const void *stream_data;
+    uint32_t stream_offset;
     uint32_t i, shader_count = 0, shader_stage_mask = 0;
+    bool textures_bound = true;
 
     if (context->state.dirty.bit.vertex_shader && vertex_program) {
         memset(vertex_attrib_state, 0,
@@ -1664,6 +5772,24 @@ static void context_flush_dirty_state(SceGxmContext *context)
         dkCmdBufBindShaders(context->cmdbuf, shader_stage_mask, shaders, shader_count);
     }
 
+    for (i = 0; context->state.vertex_streams_dirty_mask && i < SCE_GXM_MAX_VERTEX_STREAMS; i++) {
+        stream_data = context->state.vertex_streams[i];
+        if (!(context->state.vertex_streams_dirty_mask & (1u << i)) || !stream_data)
+            continue;
+
+        stream_block = SceSysmem_get_vita_memblock_info_for_addr(stream_data);
+        if (!stream_block) {
+            LOG("Vertex stream %" PRIu32 " data %p is not mapped", i, stream_data);
+            continue;
+        }
+
+        stream_offset = (uintptr_t)stream_data - (uintptr_t)stream_block->base;
+        dkCmdBufBindVtxBuffer(context->cmdbuf, i,
+                              dkMemBlockGetGpuAddr(stream_block->dk_memblock) + stream_offset,
+                              stream_block->size - stream_offset);
+    }
+    context->state.vertex_streams_dirty_mask = 0;
+
     if (context->state.dirty.bit.depth_stencil)
         dkCmdBufBindDepthStencilState(context->cmdbuf, &context->state.depth_stencil);
 
@@ -1683,48 +5809,626 @@ static void context_flush_dirty_state(SceGxmContext *context)
         dkCmdBufBindColorWriteState(context->cmdbuf, &context->state.color_write);
 
     if (context->state.dirty.bit.fragment_textures)
-        upload_fragment_texture_descriptors(context);
-
-    if (context->state.dirty.bit.vertex_default_uniform) {
-        dkCmdBufBindStorageBuffer(
-            context->cmdbuf, DkStage_Vertex, 0, context->state.vertex_default_uniform.gpu_addr,
-            vertex_program->programId->programHeader->default_uniform_buffer_count * sizeof(float));
+        textures_bound = upload_fragment_texture_descriptors(context);
+
+    /* Switching programs might switch between the uniform and storage buffer bindings */
+    if (context->state.dirty.bit.vertex_default_uniform ||
+        (context->state.dirty.bit.vertex_shader &&
+         context->state.vertex_default_uniform.gpu_addr)) {
+        bind_default_uniform_buffer(context->cmdbuf, DkStage_Vertex, 0,
+                                    vertex_program->default_uniform_ubo,
+                                    context->state.vertex_default_uniform.gpu_addr,
+                                    vertex_program->programId->programHeader,
+                                    &vertex_program->uniform_buffer_layout);
         context->state.vertex_default_uniform.allocated = false;
     }
 
-    if (context->state.dirty.bit.fragment_default_uniform) {
-        dkCmdBufBindStorageBuffer(
-            context->cmdbuf, DkStage_Fragment, 1, context->state.fragment_default_uniform.gpu_addr,
-            fragment_program->programId->programHeader->default_uniform_buffer_count *
-                sizeof(float));
+    if (context->state.dirty.bit.fragment_default_uniform ||
+        (context->state.dirty.bit.fragment_shader &&
+         context->state.fragment_default_uniform.gpu_addr)) {
+        bind_default_uniform_buffer(context->cmdbuf, DkStage_Fragment, 1,
+                                    fragment_program->default_uniform_ubo,
+                                    context->state.fragment_default_uniform.gpu_addr,
+                                    fragment_program->programId->programHeader,
+                                    &fragment_program->uniform_buffer_layout);
         context->state.fragment_default_uniform.allocated = false;
     }
 
-    /* We have flushed all the dirty state */
+    /* We have flushed all the dirty state, the textures are retried by the next draw if needed */
     context->state.dirty.raw = 0;
+    context->state.dirty.bit.fragment_textures = !textures_bound;
+
+    return textures_bound;
 }
 
-EXPORT(SceGxm, 0xBC059AFC, int, sceGxmDraw, SceGxmContext *context, SceGxmPrimitiveType primType,
-       SceGxmIndexFormat indexType, const void *indexData, unsigned int indexCount)
+static bool draw_is_full_screen_quad(const SceGxmContext *context, SceGxmPrimitiveType prim,
+                                     SceGxmIndexFormat index_format, const void *index_data,
+                                     uint32_t index_count, bool *has_depth, float *depth)
+{
+    const SceGxmVertexProgram *vertex_program = context->state.vertex_program;
+    const SceGxmVertexAttribute *position = &vertex_program->attributes[0];
+    const char *stream = context->state.vertex_streams[position->streamIndex];
+    const uint32_t stride = vertex_program->streams[position->streamIndex].stride;
+    uint32_t triangle_count, corners, missing_corners = 0;
+    uint32_t tri[3], index;
+    const float *v;
+
+    if (!stream || index_count < 3 || index_count > 6)
+        return false;
+
+    switch (prim) {
+    case SCE_GXM_PRIMITIVE_TRIANGLES:
+        triangle_count = index_count / 3;
+        break;
+    case SCE_GXM_PRIMITIVE_TRIANGLE_STRIP:
+    case SCE_GXM_PRIMITIVE_TRIANGLE_FAN:
+        triangle_count = index_count - 2;
+        break;
+    default:
+        return false;
+    }
+
+    *has_depth = position->componentCount >= 3;
+
+    for (uint32_t t = 0; t < triangle_count; t++) {
+        if (prim == SCE_GXM_PRIMITIVE_TRIANGLES) {
+            tri[0] = t * 3;
+            tri[1] = t * 3 + 1;
+            tri[2] = t * 3 + 2;
+        } else if (prim == SCE_GXM_PRIMITIVE_TRIANGLE_STRIP) {
+            tri[0] = t;
+            tri[1] = t + 1;
+            tri[2] = t + 2;
+        } else {
+            tri[0] = 0;
+            tri[1] = t + 1;
+            tri[2] = t + 2;
+        }
+
+        /* Every vertex must lie exactly on a corner of the clip space square */
+        corners = 0;
+        for (uint32_t i = 0; i < 3; i++) {
+            if (index_format == SCE_GXM_INDEX_FORMAT_U16)
+                index = ((const uint16_t *)index_data)[tri[i]];
+            else
+                index = ((const uint32_t *)index_data)[tri[i]];
+
+            v = (const float *)(stream + index * stride + position->offset);
+            if ((v[0] != -1.0f && v[0] != 1.0f) || (v[1] != -1.0f && v[1] != 1.0f))
+                return false;
+            /* Anything but w = 1 would move the vertex away from the corner */
+            if (position->componentCount == 4 && v[3] != 1.0f)
+                return false;
+            if (*has_depth) {
+                if (t == 0 && i == 0)
+                    *depth = v[2];
+                else if (v[2] != *depth)
+                    return false;
+            }
+            corners |= 1 << ((v[0] > 0.0f) | ((v[1] > 0.0f) << 1));
+        }
+
+        /* Degenerate triangles don't cover anything */
+        if (__builtin_popcount(corners) == 3)
+            missing_corners |= ~corners & 0xF;
+    }
+
+    /* Two triangles leaving out opposite corners split the square along one diagonal */
+    return (missing_corners & 0x9) == 0x9 || (missing_corners & 0x6) == 0x6;
+}
+
+static bool try_draw_as_clear(SceGxmContext *context, SceGxmPrimitiveType prim,
+                              SceGxmIndexFormat index_format, const void *index_data,
+                              uint32_t index_count)
+{
+    const SceGxmVertexProgram *vertex_program = context->state.vertex_program;
+    const SceGxmFragmentProgram *fragment_program = context->state.fragment_program;
+    const DkDepthStencilState *ds = &context->state.depth_stencil;
+    const SceGxmBlendInfo *blend;
+    const float *color;
+    uint32_t color_mask;
+    bool clear_stencil;
+    bool has_depth;
+    float depth;
+
+    if (context->state.scene_draw_count != 0 || !vertex_program || !fragment_program)
+        return false;
+
+    if (!vertex_program->is_clear_candidate || fragment_program->clear_color_offset < 0 ||
+        !context->state.fragment_default_uniform.cpu_addr)
+        return false;
+
+    /* The draw must overwrite whatever is in the surfaces */
+    blend = &fragment_program->blendInfo;
+    if (blend->colorFunc != SCE_GXM_BLEND_FUNC_NONE || blend->alphaFunc != SCE_GXM_BLEND_FUNC_NONE)
+        return false;
+
+    if (ds->depthCompareOp != DkCompareOp_Always)
+        return false;
+
+    if (ds->stencilFrontCompareOp != DkCompareOp_Always ||
+        ds->stencilBackCompareOp != DkCompareOp_Always ||
+        ds->stencilFrontPassOp != ds->stencilBackPassOp)
+        return false;
+
+    switch (ds->stencilFrontPassOp) {
+    case DkStencilOp_Keep:
+        clear_stencil = false;
+        break;
+    case DkStencilOp_Replace:
+        if (context->state.front_stencil.ref != context->state.back_stencil.ref ||
+            context->state.front_stencil.write_mask != context->state.back_stencil.write_mask)
+            return false;
+        clear_stencil = context->state.front_stencil.write_mask != 0;
+        break;
+    default:
+        return false;
+    }
+
+    if (!draw_is_full_screen_quad(context, prim, index_format, index_data, index_count, &has_depth,
+                                  &depth))
+        return false;
+
+    if (ds->depthWriteEnable) {
+        if (!has_depth)
+            return false;
+        /*
+         * The quad goes through the same depth transform as any other draw: clip space z outside of
+         * [0, 1] is clipped rather than clamped, and what's left is mapped to the viewport's range
+         */
+        if (!(depth >= 0.0f && depth <= 1.0f))
+            return false;
+        depth = SCENE_VIEWPORT_MIN_DEPTH +
+                depth * (SCENE_VIEWPORT_MAX_DEPTH - SCENE_VIEWPORT_MIN_DEPTH);
+    }
+
+    color = (const float *)((const char *)context->state.fragment_default_uniform.cpu_addr +
+                            fragment_program->clear_color_offset);
+    color_mask = ((blend->colorMask & SCE_GXM_COLOR_MASK_R) ? DkColorMask_R : 0) |
+                 ((blend->colorMask & SCE_GXM_COLOR_MASK_G) ? DkColorMask_G : 0) |
+                 ((blend->colorMask & SCE_GXM_COLOR_MASK_B) ? DkColorMask_B : 0) |
+                 ((blend->colorMask & SCE_GXM_COLOR_MASK_A) ? DkColorMask_A : 0);
+
+    if (color_mask)
+        dkCmdBufClearColorFloat(context->cmdbuf, 0, color_mask, color[0], color[1], color[2],
+                                color[3]);
+
+    if (ds->depthWriteEnable || clear_stencil) {
+        dkCmdBufClearDepthStencil(context->cmdbuf, ds->depthWriteEnable, depth,
+                                  clear_stencil ? context->state.front_stencil.write_mask : 0,
+                                  context->state.front_stencil.ref);
+    }
+
+    FRAME_STATS_ADD(clears_replaced, 1);
+
+    return true;
+}
+
+static bool primitive_needs_index_conversion(SceGxmPrimitiveType prim)
+{
+    return prim == SCE_GXM_PRIMITIVE_TRIANGLE_EDGES;
+}
+
+static uint32_t index_size(SceGxmIndexFormat format)
+{
+    return format == SCE_GXM_INDEX_FORMAT_U16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+/* Number of indices the primitive's indices are converted to */
+static uint32_t converted_index_count(SceGxmPrimitiveType prim, uint32_t count)
+{
+    switch (prim) {
+    case SCE_GXM_PRIMITIVE_TRIANGLE_EDGES:
+        /* Each triangle becomes its 3 edges */
+        return count / 3 * 6;
+    default:
+        return count;
+    }
+}
+
+/* Converts a triangle list to the line list of its edges */
+static void convert_triangle_edges(void *dst, const void *src, SceGxmIndexFormat format,
+                                   uint32_t count)
+{
+    const uint32_t size = index_size(format);
+    const uint8_t *in = src;
+    uint8_t *out = dst;
+
+    for (uint32_t i = 0; i + 3 <= count; i += 3) {
+        memcpy(out + 0 * size, in + 0 * size, size);
+        memcpy(out + 1 * size, in + 1 * size, size);
+        memcpy(out + 2 * size, in + 1 * size, size);
+        memcpy(out + 3 * size, in + 2 * size, size);
+        memcpy(out + 4 * size, in + 2 * size, size);
+        memcpy(out + 5 * size, in + 0 * size, size);
+        in += 3 * size;
+        out += 6 * size;
+    }
+}
+
+/*
+ * Returns the GPU address of the converted indices of a primitive with no Maxwell equivalent.
+ * Like textures, the source indices are checked for changes once per scene, so static geometry is
+ * only converted once.
+ */
+static bool index_cache_get(SceGxmContext *context, SceGxmPrimitiveType prim,
+                            SceGxmIndexFormat format, const void *data, uint32_t count,
+                            VitaMemBlockInfo *block, DkGpuAddr *gpu_addr, uint32_t *converted_count)
+{
+    const uint32_t size = count * index_size(format);
+    const uint32_t seq = context->scene_seq;
+    const uint32_t generation = atomic_load(&block->generation);
+    IndexCacheEntry *entry = NULL;
+    IndexCacheEntry *victim = &g_index_cache[0];
+    uint64_t sampled_hash;
+    uint64_t hash;
+    bool ret = false;
+
+    mutexLock(&g_index_cache_lock);
+
+    for (uint32_t i = 0; i < INDEX_CACHE_SIZE; i++) {
+        IndexCacheEntry *cur = &g_index_cache[i];
+
+        if (cur->memblock && cur->data == data && cur->count == count && cur->format == format &&
+            cur->prim == prim) {
+            entry = cur;
+            break;
+        }
+        /* Evict empty entries first, then the least recently used one */
+        if (victim->memblock &&
+            (!cur->memblock || (int32_t)(cur->last_use_seq - victim->last_use_seq) < 0))
+            victim = cur;
+    }
+
+    if (entry && entry->last_check_seq == seq)
+        goto checked;
+
+    sampled_hash = gxm_texture_hash_sampled(data, size);
+    if (entry && entry->sampled_hash == sampled_hash && entry->generation == generation &&
+        seq - entry->last_full_check_seq < TEXTURE_FULL_HASH_INTERVAL)
+        goto checked;
+
+    hash = gxm_texture_hash(data, size);
+    if (!entry || entry->hash != hash) {
+        if (!entry)
+            entry = victim;
+        /* Scenes recorded before might still be reading the previous conversion */
+        if (entry->memblock)
+            gpu_memblock_retire(entry->memblock, entry->last_use_seq);
+
+        entry->data = data;
+        entry->count = count;
+        entry->format = format;
+        entry->prim = prim;
+        entry->hash = hash;
+        entry->converted_count = converted_index_count(prim, count);
+        entry->pinned_seq = 0;
+        entry->memblock = dk_alloc_memblock(
+            g_dk_device, MAX2(entry->converted_count * index_size(format), 1),
+            DkMemBlockFlags_CpuUncached | DkMemBlockFlags_GpuCached);
+        if (!entry->memblock)
+            goto out;
+
+        convert_triangle_edges(dkMemBlockGetCpuAddr(entry->memblock), data, format, count);
+        FRAME_STATS_ADD(index_conversions, 1);
+    }
+
+    entry->sampled_hash = sampled_hash;
+    entry->generation = generation;
+    entry->last_full_check_seq = seq;
+
+checked:
+    entry->last_check_seq = seq;
+    entry->last_use_seq = seq;
+    context_pin_memblock(context, entry->memblock, &entry->pinned_seq);
+    *gpu_addr = dkMemBlockGetGpuAddr(entry->memblock);
+    *converted_count = entry->converted_count;
+    ret = true;
+
+out:
+    mutexUnlock(&g_index_cache_lock);
+    return ret;
+}
+
+static int context_record_draw(SceGxmContext *context, SceGxmPrimitiveType prim_type,
+                               SceGxmIndexFormat index_type, const void *index_data,
+                               uint32_t index_count)
 {
     VitaMemBlockInfo *index_block;
     uint32_t index_offset;
+    DkGpuAddr index_addr;
 
-    LOG("sceGxmDraw: primType: 0x%x, indexCount: %d", primType, indexCount);
-
-    index_block = SceSysmem_get_vita_memblock_info_for_addr(indexData);
+    index_block = SceSysmem_get_vita_memblock_info_for_addr(index_data);
     if (!index_block)
         return SCE_GXM_ERROR_INVALID_VALUE;
 
-    context_flush_dirty_state(context);
+    /* Clears don't go through the rasterizer, so they wouldn't be counted */
+    if (!context_visibility_enabled(context) &&
+        try_draw_as_clear(context, prim_type, index_type, index_data, index_count))
+        return 0;
+
+    /* Fail rather than sampling whatever the texture units were bound to before */
+    if (!context_flush_dirty_state(context))
+        return SCE_GXM_ERROR_OUT_OF_MEMORY;
+    context_update_visibility_run(context);
+
+    if (primitive_needs_index_conversion(prim_type)) {
+        if (!index_cache_get(context, prim_type, index_type, index_data, index_count,
+                             index_block, &index_addr, &index_count))
+            return SCE_GXM_ERROR_OUT_OF_MEMORY;
+    } else {
+        index_offset = (uintptr_t)index_data - (uintptr_t)index_block->base;
+        index_addr = dkMemBlockGetGpuAddr(index_block->dk_memblock) + index_offset;
+    }
+
+    dkCmdBufBindIdxBuffer(context->cmdbuf, gxm_to_dk_idx_format(index_type), index_addr);
+    dkCmdBufDrawIndexed(context->cmdbuf, gxm_to_dk_primitive(prim_type), index_count, 1, 0, 0, 0);
+
+    return 0;
+}
+
+static uint32_t context_get_uniform_buffer_generation(SceGxmContext *context, const void *addr)
+{
+    VitaMemBlockInfo *block = addr ? context_get_uniform_buffer_memblock(context, addr) : NULL;
+
+    return block ? atomic_load(&block->generation) : 0;
+}
+
+/*
+ * Copies the default uniform buffer into an aligned ring buffer allocation, followed by the
+ * contents of the uniform buffers the program reads, where the recompiled shader expects them.
+ *
+ * The last copy is reused while the default uniform buffer, the program and the uniform buffer
+ * addresses stay the same and the GPU hasn't written to them. Like on the hardware, the CPU
+ * writing to a uniform buffer still bound in the scene may not be seen by the following draws.
+ */
+static int context_stage_default_uniform_buffer(SceGxmContext *context, ContextRingBuffer *rb,
+                                               uint32_t *head,
+                                               SceGxmDeferredContextCallback *callback,
+                                               const SceGxmProgram *program,
+                                               const UniformBufferLayout *layout,
+                                               const void *const *buffers,
+                                               StagedUniformBuffers *staged, void **cpu_addr,
+                                               DkGpuAddr *gpu_addr)
+{
+    const uint32_t size = program->default_uniform_buffer_count * sizeof(float);
+    const void *src = *cpu_addr;
+    uint32_t generations[SCE_GXM_MAX_UNIFORM_BUFFERS] = { 0 };
+    bool reuse = staged->valid && staged->program == program && staged->cpu_addr == src &&
+                 staged->ring_wraps == rb->wraps;
+    int ret;
+
+    for (uint32_t i = 0; i < SCE_GXM_MAX_UNIFORM_BUFFERS; i++) {
+        if (layout->sizes[i] == 0)
+            continue;
+        generations[i] = context_get_uniform_buffer_generation(context, buffers[i]);
+        reuse = reuse && staged->buffers[i] == buffers[i] &&
+                staged->generations[i] == generations[i];
+    }
+
+    if (reuse)
+        return 0;
+
+    ret = context_ring_buffer_alloc(
+        context, rb, head, callback,
+        ALIGN(program_default_uniform_binding_size(program, layout), DK_UNIFORM_BUF_ALIGNMENT),
+        DK_UNIFORM_BUF_ALIGNMENT, cpu_addr, gpu_addr);
+    if (ret != 0)
+        return ret;
+
+    if (size > 0)
+        memcpy(*cpu_addr, src, size);
+
+    for (uint32_t i = 0; i < SCE_GXM_MAX_UNIFORM_BUFFERS; i++) {
+        if (layout->sizes[i] > 0)
+            context_read_uniform_buffer(context, (char *)*cpu_addr + layout->offsets[i],
+                                        buffers[i], layout->sizes[i]);
+    }
+
+    staged->valid = layout->size > 0;
+    staged->program = program;
+    staged->cpu_addr = *cpu_addr;
+    staged->ring_wraps = rb->wraps;
+    memcpy(staged->buffers, buffers, sizeof(staged->buffers));
+    memcpy(staged->generations, generations, sizeof(staged->generations));
+
+    return 0;
+}
+
+/*
+ * Copies the default uniform buffers that can't be bound where they are: the app provided ones
+ * that aren't aligned, and those of the programs reading uniform buffers, which get packed after
+ * the default uniform data.
+ */
+static int context_stage_default_uniform_buffers(SceGxmContext *context)
+{
+    const SceGxmVertexProgram *vertex_program = context->state.vertex_program;
+    const SceGxmFragmentProgram *fragment_program = context->state.fragment_program;
+    const void *vertex_cpu_addr = context->state.vertex_default_uniform.cpu_addr;
+    const void *fragment_cpu_addr = context->state.fragment_default_uniform.cpu_addr;
+    int ret;
+
+    if (vertex_program->uniform_buffer_layout.size ||
+        ((context->state.dirty.bit.vertex_default_uniform ||
+          context->state.dirty.bit.vertex_shader) &&
+         vertex_program->default_uniform_ubo &&
+         (context->state.vertex_default_uniform.gpu_addr & (DK_UNIFORM_BUF_ALIGNMENT - 1)))) {
+        ret = context_stage_default_uniform_buffer(
+            context, &context->vertex_rb, &context->state.vertex_rb.head,
+            context->deferred_params.vertexCallback, vertex_program->programId->programHeader,
+            &vertex_program->uniform_buffer_layout, context->state.vertex_uniform_buffers,
+            &context->staged_vertex_uniform_buffers,
+            &context->state.vertex_default_uniform.cpu_addr,
+            &context->state.vertex_default_uniform.gpu_addr);
+        if (ret != 0)
+            return ret;
+        /* Reusing the last copy doesn't need binding it again */
+        if (context->state.vertex_default_uniform.cpu_addr != vertex_cpu_addr)
+            context->state.dirty.bit.vertex_default_uniform = true;
+    }
+
+    if (fragment_program->uniform_buffer_layout.size ||
+        ((context->state.dirty.bit.fragment_default_uniform ||
+          context->state.dirty.bit.fragment_shader) &&
+         fragment_program->default_uniform_ubo &&
+         (context->state.fragment_default_uniform.gpu_addr & (DK_UNIFORM_BUF_ALIGNMENT - 1)))) {
+        ret = context_stage_default_uniform_buffer(
+            context, &context->fragment_rb, &context->state.fragment_rb.head,
+            context->deferred_params.fragmentCallback, fragment_program->programId->programHeader,
+            &fragment_program->uniform_buffer_layout, context->state.fragment_uniform_buffers,
+            &context->staged_fragment_uniform_buffers,
+            &context->state.fragment_default_uniform.cpu_addr,
+            &context->state.fragment_default_uniform.gpu_addr);
+        if (ret != 0)
+            return ret;
+        if (context->state.fragment_default_uniform.cpu_addr != fragment_cpu_addr)
+            context->state.dirty.bit.fragment_default_uniform = true;
+    }
+
+    return 0;
+}
+
+EXPORT(SceGxm, 0xBC059AFC, int, sceGxmDraw, SceGxmContext *context, SceGxmPrimitiveType primType,
+       SceGxmIndexFormat indexType, const void *indexData, unsigned int indexCount)
+{
+    const uint64_t start = armGetSystemTick();
+    uint32_t reserve_failures;
+    DispatchCmd *cmd;
+    uint64_t elapsed_ns;
+    int ret;
+
+    LOG("sceGxmDraw: primType: 0x%x, indexCount: %d", primType, indexCount);
+
+    /* Deferred contexts only have a command list to record into between Begin/EndCommandList */
+    if (!context->state.in_scene)
+        return SCE_GXM_ERROR_NOT_WITHIN_SCENE;
+
+    ret = context_stage_default_uniform_buffers(context);
+    if (ret != 0)
+        return ret;
+
+    if (context->dispatch) {
+        cmd = dispatch_cmd_alloc(context, DISPATCH_CMD_DRAW);
+        cmd->args.draw.prim_type = primType;
+        cmd->args.draw.index_type = indexType;
+        cmd->args.draw.index_data = indexData;
+        cmd->args.draw.index_count = indexCount;
+        dispatch_cmd_submit(context);
+
+        /* The translator thread takes care of flushing the dirty state */
+        context->state.dirty.raw = 0;
+        context->state.vertex_streams_dirty_mask = 0;
+        context->state.vertex_default_uniform.allocated = false;
+        context->state.fragment_default_uniform.allocated = false;
+    } else {
+        reserve_failures = context->cmdbuf_reserve_failures;
+        ret = context_record_draw(context, primType, indexType, indexData, indexCount);
+        if (ret != 0)
+            return ret;
+        if (context->cmdbuf_reserve_failures != reserve_failures)
+            return SCE_GXM_ERROR_RESERVE_FAILED;
+    }
+
+    context->state.scene_draw_count++;
+
+    /* Lets single and multi-threaded recording be compared on the same workload */
+    elapsed_ns = armTicksToNs(armGetSystemTick() - start);
+    if (context->deferred) {
+        FRAME_STATS_ADD(command_list_draws, 1);
+        FRAME_STATS_ADD(command_list_draw_ns, elapsed_ns);
+    } else {
+        FRAME_STATS_ADD(draws, 1);
+        FRAME_STATS_ADD(draw_ns, elapsed_ns);
+    }
+
+    return 0;
+}
+
+#if THREADED_DISPATCH
+static void dispatch_execute(SceGxmContext *context, const DispatchCmd *cmd)
+{
+    DkFence transfer_fence;
+    int ret;
+
+    switch (cmd->type) {
+    case DISPATCH_CMD_SET_STATE:
+        memcpy((char *)&context->state + cmd->args.set_state.offset, cmd->args.set_state.data,
+               cmd->args.set_state.size);
+        break;
+    case DISPATCH_CMD_BEGIN_SCENE:
+        transfer_fence = cmd->args.begin_scene.transfer_fence;
+        context_record_begin_scene(
+            context, cmd->args.begin_scene.has_transfer_fence ? &transfer_fence : NULL);
+        break;
+    case DISPATCH_CMD_END_SCENE:
+        context_record_end_scene(context,
+                                 cmd->args.end_scene.has_vertex_notification
+                                     ? &cmd->args.end_scene.vertex_notification
+                                     : NULL,
+                                 cmd->args.end_scene.has_fragment_notification
+                                     ? &cmd->args.end_scene.fragment_notification
+                                     : NULL);
+        break;
+    case DISPATCH_CMD_EXECUTE_COMMAND_LIST:
+        context_record_execute_command_list(context, cmd->args.execute_command_list.cmd_list,
+                                            cmd->args.execute_command_list.resources);
+        break;
+    case DISPATCH_CMD_DRAW:
+        ret = context_record_draw(context, cmd->args.draw.prim_type, cmd->args.draw.index_type,
+                                  cmd->args.draw.index_data, cmd->args.draw.index_count);
+        if (ret != 0)
+            LOG("Dispatched sceGxmDraw failed: 0x%x", ret);
+        break;
+    case DISPATCH_CMD_DISPLAY_QUEUE_ADD_ENTRY:
+        display_queue_submit_entry(cmd->args.display_queue_add_entry.old_buffer,
+                                   cmd->args.display_queue_add_entry.new_buffer);
+        break;
+    default:
+        UNREACHABLE("Invalid dispatch command type");
+    }
+}
+
+static int SceGxmDispatch_thread(SceSize args, void *argp)
+{
+    DispatchControlBlock *dispatch = *(DispatchControlBlock **)argp;
+    SceGxmContext *context = &dispatch->context;
+    const DispatchCmd *cmd;
+    uint64_t start;
+
+    svcSetThreadCoreMask(CUR_THREAD_HANDLE, DISPATCH_THREAD_CORE, BIT(DISPATCH_THREAD_CORE));
+
+    while (!__atomic_load_n(&dispatch->exit_thread, __ATOMIC_RELAXED)) {
+        while (CIRC_CNT(__atomic_load_n(&dispatch->head, __ATOMIC_ACQUIRE), dispatch->tail,
+                        DISPATCH_RING_NUM_ENTRIES) > 0) {
+            cmd = &dispatch->cmds[dispatch->tail];
+            start = armTicksToNs(armGetSystemTick());
+
+            /* Keep what hasn't been flushed yet (e.g. skipped by clears) */
+            if (cmd->type != DISPATCH_CMD_SET_STATE) {
+                context->state.dirty.raw |= cmd->dirty;
+                context->state.vertex_streams_dirty_mask |= cmd->vertex_streams_dirty_mask;
+                context->state.scene_draw_count = cmd->scene_draw_count;
+            }
+
+            dispatch_execute(context, cmd);
+
+            __atomic_fetch_add(&dispatch->translate_ns, armTicksToNs(armGetSystemTick()) - start,
+                               __ATOMIC_RELAXED);
+            __atomic_store_n(&dispatch->tail,
+                             (dispatch->tail + 1) & (DISPATCH_RING_NUM_ENTRIES - 1),
+                             __ATOMIC_RELEASE);
+            ueventSignal(&dispatch->ready_evflag);
+        }
+
+        if (__atomic_load_n(&dispatch->exit_thread, __ATOMIC_RELAXED))
+            break;
 
-    index_offset = (uintptr_t)indexData - (uintptr_t)index_block->base;
-    dkCmdBufBindIdxBuffer(context->cmdbuf, gxm_to_dk_idx_format(indexType),
-                          dkMemBlockGetGpuAddr(index_block->dk_memblock) + index_offset);
-    dkCmdBufDrawIndexed(context->cmdbuf, gxm_to_dk_primitive(primType), indexCount, 1, 0, 0, 0);
+        waitSingle(waiterForUEvent(&dispatch->pending_evflag), -1);
+    }
 
     return 0;
 }
+#endif
 
 EXPORT(SceGxm, 0xC61E34FC, int, sceGxmMapMemory, void *base, SceSize size,
        SceGxmMemoryAttribFlags attr)
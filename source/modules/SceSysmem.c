@@ -19,17 +19,6 @@ DICT_DEF2(vita_memblock_info_dict, SceUID, M_DEFAULT_OPLIST, VitaMemBlockInfo *,
 static vita_memblock_info_dict_t g_vita_memblock_infos;
 static RwLock g_vita_memblock_infos_lock;
 
-static VitaMemBlockInfo *get_memblock_info_for_uid(SceUID uid)
-{
-    VitaMemBlockInfo *block;
-
-    rwlockReadLock(&g_vita_memblock_infos_lock);
-    block = *vita_memblock_info_dict_get(g_vita_memblock_infos, uid);
-    rwlockReadUnlock(&g_vita_memblock_infos_lock);
-
-    return block;
-}
-
 EXPORT(SceSysmem, 0xB9D5EBDE, SceUID, sceKernelAllocMemBlock, const char *name,
        SceKernelMemBlockType type, SceSize size, SceKernelAllocMemBlockOpt *opt)
 {
@@ -86,7 +75,7 @@ EXPORT(SceSysmem, 0xB9D5EBDE, SceUID, sceKernelAllocMemBlock, const char *name,
 
 EXPORT(SceSysmem, 0xA91E15EE, int, sceKernelFreeMemBlock, SceUID uid)
 {
-    VitaMemBlockInfo *block = get_memblock_info_for_uid(uid);
+    VitaMemBlockInfo *block = SceSysmem_get_vita_memblock_info_for_uid(uid);
 
     if (!block)
         return SCE_KERNEL_ERROR_INVALID_UID;
@@ -102,7 +91,7 @@ EXPORT(SceSysmem, 0xA91E15EE, int, sceKernelFreeMemBlock, SceUID uid)
 
 EXPORT(SceSysmem, 0xB8EF5818, int, sceKernelGetMemBlockBase, SceUID uid, void **base)
 {
-    VitaMemBlockInfo *block = get_memblock_info_for_uid(uid);
+    VitaMemBlockInfo *block = SceSysmem_get_vita_memblock_info_for_uid(uid);
 
     if (!block)
         return SCE_KERNEL_ERROR_INVALID_UID;
@@ -131,6 +120,19 @@ SceUID SceSysmem_get_next_uid(void)
     return atomic_fetch_add(&g_last_uid, 1);
 }
 
+VitaMemBlockInfo *SceSysmem_get_vita_memblock_info_for_uid(SceUID uid)
+{
+    VitaMemBlockInfo **block;
+    VitaMemBlockInfo *ret;
+
+    rwlockReadLock(&g_vita_memblock_infos_lock);
+    block = vita_memblock_info_dict_get(g_vita_memblock_infos, uid);
+    ret = block ? *block : NULL;
+    rwlockReadUnlock(&g_vita_memblock_infos_lock);
+
+    return ret;
+}
+
 VitaMemBlockInfo *SceSysmem_get_vita_memblock_info_for_addr(const void *addr)
 {
     VitaMemBlockInfo *block = NULL;
@@ -158,3 +160,10 @@ DkMemBlock SceSysmem_get_dk_memblock_for_addr(const void *addr)
         return NULL;
     return info->dk_memblock;
 }
+
+void SceSysmem_mark_written(const void *addr)
+{
+    VitaMemBlockInfo *info = SceSysmem_get_vita_memblock_info_for_addr(addr);
+    if (info)
+        atomic_fetch_add(&info->generation, 1);
+}
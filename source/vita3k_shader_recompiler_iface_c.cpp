@@ -1,5 +1,6 @@
 #include <cstring>
 #include <shader/spirv_recompiler.h>
+#include <shader/usse_program_analyzer.h>
 #include <shader/usse_translator_types.h>
 
 #include "vita3k_shader_recompiler_iface_c.h"
@@ -9,7 +10,7 @@ extern "C" {
 static shader::GeneratedShader
 convert_gxp_internal(const SceGxmProgram *program, const char *shader_name,
                      bool support_shader_interlock, bool support_texture_barrier,
-                     bool direct_fragcolor, bool spirv_shader,
+                     bool direct_fragcolor, bool spirv_shader, bool use_ubo,
                      const SceGxmVertexAttribute *hint_attributes, uint32_t num_hint_attributes,
                      bool maskupdate, bool force_shader_debug,
                      bool (*dumper)(const char *ext, const char *dump), shader::Target target)
@@ -21,6 +22,8 @@ convert_gxp_internal(const SceGxmProgram *program, const char *shader_name,
     features.support_texture_barrier = support_texture_barrier;
     features.direct_fragcolor = direct_fragcolor;
     features.spirv_shader = spirv_shader;
+    /* Declare the default uniform buffer as a uniform block instead of a storage buffer */
+    features.use_ubo = use_ubo;
     features.use_mask_bit = false;
 
     std::vector<SceGxmVertexAttribute> hint_attribs;
@@ -49,14 +52,14 @@ convert_gxp_internal(const SceGxmProgram *program, const char *shader_name,
 bool convert_gxp_to_spirv_c(uint32_t **spirv, uint32_t *num_instr, const SceGxmProgram *program,
                             const char *shader_name, bool support_shader_interlock,
                             bool support_texture_barrier, bool direct_fragcolor, bool spirv_shader,
-                            const SceGxmVertexAttribute *hint_attributes,
+                            bool use_ubo, const SceGxmVertexAttribute *hint_attributes,
                             uint32_t num_hint_attributes, bool maskupdate, bool force_shader_debug,
                             bool (*dumper)(const char *ext, const char *dump))
 {
     shader::GeneratedShader shader;
 
     shader = convert_gxp_internal(program, shader_name, support_shader_interlock,
-                                  support_texture_barrier, direct_fragcolor, spirv_shader,
+                                  support_texture_barrier, direct_fragcolor, spirv_shader, use_ubo,
                                   hint_attributes, num_hint_attributes, maskupdate,
                                   force_shader_debug, dumper, shader::Target::SpirVOpenGL);
 
@@ -69,7 +72,7 @@ bool convert_gxp_to_spirv_c(uint32_t **spirv, uint32_t *num_instr, const SceGxmP
 
 bool convert_gxp_to_glsl_c(char **glsl, const SceGxmProgram *program, const char *shader_name,
                            bool support_shader_interlock, bool support_texture_barrier,
-                           bool direct_fragcolor, bool spirv_shader,
+                           bool direct_fragcolor, bool spirv_shader, bool use_ubo,
                            const SceGxmVertexAttribute *hint_attributes,
                            uint32_t num_hint_attributes, bool maskupdate, bool force_shader_debug,
                            bool (*dumper)(const char *ext, const char *dump))
@@ -77,7 +80,7 @@ bool convert_gxp_to_glsl_c(char **glsl, const SceGxmProgram *program, const char
     shader::GeneratedShader shader;
 
     shader = convert_gxp_internal(program, shader_name, support_shader_interlock,
-                                  support_texture_barrier, direct_fragcolor, spirv_shader,
+                                  support_texture_barrier, direct_fragcolor, spirv_shader, use_ubo,
                                   hint_attributes, num_hint_attributes, maskupdate,
                                   force_shader_debug, dumper, shader::Target::GLSLOpenGL);
 
@@ -86,4 +89,19 @@ bool convert_gxp_to_glsl_c(char **glsl, const SceGxmProgram *program, const char
 
     return true;
 }
+
+void get_uniform_buffer_layout_c(const SceGxmProgram *program, uint32_t *offsets, uint32_t *sizes,
+                                 uint32_t count)
+{
+    const shader::usse::UniformBufferSizes buffer_sizes =
+        shader::usse::get_uniform_buffer_sizes(*program);
+    uint32_t offset = 0;
+
+    /* The recompiler packs the buffers back to back, at vec4 granularity, in index order */
+    for (uint32_t i = 0; i < count; i++) {
+        sizes[i] = i < buffer_sizes.size() ? buffer_sizes[i] * sizeof(float) : 0;
+        offsets[i] = offset;
+        offset += (sizes[i] + 4 * sizeof(float) - 1) & ~(4 * sizeof(float) - 1);
+    }
+}
 }
@@ -0,0 +1,96 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gxm/name_table.h"
+#include "util.h"
+
+/* Lookups are repeated until at least this much time has passed, checking it every batch */
+#define MIN_BENCH_NS     200000000ull
+#define BENCH_BATCH_SIZE 256
+#define NAME_SIZE        32
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static const char *get_name(const void *items, uint32_t index)
+{
+    return (const char *)items + index * NAME_SIZE;
+}
+
+/* What sceGxmProgramFindParameterByName does for unregistered programs */
+static int32_t linear_find(const char *names, uint32_t count, const char *name)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(get_name(names, i), name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static double bench_lookups(const char *names, uint32_t count, const GxmNameTable *table)
+{
+    volatile int32_t sink = 0;
+    uint64_t start, elapsed;
+    uint64_t lookups = 0;
+
+    start = now_ns();
+    do {
+        /* Look every name up, like a game caching its parameters after loading a program */
+        for (uint32_t b = 0; b < BENCH_BATCH_SIZE; b++) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (table)
+                    sink = sink + gxm_name_table_find(table, names, get_name, get_name(names, i));
+                else
+                    sink = sink + linear_find(names, count, get_name(names, i));
+            }
+        }
+        lookups += BENCH_BATCH_SIZE * count;
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_BENCH_NS);
+
+    return (double)elapsed / lookups;
+}
+
+int main(void)
+{
+    static const uint32_t counts[] = { 4, 16, 64, 256 };
+    GxmNameTable *table;
+    char *names;
+
+    for (uint32_t c = 0; c < ARRAY_SIZE(counts); c++) {
+        names = malloc(counts[c] * NAME_SIZE);
+        if (!names) {
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+
+        /* Shader parameter names tend to share long prefixes */
+        for (uint32_t i = 0; i < counts[c]; i++)
+            snprintf(names + i * NAME_SIZE, NAME_SIZE, "u_material.param%" PRIu32, i);
+
+        table = gxm_name_table_create(names, counts[c], get_name);
+        if (!table) {
+            fprintf(stderr, "Failed to create a table of %" PRIu32 " names\n", counts[c]);
+            return EXIT_FAILURE;
+        }
+
+        printf("%3" PRIu32
+               " parameters: linear search %7.1f ns/lookup, hash table %7.1f ns/lookup\n",
+               counts[c], bench_lookups(names, counts[c], NULL),
+               bench_lookups(names, counts[c], table));
+
+        free(table);
+        free(names);
+    }
+
+    return EXIT_SUCCESS;
+}
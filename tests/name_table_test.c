@@ -0,0 +1,70 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gxm/name_table.h"
+#include "util.h"
+
+/* Includes duplicates, which must resolve to their first occurrence */
+static const char *const names[] = {
+    "position", "texcoord", "color", "wvp", "color", "lights[0].position", "lights[1].position", "",
+};
+
+static const char *const missing_names[] = { "missing", "position ", "Color", "lights" };
+
+static const char *get_name(const void *items, uint32_t index)
+{
+    return ((const char *const *)items)[index];
+}
+
+/* What sceGxmProgramFindParameterByName does for unregistered programs */
+static int32_t linear_find(uint32_t count, const char *name)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static int check_find(const GxmNameTable *table, uint32_t count, const char *name)
+{
+    const int32_t index = gxm_name_table_find(table, names, get_name, name);
+    const int32_t expected = linear_find(count, name);
+
+    if (index != expected) {
+        fprintf(stderr, "%" PRIu32 " names: \"%s\" found at %" PRId32 ", expected %" PRId32 "\n",
+                count, name, index, expected);
+        return 1;
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    GxmNameTable *table;
+    int failures = 0;
+
+    /* Every table size, each name being looked up whether it's in the table or not */
+    for (uint32_t count = 0; count <= ARRAY_SIZE(names); count++) {
+        table = gxm_name_table_create(names, count, get_name);
+        if (!table) {
+            fprintf(stderr, "Failed to create a table of %" PRIu32 " names\n", count);
+            return EXIT_FAILURE;
+        }
+
+        for (uint32_t i = 0; i < ARRAY_SIZE(names); i++)
+            failures += check_find(table, count, names[i]);
+        for (uint32_t i = 0; i < ARRAY_SIZE(missing_names); i++)
+            failures += check_find(table, count, missing_names[i]);
+
+        free(table);
+    }
+
+    printf("%d name table failures\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
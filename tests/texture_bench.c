@@ -0,0 +1,93 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gxm/texture.h"
+#include "util.h"
+
+#define PVRTC_BLOCK_HEIGHT 4
+#define PVRTC_BLOCK_BYTES  8
+/* Decodes are repeated until at least this much time has passed */
+#define MIN_BENCH_NS 200000000ull
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t random_word(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static bool bench_pvrtc(uint32_t width, uint32_t height, bool two_bpp, bool pvrtc2)
+{
+    const uint32_t block_width = two_bpp ? 8 : 4;
+    const uint32_t blocks = MAX2(width / block_width, 2) * MAX2(height / PVRTC_BLOCK_HEIGHT, 2);
+    const size_t src_size = (size_t)blocks * PVRTC_BLOCK_BYTES;
+    uint32_t state = 0x12345678;
+    uint64_t start, elapsed;
+    uint32_t iterations = 0;
+    uint32_t *src;
+    uint8_t *dst;
+
+    src = malloc(src_size);
+    dst = malloc((size_t)width * height * 4);
+    if (!src || !dst) {
+        free(src);
+        free(dst);
+        return false;
+    }
+
+    /* Random blocks exercise all the color and modulation modes */
+    for (size_t i = 0; i < src_size / sizeof(uint32_t); i++)
+        src[i] = random_word(&state);
+
+    start = now_ns();
+    do {
+        if (!gxm_texture_decode_pvrtc(dst, width * 4, src, width, height, two_bpp, pvrtc2, NULL)) {
+            free(src);
+            free(dst);
+            return false;
+        }
+        iterations++;
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_BENCH_NS);
+
+    printf("%-6s %ubpp %4" PRIu32 "x%-4" PRIu32 ": %8.3f ms/decode, %7.1f Mtexels/s\n",
+           pvrtc2 ? "PVRTC2" : "PVRTC", two_bpp ? 2 : 4, width, height,
+           (double)elapsed / iterations / 1e6,
+           (double)width * height * iterations / ((double)elapsed / 1e9) / 1e6);
+
+    free(src);
+    free(dst);
+
+    return true;
+}
+
+int main(void)
+{
+    static const uint32_t sizes[] = { 64, 256, 1024 };
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+        for (int pvrtc2 = 0; pvrtc2 <= 1; pvrtc2++) {
+            for (int two_bpp = 0; two_bpp <= 1; two_bpp++) {
+                if (!bench_pvrtc(sizes[i], sizes[i], two_bpp, pvrtc2)) {
+                    fprintf(stderr, "Failed to decode a %" PRIu32 "x%" PRIu32 " texture\n",
+                            sizes[i], sizes[i]);
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,548 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gxm/texture.h"
+#include "util.h"
+
+/* Bytes past the end of each destination row, which must be left untouched */
+#define ROW_PADDING 16
+#define PAD_BYTE    0xA5
+
+#define PVRTC_BLOCK_HEIGHT 4
+#define PVRTC_MAX_BLOCKS   8
+
+/* Color words: opaque color A is RGB554 with the mode bit, opaque color B is RGB555 */
+#define PVRTC_OPAQUE_A(r, g, b, mode) (0x8000u | (r) << 10 | (g) << 5 | (b) << 1 | (mode))
+#define PVRTC_OPAQUE_B(r, g, b)       (0x80000000u | (uint32_t)(r) << 26 | (g) << 21 | (b) << 16)
+/* Red opaque color A and blue opaque color B */
+#define PVRTC_RED_BLUE                (PVRTC_OPAQUE_A(31, 0, 0, 0) | PVRTC_OPAQUE_B(0, 0, 31))
+/* Translucent color A is ARGB3443 (here red, alpha 3), translucent color B is ARGB3444 */
+#define PVRTC_TRANSLUCENT_RED         (3u << 12 | 15u << 8)
+#define PVRTC_TRANSLUCENT_BLUE        (7u << 28 | 15u << 16)
+
+/* Lines hashed by gxm_texture_hash_sampled */
+#define HASH_SAMPLE_COUNT 64
+#define HASH_SAMPLE_SIZE  64
+
+/*
+ * Texture made of identical blocks, and the expected texels of a block: they are the same in all
+ * of them, as the colors blended from the neighbouring blocks are too. The characters of the rows
+ * index the colors.
+ */
+typedef struct {
+    const char *name;
+    bool two_bpp;
+    bool pvrtc2;
+    uint32_t mod_data;
+    uint32_t color_data;
+    const char *rows[PVRTC_BLOCK_HEIGHT];
+    uint8_t colors[4][4];
+} PvrtcCase;
+
+static const PvrtcCase pvrtc_cases[] = {
+    /* Modulation values 0 to 3 along each row, weighting color B by 0, 3/8, 5/8 and 1 */
+    {
+        "4bpp opaque",
+        false,
+        false,
+        0xE4E4E4E4,
+        PVRTC_RED_BLUE,
+        { "0123", "0123", "0123", "0123" },
+        { { 255, 0, 0, 255 }, { 159, 0, 95, 255 }, { 95, 0, 159, 255 }, { 0, 0, 255, 255 } },
+    },
+    /* Weights 0, 1/2, 1/2 and 1, value 2 being transparent */
+    {
+        "4bpp punch-through",
+        false,
+        false,
+        0xE4E4E4E4,
+        PVRTC_RED_BLUE | 1,
+        { "0123", "0123", "0123", "0123" },
+        { { 255, 0, 0, 255 }, { 127, 0, 127, 255 }, { 127, 0, 127, 0 }, { 0, 0, 255, 255 } },
+    },
+    {
+        "4bpp translucent",
+        false,
+        false,
+        0xE4E4E4E4,
+        PVRTC_TRANSLUCENT_RED | PVRTC_TRANSLUCENT_BLUE,
+        { "0123", "0123", "0123", "0123" },
+        { { 255, 0, 0, 102 }, { 159, 0, 95, 153 }, { 95, 0, 159, 187 }, { 0, 0, 255, 238 } },
+    },
+    /* Only color B is opaque: color A is ARGB3443 */
+    {
+        "4bpp mixed opacity",
+        false,
+        false,
+        0xE4E4E4E4,
+        PVRTC_TRANSLUCENT_RED | PVRTC_TRANSLUCENT_BLUE | 0x80000000u,
+        { "0123", "0123", "0123", "0123" },
+        { { 255, 0, 0, 102 }, { 246, 0, 46, 159 }, { 240, 0, 76, 197 }, { 231, 0, 123, 255 } },
+    },
+    /* PVRTC2 takes the opacity of color A from color B: the same bits are RGB554 */
+    {
+        "PVRTC2 4bpp",
+        false,
+        true,
+        0xE4E4E4E4,
+        PVRTC_TRANSLUCENT_RED | PVRTC_TRANSLUCENT_BLUE | 0x80000000u,
+        { "0123", "0123", "0123", "0123" },
+        { { 123, 198, 0, 255 }, { 163, 123, 46, 255 }, { 190, 74, 76, 255 }, { 231, 0, 123, 255 } },
+    },
+    /* One bit per texel */
+    {
+        "2bpp",
+        true,
+        false,
+        0xAAAAAAAA,
+        PVRTC_RED_BLUE,
+        { "01010101", "01010101", "01010101", "01010101" },
+        { { 255, 0, 0, 255 }, { 0, 0, 255, 255 } },
+    },
+    /*
+     * Checkerboard of stored texels, color B in the even rows and color A in the odd ones. The
+     * others are interpolated vertically, as the low bits of the first and center texels are set.
+     */
+    {
+        "2bpp vertical",
+        true,
+        false,
+        0x00FF00FF,
+        PVRTC_RED_BLUE | 1,
+        { "10101010", "10101010", "10101010", "10101010" },
+        { { 255, 0, 0, 255 }, { 0, 0, 255, 255 } },
+    },
+    /* Horizontally, with the low bit of the center texel clear */
+    {
+        "2bpp horizontal",
+        true,
+        false,
+        0x00EF00FF,
+        PVRTC_RED_BLUE | 1,
+        { "11111111", "00000000", "11111111", "00000000" },
+        { { 255, 0, 0, 255 }, { 0, 0, 255, 255 } },
+    },
+    /* In both directions, with the low bit of the first texel clear */
+    {
+        "2bpp both directions",
+        true,
+        false,
+        0x00FF00FE,
+        PVRTC_RED_BLUE | 1,
+        { "12121212", "20202020", "12121212", "20202020" },
+        { { 255, 0, 0, 255 }, { 0, 0, 255, 255 }, { 127, 0, 127, 255 } },
+    },
+};
+
+/* Reference Morton offset, interleaving one bit at a time: x in the even bits, y in the odd ones */
+static uint32_t morton_offset(uint32_t x, uint32_t y)
+{
+    uint32_t offset = 0;
+
+    for (uint32_t bit = 0; bit < 16; bit++) {
+        offset |= ((x >> bit) & 1) << (2 * bit);
+        offset |= ((y >> bit) & 1) << (2 * bit + 1);
+    }
+
+    return offset;
+}
+
+/* Non-square swizzled textures are a sequence of Morton ordered squares */
+static size_t swizzled_texel_offset(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    const uint32_t n = MIN2(width, height);
+    const uint32_t block = width > height ? x / n : y / n;
+
+    return (size_t)block * n * n + morton_offset(x % n, y % n);
+}
+
+/* Tiled textures are rows of 32x32 Morton ordered tiles */
+static size_t tiled_texel_offset(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    const uint32_t tiles_x = ALIGN(width, GXM_TEXTURE_TILE_SIZE) / GXM_TEXTURE_TILE_SIZE;
+    const uint32_t tile = (y / GXM_TEXTURE_TILE_SIZE) * tiles_x + x / GXM_TEXTURE_TILE_SIZE;
+
+    return (size_t)tile * GXM_TEXTURE_TILE_SIZE * GXM_TEXTURE_TILE_SIZE +
+           morton_offset(x % GXM_TEXTURE_TILE_SIZE, y % GXM_TEXTURE_TILE_SIZE);
+}
+
+static uint8_t random_byte(uint32_t *state)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 24;
+}
+
+static int check_conversion(const char *name,
+                            void (*convert)(void *dst, size_t dst_stride, const void *src,
+                                            uint32_t width, uint32_t height, uint32_t bpp),
+                            size_t (*texel_offset)(uint32_t x, uint32_t y, uint32_t width,
+                                                   uint32_t height),
+                            size_t src_size, uint32_t width, uint32_t height, uint32_t bpp)
+{
+    const size_t dst_stride = width * bpp + ROW_PADDING;
+    uint32_t state = width * 31 + height * 17 + bpp;
+    uint8_t *src, *dst;
+    const uint8_t *expected, *actual;
+    int failures = 0;
+
+    src = malloc(src_size);
+    dst = malloc(dst_stride * height);
+    if (!src || !dst) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < src_size; i++)
+        src[i] = random_byte(&state);
+    memset(dst, PAD_BYTE, dst_stride * height);
+
+    convert(dst, dst_stride, src, width, height, bpp);
+
+    for (uint32_t y = 0; y < height && !failures; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            expected = src + texel_offset(x, y, width, height) * bpp;
+            actual = dst + y * dst_stride + x * bpp;
+            if (memcmp(expected, actual, bpp)) {
+                fprintf(stderr, "%s %" PRIu32 "x%" PRIu32 " bpp %" PRIu32
+                                ": texel (%" PRIu32 ", %" PRIu32 ") mismatch\n",
+                        name, width, height, bpp, x, y);
+                failures++;
+                break;
+            }
+        }
+        for (uint32_t i = 0; i < ROW_PADDING; i++) {
+            if (dst[y * dst_stride + width * bpp + i] != PAD_BYTE) {
+                fprintf(stderr, "%s %" PRIu32 "x%" PRIu32 " bpp %" PRIu32
+                                ": row %" PRIu32 " written past its end\n",
+                        name, width, height, bpp, y);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    free(src);
+    free(dst);
+
+    return failures;
+}
+
+static int check_pvrtc_case(const PvrtcCase *c, uint32_t width, uint32_t height)
+{
+    const uint32_t block_width = c->two_bpp ? 8 : 4;
+    const uint32_t blocks = (width / block_width) * (height / PVRTC_BLOCK_HEIGHT);
+    uint32_t words[2 * PVRTC_MAX_BLOCKS * PVRTC_MAX_BLOCKS];
+    const uint8_t *expected, *actual;
+    uint8_t *dst;
+    int failures = 0;
+
+    for (uint32_t i = 0; i < blocks; i++) {
+        words[2 * i] = c->mod_data;
+        words[2 * i + 1] = c->color_data;
+    }
+
+    dst = malloc(width * height * 4);
+    if (!dst) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!gxm_texture_decode_pvrtc(dst, width * 4, words, width, height, c->two_bpp, c->pvrtc2,
+                                  NULL)) {
+        fprintf(stderr, "PVRTC %s: decode failed\n", c->name);
+        free(dst);
+        return 1;
+    }
+
+    for (uint32_t y = 0; y < height && !failures; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            expected = c->colors[c->rows[y % PVRTC_BLOCK_HEIGHT][x % block_width] - '0'];
+            actual = &dst[(y * width + x) * 4];
+            if (memcmp(expected, actual, 4)) {
+                fprintf(stderr,
+                        "PVRTC %s %" PRIu32 "x%" PRIu32 ": texel (%" PRIu32 ", %" PRIu32
+                        ") is %u %u %u %u, expected %u %u %u %u\n",
+                        c->name, width, height, x, y, actual[0], actual[1], actual[2], actual[3],
+                        expected[0], expected[1], expected[2], expected[3]);
+                failures++;
+                break;
+            }
+        }
+    }
+
+    free(dst);
+
+    return failures;
+}
+
+/*
+ * Blocks of a 4x2 grid, with a different opaque color A each. The texels at the block centers only
+ * take the color of their block, the others blending the 4 nearest ones, wrapping around.
+ */
+static int check_pvrtc_blocks(void)
+{
+    /* Non-square grids are Morton ordered squares side by side */
+    static const uint32_t block_index[2][4] = { { 0, 1, 4, 5 }, { 2, 3, 6, 7 } };
+    uint32_t words[2 * 8];
+    uint8_t dst[16 * 8 * 4];
+    uint32_t red;
+    int failures = 0;
+
+    for (uint32_t i = 0; i < 8; i++) {
+        words[2 * i] = 0;
+        words[2 * i + 1] = PVRTC_OPAQUE_A(4 * i, 0, 0, 0) | PVRTC_OPAQUE_B(0, 0, 0);
+    }
+
+    if (!gxm_texture_decode_pvrtc(dst, 16 * 4, words, 16, 8, false, false, NULL)) {
+        fprintf(stderr, "PVRTC blocks: decode failed\n");
+        return 1;
+    }
+
+    for (uint32_t by = 0; by < 2; by++) {
+        for (uint32_t bx = 0; bx < 4; bx++) {
+            red = 4 * block_index[by][bx];
+            red = (red << 3) | (red >> 2);
+            if (dst[((by * 4 + 2) * 16 + bx * 4 + 2) * 4] != red) {
+                fprintf(stderr, "PVRTC blocks: block (%" PRIu32 ", %" PRIu32 ") has red %u\n", bx,
+                        by, dst[((by * 4 + 2) * 16 + bx * 4 + 2) * 4]);
+                failures++;
+            }
+        }
+    }
+
+    /* Blocks 7, 2, 5 and 0 average to 14 */
+    if (dst[0] != ((14 << 3) | (14 >> 2))) {
+        fprintf(stderr, "PVRTC blocks: corner texel has red %u\n", dst[0]);
+        failures++;
+    }
+
+    return failures;
+}
+
+/* Runs the jobs backwards, which would break a decoder depending on their order */
+static void reverse_for(GxmTextureParallelFunc func, void *arg, uint32_t count)
+{
+    while (count-- > 0)
+        func(arg, count);
+}
+
+/* Random blocks, decoded by bands of rows in any order, must give the same texels */
+static int check_pvrtc_parallel(uint32_t width, uint32_t height, bool two_bpp, bool pvrtc2)
+{
+    const uint32_t block_width = two_bpp ? 8 : 4;
+    const size_t src_size = (size_t)(width / block_width) * (height / PVRTC_BLOCK_HEIGHT) * 8;
+    const size_t dst_size = (size_t)width * height * 4;
+    uint32_t state = width + height + two_bpp + pvrtc2;
+    uint8_t *src, *serial, *parallel;
+    int failures = 0;
+
+    src = malloc(src_size);
+    serial = malloc(dst_size);
+    parallel = malloc(dst_size);
+    if (!src || !serial || !parallel) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < src_size; i++)
+        src[i] = random_byte(&state);
+
+    if (!gxm_texture_decode_pvrtc(serial, width * 4, src, width, height, two_bpp, pvrtc2, NULL) ||
+        !gxm_texture_decode_pvrtc(parallel, width * 4, src, width, height, two_bpp, pvrtc2,
+                                  reverse_for)) {
+        fprintf(stderr, "PVRTC parallel: decode failed\n");
+        failures++;
+    } else if (memcmp(serial, parallel, dst_size)) {
+        fprintf(stderr, "PVRTC parallel %" PRIu32 "x%" PRIu32 " %ubpp%s: texels differ\n", width,
+                height, two_bpp ? 2 : 4, pvrtc2 ? " PVRTC2" : "");
+        failures++;
+    }
+
+    free(src);
+    free(serial);
+    free(parallel);
+
+    return failures;
+}
+
+static int check_pvrtc(void)
+{
+    /* The smallest grid of 2x2 blocks, and a wider than high one */
+    static const uint32_t sizes[][2] = { { 1, 2 }, { 4, 2 }, { 2, 4 } };
+    int failures = 0;
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(pvrtc_cases); i++) {
+        const PvrtcCase *c = &pvrtc_cases[i];
+        const uint32_t block_width = c->two_bpp ? 8 : 4;
+
+        for (uint32_t j = 0; j < ARRAY_SIZE(sizes); j++) {
+            failures += check_pvrtc_case(c, MAX2(sizes[j][0], 2) * block_width,
+                                         sizes[j][1] * PVRTC_BLOCK_HEIGHT);
+        }
+    }
+
+    for (int two_bpp = 0; two_bpp <= 1; two_bpp++) {
+        for (int pvrtc2 = 0; pvrtc2 <= 1; pvrtc2++) {
+            failures += check_pvrtc_parallel(128, 128, two_bpp, pvrtc2);
+            failures += check_pvrtc_parallel(256, 64, two_bpp, pvrtc2);
+        }
+    }
+
+    return failures + check_pvrtc_blocks();
+}
+
+static int check_hash(void)
+{
+    static const uint32_t sizes[] = { 1, 7, 31, 32, 33, 100 };
+    uint8_t data[128 + 1];
+    uint8_t zeros[65] = { 0 };
+    uint64_t hashes[ARRAY_SIZE(zeros)];
+    uint32_t state = 1;
+    uint64_t hash;
+    int failures = 0;
+
+    for (uint32_t i = 0; i < sizeof(data); i++)
+        data[i] = random_byte(&state);
+
+    /* The size is hashed too, telling runs of zeros apart */
+    for (uint32_t i = 0; i < ARRAY_SIZE(zeros); i++) {
+        hashes[i] = gxm_texture_hash(zeros, i);
+        for (uint32_t j = 0; j < i; j++) {
+            if (hashes[i] == hashes[j]) {
+                fprintf(stderr, "hash: %" PRIu32 " and %" PRIu32 " zeros collide\n", i, j);
+                failures++;
+            }
+        }
+    }
+
+    for (uint32_t s = 0; s < ARRAY_SIZE(sizes); s++) {
+        hash = gxm_texture_hash(data, sizes[s]);
+
+        /* Unaligned data hashes the same */
+        memmove(data + 1, data, sizes[s]);
+        if (gxm_texture_hash(data + 1, sizes[s]) != hash) {
+            fprintf(stderr, "hash: %" PRIu32 " bytes hash differently unaligned\n", sizes[s]);
+            failures++;
+        }
+        memmove(data, data + 1, sizes[s]);
+
+        /* Both the lanes and the tail cover every bit */
+        for (uint32_t bit = 0; bit < sizes[s] * 8; bit++) {
+            data[bit / 8] ^= 1u << (bit % 8);
+            if (gxm_texture_hash(data, sizes[s]) == hash) {
+                fprintf(stderr, "hash: flipping bit %" PRIu32 " of %" PRIu32 " bytes is missed\n",
+                        bit, sizes[s]);
+                failures++;
+            }
+            data[bit / 8] ^= 1u << (bit % 8);
+        }
+    }
+
+    return failures;
+}
+
+static int check_hash_sampled(void)
+{
+    const size_t size = 1 << 20;
+    const size_t step = size / HASH_SAMPLE_COUNT;
+    /* In the first, a middle and the last sample, and the extra one at the end */
+    const size_t sampled[] = {
+        0, HASH_SAMPLE_SIZE - 1, 31 * step, 31 * step + HASH_SAMPLE_SIZE - 1, 63 * step,
+        size - HASH_SAMPLE_SIZE, size - 1,
+    };
+    /* Between samples */
+    const size_t skipped[] = { HASH_SAMPLE_SIZE, 31 * step - 1, size - HASH_SAMPLE_SIZE - 1 };
+    uint32_t state = 2;
+    uint64_t hash;
+    uint8_t *data;
+    int failures = 0;
+
+    data = malloc(size);
+    if (!data) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < size; i++)
+        data[i] = random_byte(&state);
+
+    /* Data too small to have lines between the samples is hashed fully */
+    for (size_t s = 1; s < 2 * HASH_SAMPLE_COUNT * HASH_SAMPLE_SIZE; s += 1021) {
+        if (gxm_texture_hash_sampled(data, s) != gxm_texture_hash(data, s)) {
+            fprintf(stderr, "sampled hash: %zu bytes aren't hashed fully\n", s);
+            failures++;
+        }
+    }
+
+    hash = gxm_texture_hash_sampled(data, size);
+    for (uint32_t i = 0; i < ARRAY_SIZE(sampled); i++) {
+        data[sampled[i]] ^= 1;
+        if (gxm_texture_hash_sampled(data, size) == hash) {
+            fprintf(stderr, "sampled hash: change at offset %zu is missed\n", sampled[i]);
+            failures++;
+        }
+        data[sampled[i]] ^= 1;
+    }
+    for (uint32_t i = 0; i < ARRAY_SIZE(skipped); i++) {
+        data[skipped[i]] ^= 1;
+        if (gxm_texture_hash_sampled(data, size) != hash) {
+            fprintf(stderr, "sampled hash: offset %zu is hashed\n", skipped[i]);
+            failures++;
+        }
+        data[skipped[i]] ^= 1;
+    }
+
+    free(data);
+
+    return failures;
+}
+
+int main(void)
+{
+    /* 3 and 12 bytes per texel go through the generic path, the others through the quad ones */
+    static const uint32_t bpps[] = { 1, 2, 3, 4, 8, 12, 16 };
+    static const uint32_t pow2_sizes[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    static const uint32_t tiled_sizes[] = { 1, 3, 31, 32, 33, 64, 100 };
+    uint32_t tests = 0;
+    int failures = 0;
+
+#ifdef __ARM_NEON
+    printf("Testing with the NEON code paths\n");
+#else
+    printf("Testing without the NEON code paths\n");
+#endif
+
+    for (uint32_t b = 0; b < ARRAY_SIZE(bpps); b++) {
+        for (uint32_t w = 0; w < ARRAY_SIZE(pow2_sizes); w++) {
+            for (uint32_t h = 0; h < ARRAY_SIZE(pow2_sizes); h++) {
+                failures += check_conversion(
+                    "deswizzle", gxm_texture_deswizzle, swizzled_texel_offset,
+                    gxm_texture_swizzled_size(pow2_sizes[w], pow2_sizes[h], bpps[b]),
+                    pow2_sizes[w], pow2_sizes[h], bpps[b]);
+                tests++;
+            }
+        }
+
+        for (uint32_t w = 0; w < ARRAY_SIZE(tiled_sizes); w++) {
+            for (uint32_t h = 0; h < ARRAY_SIZE(tiled_sizes); h++) {
+                failures += check_conversion(
+                    "detile", gxm_texture_detile, tiled_texel_offset,
+                    gxm_texture_tiled_size(tiled_sizes[w], tiled_sizes[h], bpps[b]),
+                    tiled_sizes[w], tiled_sizes[h], bpps[b]);
+                tests++;
+            }
+        }
+    }
+
+    printf("%" PRIu32 " conversions tested, %d failed\n", tests, failures);
+
+    failures += check_pvrtc();
+    failures += check_hash();
+    failures += check_hash_sampled();
+
+    printf("%d failures overall\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
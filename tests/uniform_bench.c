@@ -0,0 +1,98 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gxm/uniform.h"
+#include "util.h"
+
+/* Conversions are repeated until at least this much time has passed, checking it every batch */
+#define MIN_BENCH_NS     200000000ull
+#define BENCH_BATCH_SIZE 1024
+
+typedef void (*ConvertFunc)(void *dst, const float *src, uint32_t count);
+
+#define DEFINE_CONVERT(type)                                                                       \
+    static void convert_##type(void *dst, const float *src, uint32_t count)                       \
+    {                                                                                              \
+        gxm_uniform_convert_##type(dst, src, count);                                               \
+    }
+
+DEFINE_CONVERT(f16)
+DEFINE_CONVERT(u32)
+DEFINE_CONVERT(s32)
+DEFINE_CONVERT(u16)
+DEFINE_CONVERT(s16)
+DEFINE_CONVERT(u8)
+DEFINE_CONVERT(s8)
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t random_word(uint32_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void bench_convert(const char *name, ConvertFunc convert, const float *src, void *dst,
+                          uint32_t count)
+{
+    uint64_t start, elapsed;
+    uint64_t iterations = 0;
+
+    start = now_ns();
+    do {
+        for (uint32_t i = 0; i < BENCH_BATCH_SIZE; i++)
+            convert(dst, src, count);
+        iterations += BENCH_BATCH_SIZE;
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_BENCH_NS);
+
+    printf("%-3s %4" PRIu32 " components: %8.2f ns/call, %7.1f Mcomponents/s\n", name, count,
+           (double)elapsed / iterations,
+           (double)count * iterations / ((double)elapsed / 1e9) / 1e6);
+}
+
+int main(void)
+{
+    /* A vec4, a matrix, and a whole array of them */
+    static const uint32_t counts[] = { 4, 16, 1024 };
+    const uint32_t max_count = counts[ARRAY_SIZE(counts) - 1];
+    uint32_t state = 0x12345678;
+    float *src;
+    uint32_t *dst;
+
+    src = malloc(max_count * sizeof(*src));
+    dst = malloc(max_count * sizeof(*dst));
+    if (!src || !dst) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Covers the saturated ranges of all the integer types */
+    for (uint32_t i = 0; i < max_count; i++)
+        src[i] = (float)(int32_t)random_word(&state) / 1024.0f;
+
+    for (uint32_t i = 0; i < ARRAY_SIZE(counts); i++) {
+        bench_convert("f16", convert_f16, src, dst, counts[i]);
+        bench_convert("u32", convert_u32, src, dst, counts[i]);
+        bench_convert("s32", convert_s32, src, dst, counts[i]);
+        bench_convert("u16", convert_u16, src, dst, counts[i]);
+        bench_convert("s16", convert_s16, src, dst, counts[i]);
+        bench_convert("u8", convert_u8, src, dst, counts[i]);
+        bench_convert("s8", convert_s8, src, dst, counts[i]);
+    }
+
+    free(src);
+    free(dst);
+
+    return EXIT_SUCCESS;
+}
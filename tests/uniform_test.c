@@ -0,0 +1,261 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gxm/uniform.h"
+#include "util.h"
+
+/*
+ * Every input is converted alone, which goes through the scalar code, and as part of an array
+ * long enough for the NEON code to handle all but the last few elements.
+ */
+#define ARRAY_REPEAT 3
+
+typedef struct {
+    float input;
+    int64_t expected;
+} ConversionCase;
+
+typedef void (*ConvertFunc)(void *dst, const float *src, uint32_t count);
+
+/* The conversions take typed pointers: wrap them to go through a single check */
+#define DEFINE_CONVERT(type)                                                                       \
+    static void convert_##type(void *dst, const float *src, uint32_t count)                       \
+    {                                                                                              \
+        gxm_uniform_convert_##type(dst, src, count);                                               \
+    }
+
+DEFINE_CONVERT(f16)
+DEFINE_CONVERT(u32)
+DEFINE_CONVERT(s32)
+DEFINE_CONVERT(u16)
+DEFINE_CONVERT(s16)
+DEFINE_CONVERT(u8)
+DEFINE_CONVERT(s8)
+
+static const ConversionCase f16_cases[] = {
+    { 0.0f, 0x0000 },
+    { -0.0f, 0x8000 },
+    { 1.0f, 0x3C00 },
+    { -2.0f, 0xC000 },
+    /* Round to nearest even */
+    { 1.0f + 0x1p-10f, 0x3C01 },
+    { 1.0f + 0x1p-11f, 0x3C00 },
+    { 1.0f + 0x3p-11f, 0x3C02 },
+    /* Largest half, and overflows */
+    { 65504.0f, 0x7BFF },
+    { 65519.0f, 0x7BFF },
+    { 65520.0f, 0x7C00 },
+    { 1e6f, 0x7C00 },
+    { -1e6f, 0xFC00 },
+    { INFINITY, 0x7C00 },
+    { -INFINITY, 0xFC00 },
+    { NAN, 0x7E00 },
+    { -NAN, 0x7E00 },
+    /* Smallest normal half, and half denormals */
+    { 0x1p-14f, 0x0400 },
+    { 0x1p-15f, 0x0200 },
+    { 0x1p-24f, 0x0001 },
+    { 0x3p-26f, 0x0001 },
+    { 0x1p-25f, 0x0000 },
+    { -0x1p-24f, 0x8001 },
+    /* Float denormals */
+    { 1e-40f, 0x0000 },
+    { -1e-40f, 0x8000 },
+};
+
+static const ConversionCase u32_cases[] = {
+    { 0.0f, 0 },
+    { 0.99f, 0 },
+    { 123.9f, 123 },
+    { -0.5f, 0 },
+    { -1.0f, 0 },
+    { 4294967040.0f, 4294967040u },
+    { 4294967296.0f, UINT32_MAX },
+    { INFINITY, UINT32_MAX },
+    { -INFINITY, 0 },
+    { NAN, 0 },
+    { 1e-40f, 0 },
+};
+
+static const ConversionCase s32_cases[] = {
+    { 0.0f, 0 },
+    { -1.5f, -1 },
+    { 1.5f, 1 },
+    { 2147483520.0f, 2147483520 },
+    { 2147483648.0f, INT32_MAX },
+    { -2147483648.0f, INT32_MIN },
+    { -2147483904.0f, INT32_MIN },
+    { INFINITY, INT32_MAX },
+    { -INFINITY, INT32_MIN },
+    { NAN, 0 },
+    { -NAN, 0 },
+    { -1e-40f, 0 },
+};
+
+static const ConversionCase u16_cases[] = {
+    { 0.0f, 0 },
+    { 65535.9f, 65535 },
+    { 70000.0f, 65535 },
+    { -3.0f, 0 },
+    { INFINITY, 65535 },
+    { -INFINITY, 0 },
+    { NAN, 0 },
+};
+
+static const ConversionCase s16_cases[] = {
+    { -1.9f, -1 },
+    { 32767.5f, 32767 },
+    { 40000.0f, 32767 },
+    { -40000.0f, -32768 },
+    { INFINITY, 32767 },
+    { -INFINITY, -32768 },
+    { NAN, 0 },
+    { -NAN, 0 },
+};
+
+static const ConversionCase u8_cases[] = {
+    { 0.0f, 0 },
+    { 254.9f, 254 },
+    { 300.0f, 255 },
+    { -1.0f, 0 },
+    { INFINITY, 255 },
+    { -INFINITY, 0 },
+    { NAN, 0 },
+};
+
+static const ConversionCase s8_cases[] = {
+    { -127.5f, -127 },
+    { 127.9f, 127 },
+    { 200.0f, 127 },
+    { -200.0f, -128 },
+    { INFINITY, 127 },
+    { -INFINITY, -128 },
+    { NAN, 0 },
+    { -NAN, 0 },
+};
+
+static int64_t read_element(const void *data, uint32_t index, uint32_t size, bool is_signed)
+{
+    switch (size) {
+    case 1:
+        return is_signed ? (int64_t)((const int8_t *)data)[index]
+                         : (int64_t)((const uint8_t *)data)[index];
+    case 2:
+        return is_signed ? (int64_t)((const int16_t *)data)[index]
+                         : (int64_t)((const uint16_t *)data)[index];
+    default:
+        return is_signed ? (int64_t)((const int32_t *)data)[index]
+                         : (int64_t)((const uint32_t *)data)[index];
+    }
+}
+
+static int check_conversion(const char *name, ConvertFunc convert, uint32_t size, bool is_signed,
+                            const ConversionCase *cases, uint32_t case_count)
+{
+    const uint32_t count = case_count * ARRAY_REPEAT;
+    uint8_t single[4];
+    int64_t actual;
+    float *src;
+    void *dst;
+    int failures = 0;
+
+    src = malloc(count * sizeof(float));
+    dst = malloc(count * size);
+    if (!src || !dst) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Repeating the cases puts each of them at several offsets in the vectors */
+    for (uint32_t i = 0; i < count; i++)
+        src[i] = cases[i % case_count].input;
+    convert(dst, src, count);
+
+    for (uint32_t i = 0; i < count; i++) {
+        const ConversionCase *c = &cases[i % case_count];
+
+        actual = read_element(dst, i, size, is_signed);
+        if (actual != c->expected) {
+            fprintf(stderr,
+                    "%s: %a converted to %" PRId64 " at index %" PRIu32 ", expected %" PRId64 "\n",
+                    name, c->input, actual, i, c->expected);
+            failures++;
+        }
+    }
+
+    for (uint32_t i = 0; i < case_count; i++) {
+        convert(single, &cases[i].input, 1);
+        actual = read_element(single, 0, size, is_signed);
+        if (actual != cases[i].expected) {
+            fprintf(stderr, "%s: %a converted alone to %" PRId64 ", expected %" PRId64 "\n", name,
+                    cases[i].input, actual, cases[i].expected);
+            failures++;
+        }
+    }
+
+    free(src);
+    free(dst);
+
+    return failures;
+}
+
+/* Every float that's exactly representable as a half must convert to it */
+static int check_half_round_trip(void)
+{
+    int failures = 0;
+    uint16_t half;
+    float value;
+
+    for (uint32_t bits = 0; bits < 0x10000; bits++) {
+        const uint32_t exponent = (bits >> 10) & 0x1F;
+        const uint32_t mantissa = bits & 0x3FF;
+
+        if (exponent == 0x1F)
+            continue;
+        value = ldexpf(exponent ? (float)(mantissa | 0x400) : (float)mantissa,
+                       (int)MAX2(exponent, 1) - 25);
+        if (bits & 0x8000)
+            value = -value;
+
+        half = gxm_float_to_half(value);
+        if (half != bits) {
+            fprintf(stderr, "half: %a converted to 0x%04x, expected 0x%04" PRIx32 "\n", value,
+                    half, bits);
+            failures++;
+        }
+    }
+
+    return failures;
+}
+
+#define CHECK(type, size, is_signed)                                                               \
+    check_conversion(#type, convert_##type, size, is_signed, type##_cases,                         \
+                     ARRAY_SIZE(type##_cases))
+
+int main(void)
+{
+    int failures = 0;
+
+#ifdef __ARM_NEON
+    printf("Testing with the NEON code paths\n");
+#else
+    printf("Testing without the NEON code paths\n");
+#endif
+
+    failures += CHECK(f16, 2, false);
+    failures += CHECK(u32, 4, false);
+    failures += CHECK(s32, 4, true);
+    failures += CHECK(u16, 2, false);
+    failures += CHECK(s16, 2, true);
+    failures += CHECK(u8, 1, false);
+    failures += CHECK(s8, 1, true);
+    failures += check_half_round_trip();
+
+    printf("%d uniform conversion failures\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}